@@ -0,0 +1,141 @@
+// starzik_channel.h
+// Kanał radiowy ESP-NOW – wspólny dla Master i slave'ów.
+// Master zmienia kanał dwufazowo komendami grupowymi: "channel_prepare|<kanał>" (każdy
+// osiągalny adresat musi potwierdzić), potem "channel_commit|<kanał>:<opóźnienie ms>" – slave
+// przechodzi po opóźnieniu tylko na kanał, który przygotował, Master zaraz po nich. Commit
+// z dopiskiem ":force" (Master przechodzi mimo braku potwierdzeń) nie wymaga prepare.
+// Kanał trzymany w NVS, więc po restarcie slave startuje tam, gdzie był. Slave, który
+// przegapił zmianę (wyłączony, poza zasięgiem), po CHANNEL_HUNT_AFTER_MS ciszy Mastera
+// szuka go sondą na kolejnych kanałach.
+#pragma once
+
+#include <Arduino.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <Preferences.h>
+#include "starzik_frame_magic.h"
+
+const uint8_t CHANNEL_MIN = 1;
+const uint8_t CHANNEL_MAX = 13;
+const uint8_t CHANNEL_DEFAULT = 1;             // domyślny kanał WiFi.softAP()
+const unsigned long CHANNEL_HUNT_AFTER_MS = 30000;   // Master ogranicza heartbeat_interval do połowy
+const unsigned long CHANNEL_HUNT_STEP_MS = 150;      // pełny obieg 13 kanałów ~2 s
+
+enum ChannelFrameType : uint8_t {
+  CHANNEL_PROBE = 1,     // slave -> Master: "jesteś na tym kanale?"
+  CHANNEL_HERE = 2       // Master -> rozgłoszenie: odpowiedź na sondę
+};
+
+struct __attribute__((packed)) ChannelFrame {
+  uint8_t magic;
+  uint8_t type;
+  uint8_t channel;
+};
+
+inline bool channelValid(int channel) {
+  return channel >= CHANNEL_MIN && channel <= CHANNEL_MAX;
+}
+
+inline uint8_t channelLoad() {
+  Preferences prefs;
+  prefs.begin("radio", true);
+  uint8_t channel = prefs.getUChar("channel", CHANNEL_DEFAULT);
+  prefs.end();
+  return channelValid(channel) ? channel : CHANNEL_DEFAULT;
+}
+
+inline void channelSave(uint8_t channel) {
+  Preferences prefs;
+  prefs.begin("radio", false);
+  prefs.putUChar("channel", channel);
+  prefs.end();
+}
+
+// ===== Strona slave'a =====
+
+static const uint8_t* channelMasterMac = NULL;
+static uint8_t channelCurrent = CHANNEL_DEFAULT;
+static volatile uint8_t channelPrepared = 0;
+static volatile uint8_t channelCommitTo = 0;
+static volatile unsigned long channelCommitAt = 0;
+static volatile unsigned long channelLastMaster = 0;
+static bool channelHunting = false;
+static unsigned long channelHuntStepAt = 0;
+
+// Wywołać w setup() po WiFi.mode(WIFI_STA), przed esp_now_init()
+inline void channelSlaveBegin(const uint8_t* masterMac) {
+  channelMasterMac = masterMac;
+  channelCurrent = channelLoad();
+  esp_wifi_set_channel(channelCurrent, WIFI_SECOND_CHAN_NONE);
+  channelLastMaster = millis();
+  Serial.printf("Kanał radiowy: %u\n", channelCurrent);
+}
+
+// Wywołać na początku callbacku odbioru – notuje każdą ramkę od Mastera.
+// true = ramka kanału (obsłużona), reszta idzie dalej zwykłą ścieżką.
+inline bool channelSlaveHandleFrame(const uint8_t* mac, const uint8_t* data, int len) {
+  bool channelFrame = len == sizeof(ChannelFrame) && data[0] == CHANNEL_FRAME_MAGIC;
+  if (channelMasterMac != NULL && memcmp(mac, channelMasterMac, 6) == 0) channelLastMaster = millis();
+  return channelFrame;
+}
+
+// Z handleMasterMessage(); true = komenda kanału
+inline bool channelSlaveCommand(const String& command, const String& data) {
+  if (command == "channel_prepare") {
+    int channel = data.toInt();
+    if (channelValid(channel)) channelPrepared = channel;
+    return true;
+  }
+  if (command == "channel_commit") {
+    // "<kanał>:<opóźnienie>[:force]" – bez pasującego prepare to stary albo obcy commit
+    int colon = data.indexOf(':');
+    int channel = data.toInt();
+    unsigned long delayMs = colon > 0 ? strtoul(data.c_str() + colon + 1, NULL, 10) : 0;
+    bool forced = data.endsWith(":force");
+    if (channelValid(channel) && (channel == channelPrepared || forced)) {
+      channelCommitAt = millis() + delayMs;
+      channelCommitTo = channel;
+    }
+    return true;
+  }
+  if (command == "channel_abort") {
+    channelPrepared = 0;
+    return true;
+  }
+  return false;
+}
+
+// Wywoływać w loop(): zaplanowana zmiana kanału i szukanie Mastera po ciszy
+inline void channelSlaveService() {
+  if (channelCommitTo != 0) {
+    if ((long)(millis() - channelCommitAt) < 0) return;
+    channelCurrent = channelCommitTo;
+    channelCommitTo = 0;
+    channelPrepared = 0;
+    esp_wifi_set_channel(channelCurrent, WIFI_SECOND_CHAN_NONE);
+    channelSave(channelCurrent);
+    channelLastMaster = millis();
+    Serial.printf("Kanał radiowy zmieniony na %u\n", channelCurrent);
+    return;
+  }
+
+  // Odczyt przed millis() – callback może go podbić w międzyczasie
+  unsigned long last = channelLastMaster;
+  unsigned long now = millis();
+  if (now - last < CHANNEL_HUNT_AFTER_MS) {
+    if (channelHunting) {
+      channelHunting = false;
+      channelSave(channelCurrent);
+      Serial.printf("Master znaleziony na kanale %u\n", channelCurrent);
+    }
+    return;
+  }
+  if (channelHunting && now - channelHuntStepAt < CHANNEL_HUNT_STEP_MS) return;
+
+  if (channelHunting) channelCurrent = channelCurrent % CHANNEL_MAX + 1;
+  channelHunting = true;
+  channelHuntStepAt = now;
+  esp_wifi_set_channel(channelCurrent, WIFI_SECOND_CHAN_NONE);
+  ChannelFrame probe = { CHANNEL_FRAME_MAGIC, CHANNEL_PROBE, channelCurrent };
+  esp_now_send(channelMasterMac, (const uint8_t*)&probe, sizeof(probe));
+}
@@ -0,0 +1,43 @@
+// starzik_frame_magic.h
+// Pierwsze bajty ramek binarnych ESP-NOW – jedna tabela dla całego systemu.
+// Ramki tekstowe "cmd|data|ms" zaczynają się od znaku ASCII (< 0x80), więc każdy bajt
+// >= 0x80 jednoznacznie oznacza ramkę binarną, a odbiorca rozpoznaje jej typ po pierwszym
+// bajcie bez parsowania reszty. Nowy typ ramki dopisać tutaj – kontrola niżej pilnuje,
+// żeby bajt był poza ASCII i nie powtarzał się z żadnym innym.
+//
+//   0xA5 / 0xA6  przekaźniki Podłogi: ramka / ACK        starzik_relay_frame.h
+//   0xB7         OTA slave'ów (paczki i odpowiedzi)       starzik_ota.h
+//   0xC3 / 0xC4  komendy grupowe: ramka / ACK            starzik_group.h
+//   0xD1         federacja pokoi (Master <-> Master)      starzik_master.cpp
+//   0xE1         para Masterów (HA)                       starzik_master.cpp
+//   0xF1         kanał radiowy: sonda i odpowiedź         starzik_channel.h
+//   0xF2         pomiar i dzierżawa szybkości PHY         starzik_phy.h
+//   0xF3         telemetria zdrowia slave'a               starzik_health.h
+#pragma once
+
+#include <stdint.h>
+
+const uint8_t RELAY_FRAME_MAGIC = 0xA5;
+const uint8_t RELAY_ACK_MAGIC = 0xA6;
+const uint8_t OTA_MAGIC = 0xB7;
+const uint8_t GROUP_FRAME_MAGIC = 0xC3;
+const uint8_t GROUP_ACK_MAGIC = 0xC4;
+const uint8_t ROOM_FRAME_MAGIC = 0xD1;
+const uint8_t HA_FRAME_MAGIC = 0xE1;
+const uint8_t CHANNEL_FRAME_MAGIC = 0xF1;
+const uint8_t PHY_FRAME_MAGIC = 0xF2;
+const uint8_t HEALTH_FRAME_MAGIC = 0xF3;
+
+constexpr uint8_t FRAME_MAGICS[] = {
+  RELAY_FRAME_MAGIC, RELAY_ACK_MAGIC, OTA_MAGIC, GROUP_FRAME_MAGIC, GROUP_ACK_MAGIC,
+  ROOM_FRAME_MAGIC, HA_FRAME_MAGIC, CHANNEL_FRAME_MAGIC, PHY_FRAME_MAGIC, HEALTH_FRAME_MAGIC
+};
+constexpr int FRAME_MAGIC_COUNT = sizeof(FRAME_MAGICS) / sizeof(FRAME_MAGICS[0]);
+
+// Każda para (i, j > i): różne bajty, a każdy bajt poza ASCII
+constexpr bool frameMagicsValid(int i = 0, int j = 1) {
+  return i >= FRAME_MAGIC_COUNT ? true
+       : j >= FRAME_MAGIC_COUNT ? FRAME_MAGICS[i] >= 0x80 && frameMagicsValid(i + 1, i + 2)
+       : FRAME_MAGICS[i] != FRAME_MAGICS[j] && frameMagicsValid(i, j + 1);
+}
+static_assert(frameMagicsValid(), "Bajty magiczne ramek muszą być >= 0x80 i różne od siebie");
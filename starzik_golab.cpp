@@ -2,7 +2,16 @@
 #include <esp_now.h>
 #include <DFRobotDFPlayerMini.h>
 #include <HardwareSerial.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
 #include <Arduino.h>
+#include "starzik_led.h"
+#include "starzik_ota.h"
+#include "starzik_group.h"
+#include "starzik_channel.h"
+#include "starzik_phy.h"
+#include "starzik_health.h"
+#include "starzik_hash.h"
 
 // Konfiguracja DFPlayer
 HardwareSerial mySoftwareSerial(2); // UART2
@@ -27,17 +36,127 @@ bool masterConnected = false;
 unsigned long lastMasterHeartbeat = 0;
 const unsigned long HEARTBEAT_TIMEOUT = 30000;
 
-// Przycisk
-bool lastButtonState = HIGH;
-unsigned long buttonPressStart = 0;
-bool buttonPressed = false;
-bool hintRequestSent = false;
+// Przycisk (przerwanie GPIO + esp_timer na próg 3 s)
 const unsigned long HINT_PRESS_TIME = 3000;
+const unsigned long BUTTON_DEBOUNCE_US = 30000;
+
+struct ButtonEvent {
+  bool pressed;
+  unsigned long us;             // znacznik czasu zbocza z przerwania
+};
+
+QueueHandle_t buttonQueue = NULL;
+esp_timer_handle_t hintTimer = NULL;
+volatile bool buttonStableLevel = HIGH;
+volatile unsigned long lastButtonEdgeUs = 0;
+volatile unsigned long buttonPressUs = 0;
+volatile bool hintRequestSent = false;
+
+// Pomiar opóźnienia: próg 3 s -> esp_now_send -> potwierdzenie MAC od Mastera
+volatile unsigned long hintThresholdUs = 0;
+volatile unsigned long hintSendUs = 0;
+volatile unsigned long hintAckUs = 0;
+volatile bool hintAwaitingAck = false;
+volatile bool hintLatencyReady = false;
 
 // Audio
 bool isPlayingAudio = false;
 String currentAudioFile = "";
 
+// --- Sterownik DFPlayer ---
+// Po inicjalizacji UART2 należy wyłącznie do tego sterownika: komendy idą przez kolejkę
+// wysyłaną w loop() z odstępami liczonymi od millis(), odpowiedzi są parsowane
+// w zdarzeniu RX UART (onReceive) i trafiają do kolejki zdarzeń.
+// BUSY z DFPlayera (LOW = odtwarzanie), -1 = niepodłączony. W okablowaniu Gołębia BUSY nie jest
+// jeszcze wyprowadzony (DFPlayer tylko na 16/17) – pin wpisać dopiero po potwierdzeniu na płytce,
+// inaczej pull-up na wolnym pinie zlicza każde odtwarzanie jako przekroczenie czasu startu.
+#define DF_BUSY_PIN -1
+const unsigned long DF_CMD_GAP_MS = 30;     // minimalny odstęp między komendami
+const unsigned long DF_STOP_GAP_MS = 100;   // po stop DFPlayer potrzebuje chwili przed play
+const unsigned long DF_START_TIMEOUT_MS = 1500;
+
+enum DfCommandType : uint8_t {
+  DF_CMD_PLAY,        // zatrzymaj bieżące, wyczyść playlistę, zagraj
+  DF_CMD_ENQUEUE,     // dopisz do playlisty (gra po zakończeniu bieżącego)
+  DF_CMD_STOP,
+  DF_CMD_PAUSE,
+  DF_CMD_RESUME,
+  DF_CMD_VOLUME
+};
+
+struct DfCommand {
+  uint8_t type;
+  uint16_t arg;
+  char name[24];
+};
+
+struct DfEvent {
+  uint8_t cmd;        // bajt komendy z ramki DFPlayera
+  uint16_t param;
+  unsigned long us;   // micros() odebrania ramki
+};
+
+QueueHandle_t dfCommandQueue = NULL;
+QueueHandle_t dfEventQueue = NULL;
+unsigned long dfNextCommandAt = 0;
+
+// Playlista (obsługiwana tylko z loop())
+const int DF_PLAYLIST_SIZE = 8;
+DfCommand dfPlaylist[DF_PLAYLIST_SIZE];
+int dfPlaylistHead = 0;
+int dfPlaylistCount = 0;
+
+// Pomiar opóźnienia startu: wysłanie play -> zbocze BUSY, a bez BUSY -> ramka ACK (0x41)
+// DFPlayera, o którą prosimy bajtem feedback w komendzie play. ACK mierzy tylko przyjęcie
+// komendy przez moduł, nie faktyczny start dźwięku – źródło raportowane jako lat_src.
+volatile unsigned long dfBusyFallUs = 0;
+unsigned long dfPlaySentUs = 0;
+bool dfAwaitingStart = false;
+unsigned long dfLastFinishedAt = 0;
+
+// Liczniki raportowane do Mastera
+uint32_t dfPlays = 0;
+uint32_t dfErrors = 0;
+uint32_t dfStartTimeouts = 0;
+uint32_t dfQueueDrops = 0;
+uint32_t dfFrameErrors = 0;
+unsigned long dfLatencyLastUs = 0;
+unsigned long dfLatencyMaxUs = 0;
+unsigned long dfLatencySumUs = 0;
+uint32_t dfLatencyCount = 0;
+
+// --- Katalog audio ---
+// Manifest nazwa -> numer pliku przychodzi od Mastera (audio_manifest) i jest trzymany w NVS.
+// Wyszukiwanie przez tablicę z adresowaniem otwartym (stały czas, bez Stringów).
+const int AUDIO_TABLE_SIZE = 32;    // potęga 2, min. 2x liczba wpisów
+const int AUDIO_NAME_LEN = 16;
+struct AudioEntry {
+  char name[AUDIO_NAME_LEN];
+  uint16_t track;                   // 0 = pusty slot
+};
+AudioEntry audioTable[AUDIO_TABLE_SIZE];
+portMUX_TYPE audioMux = portMUX_INITIALIZER_UNLOCKED;  // tablica czytana z callbacku WiFi
+int audioEntries = 0;
+uint32_t audioManifestHash = 0;
+const char* DEFAULT_AUDIO_MANIFEST = "{\"golab\":1,\"hint1\":2,\"hint2\":2}";
+
+// Zawartość karty SD (skan przy starcie)
+const int AUDIO_MAX_FOLDERS = 10;
+int sdFileCount = 0;
+int sdFolderCount = 0;
+int sdFolderFiles[AUDIO_MAX_FOLDERS];
+
+char pendingManifest[250];          // manifest odebrany w callbacku ESP-NOW
+volatile bool pendingManifestReady = false;
+
+// Konfiguracja zagadki (nadpisywana przez Master, trzymana w NVS)
+int dfVolume = 20;
+Preferences puzzlePrefs;
+uint32_t puzzleConfigVersion = 0;
+uint32_t puzzleConfigHash = 0;
+char pendingConfig[250];            // konfiguracja odebrana w callbacku ESP-NOW
+volatile bool pendingConfigReady = false;
+
 // Stan gry
 bool gameActive = false;
 bool gamePaused = false;
@@ -46,12 +165,18 @@ String currentGameGroup = "";
 // Deklaracje funkcji
 void setupESPNow();
 void setupDFPlayer();
-void checkHintButton();
+void setupHintButton();
+void hintButtonTask(void* arg);
+void hintTimerCallback(void* arg);
+void reportHintLatency();
 void sendHintRequest();
 void checkMasterConnection();
-void checkAudioStatus();
+void setupDFDriver();
+void dfService();
+bool dfEnqueue(uint8_t type, uint16_t arg, const String& name);
+void sendAudioStats();
 void handleMasterMessage(String command, String data);
-void playAudio(String fileName);
+void playAudio(String fileName, bool queued);
 int getFileNumber(String fileName);
 void stopAudio();
 void setVolume(int volume);
@@ -61,7 +186,13 @@ void resumeGame();
 void endGame(String status);
 void sendHeartbeatToMaster();
 bool sendToMaster(MasterMessage& message);
-void blinkLED(int times, int delayMs);
+void loadPuzzleConfig();
+bool applyPuzzleConfig(const String& blob, bool persist);
+void checkPendingConfig();
+void loadAudioManifest();
+bool applyAudioManifest(const String& manifest, bool persist);
+void checkPendingManifest();
+void sendAudioCatalog();
 void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status);
 void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len);
 
@@ -70,8 +201,7 @@ void setup() {
   mySoftwareSerial.begin(9600, SERIAL_8N1, 16, 17);
   Serial.println("ESP32 Gołąb - Escape Room Slave");
 
-  pinMode(HINT_BUTTON_PIN, INPUT_PULLUP);
-  pinMode(LED_PIN, OUTPUT);
+  ledEngineBegin(LED_PIN);
 
   WiFi.mode(WIFI_STA);
   Serial.print("MAC Address Gołąb: ");
@@ -79,19 +209,32 @@ void setup() {
 
   setupESPNow();
   setupDFPlayer();
+  setupDFDriver();
+  loadPuzzleConfig();
+  loadAudioManifest();
+  sendAudioCatalog();
+
+  setupHintButton();
 
   Serial.println("Gołąb gotowy!");
-  blinkLED(3, 300);
+  ledPlay(LED_STARTUP);
 }
 
 void loop() {
-  checkHintButton();
+  healthLoopTick();
+  reportHintLatency();
   checkMasterConnection();
-  checkAudioStatus();
+  channelSlaveService();
+  phySlaveService();
+  dfService();
+  checkPendingConfig();
+  checkPendingManifest();
   
   static unsigned long lastHeartbeat = 0;
   if (millis() - lastHeartbeat > 15000) {
     sendHeartbeatToMaster();
+    healthSlaveSend(master_mac, min(dfErrors + dfStartTimeouts, (uint32_t)0xFFFF), true);   // bez DFPlayera setup() nie kończy się
+    sendAudioStats();
     lastHeartbeat = millis();
   }
   
@@ -103,6 +246,7 @@ void setupESPNow() {
   WiFi.mode(WIFI_STA);
   WiFi.disconnect();
   delay(100);
+  channelSlaveBegin(master_mac);   // kanał z NVS, zanim ruszy ESP-NOW
 
   if (esp_now_init() != ESP_OK) {
     Serial.println("Błąd inicjalizacji ESP-NOW");
@@ -123,7 +267,10 @@ void setupESPNow() {
     Serial.println("Błąd dodawania Master peer");
     return;
   }
-  
+
+  otaSlaveBegin(master_mac);
+  groupSlaveBegin(master_mac, "golab");
+  phySlaveBegin(master_mac);
   Serial.println("ESP-NOW skonfigurowane dla Master");
 }
 
@@ -141,57 +288,128 @@ void setupDFPlayer() {
   }
   
   Serial.println("DFPlayer Mini online.");
-  myDFPlayer.volume(20);
+  myDFPlayer.volume(dfVolume);
   myDFPlayer.EQ(DFPLAYER_EQ_NORMAL);
   delay(1000);
   
-  int fileCount = myDFPlayer.readFileCounts();
+  sdFileCount = myDFPlayer.readFileCounts();
   Serial.print("Plików na karcie SD: ");
-  Serial.println(fileCount);
+  Serial.println(sdFileCount);
+
+  // Skan folderów (01..10) – wynik trafia do katalogu audio na Masterze
+  sdFolderCount = myDFPlayer.readFolderCounts();
+  if (sdFolderCount < 0) sdFolderCount = 0;
+  for (int f = 0; f < AUDIO_MAX_FOLDERS; f++) {
+    sdFolderFiles[f] = (f < sdFolderCount) ? myDFPlayer.readFileCountsInFolder(f + 1) : 0;
+    if (sdFolderFiles[f] < 0) sdFolderFiles[f] = 0;
+  }
+  Serial.println("Folderów na karcie SD: " + String(sdFolderCount));
   
-  if (fileCount >= 2) {
+  if (sdFileCount >= 2) {
     Serial.println("Karta SD wykryta z plikami MP3");
-    Serial.println("TESTY: Oczekiwane pliki 001.mp3, 002.mp3");
   } else {
     Serial.println("UWAGA: Brak wystarczającej liczby plików MP3 na karcie SD!");
-    Serial.println("TESTY: Potrzebujesz 2 pliki: 001.mp3, 002.mp3");
   }
 }
 
-void checkHintButton() {
-  bool currentButtonState = digitalRead(HINT_BUTTON_PIN);
-  
-  if (currentButtonState == LOW && lastButtonState == HIGH) {
-    buttonPressStart = millis();
-    buttonPressed = true;
-    hintRequestSent = false;
-    Serial.println("Przycisk naciśnięty - liczenie czasu...");
-    digitalWrite(LED_PIN, HIGH);
-  }
-  
-  if (buttonPressed && currentButtonState == LOW) {
-    unsigned long pressDuration = millis() - buttonPressStart;
-    if (pressDuration >= HINT_PRESS_TIME && !hintRequestSent) {
-      sendHintRequest();
-      hintRequestSent = true;
-      blinkLED(5, 100);
+// === PRZYCISK PODPOWIEDZI ===
+
+void IRAM_ATTR hintButtonIsr() {
+  unsigned long now = micros();
+  bool level = digitalRead(HINT_BUTTON_PIN);
+
+  // Debounce: przyjmij tylko zmianę stanu stabilnego, nie częściej niż co 30 ms
+  if (level == buttonStableLevel) return;
+  if (now - lastButtonEdgeUs < BUTTON_DEBOUNCE_US) return;
+  lastButtonEdgeUs = now;
+  buttonStableLevel = level;
+
+  ButtonEvent ev = { level == LOW, now };
+  BaseType_t woken = pdFALSE;
+  xQueueSendFromISR(buttonQueue, &ev, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+void setupHintButton() {
+  pinMode(HINT_BUTTON_PIN, INPUT_PULLUP);
+  buttonStableLevel = digitalRead(HINT_BUTTON_PIN);
+
+  buttonQueue = xQueueCreate(8, sizeof(ButtonEvent));
+
+  esp_timer_create_args_t args = {};
+  args.callback = &hintTimerCallback;
+  args.name = "hint";
+  esp_timer_create(&args, &hintTimer);
+
+  // Zdarzenia z przerwania obsługuje osobne zadanie – loop() może stać, a próg i tak zadziała
+  xTaskCreatePinnedToCore(hintButtonTask, "hintBtn", 3072, NULL, 5, NULL, 1);
+  attachInterrupt(digitalPinToInterrupt(HINT_BUTTON_PIN), hintButtonIsr, CHANGE);
+}
+
+void hintButtonTask(void* arg) {
+  ButtonEvent ev;
+  while (true) {
+    if (xQueueReceive(buttonQueue, &ev, portMAX_DELAY) != pdTRUE) continue;
+
+    if (ev.pressed) {
+      buttonPressUs = ev.us;
+      hintRequestSent = false;
+      ledSetBase(true);
+
+      // Próg liczony od zbocza z przerwania, nie od chwili obsługi zdarzenia
+      unsigned long elapsedUs = micros() - ev.us;
+      unsigned long thresholdUs = HINT_PRESS_TIME * 1000UL;
+      esp_timer_stop(hintTimer);
+      esp_timer_start_once(hintTimer, elapsedUs < thresholdUs ? thresholdUs - elapsedUs : 1);
+      Serial.println("Przycisk naciśnięty - liczenie czasu...");
+    } else {
+      esp_timer_stop(hintTimer);
+      ledSetBase(false);
+
+      unsigned long pressDuration = (ev.us - buttonPressUs) / 1000;
+      Serial.print("Przycisk puszczony po: ");
+      Serial.print(pressDuration);
+      Serial.println(" ms");
+
+      if (pressDuration < HINT_PRESS_TIME) {
+        Serial.println("Za krótkie naciśnięcie - wymagane 3 sekundy");
+      }
     }
   }
-  
-  if (currentButtonState == HIGH && lastButtonState == LOW) {
-    digitalWrite(LED_PIN, LOW);
-    buttonPressed = false;
-    unsigned long pressDuration = millis() - buttonPressStart;
-    Serial.print("Przycisk puszczony po: ");
-    Serial.print(pressDuration);
-    Serial.println(" ms");
-    
-    if (pressDuration < HINT_PRESS_TIME) {
-      Serial.println("Za krótkie naciśnięcie - wymagane 3 sekundy");
-    }
+}
+
+void hintTimerCallback(void* arg) {
+  if (buttonStableLevel != LOW || hintRequestSent) return;
+
+  // Puszczenie w oknie debounce przepada – bez ponownego odczytu krótkie stuknięcie
+  // wysłałoby po 3 s podpowiedź. Zamiast niej zaległe zdarzenie puszczenia.
+  if (digitalRead(HINT_BUTTON_PIN) != LOW) {
+    buttonStableLevel = HIGH;
+    ButtonEvent ev = { false, micros() };
+    xQueueSend(buttonQueue, &ev, 0);
+    return;
   }
-  
-  lastButtonState = currentButtonState;
+
+  hintThresholdUs = buttonPressUs + HINT_PRESS_TIME * 1000UL;
+  hintRequestSent = true;
+  sendHintRequest();
+  ledPlay(LED_HINT);
+}
+
+void reportHintLatency() {
+  if (!hintLatencyReady) return;
+  hintLatencyReady = false;
+
+  // "<próg -> wysłanie us>:<wysłanie -> ACK us>"
+  unsigned long toSend = hintSendUs - hintThresholdUs;
+  unsigned long toAck = hintAckUs - hintSendUs;
+  Serial.println("⏱️ Podpowiedź: próg->wysłanie " + String(toSend) + " us, wysłanie->ACK " + String(toAck) + " us");
+
+  MasterMessage msg;
+  msg.command = "hint_latency";
+  msg.data = String(toSend) + ":" + String(toAck);
+  msg.timestamp = millis();
+  sendToMaster(msg);
 }
 
 void sendHintRequest() {
@@ -206,6 +424,8 @@ void sendHintRequest() {
   msg.data = "golab_button_3sec";
   msg.timestamp = millis();
   
+  hintAwaitingAck = true;
+  hintSendUs = micros();
   if (sendToMaster(msg)) {
     Serial.println("✅ Żądanie podpowiedzi wysłane!");
   } else {
@@ -217,45 +437,309 @@ void checkMasterConnection() {
   if (masterConnected && (millis() - lastMasterHeartbeat > HEARTBEAT_TIMEOUT)) {
     masterConnected = false;
     Serial.println("Utracono połączenie z Master");
-    if (isPlayingAudio) {
-      myDFPlayer.stop();
-      isPlayingAudio = false;
-    }
+    dfEnqueue(DF_CMD_STOP, 0, "");
     gameActive = false;
   }
 }
 
-void checkAudioStatus() {
-  if (isPlayingAudio && myDFPlayer.available()) {
-    uint8_t type = myDFPlayer.readType();
-    int value = myDFPlayer.read();
-    
-    if (type == DFPlayerPlayFinished) {
+// === STEROWNIK DFPLAYER ===
+
+void dfSendFrame(uint8_t cmd, uint16_t param, bool feedback = false) {
+  uint8_t frame[10] = {0x7E, 0xFF, 0x06, cmd, (uint8_t)(feedback ? 0x01 : 0x00),
+                       (uint8_t)(param >> 8), (uint8_t)(param & 0xFF), 0, 0, 0xEF};
+  uint16_t sum = 0;
+  for (int i = 1; i < 7; i++) sum += frame[i];
+  sum = 0 - sum;
+  frame[7] = sum >> 8;
+  frame[8] = sum & 0xFF;
+  mySoftwareSerial.write(frame, sizeof(frame));
+}
+
+void dfOnReceive() {
+  // Zdarzenie RX UART: składamy ramki 7E FF 06 CMD ACK PH PL CH CL EF
+  static uint8_t frame[10];
+  static int pos = 0;
+
+  while (mySoftwareSerial.available()) {
+    uint8_t b = mySoftwareSerial.read();
+    if (pos == 0 && b != 0x7E) continue;
+    frame[pos++] = b;
+    if (pos < 10) continue;
+    pos = 0;
+
+    uint16_t sum = 0;
+    for (int i = 1; i < 7; i++) sum += frame[i];
+    uint16_t expected = ((uint16_t)frame[7] << 8) | frame[8];
+    if (frame[9] != 0xEF || (uint16_t)(sum + expected) != 0) {
+      dfFrameErrors++;
+      continue;
+    }
+
+    DfEvent ev = { frame[3], (uint16_t)(((uint16_t)frame[5] << 8) | frame[6]), micros() };
+    xQueueSend(dfEventQueue, &ev, 0);
+  }
+}
+
+void IRAM_ATTR dfBusyIsr() {
+  dfBusyFallUs = micros();
+}
+
+void setupDFDriver() {
+  dfCommandQueue = xQueueCreate(16, sizeof(DfCommand));
+  dfEventQueue = xQueueCreate(16, sizeof(DfEvent));
+
+  // Od tej chwili nie używamy już biblioteki DFRobot – odpowiedzi czyta onReceive
+  while (mySoftwareSerial.available()) mySoftwareSerial.read();
+  mySoftwareSerial.onReceive(dfOnReceive);
+
+  if (DF_BUSY_PIN >= 0) {
+    pinMode(DF_BUSY_PIN, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(DF_BUSY_PIN), dfBusyIsr, FALLING);
+  }
+}
+
+bool dfEnqueue(uint8_t type, uint16_t arg, const String& name) {
+  DfCommand cmd;
+  cmd.type = type;
+  cmd.arg = arg;
+  strncpy(cmd.name, name.c_str(), sizeof(cmd.name) - 1);
+  cmd.name[sizeof(cmd.name) - 1] = '\0';
+
+  if (dfCommandQueue == NULL || xQueueSend(dfCommandQueue, &cmd, 0) != pdTRUE) {
+    dfQueueDrops++;
+    Serial.println("❌ Kolejka DFPlayer pełna - komenda odrzucona");
+    return false;
+  }
+  return true;
+}
+
+void dfStartTrack(const DfCommand& cmd) {
+  dfPlaySentUs = micros();
+  dfSendFrame(0x03, cmd.arg, DF_BUSY_PIN < 0);
+  dfBusyFallUs = 0;
+  dfAwaitingStart = true;
+  dfPlays++;
+
+  isPlayingAudio = true;
+  currentAudioFile = cmd.name;
+  Serial.println("▶️ Odtwarzanie pliku " + String(cmd.arg) + ": " + currentAudioFile);
+  ledPlay(LED_PLAY);
+}
+
+void dfNotifyFinished(const String& data) {
+  MasterMessage msg;
+  msg.command = "audio_finished";
+  msg.data = data;
+  msg.timestamp = millis();
+  sendToMaster(msg);
+}
+
+void dfExecute(const DfCommand& cmd) {
+  unsigned long gap = DF_CMD_GAP_MS;
+
+  switch (cmd.type) {
+    case DF_CMD_PLAY:
+      dfPlaylistCount = 0;
+      if (isPlayingAudio) {
+        // Najpierw stop; utwór czeka na początku playlisty i startuje po odstępie
+        dfSendFrame(0x16, 0);
+        isPlayingAudio = false;
+        dfPlaylistHead = 0;
+        dfPlaylist[0] = cmd;
+        dfPlaylist[0].type = DF_CMD_ENQUEUE;
+        dfPlaylistCount = 1;
+        gap = DF_STOP_GAP_MS;
+      } else {
+        dfStartTrack(cmd);
+      }
+      break;
+
+    case DF_CMD_ENQUEUE:
+      if (!isPlayingAudio && dfPlaylistCount == 0) {
+        dfStartTrack(cmd);
+      } else if (dfPlaylistCount < DF_PLAYLIST_SIZE) {
+        dfPlaylist[(dfPlaylistHead + dfPlaylistCount) % DF_PLAYLIST_SIZE] = cmd;
+        dfPlaylistCount++;
+        Serial.println("🎵 W kolejce: " + String(cmd.name) + " (" + String(dfPlaylistCount) + ")");
+      } else {
+        dfQueueDrops++;
+        Serial.println("❌ Playlista pełna: " + String(cmd.name));
+      }
+      gap = 0;
+      break;
+
+    case DF_CMD_STOP:
+      dfPlaylistCount = 0;
+      dfSendFrame(0x16, 0);
+      gap = DF_STOP_GAP_MS;
+      if (isPlayingAudio) {
+        isPlayingAudio = false;
+        currentAudioFile = "";
+        dfAwaitingStart = false;
+        Serial.println("⏹️ Audio zatrzymane");
+        if (cmd.arg) dfNotifyFinished("stopped");
+      }
+      break;
+
+    case DF_CMD_PAUSE:
+      if (isPlayingAudio) dfSendFrame(0x0E, 0);
+      break;
+
+    case DF_CMD_RESUME:
+      if (isPlayingAudio) dfSendFrame(0x0D, 0);
+      break;
+
+    case DF_CMD_VOLUME:
+      dfSendFrame(0x06, cmd.arg);
+      break;
+  }
+
+  dfNextCommandAt = millis() + gap;
+}
+
+void dfRecordLatency(unsigned long latencyUs) {
+  dfAwaitingStart = false;
+  dfLatencyLastUs = latencyUs;
+  if (dfLatencyLastUs > dfLatencyMaxUs) dfLatencyMaxUs = dfLatencyLastUs;
+  dfLatencySumUs += dfLatencyLastUs;
+  dfLatencyCount++;
+}
+
+void dfHandleEvent(const DfEvent& ev) {
+  switch (ev.cmd) {
+    case 0x3D:  // zakończono utwór z karty SD
+      // DFPlayer potrafi zgłosić koniec dwa razy pod rząd
+      if (millis() - dfLastFinishedAt < 200) break;
+      dfLastFinishedAt = millis();
+      if (!isPlayingAudio) break;
+
       Serial.println("Zakończono odtwarzanie audio");
       isPlayingAudio = false;
-      
-      MasterMessage msg;
-      msg.command = "audio_finished";
-      msg.data = currentAudioFile;
-      msg.timestamp = millis();
-      sendToMaster(msg);
-      
+      dfAwaitingStart = false;
+      dfNotifyFinished(currentAudioFile);
       currentAudioFile = "";
-    } else if (type == DFPlayerError) {
+      break;
+
+    case 0x40:  // błąd
+      dfErrors++;
       Serial.print("Błąd DFPlayer: ");
-      Serial.println(value);
-      isPlayingAudio = false;
+      Serial.println(ev.param);
+      if (isPlayingAudio && dfAwaitingStart) {
+        isPlayingAudio = false;
+        dfAwaitingStart = false;
+        MasterMessage msg;
+        msg.command = "error";
+        msg.data = "dfplayer:" + String(ev.param);
+        msg.timestamp = millis();
+        sendToMaster(msg);
+      }
+      break;
+
+    case 0x41:  // ACK – wysyłany tylko na komendy z bajtem feedback, czyli play bez BUSY
+      if (DF_BUSY_PIN < 0 && dfAwaitingStart) dfRecordLatency(ev.us - dfPlaySentUs);
+      break;
+
+    case 0x3A:
+      Serial.println("DFPlayer: karta SD włożona");
+      break;
+
+    case 0x3B:
+      Serial.println("DFPlayer: karta SD wyjęta");
+      dfErrors++;
+      break;
+
+    default:
+      break;
+  }
+}
+
+void dfService() {
+  DfEvent ev;
+  while (xQueueReceive(dfEventQueue, &ev, 0) == pdTRUE) {
+    dfHandleEvent(ev);
+  }
+
+  // Start odtwarzania potwierdzony zboczem BUSY (bez BUSY – ACK obsłużony w dfHandleEvent)
+  if (dfAwaitingStart) {
+    unsigned long fallUs = dfBusyFallUs;
+    if (DF_BUSY_PIN >= 0 && fallUs != 0) {
+      dfRecordLatency(fallUs - dfPlaySentUs);
+    } else if (micros() - dfPlaySentUs > DF_START_TIMEOUT_MS * 1000UL) {
+      dfAwaitingStart = false;
+      dfStartTimeouts++;
+      Serial.println(DF_BUSY_PIN >= 0 ? "⚠️ DFPlayer nie zaczął grać (brak BUSY)"
+                                      : "⚠️ DFPlayer nie potwierdził play (brak ACK)");
     }
   }
+
+  if ((long)(millis() - dfNextCommandAt) < 0) return;
+
+  // Playlista: następny utwór, gdy nic nie gra
+  if (!isPlayingAudio && dfPlaylistCount > 0) {
+    DfCommand next = dfPlaylist[dfPlaylistHead];
+    dfPlaylistHead = (dfPlaylistHead + 1) % DF_PLAYLIST_SIZE;
+    dfPlaylistCount--;
+    dfStartTrack(next);
+    dfNextCommandAt = millis() + DF_CMD_GAP_MS;
+    return;
+  }
+
+  DfCommand cmd;
+  if (xQueueReceive(dfCommandQueue, &cmd, 0) == pdTRUE) {
+    dfExecute(cmd);
+  }
+}
+
+void sendAudioStats() {
+  DynamicJsonDocument doc(256);
+  doc["plays"] = dfPlays;
+  doc["errors"] = dfErrors;
+  doc["start_timeouts"] = dfStartTimeouts;
+  doc["queue_drops"] = dfQueueDrops;
+  doc["frame_errors"] = dfFrameErrors;
+  // Bez żadnego pomiaru pola lat_* pomijamy – zera wyglądałyby jak zmierzone opóźnienie
+  if (dfLatencyCount > 0) {
+    doc["lat_src"] = DF_BUSY_PIN >= 0 ? "busy" : "ack";
+    doc["lat_last_ms"] = dfLatencyLastUs / 1000.0;
+    doc["lat_max_ms"] = dfLatencyMaxUs / 1000.0;
+    doc["lat_avg_ms"] = (dfLatencySumUs / dfLatencyCount) / 1000.0;
+  }
+  doc["playlist"] = dfPlaylistCount;
+
+  MasterMessage msg;
+  msg.command = "audio_stats";
+  serializeJson(doc, msg.data);
+  msg.timestamp = millis();
+  sendToMaster(msg);
 }
 
 void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status) {
+  healthNoteSend(status);
+  if (hintAwaitingAck) {
+    hintAwaitingAck = false;
+    if (status == ESP_NOW_SEND_SUCCESS) {
+      hintAckUs = micros();
+      hintLatencyReady = true;
+    }
+  }
+
   if (status != ESP_NOW_SEND_SUCCESS) {
     Serial.println("ESP-NOW: Błąd wysyłania do Master");
   }
 }
 
 void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
+  if (channelSlaveHandleFrame(mac, incomingData, len)) return;
+  if (phySlaveHandleFrame(mac, incomingData, len)) return;
+  if (otaSlaveHandleFrame(mac, incomingData, len)) return;
+  const uint8_t* groupText;
+  int groupLen = groupSlaveHandleFrame(mac, incomingData, len, &groupText);
+  if (groupLen == 0) return;
+  if (groupLen > 0) {          // komenda grupowa – dalej jak zwykła ramka tekstowa
+    incomingData = groupText;
+    len = groupLen;
+  }
+
   String receivedData = "";
   for (int i = 0; i < len; i++) {
     receivedData += (char)incomingData[i];
@@ -280,7 +764,9 @@ void handleMasterMessage(String command, String data) {
   Serial.println("🎛️ Master komenda: " + command + ", dane: " + data);
   
   if (command == "play_audio") {
-    playAudio(data);
+    playAudio(data, false);
+  } else if (command == "queue_audio") {
+    playAudio(data, true);
   } else if (command == "stop_audio") {
     stopAudio();
   } else if (command == "set_volume") {
@@ -297,29 +783,37 @@ void handleMasterMessage(String command, String data) {
     Serial.println("🔄 Restart żądany przez Master");
     delay(1000);
     ESP.restart();
+  } else if (command == "puzzle_config") {
+    // Zastosowanie w loop() – tu jesteśmy w callbacku WiFi
+    if (!pendingConfigReady) {
+      strncpy(pendingConfig, data.c_str(), sizeof(pendingConfig) - 1);
+      pendingConfig[sizeof(pendingConfig) - 1] = '\0';
+      pendingConfigReady = true;
+    }
+  } else if (command == "audio_manifest") {
+    if (!pendingManifestReady) {
+      strncpy(pendingManifest, data.c_str(), sizeof(pendingManifest) - 1);
+      pendingManifest[sizeof(pendingManifest) - 1] = '\0';
+      pendingManifestReady = true;
+    }
   } else if (command == "heartbeat") {
     Serial.println("💓 Heartbeat od Master");
+  } else if (channelSlaveCommand(command, data)) {
+    Serial.println("📻 Kanał radiowy: " + command + " " + data);
+  } else if (phySlaveCommand(command, data)) {
+    Serial.println("📻 Szybkość radia: " + data);
   } else {
     Serial.println("❓ Nieznana komenda od Master: " + command);
   }
 }
 
-void playAudio(String fileName) {
+void playAudio(String fileName, bool queued) {
   Serial.println("🎵 Próba odtworzenia: " + fileName);
   
   int fileNumber = getFileNumber(fileName);
   if (fileNumber > 0) {
-    if (isPlayingAudio) {
-      myDFPlayer.stop();
-      delay(100);
-    }
-    
-    myDFPlayer.play(fileNumber);
-    isPlayingAudio = true;
-    currentAudioFile = fileName;
-    
-    Serial.println("▶️ Odtwarzanie pliku " + String(fileNumber) + ": " + fileName);
-    blinkLED(2, 150);
+    // Wykonanie w loop() przez kolejkę sterownika – tu jesteśmy w callbacku WiFi
+    dfEnqueue(queued ? DF_CMD_ENQUEUE : DF_CMD_PLAY, fileNumber, fileName);
   } else {
     Serial.println("❌ Nieznany plik audio: " + fileName);
     MasterMessage msg;
@@ -330,26 +824,113 @@ void playAudio(String fileName) {
   }
 }
 
+// Zwraca numer pliku z manifestu albo 0, gdy nazwa jest nieznana
 int getFileNumber(String fileName) {
-  if (fileName == "golab") return 1;
-  if (fileName == "hint1") return 2;
-  if (fileName == "hint2") return 2;
-  return 1;
+  int track = 0;
+  uint32_t slot = fnv1aHash(fileName) & (AUDIO_TABLE_SIZE - 1);
+
+  portENTER_CRITICAL(&audioMux);
+  for (int i = 0; i < AUDIO_TABLE_SIZE; i++) {
+    const AudioEntry& e = audioTable[slot];
+    if (e.track == 0) break;
+    if (strncmp(e.name, fileName.c_str(), AUDIO_NAME_LEN) == 0) {
+      track = e.track;
+      break;
+    }
+    slot = (slot + 1) & (AUDIO_TABLE_SIZE - 1);
+  }
+  portEXIT_CRITICAL(&audioMux);
+  return track;
 }
 
-void stopAudio() {
-  if (isPlayingAudio) {
-    myDFPlayer.stop();
-    isPlayingAudio = false;
-    currentAudioFile = "";
-    Serial.println("⏹️ Audio zatrzymane");
-    
-    MasterMessage msg;
-    msg.command = "audio_finished";
-    msg.data = "stopped";
-    msg.timestamp = millis();
-    sendToMaster(msg);
+void loadAudioManifest() {
+  puzzlePrefs.begin("audio", true);
+  String stored = puzzlePrefs.getString("manifest", "");
+  puzzlePrefs.end();
+
+  if (stored.length() == 0 || !applyAudioManifest(stored, false)) {
+    applyAudioManifest(DEFAULT_AUDIO_MANIFEST, false);
+    Serial.println("🎵 Manifest audio: domyślny (firmware)");
+  }
+}
+
+bool applyAudioManifest(const String& manifest, bool persist) {
+  DynamicJsonDocument doc(1024);
+  if (deserializeJson(doc, manifest)) {
+    Serial.println("❌ Niepoprawny manifest audio");
+    return false;
+  }
+
+  AudioEntry table[AUDIO_TABLE_SIZE];
+  memset(table, 0, sizeof(table));
+  int count = 0;
+
+  for (JsonPair kv : doc.as<JsonObject>()) {
+    int track = kv.value().as<int>();
+    const char* name = kv.key().c_str();
+    if (track <= 0 || track > 3000 || strlen(name) >= AUDIO_NAME_LEN) continue;
+    if (count >= AUDIO_TABLE_SIZE / 2) break;
+
+    uint32_t slot = fnv1aHash(String(name)) & (AUDIO_TABLE_SIZE - 1);
+    while (table[slot].track != 0 && strcmp(table[slot].name, name) != 0) {
+      slot = (slot + 1) & (AUDIO_TABLE_SIZE - 1);
+    }
+    if (table[slot].track == 0) count++;
+    strncpy(table[slot].name, name, AUDIO_NAME_LEN - 1);
+    table[slot].track = track;
   }
+
+  // getFileNumber() jest wołane z callbacku WiFi – podmiana tablicy w jednym kroku
+  portENTER_CRITICAL(&audioMux);
+  memcpy(audioTable, table, sizeof(audioTable));
+  audioEntries = count;
+  portEXIT_CRITICAL(&audioMux);
+
+  audioManifestHash = fnv1aHash(manifest);
+
+  if (persist) {
+    puzzlePrefs.begin("audio", false);
+    puzzlePrefs.putString("manifest", manifest);
+    puzzlePrefs.end();
+  }
+
+  Serial.println("🎵 Manifest audio: " + String(count) + " wpisów (hash " + String(audioManifestHash, HEX) + ")");
+  return true;
+}
+
+void checkPendingManifest() {
+  if (!pendingManifestReady) return;
+
+  String manifest = String(pendingManifest);
+  pendingManifestReady = false;
+
+  if (fnv1aHash(manifest) != audioManifestHash) {
+    if (!applyAudioManifest(manifest, true)) return;
+  }
+  sendAudioCatalog();
+}
+
+void sendAudioCatalog() {
+  // Potwierdzenie manifestu + zawartość karty SD dla cache na Masterze
+  DynamicJsonDocument doc(512);
+  doc["sd"] = sdFileCount;
+  doc["manifest"] = String(audioManifestHash, HEX);
+  doc["entries"] = audioEntries;
+  JsonArray folders = doc.createNestedArray("folders");
+  for (int f = 0; f < sdFolderCount && f < AUDIO_MAX_FOLDERS; f++) {
+    folders.add(sdFolderFiles[f]);
+  }
+
+  MasterMessage msg;
+  msg.command = "audio_catalog";
+  serializeJson(doc, msg.data);
+  msg.timestamp = millis();
+  sendToMaster(msg);
+}
+
+void stopAudio() {
+  // arg = 1: po zatrzymaniu zgłoś Masterowi audio_finished "stopped"
+  dfEnqueue(DF_CMD_STOP, 1, "");
 }
 
 void startGame(String groupName) {
@@ -357,7 +938,7 @@ void startGame(String groupName) {
   gamePaused = false;
   currentGameGroup = groupName;
   Serial.println("🎮 Gra rozpoczęta: " + groupName);
-  blinkLED(3, 500);
+  ledPlay(LED_GAME_START);
   
   MasterMessage msg;
   msg.command = "status";
@@ -370,18 +951,14 @@ void pauseGame() {
   if (!gameActive) return;
   gamePaused = true;
   Serial.println("⏸️ Gra wstrzymana");
-  if (isPlayingAudio) {
-    myDFPlayer.pause();
-  }
+  dfEnqueue(DF_CMD_PAUSE, 0, "");
 }
 
 void resumeGame() {
   if (!gameActive) return;
   gamePaused = false;
   Serial.println("▶️ Gra wznowiona");
-  if (isPlayingAudio) {
-    myDFPlayer.start();
-  }
+  dfEnqueue(DF_CMD_RESUME, 0, "");
 }
 
 void endGame(String status) {
@@ -390,16 +967,12 @@ void endGame(String status) {
   currentGameGroup = "";
   Serial.println("🏁 Gra zakończona: " + status);
   
-  if (isPlayingAudio) {
-    myDFPlayer.stop();
-    isPlayingAudio = false;
-    currentAudioFile = "";
-  }
+  dfEnqueue(DF_CMD_STOP, 0, "");
   
   if (status == "completed") {
-    blinkLED(10, 100);
+    ledPlay(LED_GAME_WON);
   } else {
-    blinkLED(3, 1000);
+    ledPlay(LED_GAME_LOST);
   }
   
   MasterMessage msg;
@@ -409,6 +982,60 @@ void endGame(String status) {
   sendToMaster(msg);
 }
 
+void loadPuzzleConfig() {
+  puzzlePrefs.begin("puzzle", true);
+  String stored = puzzlePrefs.getString("blob", "");
+  puzzlePrefs.end();
+
+  if (stored.length() == 0 || !applyPuzzleConfig(stored, false)) {
+    Serial.println("⚙️ Konfiguracja: domyślna (firmware)");
+  }
+}
+
+bool applyPuzzleConfig(const String& blob, bool persist) {
+  DynamicJsonDocument doc(512);
+  if (deserializeJson(doc, blob)) {
+    Serial.println("❌ Niepoprawna konfiguracja od Master");
+    return false;
+  }
+
+  // Gołąb korzysta tylko z głośności; reszta bloba dotyczy Walizki
+  int volume = doc["vol_g"] | dfVolume;
+  if (volume != dfVolume) {
+    dfVolume = constrain(volume, 0, 30);
+    dfEnqueue(DF_CMD_VOLUME, dfVolume, "");
+  }
+
+  puzzleConfigVersion = doc["v"] | 0;
+  puzzleConfigHash = fnv1aHash(blob);
+
+  if (persist) {
+    puzzlePrefs.begin("puzzle", false);
+    puzzlePrefs.putString("blob", blob);
+    puzzlePrefs.end();
+  }
+
+  Serial.println("⚙️ Konfiguracja v" + String(puzzleConfigVersion) + " (hash " + String(puzzleConfigHash, HEX) + ")");
+  return true;
+}
+
+void checkPendingConfig() {
+  if (!pendingConfigReady) return;
+
+  String blob = String(pendingConfig);
+  pendingConfigReady = false;
+
+  if (fnv1aHash(blob) != puzzleConfigHash) {
+    if (!applyPuzzleConfig(blob, true)) return;
+  }
+
+  MasterMessage msg;
+  msg.command = "config_ack";
+  msg.data = String(puzzleConfigVersion) + ":" + String(puzzleConfigHash, HEX);
+  msg.timestamp = millis();
+  sendToMaster(msg);
+}
+
 void sendHeartbeatToMaster() {
   MasterMessage msg;
   msg.command = "heartbeat";
@@ -435,7 +1062,7 @@ bool sendToMaster(MasterMessage& message) {
 
 void setVolume(int volume) {
   volume = constrain(volume, 0, 30);
-  myDFPlayer.volume(volume);
+  dfEnqueue(DF_CMD_VOLUME, volume, "");
   Serial.println("🔊 Głośność ustawiona na: " + String(volume));
   
   MasterMessage msg;
@@ -444,12 +1071,3 @@ void setVolume(int volume) {
   msg.timestamp = millis();
   sendToMaster(msg);
 }
-
-void blinkLED(int times, int delayMs) {
-  for (int i = 0; i < times; i++) {
-    digitalWrite(LED_PIN, HIGH);
-    delay(delayMs);
-    digitalWrite(LED_PIN, LOW);
-    delay(delayMs);
-  }
-}
\ No newline at end of file
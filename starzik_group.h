@@ -0,0 +1,91 @@
+// starzik_group.h
+// Komendy grupowe Master -> wiele węzłów – wspólne dla Master i slave'ów.
+// Zamiast pętli unicastów jedna ramka rozgłoszeniowa z maską adresatów; każdy adresat
+// potwierdza ją osobno, a Master powtarza unicastem tylko do tych, którzy nie potwierdzili.
+// Wewnątrz ramki zwykły tekst "cmd|data|ms", więc węzeł wykonuje ją swoją dotychczasową ścieżką.
+#pragma once
+
+#include <Arduino.h>
+#include <esp_now.h>
+#include "starzik_frame_magic.h"
+
+const int GROUP_SEEN_HISTORY = 8;          // ostatnie numery – powtórka nie jest wykonywana drugi raz
+
+// Członkowie grup – bit w masce adresatów. Kolejność jest częścią protokołu.
+enum GroupMember : uint8_t {
+  GROUP_MEMBER_GOLAB = 0,
+  GROUP_MEMBER_WALIZKA,
+  GROUP_MEMBER_LOM,
+  GROUP_MEMBER_PODLOGA,
+  GROUP_MEMBER_IO1,
+  GROUP_MEMBER_IO2,
+  GROUP_MEMBER_IO3,
+  GROUP_MEMBER_COUNT
+};
+
+static const char* const GROUP_MEMBER_IDS[GROUP_MEMBER_COUNT] = {
+  "golab", "walizka", "lom", "podloga", "io1", "io2", "io3"
+};
+
+struct __attribute__((packed)) GroupFrameHeader {
+  uint8_t magic;
+  uint16_t seq;
+  uint32_t mask;           // bit = GroupMember
+};
+
+struct __attribute__((packed)) GroupAck {
+  uint8_t magic;
+  uint16_t seq;
+  uint8_t member;
+};
+
+const size_t GROUP_TEXT_MAX = 250 - sizeof(GroupFrameHeader);
+
+inline int groupMemberById(const char* id) {
+  for (int i = 0; i < GROUP_MEMBER_COUNT; i++) {
+    if (strcmp(GROUP_MEMBER_IDS[i], id) == 0) return i;
+  }
+  return -1;
+}
+
+// ===== Strona slave'a =====
+
+static const uint8_t* groupMasterMac = NULL;
+static int groupSelf = -1;
+static uint16_t groupSeen[GROUP_SEEN_HISTORY];
+static int groupSeenCount = 0;
+
+// Wywołać w setup() po dodaniu Mastera jako peera
+inline void groupSlaveBegin(const uint8_t* masterMac, const char* memberId) {
+  groupMasterMac = masterMac;
+  groupSelf = groupMemberById(memberId);
+}
+
+// Wywołać w callbacku odbioru przed parsowaniem tekstu.
+// -1 = to nie ramka grupowa, 0 = obsłużona (nie do nas albo powtórka),
+// >0 = długość tekstu "cmd|data|ms" pod *text do wykonania jak zwykła ramka od Mastera.
+inline int groupSlaveHandleFrame(const uint8_t* mac, const uint8_t* data, int len, const uint8_t** text) {
+  if (len < (int)sizeof(GroupFrameHeader) || data[0] != GROUP_FRAME_MAGIC) return -1;
+  if (groupSelf < 0 || memcmp(mac, groupMasterMac, 6) != 0) return 0;
+
+  const GroupFrameHeader* h = (const GroupFrameHeader*)data;
+  if (!(h->mask & (1UL << groupSelf))) return 0;
+
+  // ACK od razu z callbacku – Master mierzy czas do ostatniego potwierdzenia
+  GroupAck ack = { GROUP_ACK_MAGIC, h->seq, (uint8_t)groupSelf };
+  esp_now_send(groupMasterMac, (const uint8_t*)&ack, sizeof(ack));
+
+  // Powtórka, bo ACK zginął – potwierdzona, ale nie wykonywana drugi raz
+  for (int i = 0; i < groupSeenCount; i++) {
+    if (groupSeen[i] == h->seq) return 0;
+  }
+  if (groupSeenCount < GROUP_SEEN_HISTORY) {
+    groupSeen[groupSeenCount++] = h->seq;
+  } else {
+    memmove(groupSeen, groupSeen + 1, (GROUP_SEEN_HISTORY - 1) * sizeof(groupSeen[0]));
+    groupSeen[GROUP_SEEN_HISTORY - 1] = h->seq;
+  }
+
+  *text = data + sizeof(GroupFrameHeader);
+  return len - sizeof(GroupFrameHeader);
+}
@@ -0,0 +1,15 @@
+// starzik_hash.h
+// FNV-1a (32 bit) – wspólny dla Master i slave'ów. Ten sam skrót liczą obie strony, np. Master
+// z konfiguracji zagadek, a slave z tego, co odebrał – wynik musi być identyczny co do bitu.
+#pragma once
+
+#include <Arduino.h>
+
+inline uint32_t fnv1aHash(const String& text) {
+  uint32_t hash = 2166136261UL;
+  for (size_t i = 0; i < text.length(); i++) {
+    hash ^= (uint8_t)text.charAt(i);
+    hash *= 16777619UL;
+  }
+  return hash;
+}
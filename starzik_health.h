@@ -0,0 +1,87 @@
+// starzik_health.h
+// Telemetria zdrowia slave'a – wspólna dla Master i slave'ów.
+// Zaraz po każdym heartbeacie slave wysyła zwięzły rekord binarny: sterta, obieg loop(),
+// wysyłki ESP-NOW bez potwierdzenia, przyczyna ostatniego restartu i błędy peryferiów.
+// Liczniki okresowe (pętla, radio) są zerowane po każdym rekordzie – rekord opisuje odcinek
+// od poprzedniego heartbeatu. Historię i trendy liczy Master (/nodes).
+#pragma once
+
+#include <Arduino.h>
+#include <esp_now.h>
+#include <esp_system.h>
+#include "starzik_frame_magic.h"
+
+const uint8_t HEALTH_VERSION = 1;
+
+enum HealthFlags : uint8_t {
+  HEALTH_PERIPHERAL_OK = 0x01,     // peryferia węzła odpowiadają
+  HEALTH_NO_PERIPHERAL = 0x02      // węzeł nie ma monitorowanych peryferiów – pola peryferiów bez znaczenia
+};
+
+struct __attribute__((packed)) HealthRecord {
+  uint8_t magic;
+  uint8_t version;
+  uint8_t resetReason;       // esp_reset_reason()
+  uint8_t flags;             // HealthFlags
+  uint32_t uptimeS;
+  uint32_t heapFree;
+  uint32_t heapMin;          // najniższy poziom od startu
+  uint32_t heapMaxBlock;     // największy wolny blok – fragmentacja
+  uint16_t loopMaxMs;        // najdłuższy obieg loop() na odcinku
+  uint16_t loopAvgMs;
+  uint16_t radioSent;        // wysyłki ESP-NOW na odcinku
+  uint16_t radioFailed;      // w tym bez ACK po wszystkich powtórkach warstwy MAC
+  uint16_t peripheralErrors; // od startu: błędy zgłoszone przez DFPlayer, brak odpowiedzi czytnika RFID
+};
+
+// ===== Strona slave'a =====
+
+static unsigned long healthLoopLastUs = 0;
+static uint32_t healthLoopMaxUs = 0;
+static uint32_t healthLoopSumUs = 0;
+static uint32_t healthLoopCount = 0;
+static volatile uint16_t healthRadioSent = 0;
+static volatile uint16_t healthRadioFailed = 0;
+
+// Wywołać na początku loop() – mierzy odstęp między kolejnymi obiegami (z delay() na końcu)
+inline void healthLoopTick() {
+  unsigned long now = micros();
+  if (healthLoopLastUs != 0) {
+    uint32_t period = now - healthLoopLastUs;
+    if (period > healthLoopMaxUs) healthLoopMaxUs = period;
+    healthLoopSumUs += period;
+    healthLoopCount++;
+  }
+  healthLoopLastUs = now;
+}
+
+// Z callbacku wysyłki ESP-NOW
+inline void healthNoteSend(esp_now_send_status_t status) {
+  if (healthRadioSent < 0xFFFF) healthRadioSent++;
+  if (status != ESP_NOW_SEND_SUCCESS && healthRadioFailed < 0xFFFF) healthRadioFailed++;
+}
+
+// Zaraz po heartbeacie do Mastera; hasPeripheral = false dla węzłów bez monitorowanych peryferiów
+inline void healthSlaveSend(const uint8_t* masterMac, uint16_t peripheralErrors, bool peripheralOk, bool hasPeripheral = true) {
+  HealthRecord r;
+  r.magic = HEALTH_FRAME_MAGIC;
+  r.version = HEALTH_VERSION;
+  r.resetReason = esp_reset_reason();
+  r.flags = hasPeripheral ? (peripheralOk ? HEALTH_PERIPHERAL_OK : 0) : HEALTH_NO_PERIPHERAL;
+  r.uptimeS = millis() / 1000;
+  r.heapFree = ESP.getFreeHeap();
+  r.heapMin = ESP.getMinFreeHeap();
+  r.heapMaxBlock = ESP.getMaxAllocHeap();
+  r.loopMaxMs = min(healthLoopMaxUs / 1000, (uint32_t)0xFFFF);
+  r.loopAvgMs = healthLoopCount > 0 ? min(healthLoopSumUs / healthLoopCount / 1000, (uint32_t)0xFFFF) : 0;
+  r.radioSent = healthRadioSent;
+  r.radioFailed = healthRadioFailed;
+  r.peripheralErrors = peripheralErrors;
+
+  healthLoopMaxUs = 0;
+  healthLoopSumUs = 0;
+  healthLoopCount = 0;
+  healthRadioSent = 0;
+  healthRadioFailed = 0;
+  esp_now_send(masterMac, (const uint8_t*)&r, sizeof(r));
+}
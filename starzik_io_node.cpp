@@ -0,0 +1,385 @@
+// Uniwersalny węzeł I/O – bez własnej logiki zagadki.
+// Wejścia, przekaźniki, PWM i DFPlayer opisuje profil (starzik_io_profile.h),
+// a całym zachowaniem steruje Master komendami i subskrypcją zdarzeń wejść.
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_timer.h>
+#include <soc/gpio_reg.h>
+#include <HardwareSerial.h>
+#include <DFRobotDFPlayerMini.h>
+#include "starzik_io_profile.h"
+#include "starzik_ota.h"
+#include "starzik_group.h"
+#include "starzik_channel.h"
+#include "starzik_phy.h"
+#include "starzik_health.h"
+
+// --- Master (ESP-NOW) ---
+#define REGISTER_RETRY_MS 2000
+#define MASTER_TIMEOUT_MS 30000
+#define IO_SCAN_US 5000            // skan wszystkich wejść jednym odczytem rejestrów co 5 ms
+
+uint8_t master_mac[] = {0x78, 0x1C, 0x3C, 0xF5, 0x82, 0xD8};
+
+struct MasterFrame {
+  char text[250];
+};
+
+QueueHandle_t master_queue = NULL;
+bool master_connected = false;
+unsigned long last_master_frame = 0;
+unsigned long last_register_attempt = 0;
+
+// --- Wejścia ---
+esp_timer_handle_t scan_timer = NULL;
+uint32_t input_mask0[IO_INPUT_COUNT];   // bit w GPIO_IN_REG albo GPIO_IN1_REG
+bool input_high[IO_INPUT_COUNT];        // pin >= 32
+bool input_raw[IO_INPUT_COUNT];
+int64_t input_since[IO_INPUT_COUNT];
+volatile uint32_t input_state = 0;      // stan po debounce, bit i = wejście i aktywne
+volatile uint32_t subscribed = 0xFFFFFFFF;
+volatile uint32_t scan_max_us = 0;
+portMUX_TYPE event_mux = portMUX_INITIALIZER_UNLOCKED;  // timery -> loop(): zdarzenia do wysłania
+uint32_t pending_inputs = 0;            // zmienione wejścia od ostatniego wysłania
+uint32_t pending_relays = 0;            // koniec impulsu przekaźnika i
+
+// --- Wyjścia ---
+portMUX_TYPE relay_mux = portMUX_INITIALIZER_UNLOCKED;   // loop() i timery impulsów
+uint8_t relay_state = 0;
+esp_timer_handle_t relay_timers[IO_RELAY_COUNT];
+uint8_t pwm_duty[IO_PWM_COUNT];
+
+HardwareSerial dfSerial(1);
+DFRobotDFPlayerMini dfplayer;
+bool df_ready = false;
+bool df_was_busy = false;
+uint16_t df_errors = 0;               // od startu, do rekordu zdrowia
+
+void sendToMaster(const String& command, const String& data) {
+  String serialized = command + "|" + data + "|" + String(millis());
+  uint8_t message[250];
+  size_t len = serialized.length();
+  if (len > 249) len = 249;
+  serialized.getBytes(message, len + 1);
+
+  if (esp_now_send(master_mac, message, len) != ESP_OK) {
+    Serial.println("Błąd wysyłania do Master: " + command);
+  }
+}
+
+// Wspólny format zdarzeń węzłów: {"ev","id","stage","relay"} + stan wejść/wyjść
+void sendEvent(const char* ev, uint32_t id) {
+  if (!master_connected) return;
+  char json[160];
+  snprintf(json, sizeof(json),
+           "{\"ev\":\"%s\",\"id\":%lu,\"stage\":\"IN:%08lX\",\"relay\":%s,\"in\":%lu,\"out\":%u}",
+           ev, (unsigned long)id, (unsigned long)input_state, relay_state ? "true" : "false",
+           (unsigned long)input_state, relay_state);
+  sendToMaster("event", json);
+}
+
+// --- Skan wejść (esp_timer): odczyt GPIO_IN/GPIO_IN1 raz na skan, raport tylko zmian ---
+void scanInputs(void* arg) {
+  int64_t now = esp_timer_get_time();
+  uint32_t in0 = REG_READ(GPIO_IN_REG);
+  uint32_t in1 = REG_READ(GPIO_IN1_REG);
+  uint32_t state = input_state;
+  uint32_t changed = 0;
+
+  for (int i = 0; i < IO_INPUT_COUNT; i++) {
+    bool raw = (input_high[i] ? in1 : in0) & input_mask0[i];
+    if (IO_INPUTS[i].activeLow) raw = !raw;
+
+    if (raw != input_raw[i]) {
+      input_raw[i] = raw;
+      input_since[i] = now;
+    } else if (raw != (bool)(state & (1UL << i)) &&
+               now - input_since[i] >= (int64_t)IO_INPUTS[i].debounceMs * 1000) {
+      state ^= 1UL << i;
+      changed |= 1UL << i;
+    }
+  }
+
+  input_state = state;
+  // Wysyła loop() – w zadaniu esp_timer bez String, radia i Serial
+  if (changed & subscribed) {
+    portENTER_CRITICAL(&event_mux);
+    pending_inputs |= changed & subscribed;
+    portEXIT_CRITICAL(&event_mux);
+  }
+
+  uint32_t took = esp_timer_get_time() - now;
+  if (took > scan_max_us) scan_max_us = took;
+}
+
+void setupInputs() {
+  for (int i = 0; i < IO_INPUT_COUNT; i++) {
+    uint8_t pin = IO_INPUTS[i].pin;
+    pinMode(pin, IO_INPUTS[i].activeLow ? INPUT_PULLUP : INPUT);
+    input_high[i] = pin >= 32;
+    input_mask0[i] = 1UL << (pin >= 32 ? pin - 32 : pin);
+    input_raw[i] = digitalRead(pin) == (IO_INPUTS[i].activeLow ? LOW : HIGH);
+    input_since[i] = 0;
+    if (input_raw[i]) input_state |= 1UL << i;
+  }
+
+  esp_timer_create_args_t args = {};
+  args.callback = &scanInputs;
+  args.name = "ioScan";
+  esp_timer_create(&args, &scan_timer);
+  esp_timer_start_periodic(scan_timer, IO_SCAN_US);
+}
+
+// --- Przekaźniki i PWM ---
+void setRelay(int i, bool on) {
+  if (i < 0 || i >= IO_RELAY_COUNT) return;
+  digitalWrite(IO_RELAYS[i].pin, (on == IO_RELAYS[i].activeHigh) ? HIGH : LOW);
+  portENTER_CRITICAL(&relay_mux);
+  if (on) relay_state |= 1 << i;
+  else relay_state &= ~(1 << i);
+  portEXIT_CRITICAL(&relay_mux);
+}
+
+void relayPulseEnd(void* arg) {
+  int i = (int)(intptr_t)arg;
+  setRelay(i, false);
+  portENTER_CRITICAL(&event_mux);
+  pending_relays |= 1UL << i;
+  portEXIT_CRITICAL(&event_mux);
+}
+
+// Zdarzenia z timerów: jedna ramka na wszystkie wejścia zmienione od ostatniego obiegu
+void serviceEvents() {
+  portENTER_CRITICAL(&event_mux);
+  uint32_t inputs = pending_inputs;
+  uint32_t relays = pending_relays;
+  pending_inputs = 0;
+  pending_relays = 0;
+  portEXIT_CRITICAL(&event_mux);
+
+  if (inputs) sendEvent("inputs", inputs);
+  for (int i = 0; i < IO_RELAY_COUNT; i++) {
+    if (relays & (1UL << i)) sendEvent("relay", i);
+  }
+}
+
+void setPwm(int i, int duty) {
+  if (i < 0 || i >= IO_PWM_COUNT) return;
+  pwm_duty[i] = constrain(duty, 0, 255);
+  ledcWrite(IO_PWMS[i].channel, pwm_duty[i]);
+}
+
+void setupOutputs() {
+  for (int i = 0; i < IO_RELAY_COUNT; i++) {
+    pinMode(IO_RELAYS[i].pin, OUTPUT);
+    setRelay(i, false);
+
+    esp_timer_create_args_t args = {};
+    args.callback = &relayPulseEnd;
+    args.arg = (void*)(intptr_t)i;
+    args.name = "ioPulse";
+    esp_timer_create(&args, &relay_timers[i]);
+  }
+
+  for (int i = 0; i < IO_PWM_COUNT; i++) {
+    ledcSetup(IO_PWMS[i].channel, IO_PWMS[i].freqHz, 8);
+    ledcAttachPin(IO_PWMS[i].pin, IO_PWMS[i].channel);
+    setPwm(i, 0);
+  }
+}
+
+void allOutputsOff() {
+  for (int i = 0; i < IO_RELAY_COUNT; i++) {
+    esp_timer_stop(relay_timers[i]);
+    setRelay(i, false);
+  }
+  for (int i = 0; i < IO_PWM_COUNT; i++) setPwm(i, 0);
+  if (df_ready) dfplayer.stop();
+}
+
+void setupDfPlayer() {
+  if (!IO_DFPLAYER.enabled) return;
+  if (IO_DFPLAYER.busyPin >= 0) pinMode(IO_DFPLAYER.busyPin, INPUT_PULLUP);
+  dfSerial.begin(9600, SERIAL_8N1, IO_DFPLAYER.rxPin, IO_DFPLAYER.txPin);
+  df_ready = dfplayer.begin(dfSerial);
+  if (df_ready) dfplayer.volume(IO_DFPLAYER.volume);
+  else Serial.println("DFPlayer nie znaleziony!");
+}
+
+void checkDfPlayer() {
+  if (!df_ready) return;
+  // Odpowiedzi z UART – liczymy tylko błędy (brak karty, błąd ramki, timeout)
+  while (dfplayer.available()) {
+    uint8_t type = dfplayer.readType();
+    if ((type == DFPlayerError || type == TimeOut || type == WrongStack) && df_errors < 0xFFFF) df_errors++;
+  }
+  if (IO_DFPLAYER.busyPin < 0) return;
+  bool busy = digitalRead(IO_DFPLAYER.busyPin) == LOW;
+  if (df_was_busy && !busy) sendEvent("audio_finished", 0);
+  df_was_busy = busy;
+}
+
+// --- Komendy Mastera: "indeks:wartość" ---
+bool parsePair(const String& data, int& index, long& value) {
+  int sep = data.indexOf(':');
+  if (sep <= 0) return false;
+  index = data.substring(0, sep).toInt();
+  value = data.substring(sep + 1).toInt();
+  return true;
+}
+
+void sendState() {
+  char json[200];
+  int n = snprintf(json, sizeof(json), "{\"node\":\"%s\",\"in\":%lu,\"out\":%u,\"scan_max_us\":%lu,\"pwm\":[",
+                   IO_NODE_ID, (unsigned long)input_state, relay_state, (unsigned long)scan_max_us);
+  for (int i = 0; i < IO_PWM_COUNT && n < (int)sizeof(json) - 8; i++) {
+    n += snprintf(json + n, sizeof(json) - n, i ? ",%u" : "%u", pwm_duty[i]);
+  }
+  snprintf(json + n, sizeof(json) - n, "]}");
+  sendToMaster("state", json);
+}
+
+void handleMasterMessage(const String& command, const String& data) {
+  int index;
+  long value;
+
+  if (command == "heartbeat" || command == "registered") {
+    if (!master_connected) Serial.println("Połączono z Master");
+    master_connected = true;
+    sendToMaster("heartbeat", data);    // echo – Master liczy z tego RTT
+    healthSlaveSend(master_mac, df_errors, df_ready, IO_DFPLAYER.enabled);
+  } else if (command == "relay" && parsePair(data, index, value)) {
+    if (index >= 0 && index < IO_RELAY_COUNT) {
+      esp_timer_stop(relay_timers[index]);
+      setRelay(index, value != 0);
+      sendEvent("relay", index);
+    }
+  } else if (command == "pulse" && parsePair(data, index, value)) {
+    if (index >= 0 && index < IO_RELAY_COUNT && value > 0) {
+      setRelay(index, true);
+      esp_timer_stop(relay_timers[index]);
+      esp_timer_start_once(relay_timers[index], (uint64_t)value * 1000);
+      sendEvent("pulse", index);
+    }
+  } else if (command == "pwm" && parsePair(data, index, value)) {
+    setPwm(index, value);
+  } else if (command == "play") {
+    if (df_ready) dfplayer.play(data.toInt());
+  } else if (command == "volume") {
+    if (df_ready) dfplayer.volume(constrain(data.toInt(), 0, 30));
+  } else if (command == "stop_audio") {
+    if (df_ready) dfplayer.stop();
+  } else if (command == "subscribe") {
+    // Maska szesnastkowa wejść, o których zmianach węzeł ma raportować
+    subscribed = strtoul(data.c_str(), NULL, 16);
+    sendState();
+  } else if (command == "get") {
+    sendState();
+  } else if (command == "reset_puzzle") {
+    allOutputsOff();
+    sendEvent("reset", 0);
+  } else if (command == "start_puzzle") {
+    sendEvent("started", 0);
+  } else if (command == "restart") {
+    ESP.restart();
+  } else if (channelSlaveCommand(command, data)) {
+    Serial.println("Kanał radiowy: " + command + " " + data);
+  } else if (phySlaveCommand(command, data)) {
+    Serial.println("Szybkość radia: " + data);
+  } else {
+    Serial.println("Nieznana komenda od Master: " + command);
+  }
+}
+
+void onDataSent(const uint8_t* mac, esp_now_send_status_t status) {
+  healthNoteSend(status);
+}
+
+void onDataRecv(const uint8_t* mac, const uint8_t* incomingData, int len) {
+  if (channelSlaveHandleFrame(mac, incomingData, len)) return;
+  if (phySlaveHandleFrame(mac, incomingData, len)) return;
+  if (otaSlaveHandleFrame(mac, incomingData, len)) return;
+  const uint8_t* groupText;
+  int groupLen = groupSlaveHandleFrame(mac, incomingData, len, &groupText);
+  if (groupLen == 0) return;
+  if (groupLen > 0) {          // komenda grupowa – dalej jak zwykła ramka tekstowa
+    incomingData = groupText;
+    len = groupLen;
+  }
+  if (memcmp(mac, master_mac, 6) != 0) return;
+
+  MasterFrame frame;
+  if (len > (int)sizeof(frame.text) - 1) len = sizeof(frame.text) - 1;
+  memcpy(frame.text, incomingData, len);
+  frame.text[len] = '\0';
+  xQueueSend(master_queue, &frame, 0);
+}
+
+void serviceMaster() {
+  MasterFrame frame;
+  while (xQueueReceive(master_queue, &frame, 0) == pdTRUE) {
+    String payload = frame.text;
+    int p1 = payload.indexOf('|');
+    int p2 = payload.indexOf('|', p1 + 1);
+    if (p1 <= 0 || p2 <= 0) continue;
+    last_master_frame = millis();
+    handleMasterMessage(payload.substring(0, p1), payload.substring(p1 + 1, p2));
+  }
+
+  if (master_connected && millis() - last_master_frame > MASTER_TIMEOUT_MS) {
+    master_connected = false;
+    Serial.println("Utracono połączenie z Master");
+  }
+
+  if (!master_connected && millis() - last_register_attempt > REGISTER_RETRY_MS) {
+    last_register_attempt = millis();
+    sendToMaster("register", IO_NODE_ID);
+  }
+}
+
+void setupESPNow() {
+  WiFi.mode(WIFI_STA);
+  WiFi.disconnect();
+  channelSlaveBegin(master_mac);   // kanał z NVS, zanim ruszy ESP-NOW
+
+  master_queue = xQueueCreate(8, sizeof(MasterFrame));
+  if (esp_now_init() != ESP_OK) {
+    Serial.println("Błąd inicjalizacji ESP-NOW");
+    return;
+  }
+  esp_now_register_send_cb(onDataSent);
+  esp_now_register_recv_cb(onDataRecv);
+
+  esp_now_peer_info_t peer = {};
+  memcpy(peer.peer_addr, master_mac, 6);
+  peer.channel = 0;
+  peer.encrypt = false;
+  peer.ifidx = WIFI_IF_STA;
+  if (esp_now_add_peer(&peer) != ESP_OK) Serial.println("Błąd dodawania Master peer");
+  otaSlaveBegin(master_mac);
+  groupSlaveBegin(master_mac, IO_NODE_ID);
+  phySlaveBegin(master_mac);
+}
+
+void setup() {
+  Serial.begin(115200);
+
+  setupOutputs();
+  setupDfPlayer();
+  setupESPNow();
+  setupInputs();
+
+  Serial.printf("Węzeł I/O %s gotowy: %d wejść, %d przekaźników, %d PWM, DFPlayer %s\n",
+                IO_NODE_ID, IO_INPUT_COUNT, IO_RELAY_COUNT, IO_PWM_COUNT, df_ready ? "tak" : "nie");
+}
+
+void loop() {
+  healthLoopTick();
+  serviceMaster();
+  serviceEvents();
+  channelSlaveService();
+  phySlaveService();
+  checkDfPlayer();
+  delay(10);
+}
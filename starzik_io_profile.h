@@ -0,0 +1,83 @@
+// starzik_io_profile.h
+// Profile węzła I/O – układ pinów i peryferiów wkompilowany w firmware.
+// Profil wybiera flaga -DIO_PROFILE_* w platformio.ini; bez flagi używany jest domyślny.
+#pragma once
+
+#include <stdint.h>
+
+struct IoInput {
+  uint8_t pin;
+  bool activeLow;          // z INPUT_PULLUP: zwarcie do masy = aktywne
+  uint16_t debounceMs;
+  const char* name;
+};
+
+struct IoRelay {
+  uint8_t pin;
+  bool activeHigh;
+  const char* name;
+};
+
+struct IoPwm {
+  uint8_t pin;
+  uint8_t channel;         // kanał LEDC
+  uint16_t freqHz;
+  const char* name;
+};
+
+struct IoDfPlayer {
+  bool enabled;
+  uint8_t rxPin;
+  uint8_t txPin;
+  int8_t busyPin;          // -1 = brak
+  uint8_t volume;
+};
+
+#if defined(IO_PROFILE_LOM)
+
+// Układ jak w Łomie – ta sama płytka sterowana w całości z Mastera
+#define IO_NODE_ID "io2"
+static const IoInput IO_INPUTS[] = {
+  { 27, true, 30, "blaszka1" },
+  { 33, true, 30, "blaszka2" },
+  { 13, true, 50, "przycisk" },
+};
+static const IoRelay IO_RELAYS[] = {
+  { 26, true, "przekaznik" },
+};
+static const IoPwm IO_PWMS[] = {
+  { 18, 0, 1000, "silnik1" },
+  { 19, 1, 1000, "silnik2" },
+  { 21, 2, 1000, "led" },
+};
+static const IoDfPlayer IO_DFPLAYER = { true, 16, 17, 32, 25 };
+
+#else
+
+// Domyślny: 4 wejścia, 2 przekaźniki, 2 wyjścia PWM, bez DFPlayera
+#define IO_NODE_ID "io1"
+static const IoInput IO_INPUTS[] = {
+  { 32, true, 30, "in1" },
+  { 33, true, 30, "in2" },
+  { 25, true, 30, "in3" },
+  { 26, true, 30, "in4" },
+};
+// GPIO16/17 są zajęte przez PSRAM na modułach WROVER – przekaźniki tylko na pinach wolnych na obu
+static const IoRelay IO_RELAYS[] = {
+  { 4, false, "relay1" },
+  { 27, false, "relay2" },
+};
+static const IoPwm IO_PWMS[] = {
+  { 18, 0, 1000, "pwm1" },
+  { 19, 1, 1000, "pwm2" },
+};
+static const IoDfPlayer IO_DFPLAYER = { false, 0, 0, -1, 0 };
+
+#endif
+
+const int IO_INPUT_COUNT = sizeof(IO_INPUTS) / sizeof(IO_INPUTS[0]);
+const int IO_RELAY_COUNT = sizeof(IO_RELAYS) / sizeof(IO_RELAYS[0]);
+const int IO_PWM_COUNT = sizeof(IO_PWMS) / sizeof(IO_PWMS[0]);
+
+static_assert(IO_INPUT_COUNT <= 32, "Maska wejść ma 32 bity");
+static_assert(IO_RELAY_COUNT <= 8, "Maska przekaźników ma 8 bitów");
@@ -0,0 +1,98 @@
+// starzik_led.h
+// Nieblokujący silnik wzorów LED (esp_timer) – wspólny dla Master i Gołąb.
+// Wzór jest odtwarzany w tle, więc loop() nie stoi na delay() podczas mrugania.
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+// Wzór: N razy (onMs włączona, offMs wyłączona). Wyższy priorytet przerywa niższy,
+// niższy jest ignorowany, dopóki trwa wzór o wyższym priorytecie.
+struct LedPattern {
+  uint16_t onMs;
+  uint16_t offMs;
+  uint8_t times;
+  uint8_t priority;
+};
+
+// --- Biblioteka wzorów ---
+const LedPattern LED_STARTUP    = { 300,  300,  3, 1 };
+const LedPattern LED_PLAY       = { 150,  150,  2, 1 };
+const LedPattern LED_GAME_START = { 500,  500,  3, 2 };
+const LedPattern LED_HINT       = { 100,  100,  5, 3 };
+const LedPattern LED_GAME_WON   = { 100,  100, 10, 4 };
+const LedPattern LED_GAME_LOST  = { 1000, 1000, 3, 4 };
+
+static uint8_t ledPin = 0;
+static esp_timer_handle_t ledTimer = NULL;
+static portMUX_TYPE ledMux = portMUX_INITIALIZER_UNLOCKED;
+static LedPattern ledCurrent = { 0, 0, 0, 0 };
+static uint8_t ledStepsLeft = 0;      // pozostałe przełączenia (2 na mrugnięcie)
+static bool ledLevel = false;
+static bool ledBaseLevel = false;     // stan diody, gdy nie gra żaden wzór
+
+static void ledTimerCallback(void* arg) {
+  uint32_t nextMs = 0;
+
+  portENTER_CRITICAL(&ledMux);
+  if (ledStepsLeft > 0) {
+    ledStepsLeft--;
+    ledLevel = !ledLevel;
+    if (ledStepsLeft > 0) nextMs = ledLevel ? ledCurrent.onMs : ledCurrent.offMs;
+  }
+  if (ledStepsLeft == 0) {
+    ledCurrent.priority = 0;
+    ledLevel = ledBaseLevel;
+  }
+  bool level = ledLevel;
+  portEXIT_CRITICAL(&ledMux);
+
+  digitalWrite(ledPin, level ? HIGH : LOW);
+  if (nextMs > 0) esp_timer_start_once(ledTimer, (uint64_t)nextMs * 1000);
+}
+
+inline void ledEngineBegin(uint8_t pin) {
+  ledPin = pin;
+  pinMode(ledPin, OUTPUT);
+  digitalWrite(ledPin, LOW);
+
+  esp_timer_create_args_t args = {};
+  args.callback = &ledTimerCallback;
+  args.name = "led";
+  esp_timer_create(&args, &ledTimer);
+}
+
+// Uruchom wzór; zwraca false, jeśli trwa wzór o wyższym priorytecie
+inline bool ledPlay(const LedPattern& pattern) {
+  if (ledTimer == NULL || pattern.times == 0) return false;
+
+  portENTER_CRITICAL(&ledMux);
+  if (ledCurrent.priority > pattern.priority) {
+    portEXIT_CRITICAL(&ledMux);
+    return false;
+  }
+  ledCurrent = pattern;
+  ledStepsLeft = pattern.times * 2;
+  ledLevel = true;
+  portEXIT_CRITICAL(&ledMux);
+
+  esp_timer_stop(ledTimer);
+  digitalWrite(ledPin, HIGH);
+  esp_timer_start_once(ledTimer, (uint64_t)pattern.onMs * 1000);
+  return true;
+}
+
+// Stan diody poza wzorami (np. podświetlenie przy trzymaniu przycisku)
+inline void ledSetBase(bool on) {
+  portENTER_CRITICAL(&ledMux);
+  ledBaseLevel = on;
+  bool idle = (ledStepsLeft == 0);
+  if (idle) ledLevel = on;
+  portEXIT_CRITICAL(&ledMux);
+
+  if (idle) digitalWrite(ledPin, on ? HIGH : LOW);
+}
+
+inline bool ledBusy() {
+  return ledStepsLeft > 0;
+}
@@ -0,0 +1,535 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_now.h>
+#include <DFRobotDFPlayerMini.h>
+#include <HardwareSerial.h>
+#include <esp_timer.h>
+#include "starzik_ota.h"
+#include "starzik_group.h"
+#include "starzik_channel.h"
+#include "starzik_phy.h"
+#include "starzik_health.h"
+
+// --- Czujniki (blaszki) ---
+#define SENSOR1_PIN 27
+#define SENSOR2_PIN 33
+
+// --- Przekaźnik ---
+#define RELAY_PIN 26
+
+// --- Silniki wibracyjne ---
+#define MOTOR1_PIN 18
+#define MOTOR2_PIN 19
+#define MOTOR1_CH 0          // kanały 0 i 1 dzielą jeden timer LEDC
+#define MOTOR2_CH 1
+#define HAPTIC_RES_BITS 8
+#define HAPTIC_BASE_FREQ 1000
+#define HAPTIC_TICK_MS 10
+
+// --- LEDy ---
+#define LED_PIN 21
+
+// --- Przycisk aktywujący ---
+#define BUTTON_PIN 13
+
+// --- DFPlayer ---
+#define DF_RX 16
+#define DF_TX 17
+#define DF_BUSY 32
+
+// --- Master (ESP-NOW) ---
+#define NODE_ID "lom"
+#define REGISTER_RETRY_MS 2000
+#define MASTER_TIMEOUT_MS 30000
+
+uint8_t master_mac[] = {0x78, 0x1C, 0x3C, 0xF5, 0x82, 0xD8};
+
+struct MasterFrame {
+  char text[250];
+};
+
+QueueHandle_t master_queue = NULL;    // ramki z callbacku ESP-NOW, obsługiwane w loop()
+bool master_connected = false;
+unsigned long last_master_frame = 0;
+unsigned long last_register_attempt = 0;
+
+HardwareSerial dfSerial(1);
+DFRobotDFPlayerMini dfplayer;
+bool df_ready = false;
+uint16_t df_errors = 0;               // od startu, do rekordu zdrowia
+
+bool sensor1_triggered = false;
+bool sensor2_triggered = false;
+bool effect_started = false;
+bool puzzle_active = false;
+bool button_was_pressed = false;
+unsigned long last_sound_time = 0;
+bool relay_on = false;
+
+// --- Efekt końcowy (bez blokowania pętli) ---
+#define FINAL_BUSY_GRACE_MS 500    // DFPlayer potrzebuje chwili, zanim ustawi BUSY
+#define FINAL_MAX_MS 60000
+#define FINAL_RELAY_DELAY_MS 1000
+
+enum FinalStage { FINAL_IDLE, FINAL_VIBRATING, FINAL_RELAY_WAIT, FINAL_DONE };
+FinalStage final_stage = FINAL_IDLE;
+unsigned long final_stage_time = 0;
+
+// --- Silnik haptyczny: tablice kroków odtwarzane z esp_timer ---
+enum HapticShape : uint8_t {
+  HS_HOLD,    // stała amplituda przez durMs
+  HS_RAMP,    // liniowo od amplitudy z końca poprzedniego kroku do docelowej
+  HS_CHAOS    // losowe impulsy 80-250 ms na jednym/obu silnikach, przerwa 60 ms
+};
+
+struct HapticStep {
+  HapticShape shape;
+  uint8_t amp1;      // wypełnienie MOTOR1 (0-255), przy HS_CHAOS maksimum
+  uint8_t amp2;
+  uint16_t freqHz;   // częstotliwość PWM, 0 = bez zmiany
+  uint16_t durMs;    // 0 = krok trwa do hapticStop()
+};
+
+struct HapticWave {
+  const HapticStep* steps;
+  uint8_t count;
+  bool loop;
+};
+
+const HapticStep HAPTIC_SHORT_STEPS[] = {
+  { HS_RAMP, 255, 255, HAPTIC_BASE_FREQ, 50 },
+  { HS_HOLD, 255, 255, 0, 300 },
+  { HS_RAMP, 0, 0, 0, 50 },
+};
+const HapticStep HAPTIC_FINAL_STEPS[] = {
+  { HS_RAMP, 180, 180, 150, 400 },   // niska częstotliwość – wyczuwalne "tętnienie"
+  { HS_CHAOS, 255, 255, HAPTIC_BASE_FREQ, 0 },
+};
+const HapticWave HAPTIC_SHORT = { HAPTIC_SHORT_STEPS, 3, false };
+const HapticWave HAPTIC_FINAL = { HAPTIC_FINAL_STEPS, 2, false };
+
+esp_timer_handle_t hapticTimer = NULL;
+portMUX_TYPE hapticMux = portMUX_INITIALIZER_UNLOCKED;
+const HapticWave* hapticWave = NULL;
+uint8_t hapticStep = 0;
+uint16_t hapticStepMs = 0;
+uint8_t hapticFrom1 = 0, hapticFrom2 = 0;
+uint8_t hapticAmp1 = 0, hapticAmp2 = 0;
+uint16_t hapticChaosLeft = 0;
+bool hapticChaosGap = false;
+uint32_t hapticRng = 1;
+
+// xorshift32 – powtarzalny przebieg dla danego ziarna
+uint32_t hapticRandom(uint32_t lo, uint32_t hi) {
+  hapticRng ^= hapticRng << 13;
+  hapticRng ^= hapticRng >> 17;
+  hapticRng ^= hapticRng << 5;
+  return lo + hapticRng % (hi - lo);
+}
+
+void hapticEnterStep(uint8_t index) {
+  hapticStep = index;
+  hapticStepMs = 0;
+  hapticFrom1 = hapticAmp1;
+  hapticFrom2 = hapticAmp2;
+  hapticChaosLeft = 0;
+  hapticChaosGap = true;
+}
+
+void hapticTick(void* arg) {
+  uint16_t freq = 0;
+  bool finished = false;
+
+  portENTER_CRITICAL(&hapticMux);
+  if (hapticWave == NULL) {
+    portEXIT_CRITICAL(&hapticMux);
+    return;
+  }
+
+  const HapticStep& st = hapticWave->steps[hapticStep];
+  if (hapticStepMs == 0) freq = st.freqHz;
+  hapticStepMs += HAPTIC_TICK_MS;
+
+  switch (st.shape) {
+    case HS_RAMP:
+      if (st.durMs > 0) {
+        uint32_t k = min<uint32_t>(hapticStepMs, st.durMs);
+        hapticAmp1 = hapticFrom1 + ((int)st.amp1 - hapticFrom1) * (int)k / (int)st.durMs;
+        hapticAmp2 = hapticFrom2 + ((int)st.amp2 - hapticFrom2) * (int)k / (int)st.durMs;
+        break;
+      }
+      // rampa bez czasu trwania = skok do amplitudy docelowej
+    case HS_HOLD:
+      hapticAmp1 = st.amp1;
+      hapticAmp2 = st.amp2;
+      break;
+    case HS_CHAOS:
+      if (hapticChaosLeft > HAPTIC_TICK_MS) {
+        hapticChaosLeft -= HAPTIC_TICK_MS;
+      } else if (!hapticChaosGap) {
+        hapticChaosGap = true;
+        hapticChaosLeft = 60;
+        hapticAmp1 = 0;
+        hapticAmp2 = 0;
+      } else {
+        // 0: silnik 1, 1: silnik 2, 2: oba, 3: żaden
+        uint32_t pattern = hapticRandom(0, 4);
+        hapticChaosGap = false;
+        hapticChaosLeft = hapticRandom(80, 250);
+        hapticAmp1 = (pattern == 0 || pattern == 2) ? st.amp1 : 0;
+        hapticAmp2 = (pattern == 1 || pattern == 2) ? st.amp2 : 0;
+      }
+      break;
+  }
+
+  if (st.durMs > 0 && hapticStepMs >= st.durMs) {
+    if (hapticStep + 1 < hapticWave->count) {
+      hapticEnterStep(hapticStep + 1);
+    } else if (hapticWave->loop) {
+      hapticEnterStep(0);
+    } else {
+      hapticWave = NULL;
+      hapticAmp1 = 0;
+      hapticAmp2 = 0;
+      finished = true;
+    }
+  }
+
+  uint8_t a1 = hapticAmp1;
+  uint8_t a2 = hapticAmp2;
+  portEXIT_CRITICAL(&hapticMux);
+
+  if (freq > 0) ledcChangeFrequency(MOTOR1_CH, freq, HAPTIC_RES_BITS);
+  ledcWrite(MOTOR1_CH, a1);
+  ledcWrite(MOTOR2_CH, a2);
+  if (finished) esp_timer_stop(hapticTimer);
+}
+
+void setupHaptics() {
+  ledcSetup(MOTOR1_CH, HAPTIC_BASE_FREQ, HAPTIC_RES_BITS);
+  ledcSetup(MOTOR2_CH, HAPTIC_BASE_FREQ, HAPTIC_RES_BITS);
+  ledcAttachPin(MOTOR1_PIN, MOTOR1_CH);
+  ledcAttachPin(MOTOR2_PIN, MOTOR2_CH);
+  ledcWrite(MOTOR1_CH, 0);
+  ledcWrite(MOTOR2_CH, 0);
+
+  esp_timer_create_args_t args = {};
+  args.callback = &hapticTick;
+  args.name = "haptic";
+  esp_timer_create(&args, &hapticTimer);
+}
+
+// Uruchom przebieg (przerywa bieżący); seed 0 = losowe ziarno. Zwraca użyte ziarno.
+uint32_t hapticPlay(const HapticWave& wave, uint32_t seed = 0) {
+  if (seed == 0) seed = esp_random() | 1;   // xorshift nie może startować od zera
+
+  esp_timer_stop(hapticTimer);
+  portENTER_CRITICAL(&hapticMux);
+  hapticWave = &wave;
+  hapticRng = seed;
+  hapticEnterStep(0);
+  portEXIT_CRITICAL(&hapticMux);
+
+  esp_timer_start_periodic(hapticTimer, HAPTIC_TICK_MS * 1000);
+  return seed;
+}
+
+void hapticStop() {
+  esp_timer_stop(hapticTimer);
+  portENTER_CRITICAL(&hapticMux);
+  hapticWave = NULL;
+  hapticAmp1 = 0;
+  hapticAmp2 = 0;
+  portEXIT_CRITICAL(&hapticMux);
+
+  ledcWrite(MOTOR1_CH, 0);
+  ledcWrite(MOTOR2_CH, 0);
+}
+
+void playSound(uint8_t track) {
+  while (digitalRead(DF_BUSY) == LOW) {
+    delay(50);
+  }
+  delay(150);
+  dfplayer.play(track);
+  Serial.print("Odtwarzam plik: ");
+  Serial.println(track);
+}
+
+// Odpowiedzi DFPlayera z UART – liczymy tylko błędy (brak karty, błąd ramki, timeout)
+void checkDfErrors() {
+  if (!df_ready) return;
+  while (dfplayer.available()) {
+    uint8_t type = dfplayer.readType();
+    if ((type == DFPlayerError || type == TimeOut || type == WrongStack) && df_errors < 0xFFFF) df_errors++;
+  }
+}
+
+// --- Komunikacja z Master ---
+void sendToMaster(const String& command, const String& data) {
+  String serialized = command + "|" + data + "|" + String(millis());
+  uint8_t message[250];
+  size_t len = serialized.length();
+  if (len > 249) len = 249;
+  serialized.getBytes(message, len + 1);
+
+  if (esp_now_send(master_mac, message, len) != ESP_OK) {
+    Serial.println("Błąd wysyłania do Master: " + command);
+  }
+}
+
+const char* lomStage() {
+  if (!puzzle_active) return "IDLE";
+  if (final_stage == FINAL_DONE) return "SOLVED";
+  if (final_stage != FINAL_IDLE) return "FINAL";
+  return "ACTIVE";
+}
+
+// Strumień zdarzeń do Master: {"ev":...,"id":...,"stage":...,"relay":...}
+void sendEvent(const char* ev, int id = 0) {
+  if (!master_connected) return;
+  char json[128];
+  snprintf(json, sizeof(json), "{\"ev\":\"%s\",\"id\":%d,\"stage\":\"%s\",\"relay\":%s}",
+           ev, id, lomStage(), relay_on ? "true" : "false");
+  sendToMaster("event", json);
+}
+
+void setRelay(bool on) {
+  relay_on = on;
+  digitalWrite(RELAY_PIN, on ? HIGH : LOW);
+  Serial.println(on ? "Przekaźnik włączony!" : "Przekaźnik wyłączony");
+  sendEvent("relay", on ? 1 : 0);
+}
+
+void activatePuzzle(const char* source) {
+  if (puzzle_active) return;
+  puzzle_active = true;
+  digitalWrite(LED_PIN, HIGH);
+  Serial.print("Zagadka aktywowana: ");
+  Serial.println(source);
+  sendEvent("activated");
+}
+
+void resetPuzzle() {
+  hapticStop();
+  dfplayer.stop();
+  sensor1_triggered = false;
+  sensor2_triggered = false;
+  effect_started = false;
+  puzzle_active = false;
+  button_was_pressed = false;
+  final_stage = FINAL_IDLE;
+  digitalWrite(LED_PIN, LOW);
+  relay_on = false;
+  digitalWrite(RELAY_PIN, LOW);
+  Serial.println("Reset zagadki – czekam na wciśnięcie przycisku.");
+  sendEvent("reset");
+}
+
+void onDataSent(const uint8_t* mac, esp_now_send_status_t status) {
+  healthNoteSend(status);
+}
+
+void onDataRecv(const uint8_t* mac, const uint8_t* incomingData, int len) {
+  if (channelSlaveHandleFrame(mac, incomingData, len)) return;
+  if (phySlaveHandleFrame(mac, incomingData, len)) return;
+  if (otaSlaveHandleFrame(mac, incomingData, len)) return;
+  const uint8_t* groupText;
+  int groupLen = groupSlaveHandleFrame(mac, incomingData, len, &groupText);
+  if (groupLen == 0) return;
+  if (groupLen > 0) {          // komenda grupowa – dalej jak zwykła ramka tekstowa
+    incomingData = groupText;
+    len = groupLen;
+  }
+  if (memcmp(mac, master_mac, 6) != 0) return;
+
+  MasterFrame frame;
+  if (len > (int)sizeof(frame.text) - 1) len = sizeof(frame.text) - 1;
+  memcpy(frame.text, incomingData, len);
+  frame.text[len] = '\0';
+  xQueueSend(master_queue, &frame, 0);
+}
+
+void handleMasterMessage(const String& command, const String& data) {
+  if (command == "heartbeat" || command == "registered") {
+    if (!master_connected) Serial.println("Połączono z Master");
+    master_connected = true;
+    sendToMaster("heartbeat", data);    // echo – Master liczy z tego RTT
+    healthSlaveSend(master_mac, df_errors, df_ready);
+  } else if (command == "start_puzzle") {
+    activatePuzzle("Master");
+  } else if (command == "reset_puzzle") {
+    resetPuzzle();
+  } else if (command == "relay") {
+    setRelay(data == "1");
+  } else if (command == "restart") {
+    ESP.restart();
+  } else if (channelSlaveCommand(command, data)) {
+    Serial.println("Kanał radiowy: " + command + " " + data);
+  } else if (phySlaveCommand(command, data)) {
+    Serial.println("Szybkość radia: " + data);
+  } else {
+    Serial.println("Nieznana komenda od Master: " + command);
+  }
+}
+
+void serviceMaster() {
+  MasterFrame frame;
+  while (xQueueReceive(master_queue, &frame, 0) == pdTRUE) {
+    String payload = frame.text;
+    int p1 = payload.indexOf('|');
+    int p2 = payload.indexOf('|', p1 + 1);
+    if (p1 <= 0 || p2 <= 0) continue;
+    last_master_frame = millis();
+    handleMasterMessage(payload.substring(0, p1), payload.substring(p1 + 1, p2));
+  }
+
+  if (master_connected && millis() - last_master_frame > MASTER_TIMEOUT_MS) {
+    master_connected = false;
+    Serial.println("Utracono połączenie z Master");
+  }
+
+  // Bez połączenia ponawiaj rejestrację
+  if (!master_connected && millis() - last_register_attempt > REGISTER_RETRY_MS) {
+    last_register_attempt = millis();
+    sendToMaster("register", NODE_ID);
+  }
+}
+
+void setupESPNow() {
+  WiFi.mode(WIFI_STA);
+  WiFi.disconnect();
+  channelSlaveBegin(master_mac);   // kanał z NVS, zanim ruszy ESP-NOW
+
+  master_queue = xQueueCreate(4, sizeof(MasterFrame));
+  if (esp_now_init() != ESP_OK) {
+    Serial.println("Błąd inicjalizacji ESP-NOW");
+    return;
+  }
+  esp_now_register_send_cb(onDataSent);
+  esp_now_register_recv_cb(onDataRecv);
+
+  esp_now_peer_info_t peer = {};
+  memcpy(peer.peer_addr, master_mac, 6);
+  peer.channel = 0;
+  peer.encrypt = false;
+  peer.ifidx = WIFI_IF_STA;
+  if (esp_now_add_peer(&peer) != ESP_OK) Serial.println("Błąd dodawania Master peer");
+  otaSlaveBegin(master_mac);
+  groupSlaveBegin(master_mac, NODE_ID);
+  phySlaveBegin(master_mac);
+}
+
+void checkFinalEffect() {
+  switch (final_stage) {
+    case FINAL_VIBRATING: {
+      // Chaos trwa, dopóki gra dźwięk 3
+      unsigned long elapsed = millis() - final_stage_time;
+      bool playing = digitalRead(DF_BUSY) == LOW;
+      if ((elapsed > FINAL_BUSY_GRACE_MS && !playing) || elapsed > FINAL_MAX_MS) {
+        hapticStop();
+        final_stage = FINAL_RELAY_WAIT;
+        final_stage_time = millis();
+      }
+      break;
+    }
+    case FINAL_RELAY_WAIT:
+      if (millis() - final_stage_time > FINAL_RELAY_DELAY_MS) {
+        final_stage = FINAL_DONE;
+        setRelay(true);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+
+  pinMode(SENSOR1_PIN, INPUT_PULLUP);
+  pinMode(SENSOR2_PIN, INPUT_PULLUP);
+  pinMode(BUTTON_PIN, INPUT_PULLUP);
+
+  pinMode(RELAY_PIN, OUTPUT);
+  digitalWrite(RELAY_PIN, LOW);
+
+  setupHaptics();
+
+  pinMode(LED_PIN, OUTPUT);
+  digitalWrite(LED_PIN, LOW); // LED wyłączony do aktywacji
+
+  pinMode(DF_BUSY, INPUT_PULLUP);
+  dfSerial.begin(9600, SERIAL_8N1, DF_RX, DF_TX);
+  df_ready = dfplayer.begin(dfSerial);
+  if (!df_ready) {
+    Serial.println("DFPlayer nie znaleziony!");
+  } else {
+    dfplayer.volume(25);
+  }
+
+  setupESPNow();
+
+  Serial.println("System gotowy – czekam na wciśnięcie przycisku.");
+}
+
+void loop() {
+  healthLoopTick();
+  serviceMaster();
+  channelSlaveService();
+  phySlaveService();
+  checkDfErrors();
+
+  // --- Aktywacja zagadki przez przycisk ---
+  if (!puzzle_active) {
+    bool button_state = digitalRead(BUTTON_PIN);
+
+    if (button_state == LOW) {
+      button_was_pressed = true;
+    }
+
+    if (button_was_pressed && button_state == HIGH) {
+      activatePuzzle("przycisk");
+      delay(300);
+    }
+
+    delay(20);
+    return;
+  }
+
+  // --- Obsługa blaszek ---
+  if (digitalRead(SENSOR1_PIN) == LOW && !sensor1_triggered) {
+    sensor1_triggered = true;
+    Serial.println("Zwarcie: blaszka 1");
+    sendEvent("sensor", 1);
+    playSound(1);
+    hapticPlay(HAPTIC_SHORT);
+    last_sound_time = millis();
+  }
+
+  if (digitalRead(SENSOR2_PIN) == LOW && !sensor2_triggered) {
+    sensor2_triggered = true;
+    Serial.println("Zwarcie: blaszka 2");
+    sendEvent("sensor", 2);
+    playSound(2);
+    hapticPlay(HAPTIC_SHORT);
+    last_sound_time = millis();
+  }
+
+  // --- Efekt końcowy ---
+  if (sensor1_triggered && sensor2_triggered && !effect_started && millis() - last_sound_time > 3500) {
+    effect_started = true;
+    Serial.println("Start efektu końcowego (chaos + przekaźnik + dźwięk 3)");
+    playSound(3);
+    uint32_t seed = hapticPlay(HAPTIC_FINAL);
+    Serial.print("Chaos – ziarno: ");
+    Serial.println(seed);
+    final_stage = FINAL_VIBRATING;
+    final_stage_time = millis();
+    sendEvent("final_start");
+  }
+
+  checkFinalEffect();
+
+  delay(50);
+}
@@ -1,20 +1,75 @@
 #include <WiFi.h>
 #include <WebServer.h>
+#include <WebSocketsServer.h>
+#include <LittleFS.h>
 #include <SPIFFS.h>
+#include <mbedtls/sha256.h>
 #include <esp_now.h>
+#include <esp_partition.h>
+#include <esp_wifi.h>
 #include <ArduinoJson.h>
+#include <Preferences.h>
 #include <Arduino.h>
+#include "starzik_led.h"
+#include "starzik_frame_magic.h"
+#include "starzik_relay_frame.h"
+#include "starzik_ota.h"
+#include "starzik_group.h"
+#include "starzik_channel.h"
+#include "starzik_phy.h"
+#include "starzik_health.h"
+#include "starzik_hash.h"
 
-// Konfiguracja WiFi Access Point
-const char* ap_ssid = "EscapeRoom_Master";
-const char* ap_password = "escape123";
+const int ROOM_MEMBERS_MAX = 7;         // pokoje członkowskie u agregatora (bez własnego)
+
+// Konfiguracja Mastera (NVS, wczytywana raz przy starcie do płaskiej struktury)
+struct MasterConfig {
+  char apSsid[33];
+  char apPassword[65];
+  uint8_t golabMac[6];
+  uint8_t walizkaMac[6];
+  unsigned long heartbeatTimeout;
+  unsigned long heartbeatInterval;
+  uint8_t zones[GROUP_MEMBER_COUNT];     // strefa pokoju węzła dla komend "zone:<n>"
+  char roomId[16];                       // nazwa pokoju w federacji Masterów
+  uint8_t roomRole;                      // RoomRole
+  uint8_t aggregatorMac[6];              // MAC (STA) Mastera zbierającego pokoje
+  uint8_t roomMembers[ROOM_MEMBERS_MAX][6];  // agregator: MAC-i (STA) Masterów, które przyjmuje jako pokoje
+  uint8_t roomMemberCount;
+  uint8_t haRole;                        // HaRole – rola preferowana w parze Masterów (po restarcie)
+  uint8_t haPeerMac[6];                  // fabryczny MAC (STA) drugiej płytki z pary
+  uint8_t haKey[16];                     // LMK łącza pary (SHA-256 hasła ha_key) – ramki HA szyfrowane
+  bool haKeySet;
+  uint8_t channel;                       // kanał AP i ESP-NOW – zmieniany razem ze slave'ami (/channel_switch)
+  bool channelAuto;                      // przegląd pasma po starcie i przejście na wyraźnie lepszy kanał
+  uint8_t phyModes[GROUP_MEMBER_COUNT];  // szybkość ESP-NOW węzła: PHY_MODE_AUTO albo indeks w PHY_RATES
+} masterConfig;
+
+enum RoomRole : uint8_t { ROOM_STANDALONE = 0, ROOM_MEMBER = 1, ROOM_AGGREGATOR = 2 };
+const char* const ROOM_ROLE_NAMES[] = { "standalone", "member", "aggregator" };
+
+enum HaRole : uint8_t { HA_OFF = 0, HA_PRIMARY = 1, HA_STANDBY = 2 };
+const char* const HA_ROLE_NAMES[] = { "off", "primary", "standby" };
+
+// Wartości domyślne, gdy NVS jest pusty
+const char* DEFAULT_AP_SSID = "EscapeRoom_Master";
+const char* DEFAULT_AP_PASSWORD = "escape123";
+const uint8_t DEFAULT_GOLAB_MAC[] = {0x14, 0x33, 0x5C, 0x0E, 0xCC, 0x24};
+const uint8_t DEFAULT_WALIZKA_MAC[] = {0x14, 0x33, 0x5C, 0x0E, 0x16, 0x30};
+const unsigned long DEFAULT_HEARTBEAT_TIMEOUT = 30000;
+const unsigned long DEFAULT_HEARTBEAT_INTERVAL = 10000;
+const uint8_t DEFAULT_ZONE = 1;
+const char* DEFAULT_ROOM_ID = "pokoj1";
+const uint8_t PHY_MODE_AUTO = 0xFF;
+
+Preferences configPrefs;
+unsigned long bootTimeMs = 0;
+unsigned long configLoadUs = 0;
+bool apRestartPending = false;
 
 // Serwer WWW
 WebServer server(80);
-
-// MAC adresy ESP32 Slaves
-uint8_t golab_mac[] = {0x14, 0x33, 0x5C, 0x0E, 0xCC, 0x24};
-uint8_t walizka_mac[] = {0x14, 0x33, 0x5C, 0x0E, 0x16, 0x30};
+WebSocketsServer webSocket(81);
 
 // Struktura komunikacji z Gołąb
 typedef struct {
@@ -28,9 +83,12 @@ bool golabConnected = false;
 bool walizkaConnected = false;
 unsigned long lastGolabHeartbeat = 0;
 unsigned long lastWalizkaHeartbeat = 0;
-const unsigned long HEARTBEAT_TIMEOUT = 30000;
 bool hintRequested = false;
 unsigned long hintRequestTime = 0;
+uint32_t hintRequestCount = 0;
+String golabAudioStats = "{}";   // ostatnie statystyki DFPlayera z Gołąb (JSON)
+unsigned long hintThresholdToSendUs = 0;  // Gołąb: próg 3 s -> esp_now_send
+unsigned long hintSendToAckUs = 0;        // Gołąb: esp_now_send -> ACK od Mastera
 
 // Status Walizka LOTTO
 struct WalizkaState {
@@ -47,7 +105,8 @@ struct WalizkaState {
   unsigned long lastUpdate;
 } walizkaState;
 
-// Status gry
+// Sesja gry – Master jest jedynym źródłem prawdy, tablety tylko ją wyświetlają.
+// Stan: idle -> active <-> paused -> finished (do następnego startu)
 struct GameSession {
   String sessionId;
   String groupName;
@@ -56,70 +115,987 @@ struct GameSession {
   bool isActive;
   bool isPaused;
   unsigned long startTime;
+  unsigned long pausedAt;          // millis() początku bieżącej pauzy
+  unsigned long pausedTotalMs;     // suma zakończonych pauz
+  unsigned long endedAt;           // millis() zakończenia gry
+  unsigned long gameTimeMs;        // limit czasu z panelu (0 = bez limitu)
+  int hintsUsed;
+  String state;                    // idle, active, paused, finished
+  String endStatus;                // completed / failed po zakończeniu
 } currentGame;
 
+// Konfiguracja zagadek wysyłana do slave'ów (trzymana w NVS)
+struct PuzzleConfig {
+  uint32_t version;
+  String lottoCode;
+  String compartment;
+  int triggerTrack;
+  String startTag1;
+  String startTag2;
+  int walizkaVolume;
+  int golabVolume;
+} puzzleConfig;
+
+// Ramka "puzzle_config|<blob>|<millis, do 10 cyfr>" jest ucinana na 249 B (sendToWalizka / sendToGolab)
+const size_t PUZZLE_CONFIG_BLOB_MAX = 249 - (sizeof("puzzle_config|") - 1) - 11;
+
+Preferences puzzlePrefs;
+String puzzleConfigBlob = "";          // JSON wysyłany do slave'ów
+uint32_t puzzleConfigHash = 0;         // FNV-1a z puzzleConfigBlob
+uint32_t golabConfigHash = 0;          // hash potwierdzony przez Gołąb
+uint32_t walizkaConfigHash = 0;        // hash potwierdzony przez Walizka
+unsigned long lastGolabConfigPush = 0;
+unsigned long lastWalizkaConfigPush = 0;
+const unsigned long CONFIG_PUSH_RETRY = 5000;
+
+// Katalog audio: manifest nazwa -> numer pliku (NVS) i cache zawartości karty SD Gołąb
+const char* DEFAULT_AUDIO_MANIFEST = "{\"golab\":1,\"hint1\":2,\"hint2\":2}";
+const int AUDIO_MAX_FOLDERS = 10;
+String audioManifest = "";
+uint32_t audioManifestHash = 0;
+unsigned long lastGolabManifestPush = 0;
+
+struct AudioCatalog {
+  bool valid;
+  int sdFiles;
+  int folderCount;
+  int folderFiles[AUDIO_MAX_FOLDERS];
+  uint32_t manifestHash;   // hash manifestu potwierdzony przez węzeł
+  int entries;
+  unsigned long updated;
+} golabCatalog;
+
+// Węzły dołączające przez rejestrację (Łom, Podłoga) – MAC poznajemy z ramki "register"
+const int NODE_EVENT_HISTORY = 10;
+
+struct NodeLink {
+  const char* id;
+  const char* label;
+  uint8_t mac[6];
+  bool registered;
+  bool connected;
+  unsigned long lastSeen;
+  long clockOffset;                // millis Mastera - millis węzła (z heartbeatu)
+  bool clockValid;
+  unsigned long rttMs;
+  unsigned long eventLatencyMs;    // ostatnie zdarzenie: nadanie w węźle -> odbiór w Master
+  unsigned long eventLatencyMaxMs;
+  unsigned long eventLatencySumMs;
+  uint32_t eventCount;
+  String stage;
+  bool relayState;
+  String events[NODE_EVENT_HISTORY];
+  int eventsCount;
+  String bench;                    // ostatnie bench_stats z węzła (JSON)
+  String state;                    // ostatni stan węzła I/O (odpowiedź na get/subscribe)
+};
+
+NodeLink nodeLinks[] = {
+  { "lom", "Łom" },
+  { "podloga", "Podłoga" },
+  { "io1", "Węzeł I/O 1" },      // starzik_io_node.cpp – profil wybierany w platformio.ini
+  { "io2", "Węzeł I/O 2" },
+  { "io3", "Węzeł I/O 3" },
+};
+const int NODE_LINK_COUNT = sizeof(nodeLinks) / sizeof(nodeLinks[0]);
+
+// Binarne ramki przekaźników Podłogi – ostatni ACK zapisywany w callbacku ESP-NOW
+uint8_t relaySeq = 0;
+volatile bool relayAckReady = false;
+volatile uint8_t relayAckSeq = 0;
+volatile uint8_t relayAckStatus = 0;
+volatile uint8_t relayAckOutputs = 0;
+volatile uint32_t relayAckNs = 0;
+volatile unsigned long relayAckUs = 0;
+
+// Pomiar przekaźnika (/relay_bench) w zadaniu relayBenchTask – HTTP i loop() nie czekają na ACK-i.
+// Pola wyników pisze tylko zadanie; GET /relay_bench czyta je w trakcie jako postęp.
+struct RelayBench {
+  volatile bool active;
+  uint8_t channel;
+  int count;
+  uint32_t ms;
+  unsigned long startedAt;
+  uint32_t durationMs;           // 0 = brak zakończonego pomiaru
+  volatile int sent;
+  int acked;
+  int rejected;
+  unsigned long rttMin, rttMax, rttSum;
+  uint32_t devMin, devMax;
+  uint64_t devSum;
+} relayBench;
+
+// OTA slave'ów: obraz trzymany w nieaktywnej partycji OTA Mastera (meta w NVS "ota_img"),
+// wysyłany do wybranego węzła z osobnego zadania
+const unsigned long OTA_ACK_TIMEOUT_MS = 300;     // brak postępu -> cofnięcie okna
+const int OTA_MAX_TIMEOUTS = 40;                  // kolejne cofnięcia bez postępu -> błąd
+const unsigned long OTA_VERIFY_TIMEOUT_MS = 20000;
+
+struct OtaTransfer {
+  const esp_partition_t* image;
+  uint32_t imageSize;
+  uint32_t imageCrc;
+  bool imageReady;
+  bool uploadFailed;
+  uint32_t uploadErased;
+  unsigned long uploadStartMs;
+  unsigned long uploadMs;
+  String node;
+  uint8_t mac[6];
+  volatile bool running;
+  const char* volatile state;    // idle, begin, sending, verifying, done, error, aborted
+  char error[128];               // bufory stałe – czytane przez serwer WWW w trakcie pracy zadania
+  uint32_t resumedFrom;
+  uint32_t retransmits;
+  unsigned long startMs;
+  unsigned long endMs;
+} ota;
+
+// Upload plików panelu na LittleFS: strumieniowo do pliku tymczasowego, potem zamiana nazwy
+const size_t FS_UPLOAD_RESERVE = 16384;          // wolne miejsce zostawiane dla pozostałych plików
+const size_t FS_MAX_PATH = 59;                   // limit nazwy LittleFS (64) minus ".tmp"
+
+struct FsUpload {
+  File file;
+  String path;
+  String tmpPath;
+  String expectedHash;
+  String hash;
+  mbedtls_sha256_context sha;
+  size_t size;
+  bool failed;
+  char error[96];
+  unsigned long startMs;
+  unsigned long ms;
+} fsUpload;
+
+// Zasoby panelu: wersja .gz z web_build.py ma pierwszeństwo, ETag = początek SHA-256 treści.
+// Małe pliki trzymane w RAM, więc odpowiedź nie otwiera pliku na LittleFS.
+const size_t ASSET_CACHE_MAX = 32768;
+
+struct StaticAsset {
+  const char* path;
+  const char* contentType;
+  const char* cacheControl;
+  bool loaded;
+  bool exists;
+  bool gzip;
+  size_t size;
+  String etag;
+  uint8_t* data;           // NULL = plik za duży do cache, strumieniowany z LittleFS
+};
+
+StaticAsset staticAssets[] = {
+  // no-cache = przeglądarka zawsze pyta, ale z If-None-Match dostaje 304 bez treści
+  { "/index.html", "text/html", "no-cache", false, false, false, 0, "", NULL },
+  { "/beep.mp3", "audio/mpeg", "public, max-age=86400", false, false, false, 0, "", NULL },
+};
+const int STATIC_ASSET_COUNT = sizeof(staticAssets) / sizeof(staticAssets[0]);
+
+// Odpowiedzi HTTP: JSON/CSV strumieniowany do gniazda kawałkami (Transfer-Encoding: chunked)
+// przez stały bufor, a dokument odpowiedzi jest jeden, przydzielony raz przy starcie.
+// Handlery WebServer wykonują się po kolei w loop(), więc współdzielenie jest bezpieczne.
+const size_t RESPONSE_CHUNK_SIZE = 512;
+const size_t RESPONSE_DOC_SIZE = 8192;       // największa: /nodes?node=<id> z historią (~7,5 kB)
+const size_t REQUEST_DOC_SIZE = 1024;        // ciała POST/PUT; największe: manifest audio (16 wpisów)
+
+class ChunkedResponse : public Print {
+ public:
+  void begin(int code, const char* contentType) {
+    used = 0;
+    total = 0;
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(code, contentType, "");
+  }
+
+  size_t write(uint8_t c) override {
+    buf[used++] = c;
+    total++;
+    if (used == sizeof(buf)) flushChunk();
+    return 1;
+  }
+
+  size_t write(const uint8_t* data, size_t len) override {
+    size_t left = len;
+    while (left > 0) {
+      size_t n = min(left, sizeof(buf) - used);
+      memcpy(buf + used, data, n);
+      used += n;
+      data += n;
+      left -= n;
+      if (used == sizeof(buf)) flushChunk();
+    }
+    total += len;
+    return len;
+  }
+
+  // Pusty kawałek kończy odpowiedź chunked
+  size_t end() {
+    flushChunk();
+    server.sendContent("");
+    return total;
+  }
+
+ private:
+  void flushChunk() {
+    if (used == 0) return;
+    server.sendContent((const char*)buf, used);
+    used = 0;
+  }
+
+  uint8_t buf[RESPONSE_CHUNK_SIZE];
+  size_t used = 0;
+  size_t total = 0;
+};
+
+ChunkedResponse chunkedResponse;
+DynamicJsonDocument responseDoc(RESPONSE_DOC_SIZE);
+StaticJsonDocument<REQUEST_DOC_SIZE> requestDoc;
+
+// Zużycie sterty na żądanie: wolna sterta przed handleClient() minus wolna sterta w chwili,
+// gdy odpowiedź jest zbudowana (szczyt – samo wysyłanie już nic nie przydziela)
+struct ResponseStats {
+  uint32_t count;
+  uint32_t lastBytes;
+  uint32_t maxBytes;
+  uint32_t lastHeapUsed;
+  uint32_t maxHeapUsed;
+  uint32_t lastStringPathHeap;   // ile ta sama odpowiedź zajęłaby dawną ścieżką (dokument + String)
+  uint32_t maxStringPathHeap;
+} responseStats;
+const uint32_t HEAP_BLOCK_OVERHEAD = 8;          // nagłówek bloku multi_heap (IDF 4.4)
+uint32_t heapBeforeRequest = 0;
+
+// Snapshot panelu: sekcje przebudowywane najwyżej co SNAPSHOT_REFRESH_MS (kilka tabletów dzieli
+// jedną serializację); nowa wersja sekcji tylko, gdy zmienił się hash jej treści.
+const unsigned long SNAPSHOT_REFRESH_MS = 250;
+const size_t MAX_BATCH_COMMANDS = 16;
+
+enum SnapshotSection { SNAP_STATUS, SNAP_HINT, SNAP_PUZZLES, SNAP_PEERS, SNAP_GAME, SNAP_SECTION_COUNT };
+
+struct SnapshotPart {
+  const char* name;
+  String json;
+  uint32_t hash;
+  uint32_t version;
+};
+
+SnapshotPart snapshotParts[SNAP_SECTION_COUNT] = {
+  { "status", "", 0, 0 },
+  { "hint", "", 0, 0 },
+  { "puzzles", "", 0, 0 },
+  { "peers", "", 0, 0 },
+  { "game", "", 0, 0 },
+};
+uint32_t snapshotVersion = 0;
+uint32_t snapshotEpoch = 0;          // losowe przy starcie – klient wykrywa restart Mastera
+unsigned long snapshotBuiltAt = 0;
+bool snapshotDirty = false;          // zmiana sesji gry – przebuduj przy najbliższym odczycie
+
+// Dziennik sesji gry: partycja "journal" (partitions_master.csv) podzielona na sloty po 128 B.
+// Rekordy są tylko dopisywane, każdy z numerem sekwencyjnym i CRC32 – rekord urwany zanikiem
+// zasilania ma zły CRC i jest pomijany. Czas zdarzenia to czas gry, bo millis() po restarcie
+// liczy od zera. Przy starcie odtwarzane są rekordy od ostatniego START.
+const uint8_t JOURNAL_PARTITION_SUBTYPE = 0x40;
+const uint16_t JOURNAL_MAGIC = 0x4A53;
+const uint8_t JOURNAL_VERSION = 1;
+const size_t JOURNAL_SLOT_SIZE = 128;
+const size_t JOURNAL_SECTOR_SIZE = 4096;
+const int JOURNAL_SLOTS_PER_SECTOR = JOURNAL_SECTOR_SIZE / JOURNAL_SLOT_SIZE;
+const int JOURNAL_MAX_SECTORS = 32;                // maska czystych sektorów ma 32 bity
+const unsigned long JOURNAL_TICK_MS = 10000;       // tyle czasu gry najwyżej ginie przy zaniku zasilania
+
+enum JournalType : uint8_t {
+  JRN_START = 1,     // także przepisanie sesji (checkpoint) – od ostatniego START zaczyna się odtwarzanie
+  JRN_PAUSE = 2,
+  JRN_RESUME = 3,
+  JRN_HINT = 4,      // licznik bezwzględny, nie przyrost
+  JRN_STAGE = 5,     // etap zagadki (Walizka lub węzeł)
+  JRN_TICK = 6,      // sam czas gry
+  JRN_END = 7
+};
+
+struct __attribute__((packed)) JournalStart {
+  uint32_t gameTimeMs;
+  uint8_t players;
+  uint8_t test;
+  char sessionId[40];
+  char group[62];
+};
+
+struct __attribute__((packed)) JournalStage {
+  char node[12];
+  char stage[48];
+};
+
+struct __attribute__((packed)) JournalRecord {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t type;
+  uint32_t seq;
+  uint32_t elapsedMs;            // czas gry w chwili zdarzenia
+  union {
+    JournalStart start;
+    JournalStage stage;
+    uint16_t hints;
+    char endStatus[16];
+    uint8_t raw[JOURNAL_SLOT_SIZE - 16];
+  };
+  uint32_t crc;                  // CRC32 wszystkich poprzednich bajtów
+};
+static_assert(sizeof(JournalRecord) == JOURNAL_SLOT_SIZE, "Rekord dziennika musi wypełniać slot");
+
+enum JournalSlot { JSLOT_ERASED, JSLOT_VALID, JSLOT_BROKEN };
+
+struct JournalState {
+  const esp_partition_t* part;
+  int sectors;
+  int slots;
+  int head;                      // następny slot do zapisu
+  int baseSlot;                  // START bieżącej sesji (-1 = brak)
+  uint32_t nextSeq;
+  uint32_t cleanSectors;         // bit = sektor skasowany i pusty
+  uint32_t eraseMask;            // sektory do skasowania po kompakcji
+  bool checkpointPending;        // pierścień doszedł do sektora ze START – przepisz sesję
+  bool checkpointing;
+  bool compactPending;
+  unsigned long lastWriteMs;
+  String stages[1 + NODE_LINK_COUNT];   // ostatnio zapisane etapy: Walizka, potem węzły
+  // Koszt zapisu – raportowany w /status
+  uint32_t records;
+  uint32_t lastWriteUs;
+  uint32_t maxWriteUs;
+  uint64_t totalWriteUs;
+  uint32_t erases;
+  uint32_t lastEraseUs;
+  uint32_t maxEraseUs;
+  uint32_t checkpoints;
+  uint32_t compactions;
+  uint32_t errors;
+  uint32_t mountUs;
+  uint32_t replayed;
+  bool restored;
+} journal;
+
+// Kanał WebSocket panelu: {"id":N,"op":...,pola jak w HTTP} -> od razu wynik komendy z "id",
+// a gdy komenda wysłała ramkę ESP-NOW – osobno {"id":N,"dlv":1,"ms":...} po potwierdzeniu MAC.
+const unsigned long DELIVERY_TIMEOUT_MS = 500;
+const int DELIVERY_SLOTS = 8;
+
+struct DeliveryWatch {
+  bool used;
+  uint8_t client;
+  uint32_t id;
+  uint8_t mac[6];
+  unsigned long startUs;       // odebranie komendy z WebSocket
+  unsigned long sentMs;
+};
+
+struct DeliveryReport {
+  uint8_t client;
+  uint32_t id;
+  bool delivered;
+  unsigned long us;
+};
+
+DeliveryWatch deliveryWatches[DELIVERY_SLOTS];
+portMUX_TYPE deliveryMux = portMUX_INITIALIZER_UNLOCKED;
+QueueHandle_t deliveryQueue = NULL;    // OnDataSent (zadanie WiFi) -> loop(), który pisze do WebSocket
+bool deliveryArmed = false;            // następny esp_now_send należy do bieżącej komendy WebSocket
+uint8_t deliveryArmClient = 0;
+uint32_t deliveryArmId = 0;
+unsigned long deliveryArmUs = 0;
+
+// Komendy grupowe (starzik_group.h). Adresaci: "all", "role:<rola>", "zone:<n>" albo "node:<id>".
+// Jedna ramka rozgłoszeniowa; brakujące ACK po GROUP_RETRY_MS – unicast tylko do brakujących.
+const unsigned long GROUP_RETRY_MS = 40;
+const int GROUP_MAX_RETRIES = 5;
+const int GROUP_FANOUT_SLOTS = 8;        // komendy w locie i historia do /groups
+const uint8_t BROADCAST_MAC[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+struct GroupRole {
+  const char* name;
+  uint32_t mask;
+};
+
+const GroupRole GROUP_ROLES[] = {
+  { "audio", 1UL << GROUP_MEMBER_GOLAB },
+  { "game", (1UL << GROUP_MEMBER_GOLAB) | (1UL << GROUP_MEMBER_WALIZKA) },     // śledzą przebieg gry
+  { "puzzle", (1UL << GROUP_MEMBER_WALIZKA) | (1UL << GROUP_MEMBER_LOM) | (1UL << GROUP_MEMBER_PODLOGA) },
+  { "io", (1UL << GROUP_MEMBER_IO1) | (1UL << GROUP_MEMBER_IO2) | (1UL << GROUP_MEMBER_IO3) },
+};
+const int GROUP_ROLE_COUNT = sizeof(GROUP_ROLES) / sizeof(GROUP_ROLES[0]);
+
+struct GroupFanout {
+  bool active;                 // czeka na ACK
+  uint16_t seq;
+  String target;
+  String command;
+  uint32_t members;            // cała grupa – maska w ramce
+  uint32_t expected;           // osiągalni członkowie, od których czekamy na ACK
+  volatile uint32_t acked;     // ustawiane w OnDataRecv
+  volatile uint32_t doneUs;    // wysłanie -> ostatni ACK (albo rezygnacja); 0 = w toku
+  bool complete;
+  bool broadcast;
+  uint8_t frame[250];
+  uint8_t frameLen;
+  unsigned long startUs;
+  unsigned long lastSendMs;
+  uint8_t retries;
+  uint16_t unicasts;
+  bool wsTracked;              // komenda z WebSocket – wynik jako {"id","dlv"}
+  uint8_t wsClient;
+  uint32_t wsId;
+};
+
+GroupFanout groupFanouts[GROUP_FANOUT_SLOTS];
+int groupFanoutNext = 0;
+uint16_t groupSeq = 0;                   // losowy start – węzeł nie weźmie nowej komendy za powtórkę
+uint32_t gameAnnouncePending = 0;        // role:game, którym trzeba jeszcze ogłosić bieżący stan gry
+portMUX_TYPE groupMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Federacja pokoi: Mastery sąsiednich pokoi rozmawiają przez ESP-NOW (ten sam kanał co ich AP).
+// Członek wysyła agregatorowi zwięzły status co sekundę i zdarzenia na bieżąco; agregator trzyma
+// ograniczony bufor na pokój, pokazuje wszystkie pokoje w /rooms i przekazuje komendy panelu
+// do wybranego pokoju z twardym budżetem czasu na odpowiedź.
+const size_t ROOM_PAYLOAD_MAX = 240;                // JSON w ramce, reszta do 250 B to nagłówek
+const int ROOM_MAX = ROOM_MEMBERS_MAX + 1;          // razem z własnym pokojem (indeks 0)
+const int ROOM_EVENT_BUFFER = 12;                   // zdarzeń na pokój – starsze są nadpisywane
+const size_t ROOM_EVENT_TEXT = 64;
+const unsigned long ROOM_STATUS_INTERVAL_MS = 1000;
+const unsigned long ROOM_TIMEOUT_MS = 5000;
+const unsigned long ROOM_EXPIRE_MS = 300000;         // po tylu ms ciszy pokój znika z /rooms i zwalnia slot
+const unsigned long ROOM_COMMAND_BUDGET_MS = 300;   // komenda do innego pokoju: wysłanie -> wynik
+
+enum RoomFrameType : uint8_t { ROOM_STATUS = 1, ROOM_EVENT = 2, ROOM_COMMAND = 3, ROOM_RESULT = 4 };
+
+struct RoomEvent {
+  unsigned long at;
+  char text[ROOM_EVENT_TEXT];
+};
+
+struct RoomEventRing {
+  RoomEvent items[ROOM_EVENT_BUFFER];
+  int head;                    // następny do zapisu
+  int count;
+  uint32_t dropped;            // nadpisane przed odczytem / wysłaniem
+};
+
+struct RoomLink {
+  bool used;
+  char id[16];
+  uint8_t mac[6];
+  bool peerAdded;
+  unsigned long lastSeen;
+  bool statusNew;                      // status jeszcze nie przeczytany w serviceRooms() (id pokoju)
+  char status[ROOM_PAYLOAD_MAX + 1];   // ostatni status pokoju (JSON)
+  RoomEventRing events;
+  uint32_t commands;
+  uint32_t commandTimeouts;
+  uint32_t commandLastUs;
+  uint32_t commandMaxUs;
+  uint64_t commandTotalUs;
+};
+
+struct RoomCommandItem {
+  uint8_t len;
+  char text[ROOM_PAYLOAD_MAX + 1];
+};
+
+RoomLink rooms[ROOM_MAX];
+RoomEventRing roomOutbox;              // członek: zdarzenia czekające na wysłanie do agregatora
+portMUX_TYPE roomMux = portMUX_INITIALIZER_UNLOCKED;
+QueueHandle_t roomCommandQueue = NULL; // członek: komendy od agregatora -> loop()
+unsigned long lastRoomStatusMs = 0;
+uint32_t lastRoomGameVersion = 0;
+bool lastRoomHintRequested = false;
+uint32_t roomCommandSeq = 0;
+volatile uint32_t roomReplyId = 0;     // agregator: odpowiedź na bieżącą komendę (z OnDataRecv)
+volatile bool roomReplyReady = false;
+char roomReply[ROOM_PAYLOAD_MAX + 1];
+volatile uint32_t roomFramesRejected = 0;  // agregator: ramki od MAC-ów spoza room_members
+
+// Gorąca rezerwa: para Masterów z tym samym firmware. Aktywny występuje pod adresem MAC pokoju
+// (tym, który slave'y mają wpisany), rezerwowy pod adresem drugiej płytki. Aktywny co
+// HA_HEARTBEAT_MS wysyła rezerwowemu heartbeat z numerem ostatniego rekordu dziennika
+// i rejestracjami węzłów, a każdy zapisany rekord dziennika od razu za nim – rezerwowy stosuje
+// go w RAM i dopisuje do własnego dziennika. Po HA_FAILOVER_MS ciszy rezerwowy restartuje się
+// jako aktywny pod adresem pokoju i odtwarza grę z dziennika jak po zaniku zasilania.
+// Heartbeat wysyła osobne zadanie, nie loop() – dłuższy handler HTTP nie może wywołać przejęcia
+// przy żywym aktywnym. loop() tylko odświeża treść; gdy nie zrobi tego przez HA_LOOP_STALL_MS
+// (zawieszony), zadanie milknie i rezerwowy przejmuje pokój.
+const unsigned long HA_HEARTBEAT_MS = 200;
+const unsigned long HA_FAILOVER_MS = 1500;
+const unsigned long HA_LOOP_STALL_MS = 15000;
+const unsigned long HA_CONFIG_MS = 5000;
+const unsigned long HA_SYNC_RETRY_MS = 1000;
+const unsigned long HA_DRILL_SILENCE_MS = 10000;   // próba przejęcia: aktywny milknie na tyle
+const uint32_t HA_HANDOVER_MAGIC = 0x48414F56;
+const int HA_RECORD_QUEUE = 16;
+
+enum HaFrameType : uint8_t { HA_HEARTBEAT = 1, HA_RECORD = 2, HA_CONFIG = 3, HA_SYNC_REQUEST = 4, HA_CHANNEL = 5 };
+enum HaGameState : uint8_t { HA_GAME_IDLE = 0, HA_GAME_ACTIVE = 1, HA_GAME_PAUSED = 2, HA_GAME_FINISHED = 3 };
+
+struct __attribute__((packed)) HaHeartbeat {
+  uint8_t magic;
+  uint8_t type;
+  uint32_t seq;                  // ostatni rekord dziennika aktywnego
+  uint8_t state;                 // HaGameState
+  uint8_t nodeMask;              // zarejestrowane węzły (bit = indeks w nodeLinks)
+  uint8_t nodeMacs[NODE_LINK_COUNT][6];
+};
+
+struct __attribute__((packed)) HaRecordFrame {
+  uint8_t magic;
+  uint8_t type;
+  JournalRecord rec;
+};
+
+struct __attribute__((packed)) HaConfigFrame {
+  uint8_t magic;
+  uint8_t type;
+  char apSsid[33];
+  char apPassword[65];
+  uint8_t golabMac[6];
+  uint8_t walizkaMac[6];
+  uint32_t heartbeatTimeout;
+  uint32_t heartbeatInterval;
+  uint8_t channel;
+};
+
+struct __attribute__((packed)) HaControlFrame {
+  uint8_t magic;
+  uint8_t type;
+};
+
+// Zapowiedź zmiany kanału – rezerwowy przechodzi razem ze slave'ami, inaczej zgubiłby heartbeat
+struct __attribute__((packed)) HaChannelFrame {
+  uint8_t magic;
+  uint8_t type;
+  uint8_t channel;
+  uint16_t delayMs;
+};
+
+// Przekazanie pokoju przez restart – RTC_NOINIT przeżywa ESP.restart(), ale nie zanik zasilania
+struct HaHandover {
+  uint32_t magic;
+  uint32_t detectMs;             // cisza aktywnego w chwili decyzji
+  uint8_t nodeMask;
+  uint8_t nodeMacs[NODE_LINK_COUNT][6];
+};
+RTC_NOINIT_ATTR HaHandover haHandover;
+
+struct HaState {
+  uint8_t role;                  // rola w tej chwili (HaRole)
+  uint8_t roomMac[6];            // MAC aktywnego – ten znają slave'y
+  uint8_t standbyMac[6];
+  volatile unsigned long lastHeartbeatMs;
+  volatile bool heardPrimary;
+  volatile bool heartbeatPending;
+  HaHeartbeat heartbeat;         // rezerwowy: ostatni odebrany; aktywny: treść dla zadania heartbeatu
+  volatile unsigned long loopAliveMs;   // aktywny: ostatnie odświeżenie treści przez loop()
+  volatile bool configPending;
+  HaConfigFrame config;
+  volatile bool syncRequested;   // aktywny: rezerwowy zgubił rekordy
+  volatile uint8_t channelTo;    // rezerwowy: kanał zapowiedziany przez aktywnego, 0 = brak
+  volatile unsigned long channelAt;
+  QueueHandle_t records;         // rezerwowy: rekordy od aktywnego -> loop()
+  uint32_t lastSeq;              // rezerwowy: ostatni zastosowany rekord (numeracja aktywnego)
+  bool synced;
+  int mismatches;
+  unsigned long lastSyncRequestMs;
+  unsigned long lastHeartbeatSentMs;
+  unsigned long lastConfigSentMs;
+  bool drill;
+  uint32_t heartbeats;
+  uint32_t recordsSent;
+  uint32_t recordsApplied;
+  uint32_t gaps;
+  uint32_t syncs;
+  // Ostatnie przejęcie – raportowane przez nowego aktywnego
+  bool tookOver;
+  uint32_t detectMs;
+  uint32_t readyMs;              // millis() po setup() = czas od restartu do gotowości
+  uint32_t rehomeMs;             // millis() przy pierwszej ramce od slave'a
+} ha;
+portMUX_TYPE haMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Kanał radiowy: przegląd pasma (sieci WiFi widoczne na każdym kanale, a z ruchu ESP-NOW
+// straty i RTT tam, gdzie system już pracował) i dwufazowa zmiana kanału razem ze slave'ami
+// (starzik_channel.h). Skan w tle, po jednym kanale z przerwą na kanale pokoju – radio znika
+// najwyżej na CHANNEL_SCAN_MS, więc heartbeaty (także HA) i komendy przechodzą w trakcie.
+const unsigned long CHANNEL_BOOT_SURVEY_MS = 20000;    // po starcie – slave'y zdążą się zgłosić
+const uint32_t CHANNEL_SCAN_MS = 120;                  // na kanał
+const unsigned long CHANNEL_SCAN_GAP_MS = 250;         // na kanale pokoju między skanami
+const unsigned long HEARTBEAT_INTERVAL_MAX = CHANNEL_HUNT_AFTER_MS / 2;   // jeden zgubiony heartbeat nie rusza szukania
+const unsigned long CHANNEL_SWITCH_DELAY_MS = 500;     // commit -> zmiana u slave'ów
+const float CHANNEL_SWITCH_MARGIN_DB = 6.0f;           // automatycznie tylko na wyraźnie lepszy kanał
+const float CHANNEL_LOSS_PENALTY_DB = 0.5f;            // za każdy procent strat ESP-NOW
+const uint32_t CHANNEL_MIN_SAMPLES = 50;               // mniej wysłanych ramek – straty nieznane
+const float CHANNEL_NOISE_FLOOR_DBM = -100.0f;
+const float CHANNEL_OVERLAP[] = { 1.0f, 0.7f, 0.4f, 0.15f, 0.05f };   // sieć odległa o 0..4 kanały
+
+enum ChannelPhase : uint8_t { CHANNEL_IDLE = 0, CHANNEL_PREPARING = 1, CHANNEL_COMMITTED = 2 };
+const char* const CHANNEL_PHASE_NAMES[] = { "idle", "preparing", "committed" };
+
+struct ChannelLink {
+  volatile uint32_t sent;          // unicasty ESP-NOW na tym kanale (OnDataSent)
+  volatile uint32_t failed;
+  uint32_t rttMs;                  // średni RTT heartbeatu węzłów, próbkowany przy raporcie i zmianie
+};
+
+struct ChannelSurvey {
+  bool running;
+  bool autoSwitch;                 // po skończeniu: automatyczna zmiana na wyraźnie lepszy kanał
+  uint8_t scanChannel;             // skanowany teraz kanał
+  unsigned long startedAt;
+  unsigned long nextScanAt;
+  int scanNetworks;
+  uint8_t scanApCount[CHANNEL_MAX + 1];
+  int8_t scanMaxRssi[CHANNEL_MAX + 1];
+  float scanPowerMw[CHANNEL_MAX + 1];
+  bool valid;
+  unsigned long at;
+  uint32_t durationMs;
+  int networks;
+  uint8_t apCount[CHANNEL_MAX + 1];
+  int8_t maxRssi[CHANNEL_MAX + 1];
+  float interferenceDbm[CHANNEL_MAX + 1];   // moc obcych sieci ważona nakładaniem się kanałów
+};
+
+struct ChannelSwitch {
+  uint8_t phase;                   // ChannelPhase
+  uint8_t from;
+  uint8_t target;
+  bool force;                      // commit mimo braku potwierdzenia od części slave'ów
+  uint16_t seq;                    // komenda grupowa bieżącej fazy
+  String reason;
+  unsigned long startedAt;
+  unsigned long switchAt;
+  String result;
+  uint32_t switches;
+  uint32_t aborts;
+  uint32_t lastDurationMs;
+};
+
+volatile uint8_t radioChannel = CHANNEL_DEFAULT;     // kanał, na którym radio jest teraz
+ChannelLink channelLinks[CHANNEL_MAX + 1];
+ChannelSurvey channelSurvey;
+ChannelSwitch channelSwitch;
+bool channelBootSurveyDone = false;
+unsigned long lastChannelHereMs = 0;
+
+// Szybkość PHY na węzeł (starzik_phy.h): stała z konfiguracji albo automat. Co PHY_RENEW_MS
+// automat patrzy na straty unicastów w oknie i RSSI ramek od węzła (nasłuch promiscuous –
+// callback ESP-NOW w IDF 4.4 nie podaje RSSI): w dół od razu przy stratach albo słabym
+// sygnale, w górę dopiero po PHY_UP_WINDOWS czystych oknach z zapasem PHY_HYSTERESIS_DB.
+// Rozgłoszenia i ramki do innych Masterów idą domyślnym 1 Mb/s.
+// Walizka nadaje też wprost do Podłogi (sendToPeer), a szybkość slave'a jest na interfejs –
+// dzierżawa Mastera zmieniłaby i to łącze, więc takie węzły zostają na 1 Mb/s.
+const uint32_t PHY_PINNED_MEMBERS = 1UL << GROUP_MEMBER_WALIZKA;
+const uint32_t PHY_MIN_SAMPLES = 20;           // mniej unicastów w oknie – straty nieznane
+const float PHY_DOWN_LOSS_PCT = 10.0f;
+const float PHY_UP_LOSS_PCT = 1.0f;
+const int PHY_FADE_MARGIN_DB = 10;             // zapas ponad czułość przy danej szybkości
+const int PHY_HYSTERESIS_DB = 5;
+const uint8_t PHY_UP_WINDOWS = 3;
+const unsigned long PHY_DRAIN_MS = 20;         // ramka 250 B przy LR 250 kb/s z powtórkami
+const int PHY_BENCH_MAX_FRAMES = 200;
+const unsigned long PHY_BENCH_PONG_MS = 50;
+const unsigned long PHY_BENCH_WARMUP_MS = 300; // slave przełącza szybkość odpowiedzi w loop()
+
+struct PhyPeer {
+  uint8_t rate;                  // indeks w PHY_RATES – tak Master nadaje teraz do węzła
+  volatile uint32_t sent;        // bieżące okno oceny (OnDataSent)
+  volatile uint32_t failed;
+  uint32_t totalSent;
+  uint32_t totalFailed;
+  volatile int16_t rssi;         // wygładzony RSSI ramek od węzła, 0 = jeszcze nie słyszany
+  float lossPct;                 // ostatnie okno, -1 = za mało ramek
+  uint8_t upStreak;
+  uint32_t changes;
+  String lastChange;
+};
+
+struct PhyBenchResult {
+  uint8_t rate;
+  bool answered;                 // rozgrzewka dostała odpowiedź wysłaną testowaną szybkością
+  uint32_t fps;
+  float macLossPct;
+  float lossPct;
+  uint16_t pongs;
+  uint32_t rttMin, rttP50, rttP90, rttP99, rttMax;
+};
+
+struct PhyBench {
+  volatile bool active;          // pomiar w toku (zadanie phyBenchTask)
+  int member;
+  uint8_t rates[PHY_RATE_COUNT];
+  int rateCount;
+  int frames;
+  int size;
+  PhyBenchResult results[PHY_RATE_COUNT];
+  volatile int done;             // gotowe wyniki – zadanie pisze tylko następny
+  unsigned long startedAt;
+  uint32_t durationMs;
+  uint8_t mac[6];
+  uint8_t rate;                  // nadpisuje szybkość węzła na czas pomiaru
+  volatile bool sentDone;        // OnDataSent ostatniej ramki serii
+  volatile bool sentOk;
+  volatile bool pongReady;       // OnDataRecv
+  volatile uint16_t pongSeq;
+  volatile uint8_t pongRate;
+  volatile unsigned long pongUs;
+};
+
+PhyPeer phyPeers[GROUP_MEMBER_COUNT];
+PhyBench phyBench;
+uint8_t phyApplied = PHY_RATE_DEFAULT;         // szybkość ustawiona teraz w radiu
+volatile int phyInFlight = 0;                  // wysłane bez callbacku OnDataSent
+uint32_t phySwitches = 0;
+SemaphoreHandle_t phyLock = NULL;              // przełączenie szybkości i wysłanie jako całość
+TaskHandle_t radioTask = NULL;                 // zadanie WiFi (callbacki ESP-NOW) – tam bez czekania
+portMUX_TYPE phyMux = portMUX_INITIALIZER_UNLOCKED;
+unsigned long lastPhyEvalMs = 0;
+
+// Telemetria zdrowia slave'ów (/nodes) – rekord po każdym heartbeacie węzła
+const int HEALTH_HISTORY = 60;                 // ~15 min przy heartbeacie co 15 s
+const unsigned long HEALTH_STALE_MS = 45000;   // trzy heartbeaty bez rekordu
+const int HEALTH_TREND_MIN_SAMPLES = 8;        // poniżej tego nachylenie sterty to szum
+const float HEALTH_LEAK_BPM = -200.0f;         // spadek wolnej sterty [B/min] uznany za wyciek
+const uint32_t HEALTH_HEAP_LOW = 20000;
+const uint16_t HEALTH_LOOP_SLOW_MS = 500;
+const float HEALTH_RADIO_FAIL_PCT = 20.0f;
+static const char* const RESET_REASON_NAMES[] = {
+  "unknown", "poweron", "ext", "sw", "panic", "int_wdt", "task_wdt", "wdt", "deepsleep", "brownout", "sdio"
+};
+
+struct HealthSample {
+  unsigned long at;              // millis() Mastera przy odbiorze
+  HealthRecord rec;
+  int16_t rssi;                  // wygładzony RSSI z PhyPeer w chwili odbioru
+};
+
+struct NodeHealth {
+  HealthSample samples[HEALTH_HISTORY];
+  uint8_t head;
+  uint8_t count;
+  uint32_t records;
+  uint32_t reboots;              // spadek uptime między kolejnymi rekordami
+  unsigned long lastRebootAt;
+};
+
+NodeHealth nodeHealth[GROUP_MEMBER_COUNT];
+portMUX_TYPE healthMux = portMUX_INITIALIZER_UNLOCKED;
+
+volatile uint32_t otaAckOffset = 0;     // skumulowany ACK od slave'a
+volatile bool otaNack = false;
+volatile bool otaCtrlReady = false;
+volatile uint8_t otaCtrlType = 0;
+volatile uint8_t otaCtrlStatus = 0;
+volatile uint32_t otaCtrlOffset = 0;
+
 // Deklaracje funkcji
 void setupWiFiAP();
 void setupESPNow();
+bool addEspNowPeer(const uint8_t* mac, const char* name, const uint8_t* lmk = NULL);
 void setupWebServer();
-void listSPIFFSFiles();
+JsonDocument& beginResponseDoc();
+bool parseRequestBody();
+void sendJson(int code, JsonDocument& doc);
+void setupWebSocket();
+void webSocketEvent(uint8_t num, WStype_t type, uint8_t* payload, size_t length);
+void watchDelivery(const uint8_t* mac);
+void resolveDelivery(const uint8_t* mac, bool delivered);
+void flushDeliveryReports();
+uint32_t resolveGroupTarget(const String& target);
+bool groupMemberAddress(int member, uint8_t* mac);
+bool groupMemberMac(int member, uint8_t* mac);
+uint16_t sendGroupCommand(const String& target, const String& command, const String& data, bool wholeGroup = false);
+void handleGroupAck(const uint8_t* mac, const GroupAck* ack);
+void serviceGameAnnounce();
+void announceGameState(uint16_t seq);
+GroupFanout* findGroupFanout(uint16_t seq);
+void serviceGroupFanouts();
+void fillGroupReport(JsonObject doc);
+void setupRooms();
+void queueRoomEvent(const String& text);
+void handleRoomFrame(const uint8_t* mac, const uint8_t* data, int len);
+void serviceRooms();
+int relayRoomCommand(const String& roomId, JsonObject command, JsonObject result);
+void fillRoomsReport(JsonObject doc);
+void haBegin();
+void haStart();
+void haHandleFrame(const uint8_t* mac, const uint8_t* data, int len);
+void haReplicateRecord(const JournalRecord& rec);
+void haService();
+void haHeartbeatTask(void* arg);
+void fillHaReport(JsonObject doc);
+bool startChannelSurvey(bool autoSwitch);
+void serviceChannelSurvey();
+uint8_t bestSurveyChannel();
+bool startChannelSwitch(uint8_t target, const String& reason, bool force, String& error);
+void answerChannelProbe();
+void serviceChannel();
+void fillChannelReport(JsonObject doc);
+void setupPhy();
+int phyMemberByMac(const uint8_t* mac);
+esp_err_t espNowSend(const uint8_t* mac, const uint8_t* data, size_t len);
+void phyBenchTask(void* arg);
+void relayBenchTask(void* arg);
+void fillRelayBenchReport(JsonObject doc);
+void servicePhy();
+void fillPhyReport(JsonObject doc);
+void handleHealthRecord(const uint8_t* mac, const HealthRecord* rec);
+void fillNodesReport(JsonObject doc, int only);
+void loadMasterConfig();
+void saveMasterConfig();
+bool applyMasterConfig(JsonObject changes, String& error);
+bool parseMac(const String& text, uint8_t* mac);
+String formatMac(const uint8_t* mac);
+void checkPendingApRestart();
+bool mountFs();
+void listFsFiles();
+void loadStaticAsset(StaticAsset& asset);
+void invalidateStaticAsset(const String& path);
+void serveStaticAsset(StaticAsset& asset);
 void resetGameSession();
+unsigned long gameElapsedMs(unsigned long now);
+void fillGameSession(JsonObject doc);
+void journalMount();
+void journalService();
+void journalLog(uint8_t type);
+void journalLogStart();
+void journalLogHint();
+void journalLogStage(int index, const String& stage);
+void journalLogEnd();
 void resetWalizkaState();
-void blinkLED(int times, int delayMs);
 void checkGolabConnection();
-bool sendAudioToGolab(String fileName);
+bool sendAudioToGolab(String fileName, bool queued = false);
 bool sendCommandToGolab(String command, String data);
 bool sendCommandToWalizka(String command, String data);
 bool sendToGolab(GolabMessage& message);
 bool sendToWalizka(GolabMessage& message);
 void handleGolabMessage(String command, String data);
 void handleWalizkaMessage(String command, String data);
+NodeLink* findNodeById(const String& id);
+NodeLink* findNodeByMac(const uint8_t* mac);
+void handleNodeFrame(const uint8_t* mac, const String& frame);
+void handleNodeMessage(NodeLink& node, String command, String data, unsigned long nodeMs);
+bool sendCommandToNode(NodeLink& node, String command, String data);
+int sendRelayFrame(NodeLink& node, uint8_t channel, uint8_t mode, uint32_t argMs);
+void addNodeStatus(JsonObject obj, NodeLink& node, bool timing);
+void fillStatus(JsonObject doc, bool volatileFields);
+void fillPuzzleStatus(JsonObject doc, bool timing);
+void fillPeerHealth(JsonObject doc);
+void fillPeerTiming(JsonObject doc);
+void refreshSnapshot();
+void handlePanelCommand(const char* op, bool needsBody);
+int runPanelCommand(const String& op, JsonObject args, JsonObject result);
+int commandResult(JsonObject result, int code, const String& text);
+void loadOtaImage();
+void handleOtaUpload();
+void handleFsUpload();
+void failFsUpload(const char* error);
+bool isValidFsPath(const String& path);
+bool resolveOtaTarget(const String& node, uint8_t* mac);
+void handleOtaReply(const uint8_t* mac, const OtaReplyFrame* reply);
+void otaSendTask(void* arg);
 bool startGame(JsonObject gameData);
 bool pauseGame(bool paused);
 bool endGame(String status);
 String formatTimestamp(unsigned long timestamp);
+void loadPuzzleConfig();
+void savePuzzleConfig();
+void buildPuzzleConfigBlob();
+bool updatePuzzleConfig(JsonObject changes, String& error);
+void checkPuzzleConfigSync();
+void handleConfigAck(String node, String data);
+void loadAudioManifest();
+bool updateAudioManifest(JsonObject manifest, String& error);
+void checkAudioManifestSync();
+void handleAudioCatalog(String data);
 void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status);
 void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len);
 
 void setup() {
+  unsigned long bootStart = millis();
   Serial.begin(115200);
   Serial.println("ESP32 Master - Escape Room Gołąb");
   Serial.print("MAC Address Master: ");
   Serial.println(WiFi.macAddress());
 
-  pinMode(2, OUTPUT);
+  ledEngineBegin(2);
 
-  if (!SPIFFS.begin(true)) {
-    Serial.println("Błąd inicjalizacji SPIFFS");
+  if (!mountFs()) {
+    Serial.println("Błąd inicjalizacji LittleFS");
     return;
   }
   
-  listSPIFFSFiles();
-  setupWiFiAP();
+  listFsFiles();
+  for (int i = 0; i < STATIC_ASSET_COUNT; i++) loadStaticAsset(staticAssets[i]);
+
+  unsigned long configStart = micros();
+  loadMasterConfig();
+  configLoadUs = micros() - configStart;
+  Serial.println("Konfiguracja Master wczytana w " + String(configLoadUs) + " us");
+
+  loadPuzzleConfig();
+  loadAudioManifest();
+  loadOtaImage();
+  haBegin();             // para Masterów: rola i adres MAC ustalane przed startem AP
+  if (ha.role != HA_STANDBY) setupWiFiAP();
   setupESPNow();
+  haStart();
+  snapshotEpoch = esp_random();      // po starcie radia – sprzętowe RNG ma wtedy pełną entropię
   setupWebServer();
+  setupWebSocket();
   resetGameSession();
   resetWalizkaState();
+  journalMount();        // po ESP-NOW – odtworzona gra jest od razu ogłaszana slave'om
 
-  Serial.println("Master gotowy!");
+  bootTimeMs = millis() - bootStart;
+  if (ha.tookOver) ha.readyMs = millis();
+  Serial.println("Master gotowy! Czas startu: " + String(bootTimeMs) + " ms");
   Serial.print("Access Point IP: ");
   Serial.println(WiFi.softAPIP());
-  blinkLED(3, 300);
+  ledPlay(LED_STARTUP);
 }
 
 void loop() {
+  heapBeforeRequest = ESP.getFreeHeap();
   server.handleClient();
+  webSocket.loop();
+  haService();
+  if (ha.role == HA_STANDBY) {
+    // Rezerwowy tylko przyjmuje replikację – slave'y i panel obsługuje aktywny
+    journalService();
+    delay(2);
+    return;
+  }
+  flushDeliveryReports();
+  serviceGroupFanouts();
+  serviceGameAnnounce();
+  serviceRooms();
+  serviceChannel();
+  servicePhy();
   checkGolabConnection();
-  delay(100);
+  checkPuzzleConfigSync();
+  checkAudioManifestSync();
+  checkPendingApRestart();
+  journalService();
+  delay(2);   // krótko – przy 100 ms komenda z panelu czekała w kolejce dłużej niż leci radiem
 }
 
 void setupWiFiAP() {
   WiFi.mode(WIFI_AP_STA);
-  WiFi.softAP(ap_ssid, ap_password);
+  WiFi.softAP(masterConfig.apSsid, masterConfig.apPassword, masterConfig.channel);
+  radioChannel = masterConfig.channel;
   
   Serial.println("WiFi Access Point uruchomiony");
   Serial.print("SSID: ");
-  Serial.println(ap_ssid);
+  Serial.println(masterConfig.apSsid);
+  Serial.println("Kanał: " + String(masterConfig.channel));
   Serial.print("IP: ");
   Serial.println(WiFi.softAPIP());
 }
@@ -132,187 +1108,134 @@ void setupESPNow() {
 
   esp_now_register_send_cb(OnDataSent);
   esp_now_register_recv_cb(OnDataRecv);
+  setupPhy();
 
-  // Dodaj Gołąb
-  esp_now_peer_info_t golabPeer;
-  memset(&golabPeer, 0, sizeof(golabPeer));
-  memcpy(golabPeer.peer_addr, golab_mac, 6);
-  golabPeer.channel = 0;
-  golabPeer.encrypt = false;
-  golabPeer.ifidx = WIFI_IF_STA;
-
-  if (esp_now_add_peer(&golabPeer) != ESP_OK) {
-    Serial.println("Błąd dodawania Gołąb peer");
-  } else {
-    Serial.println("ESP-NOW: Gołąb dodany");
-  }
-  
-  // Dodaj Walizka
-  esp_now_peer_info_t walizkaPeer;
-  memset(&walizkaPeer, 0, sizeof(walizkaPeer));
-  memcpy(walizkaPeer.peer_addr, walizka_mac, 6);
-  walizkaPeer.channel = 0;
-  walizkaPeer.encrypt = false;
-  walizkaPeer.ifidx = WIFI_IF_STA;
-
-  if (esp_now_add_peer(&walizkaPeer) != ESP_OK) {
-    Serial.println("Błąd dodawania Walizka peer");
-  } else {
-    Serial.println("ESP-NOW: Walizka dodana");
-  }
+  addEspNowPeer(masterConfig.golabMac, "Gołąb");
+  addEspNowPeer(masterConfig.walizkaMac, "Walizka");
+  addEspNowPeer(BROADCAST_MAC, "Rozgłoszenie");
+  groupSeq = esp_random();
+  setupRooms();
 
   Serial.println("ESP-NOW skonfigurowane");
 }
 
+// lmk != NULL: ramki do i od tego peera szyfrowane (CCMP), druga strona musi mieć ten sam klucz
+bool addEspNowPeer(const uint8_t* mac, const char* name, const uint8_t* lmk) {
+  esp_now_peer_info_t peer;
+  memset(&peer, 0, sizeof(peer));
+  memcpy(peer.peer_addr, mac, 6);
+  peer.channel = 0;
+  peer.encrypt = lmk != NULL;
+  if (lmk) memcpy(peer.lmk, lmk, sizeof(peer.lmk));
+  peer.ifidx = WIFI_IF_STA;
+
+  if (esp_now_add_peer(&peer) != ESP_OK) {
+    Serial.println("Błąd dodawania " + String(name) + " peer");
+    return false;
+  }
+  Serial.println("ESP-NOW: " + String(name) + " dodany (" + formatMac(mac) + ")");
+  return true;
+}
+
 void setupWebServer() {
   server.on("/", HTTP_GET, []() {
-    if (SPIFFS.exists("/index.html")) {
-      File file = SPIFFS.open("/index.html", "r");
-      server.streamFile(file, "text/html");
-      file.close();
-      Serial.println("Wysłano index.html");
-    } else {
-      server.send(404, "text/plain", "Panel index.html nie znaleziony na SPIFFS!");
-      Serial.println("BŁĄD: index.html nie znaleziony!");
-    }
+    serveStaticAsset(staticAssets[0]);
   });
 
   server.on("/beep.mp3", HTTP_GET, []() {
-    if (SPIFFS.exists("/beep.mp3")) {
-      File file = SPIFFS.open("/beep.mp3", "r");
-      server.streamFile(file, "audio/mpeg");
-      file.close();
-      Serial.println("Wysłano beep.mp3");
-    } else {
-      server.send(404, "text/plain", "beep.mp3 nie znaleziony na SPIFFS!");
-      Serial.println("BŁĄD: beep.mp3 nie znaleziony!");
-    }
+    serveStaticAsset(staticAssets[1]);
   });
 
   server.on("/hint_status", HTTP_GET, []() {
-    DynamicJsonDocument doc(256);
+    JsonDocument& doc = beginResponseDoc();
     doc["hint_requested"] = hintRequested;
     doc["hint_time"] = hintRequestTime;
     doc["timestamp"] = millis();
     
-    String response;
-    serializeJson(doc, response);
-    server.send(200, "application/json", response);
+    sendJson(200, doc);
     
     hintRequested = false;
   });
 
   server.on("/status", HTTP_GET, []() {
-    DynamicJsonDocument doc(512);
+    JsonDocument& doc = beginResponseDoc();
     doc["success"] = true;
-    doc["ip"] = WiFi.softAPIP().toString();
-    doc["ssid"] = ap_ssid;
-    doc["rssi"] = WiFi.RSSI();
-    doc["golab_connected"] = golabConnected;
-    doc["walizka_connected"] = walizkaConnected;
-    doc["game_active"] = currentGame.isActive;
-    doc["uptime"] = millis();
-    doc["free_heap"] = ESP.getFreeHeap();
-    doc["spiffs_total"] = SPIFFS.totalBytes();
-    doc["spiffs_used"] = SPIFFS.usedBytes();
+    fillStatus(doc.as<JsonObject>(), true);
     
-    String response;
-    serializeJson(doc, response);
-    server.send(200, "application/json", response);
+    sendJson(200, doc);
   });
 
   server.on("/play_audio", HTTP_POST, []() {
-    if (server.hasArg("plain")) {
-      DynamicJsonDocument doc(512);
-      deserializeJson(doc, server.arg("plain"));
-      
-      String fileName = doc["fileName"];
-      String sessionId = doc["sessionId"] | "";
-      
-      if (sendAudioToGolab(fileName)) {
-        DynamicJsonDocument response(256);
-        response["success"] = true;
-        response["message"] = "Audio wysłane do Gołąb";
-        String responseStr;
-        serializeJson(response, responseStr);
-        server.send(200, "application/json", responseStr);
-        Serial.println("Wysłano audio do Gołąb: " + fileName);
-      } else {
-        DynamicJsonDocument response(256);
-        response["success"] = false;
-        response["error"] = "Błąd wysyłania do Gołąb";
-        String responseStr;
-        serializeJson(response, responseStr);
-        server.send(500, "application/json", responseStr);
-      }
-    } else {
-      server.send(400, "application/json", "{\"success\":false,\"error\":\"Brak danych\"}");
-    }
+    handlePanelCommand("play_audio", true);
   });
 
   server.on("/stop_audio", HTTP_POST, []() {
-    if (sendCommandToGolab("stop_audio", "")) {
-      server.send(200, "application/json", "{\"success\":true,\"message\":\"Stop wysłane do Gołąb\"}");
-    } else {
-      server.send(500, "application/json", "{\"success\":false,\"error\":\"Błąd komunikacji z Gołąb\"}");
-    }
+    handlePanelCommand("stop_audio", false);
   });
 
   server.on("/command", HTTP_POST, []() {
-    if (server.hasArg("plain")) {
-      DynamicJsonDocument doc(512);
-      deserializeJson(doc, server.arg("plain"));
-      
-      String command = doc["command"];
-      bool success = false;
-      String message = "";
-      
-      if (command == "start_game") {
-        success = startGame(doc["data"]);
-        message = success ? "Gra rozpoczęta" : "Błąd rozpoczynania gry";
-      } else if (command == "pause_game") {
-        success = pauseGame(doc["data"]["paused"]);
-        message = success ? "Pauza toggled" : "Błąd pauzy";
-      } else if (command == "end_game") {
-        success = endGame(doc["data"]["status"]);
-        message = success ? "Gra zakończona" : "Błąd zakończenia gry";
-      } else {
-        message = "Nieznana komenda: " + command;
-      }
-      
-      DynamicJsonDocument response(256);
-      response["success"] = success;
-      response["message"] = message;
-      String responseStr;
-      serializeJson(response, responseStr);
-      server.send(200, "application/json", responseStr);
-    } else {
-      server.send(400, "application/json", "{\"success\":false,\"error\":\"Brak danych\"}");
-    }
+    handlePanelCommand("command", true);
   });
 
   server.on("/set_volume", HTTP_POST, []() {
-    if (server.hasArg("plain")) {
-      DynamicJsonDocument doc(256);
-      deserializeJson(doc, server.arg("plain"));
-      
-      int volume = doc["volume"] | 20;
-      volume = constrain(volume, 0, 30);
-      
-      if (sendCommandToGolab("set_volume", String(volume))) {
-        DynamicJsonDocument response(256);
-        response["success"] = true;
-        response["message"] = "Głośność ustawiona: " + String(volume);
-        String responseStr;
-        serializeJson(response, responseStr);
-        server.send(200, "application/json", responseStr);
-        Serial.println("Ustawiono głośność Gołąb: " + String(volume));
-      } else {
-        server.send(500, "application/json", "{\"success\":false,\"error\":\"Błąd komunikacji z Gołąb\"}");
+    handlePanelCommand("set_volume", true);
+  });
+
+  // Stan panelu w jednym żądaniu; ?since=<version>&epoch=<epoch> zwraca tylko zmienione sekcje
+  server.on("/snapshot", HTTP_GET, []() {
+    refreshSnapshot();
+
+    uint32_t since = strtoul(server.arg("since").c_str(), NULL, 10);
+    // Inna epoka = Master uruchomiony od nowa, numery wersji zaczęły się od zera
+    if (strtoul(server.arg("epoch").c_str(), NULL, 10) != snapshotEpoch || since > snapshotVersion) since = 0;
+
+    // Sekcje są już gotowym JSON-em – idą do gniazda bez sklejania w jeden String
+    chunkedResponse.begin(200, "application/json");
+    chunkedResponse.printf("{\"version\":%lu,\"epoch\":%lu,\"full\":%s,\"uptime\":%lu,\"rssi\":%d,\"free_heap\":%lu",
+                           (unsigned long)snapshotVersion, (unsigned long)snapshotEpoch, since == 0 ? "true" : "false",
+                           millis(), (int)WiFi.RSSI(), (unsigned long)ESP.getFreeHeap());
+    JsonDocument& timing = beginResponseDoc();
+    fillPeerTiming(timing.as<JsonObject>());
+    chunkedResponse.print(",\"peer_timing\":");
+    serializeJson(timing, chunkedResponse);
+    for (int i = 0; i < SNAP_SECTION_COUNT; i++) {
+      if (snapshotParts[i].version > since) {
+        chunkedResponse.printf(",\"%s\":", snapshotParts[i].name);
+        chunkedResponse.print(snapshotParts[i].json);
       }
-    } else {
-      server.send(400, "application/json", "{\"success\":false,\"error\":\"Brak danych\"}");
     }
+    chunkedResponse.print("}");
+    chunkedResponse.end();
+  });
+
+  // Kilka komend w jednym żądaniu: {"commands":[{"op":"set_volume","volume":20}, ...]}
+  // Pola komendy są takie same jak w body pojedynczego endpointu
+  server.on("/batch", HTTP_POST, []() {
+    DynamicJsonDocument doc(2048);
+    if (!server.hasArg("plain") || deserializeJson(doc, server.arg("plain"))) {
+      server.send(400, "application/json", "{\"success\":false,\"error\":\"Niepoprawny JSON\"}");
+      return;
+    }
+    JsonArray commands = doc["commands"];
+    if (commands.isNull() || commands.size() == 0 || commands.size() > MAX_BATCH_COMMANDS) {
+      server.send(400, "application/json", "{\"success\":false,\"error\":\"Brak komend albo za dużo komend\"}");
+      return;
+    }
+
+    JsonDocument& response = beginResponseDoc();
+    JsonArray results = response.createNestedArray("results");
+    bool allOk = true;
+    for (JsonObject command : commands) {
+      JsonObject result = results.createNestedObject();
+      String op = command["op"] | "";
+      result["op"] = op;
+      int code = runPanelCommand(op, command, result);
+      result["code"] = code;
+      if (code != 200) allOk = false;
+    }
+    response["success"] = allOk;
+
+    sendJson(200, response);
   });
 
   server.on("/restart", HTTP_POST, []() {
@@ -330,140 +1253,586 @@ void setupWebServer() {
   });
 
   server.on("/restart_all", HTTP_POST, []() {
-    sendCommandToGolab("restart", "all_restart");
-    sendCommandToWalizka("restart", "all_restart");
+    sendGroupCommand("all", "restart", "all_restart", true);   // też do zawieszonych i rozłączonych
     server.send(200, "application/json", "{\"success\":true,\"message\":\"Restartowanie całego systemu...\"}");
-    delay(2000);
+    // Powtórki do węzłów bez ACK – po restarcie Mastera nikt by ich nie dokończył
+    unsigned long waitStart = millis();
+    while (millis() - waitStart < 2000) {
+      serviceGroupFanouts();
+      delay(5);
+    }
     ESP.restart();
   });
 
-  // === NOWE ENDPOINTY ZAGADEK ===
-  
-  server.on("/puzzle_status", HTTP_GET, []() {
-    DynamicJsonDocument doc(1024);
-    
-    // Status Walizka LOTTO
-    JsonObject walizka = doc.createNestedObject("walizka");
-    walizka["stage"] = walizkaState.stage;
-    walizka["connected"] = walizkaConnected;
-    walizka["last_update"] = walizkaState.lastUpdate;
-    
-    // Historia kodów
-    JsonArray codes = walizka.createNestedArray("codesHistory");
-    for (int i = 0; i < walizkaState.codesCount && i < 10; i++) {
-      String entry = walizkaState.codesHistory[i];
-      int pipe1 = entry.indexOf('|');
-      int pipe2 = entry.indexOf('|', pipe1 + 1);
-      
-      if (pipe1 > 0 && pipe2 > 0) {
-        JsonObject codeEntry = codes.createNestedObject();
-        codeEntry["code"] = entry.substring(0, pipe1);
-        codeEntry["correct"] = (entry.substring(pipe1 + 1, pipe2) == "1");
-        codeEntry["timestamp"] = formatTimestamp(entry.substring(pipe2 + 1).toInt());
+  server.on("/ha", HTTP_GET, []() {
+    JsonDocument& doc = beginResponseDoc();
+    fillHaReport(doc.as<JsonObject>());
+    sendJson(200, doc);
+  });
+
+  // Próba przejęcia: aktywny milknie na HA_DRILL_SILENCE_MS i wraca jako rezerwowy,
+  // czas przejęcia raportuje potem /ha na drugiej płytce
+  server.on("/ha_drill", HTTP_POST, []() {
+    JsonDocument& doc = beginResponseDoc();
+    if (ha.role != HA_PRIMARY) {
+      sendJson(commandResult(doc.as<JsonObject>(), 409, "Próba przejęcia tylko na aktywnym Masterze z parą"), doc);
+      return;
+    }
+    ha.drill = true;
+    commandResult(doc.as<JsonObject>(), 200, "Aktywny milknie na " + String(HA_DRILL_SILENCE_MS / 1000) + " s");
+    sendJson(200, doc);
+  });
+
+  server.on("/channel", HTTP_GET, []() {
+    JsonDocument& doc = beginResponseDoc();
+    fillChannelReport(doc.as<JsonObject>());
+    sendJson(200, doc);
+  });
+
+  // Skan w tle (~5 s) – wynik w GET /channel. Radio co chwilę znika z kanału pokoju,
+  // więc w trakcie gry tylko z {"force":true}
+  server.on("/channel_survey", HTTP_POST, []() {
+    parseRequestBody();
+    JsonDocument& doc = beginResponseDoc();
+    JsonObject result = doc.as<JsonObject>();
+    if (currentGame.isActive && !(requestDoc["force"] | false)) {
+      sendJson(commandResult(result, 409, "Gra w toku – przegląd pasma tylko z force"), doc);
+      return;
+    }
+    if (!startChannelSurvey(false)) {
+      sendJson(commandResult(result, 409, "Przegląd pasma albo zmiana kanału w toku"), doc);
+      return;
+    }
+    commandResult(result, 200, "Przegląd pasma w toku – wynik w /channel");
+    sendJson(202, doc);
+  });
+
+  // {"channel":6} albo {} = kanał zalecany przez ostatni przegląd. "force": w trakcie gry,
+  // w federacji pokoi i mimo braku potwierdzenia od części slave'ów (ci znajdą Mastera sondą)
+  server.on("/channel_switch", HTTP_POST, []() {
+    JsonDocument& doc = beginResponseDoc();
+    JsonObject result = doc.as<JsonObject>();
+    if (!parseRequestBody()) {
+      sendJson(commandResult(result, 400, "Niepoprawny JSON"), doc);
+      return;
+    }
+    bool force = requestDoc["force"] | false;
+    int target = requestDoc["channel"] | 0;
+    if (target == 0) {
+      if (!channelSurvey.valid) {
+        sendJson(commandResult(result, 409, "Brak przeglądu pasma – podaj kanał albo wywołaj /channel_survey"), doc);
+        return;
       }
+      target = bestSurveyChannel();
     }
-    
-    // Statystyki cyfr
-    JsonObject stats = walizka.createNestedObject("digitStats");
-    for (int i = 0; i < 10; i++) {
-      stats[String(i)] = walizkaState.digitStats[i];
+    if (currentGame.isActive && !force) {
+      sendJson(commandResult(result, 409, "Gra w toku – zmiana kanału tylko z force"), doc);
+      return;
     }
-    
-    String response;
-    serializeJson(doc, response);
-    server.send(200, "application/json", response);
+    if (masterConfig.roomRole != ROOM_STANDALONE && !force) {
+      sendJson(commandResult(result, 409, "Pokój w federacji – pozostałe Mastery muszą przejść na ten sam kanał (force)"), doc);
+      return;
+    }
+    String error;
+    if (!startChannelSwitch(target, "manual", force, error)) {
+      sendJson(commandResult(result, 409, error), doc);
+      return;
+    }
+    commandResult(result, 200, "Zmiana kanału " + String(radioChannel) + " -> " + String(target) + " w toku");
+    sendJson(200, doc);
   });
 
-  server.on("/puzzle_command", HTTP_POST, []() {
-    if (server.hasArg("plain")) {
-      DynamicJsonDocument doc(512);
-      deserializeJson(doc, server.arg("plain"));
-      
-      String puzzle = doc["puzzle"];
-      String command = doc["command"];
-      
-      if (puzzle == "walizka") {
-        if (command == "open_lock") {
-          if (sendCommandToWalizka("open_lock", "")) {
-            server.send(200, "application/json", "{\"success\":true,\"message\":\"Komenda wysłana do Walizka\"}");
-          } else {
-            server.send(500, "application/json", "{\"success\":false,\"error\":\"Błąd komunikacji z Walizka\"}");
-          }
-        } else if (command == "reset") {
-          if (sendCommandToWalizka("reset_puzzle", "")) {
-            server.send(200, "application/json", "{\"success\":true,\"message\":\"Reset wysłany do Walizka\"}");
-          } else {
-            server.send(500, "application/json", "{\"success\":false,\"error\":\"Błąd komunikacji z Walizka\"}");
-          }
-        } else {
-          server.send(400, "application/json", "{\"success\":false,\"error\":\"Nieznana komenda\"}");
-        }
-      } else {
-        server.send(400, "application/json", "{\"success\":false,\"error\":\"Nieznana zagadka\"}");
+  server.on("/phy", HTTP_GET, []() {
+    JsonDocument& doc = beginResponseDoc();
+    fillPhyReport(doc.as<JsonObject>());
+    sendJson(200, doc);
+  });
+
+  // Zdrowie slave'ów z trendami; ?node=<id> dokłada historię w kolumnach (od najstarszej)
+  server.on("/nodes", HTTP_GET, []() {
+    int only = -1;
+    if (server.hasArg("node")) {
+      only = groupMemberById(server.arg("node").c_str());
+      if (only < 0) {
+        JsonDocument& doc = beginResponseDoc();
+        sendJson(commandResult(doc.to<JsonObject>(), 404, "Nieznany węzeł"), doc);
+        return;
       }
-    } else {
-      server.send(400, "application/json", "{\"success\":false,\"error\":\"Brak danych\"}");
     }
+    JsonDocument& doc = beginResponseDoc();
+    fillNodesReport(doc.to<JsonObject>(), only);
+    if (doc.overflowed()) {
+      doc.clear();
+      sendJson(commandResult(doc.to<JsonObject>(), 500, "Raport nie mieści się w buforze odpowiedzi"), doc);
+      return;
+    }
+    sendJson(200, doc);
   });
 
-  server.on("/restart_slave3", HTTP_POST, []() {
-    if (sendCommandToWalizka("restart", "slave3_restart")) {
-      server.send(200, "application/json", "{\"success\":true,\"message\":\"Restart wysłany do Walizka\"}");
+  // Pomiar łącza do węzła na kolejnych szybkościach: seria (ramki/s, straty warstwy MAC)
+  // i ping-pong (RTT, straty). {"node":"lom","rates":["1m","lr250k"],"frames":100,"size":200}
+  // Pomiar idzie w tle (202) – wyniki w GET /phy, "bench"
+  server.on("/phy_bench", HTTP_POST, []() {
+    JsonDocument& doc = beginResponseDoc();
+    JsonObject result = doc.as<JsonObject>();
+    if (!parseRequestBody()) {
+      sendJson(commandResult(result, 400, "Niepoprawny JSON"), doc);
+      return;
+    }
+    JsonDocument& body = requestDoc;
+    int member = groupMemberById(body["node"] | "");
+    uint8_t mac[6];
+    if (member < 0 || !groupMemberMac(member, mac)) {
+      sendJson(commandResult(result, 409, "Węzeł nieznany albo niepołączony"), doc);
+      return;
+    }
+    if (ota.running) {
+      sendJson(commandResult(result, 409, "Trwa OTA"), doc);
+      return;
+    }
+    if (phyBench.active) {
+      sendJson(commandResult(result, 409, "Pomiar już trwa"), doc);
+      return;
+    }
+    if (currentGame.isActive && !(body["force"] | false)) {
+      sendJson(commandResult(result, 409, "Gra w toku – pomiar tylko z force"), doc);
+      return;
+    }
+
+    uint8_t* rates = phyBench.rates;
+    int rateCount = 0;
+    if (body["rates"].is<JsonArray>()) {
+      for (JsonVariant name : body["rates"].as<JsonArray>()) {
+        int rate = phyRateByName(name.as<String>());
+        if (rate < 0) {
+          sendJson(commandResult(result, 400, "Nieznana szybkość: " + name.as<String>()), doc);
+          return;
+        }
+        if (rateCount < PHY_RATE_COUNT) rates[rateCount++] = rate;
+      }
     } else {
-      server.send(500, "application/json", "{\"success\":false,\"error\":\"Błąd komunikacji z Walizka\"}");
+      for (int i = 0; i < PHY_RATE_COUNT; i++) rates[rateCount++] = i;
     }
+    int frames = constrain((int)(body["frames"] | 100), 10, PHY_BENCH_MAX_FRAMES);
+    int size = constrain((int)(body["size"] | 200), (int)sizeof(PhyBenchFrame), ESP_NOW_MAX_DATA_LEN);
+
+    memcpy(phyBench.mac, mac, 6);
+    phyBench.member = member;
+    phyBench.rateCount = rateCount;
+    phyBench.frames = frames;
+    phyBench.size = size;
+    phyBench.done = 0;
+    phyBench.durationMs = 0;
+    phyBench.startedAt = millis();
+    phyBench.active = true;
+    xTaskCreatePinnedToCore(phyBenchTask, "phyBench", 4096, NULL, 2, NULL, 1);
+    commandResult(result, 200, String("Pomiar łącza do ") + GROUP_MEMBER_IDS[member] + " w toku – wynik w /phy");
+    sendJson(202, doc);
   });
 
-  server.onNotFound([]() {
-    String message = "File Not Found\n\n";
-    message += "URI: " + server.uri() + "\n";
-    message += "Method: " + String((server.method() == HTTP_GET) ? "GET" : "POST") + "\n";
-    server.send(404, "text/plain", message);
+  server.on("/rooms", HTTP_GET, []() {
+    JsonDocument& doc = beginResponseDoc();
+    fillRoomsReport(doc.as<JsonObject>());
+    sendJson(200, doc);
   });
 
-  server.begin();
-  Serial.println("Serwer WWW uruchomiony na porcie 80");
-}
+  server.on("/room_command", HTTP_POST, []() {
+    handlePanelCommand("room_command", true);
+  });
 
-void listSPIFFSFiles() {
-  Serial.println("=== Pliki w SPIFFS ===");
-  File root = SPIFFS.open("/");
-  File file = root.openNextFile();
-  while (file) {
-    Serial.print("Plik: ");
-    Serial.print(file.name());
-    Serial.print(" (");
-    Serial.print(file.size());
-    Serial.println(" bajtów)");
-    file = root.openNextFile();
-  }
-  Serial.println("=====================");
-}
+  server.on("/groups", HTTP_GET, []() {
+    JsonDocument& doc = beginResponseDoc();
+    fillGroupReport(doc.as<JsonObject>());
+    sendJson(200, doc);
+  });
 
-String formatTimestamp(unsigned long timestamp) {
-  unsigned long seconds = timestamp / 1000;
-  unsigned long minutes = seconds / 60;
-  unsigned long hours = minutes / 60;
-  
-  seconds = seconds % 60;
-  minutes = minutes % 60;
-  hours = hours % 24;
+  server.on("/group_command", HTTP_POST, []() {
+    handlePanelCommand("group_command", true);
+  });
+
+  // === NOWE ENDPOINTY ZAGADEK ===
   
-  char timeStr[10];
-  sprintf(timeStr, "%02lu:%02lu:%02lu", hours, minutes, seconds);
-  return String(timeStr);
-}
+  server.on("/puzzle_status", HTTP_GET, []() {
+    JsonDocument& doc = beginResponseDoc();
+    fillPuzzleStatus(doc.as<JsonObject>(), true);
+    
+    sendJson(200, doc);
+  });
 
-bool sendAudioToGolab(String fileName) {
-  GolabMessage msg;
-  msg.command = "play_audio";
-  msg.data = fileName;
-  msg.timestamp = millis();
-  return sendToGolab(msg);
-}
+  server.on("/puzzle_command", HTTP_POST, []() {
+    handlePanelCommand("puzzle_command", true);
+  });
 
-bool sendCommandToGolab(String command, String data) {
-  GolabMessage msg;
+  // Pomiar ścieżki Master -> Podłoga: RTT ramka->ACK (tu) i wejście callbacku->GPIO (w węźle).
+  // {"channel":0,"count":20,"ms":200} – pomiar idzie w tle (202), wynik w GET /relay_bench.
+  // Przekaźnik klika przy każdej ramce, więc w trakcie gry tylko z {"force":true}
+  server.on("/relay_bench", HTTP_POST, []() {
+    parseRequestBody();
+    JsonDocument& body = requestDoc;
+    JsonDocument& doc = beginResponseDoc();
+    JsonObject result = doc.as<JsonObject>();
+
+    NodeLink* node = findNodeById("podloga");
+    if (relayBench.active) {
+      sendJson(commandResult(result, 409, "Pomiar przekaźnika już trwa"), doc);
+      return;
+    }
+    if (currentGame.isActive && !(body["force"] | false)) {
+      sendJson(commandResult(result, 409, "Gra w toku – pomiar przekaźnika tylko z force"), doc);
+      return;
+    }
+    if (!node->connected) {
+      sendJson(commandResult(result, 500, "Podłoga nie jest połączona"), doc);
+      return;
+    }
+    int channel = body["channel"] | 0;
+    if (channel < 0 || channel >= RELAY_CHANNEL_COUNT) {
+      sendJson(commandResult(result, 400, "Podłoga ma kanały 0-" + String(RELAY_CHANNEL_COUNT - 1)), doc);
+      return;
+    }
+
+    memset(&relayBench, 0, sizeof(relayBench));
+    relayBench.channel = channel;
+    relayBench.count = constrain((int)(body["count"] | 20), 1, 100);
+    relayBench.ms = constrain((long)(body["ms"] | 200L), 1L, (long)RELAY_MAX_MS);
+    relayBench.startedAt = millis();
+    relayBench.active = true;
+    xTaskCreatePinnedToCore(relayBenchTask, "relayBench", 3072, NULL, 2, NULL, 1);
+    commandResult(result, 200, "Pomiar przekaźnika w toku – wynik w GET /relay_bench");
+    sendJson(202, doc);
+  });
+
+  server.on("/relay_bench", HTTP_GET, []() {
+    JsonDocument& doc = beginResponseDoc();
+    fillRelayBenchReport(doc.as<JsonObject>());
+    sendJson(200, doc);
+  });
+
+  server.on("/audio_files", HTTP_GET, []() {
+    // Odpowiedź z cache – bez zapytania radiowego do Gołąb
+    JsonDocument& doc = beginResponseDoc();
+    DynamicJsonDocument manifest(1024);
+    deserializeJson(manifest, audioManifest);
+
+    doc["success"] = true;
+    JsonArray files = doc.createNestedArray("files");
+    for (JsonPair kv : manifest.as<JsonObject>()) {
+      char entry[40];
+      snprintf(entry, sizeof(entry), "%s (%03d.mp3)", kv.key().c_str(), kv.value().as<int>());
+      files.add(entry);
+    }
+    doc["manifest"] = manifest.as<JsonObject>();
+    doc["manifest_hash"] = String(audioManifestHash, HEX);
+
+    JsonObject golab = doc.createNestedObject("nodes").createNestedObject("golab");
+    golab["connected"] = golabConnected;
+    golab["synced"] = golabCatalog.valid && golabCatalog.manifestHash == audioManifestHash;
+    if (golabCatalog.valid) {
+      golab["sd_files"] = golabCatalog.sdFiles;
+      golab["entries"] = golabCatalog.entries;
+      golab["age_ms"] = millis() - golabCatalog.updated;
+      JsonArray folders = golab.createNestedArray("folders");
+      for (int f = 0; f < golabCatalog.folderCount; f++) folders.add(golabCatalog.folderFiles[f]);
+    }
+
+    sendJson(200, doc);
+  });
+
+  server.on("/audio_files", HTTP_POST, []() {
+    if (server.hasArg("plain")) {
+      if (!parseRequestBody()) {
+        server.send(400, "application/json", "{\"success\":false,\"error\":\"Niepoprawny JSON\"}");
+        return;
+      }
+
+      String error;
+      if (updateAudioManifest(requestDoc.as<JsonObject>(), error)) {
+        server.send(200, "application/json", "{\"success\":true,\"message\":\"Manifest audio zapisany\"}");
+      } else {
+        JsonDocument& response = beginResponseDoc();
+        response["success"] = false;
+        response["error"] = error;
+        sendJson(400, response);
+      }
+    } else {
+      server.send(400, "application/json", "{\"success\":false,\"error\":\"Brak danych\"}");
+    }
+  });
+
+  server.on("/puzzle_config", HTTP_GET, []() {
+    JsonDocument& doc = beginResponseDoc();
+    deserializeJson(doc, puzzleConfigBlob);
+    doc["hash"] = String(puzzleConfigHash, HEX);
+    JsonObject sync = doc.createNestedObject("sync");
+    sync["golab"] = (golabConfigHash == puzzleConfigHash);
+    sync["walizka"] = (walizkaConfigHash == puzzleConfigHash);
+
+    sendJson(200, doc);
+  });
+
+  server.on("/puzzle_config", HTTP_POST, []() {
+    if (server.hasArg("plain")) {
+      if (!parseRequestBody()) {
+        server.send(400, "application/json", "{\"success\":false,\"error\":\"Niepoprawny JSON\"}");
+        return;
+      }
+
+      String error;
+      JsonDocument& response = beginResponseDoc();
+      if (updatePuzzleConfig(requestDoc.as<JsonObject>(), error)) {
+        response["success"] = true;
+        response["version"] = puzzleConfig.version;
+        response["hash"] = String(puzzleConfigHash, HEX);
+        sendJson(200, response);
+      } else {
+        response["success"] = false;
+        response["error"] = error;
+        sendJson(400, response);
+      }
+    } else {
+      server.send(400, "application/json", "{\"success\":false,\"error\":\"Brak danych\"}");
+    }
+  });
+
+  server.on("/config", HTTP_GET, []() {
+    JsonDocument& doc = beginResponseDoc();
+    doc["ap_ssid"] = masterConfig.apSsid;
+    doc["ap_password_set"] = masterConfig.apPassword[0] != '\0';   // samo hasło tylko do zapisu
+    doc["golab_mac"] = formatMac(masterConfig.golabMac);
+    doc["walizka_mac"] = formatMac(masterConfig.walizkaMac);
+    doc["heartbeat_timeout"] = masterConfig.heartbeatTimeout;
+    doc["heartbeat_interval"] = masterConfig.heartbeatInterval;
+    JsonObject zones = doc.createNestedObject("zones");
+    for (int i = 0; i < GROUP_MEMBER_COUNT; i++) zones[GROUP_MEMBER_IDS[i]] = masterConfig.zones[i];
+    doc["room_id"] = masterConfig.roomId;
+    doc["room_role"] = ROOM_ROLE_NAMES[masterConfig.roomRole];
+    doc["aggregator_mac"] = formatMac(masterConfig.aggregatorMac);
+    JsonArray roomMembers = doc.createNestedArray("room_members");
+    for (int i = 0; i < masterConfig.roomMemberCount; i++) roomMembers.add(formatMac(masterConfig.roomMembers[i]));
+    doc["sta_mac"] = WiFi.macAddress();
+    doc["ha_role"] = HA_ROLE_NAMES[masterConfig.haRole];
+    doc["ha_peer_mac"] = formatMac(masterConfig.haPeerMac);
+    doc["ha_key_set"] = masterConfig.haKeySet;
+    doc["channel"] = masterConfig.channel;
+    doc["channel_auto"] = masterConfig.channelAuto;
+    JsonObject phy = doc.createNestedObject("phy");
+    for (int i = 0; i < GROUP_MEMBER_COUNT; i++) {
+      uint8_t mode = masterConfig.phyModes[i];
+      phy[GROUP_MEMBER_IDS[i]] = mode == PHY_MODE_AUTO ? "auto" : PHY_RATES[mode].name;
+    }
+    doc["boot_ms"] = bootTimeMs;
+    doc["config_load_us"] = configLoadUs;
+
+    sendJson(200, doc);
+  });
+
+  server.on("/config", HTTP_PUT, []() {
+    if (server.hasArg("plain")) {
+      if (!parseRequestBody()) {
+        server.send(400, "application/json", "{\"success\":false,\"error\":\"Niepoprawny JSON\"}");
+        return;
+      }
+
+      String error;
+      if (applyMasterConfig(requestDoc.as<JsonObject>(), error)) {
+        server.send(200, "application/json", "{\"success\":true,\"message\":\"Konfiguracja zastosowana\"}");
+      } else {
+        JsonDocument& response = beginResponseDoc();
+        response["success"] = false;
+        response["error"] = error;
+        sendJson(400, response);
+      }
+    } else {
+      server.send(400, "application/json", "{\"success\":false,\"error\":\"Brak danych\"}");
+    }
+  });
+
+  server.on("/restart_slave3", HTTP_POST, []() {
+    if (sendCommandToWalizka("restart", "slave3_restart")) {
+      server.send(200, "application/json", "{\"success\":true,\"message\":\"Restart wysłany do Walizka\"}");
+    } else {
+      server.send(500, "application/json", "{\"success\":false,\"error\":\"Błąd komunikacji z Walizka\"}");
+    }
+  });
+
+  // === PLIKI PANELU (LittleFS) ===
+
+  // Multipart: /upload?path=/index.html&sha256=<hex>; bez "path" używana jest nazwa pliku
+  server.on("/upload", HTTP_POST, []() {
+    JsonDocument& doc = beginResponseDoc();
+    doc["success"] = !fsUpload.failed;
+    if (fsUpload.failed) doc["error"] = (const char*)fsUpload.error;
+    doc["path"] = fsUpload.path;
+    doc["size"] = fsUpload.size;
+    doc["sha256"] = fsUpload.hash;
+    doc["upload_ms"] = fsUpload.ms;
+    doc["upload_kbps"] = fsUpload.ms > 0 ? (float)fsUpload.size / 1.024f / fsUpload.ms : 0;
+    sendJson(fsUpload.failed ? 400 : 200, doc);
+  }, handleFsUpload);
+
+  server.on("/files", HTTP_GET, []() {
+    JsonDocument& doc = beginResponseDoc();
+    doc["success"] = true;
+    doc["total"] = LittleFS.totalBytes();
+    doc["used"] = LittleFS.usedBytes();
+    JsonArray files = doc.createNestedArray("files");
+    File root = LittleFS.open("/");
+    File file = root.openNextFile();
+    while (file) {
+      JsonObject entry = files.createNestedObject();
+      String name = file.name();
+      entry["path"] = name.startsWith("/") ? name : "/" + name;
+      entry["size"] = file.size();
+      file = root.openNextFile();
+    }
+    sendJson(200, doc);
+  });
+
+  // === OTA SLAVE'ÓW ===
+
+  // Obraz firmware (multipart) zapisywany strumieniowo do nieaktywnej partycji OTA Mastera
+  server.on("/ota_upload", HTTP_POST, []() {
+    JsonDocument& doc = beginResponseDoc();
+    doc["success"] = ota.imageReady && !ota.uploadFailed;
+    if (ota.uploadFailed) doc["error"] = (const char*)ota.error;
+    doc["size"] = ota.imageSize;
+    doc["crc"] = String(ota.imageCrc, HEX);
+    doc["upload_ms"] = ota.uploadMs;
+    doc["upload_kbps"] = ota.uploadMs > 0 ? (float)ota.imageSize / 1.024f / ota.uploadMs : 0;
+    sendJson(ota.uploadFailed ? 400 : 200, doc);
+  }, handleOtaUpload);
+
+  server.on("/ota_start", HTTP_POST, []() {
+    parseRequestBody();
+    String node = requestDoc["node"] | "";
+    JsonDocument& doc = beginResponseDoc();
+    JsonObject result = doc.as<JsonObject>();
+
+    if (ota.running) {
+      sendJson(commandResult(result, 409, "Transfer OTA już trwa"), doc);
+      return;
+    }
+    if (phyBench.active) {
+      sendJson(commandResult(result, 409, "Trwa pomiar łącza"), doc);
+      return;
+    }
+    // Transfer zajmuje radio na dziesiątki sekund, a węzeł po flashu restartuje się
+    if (currentGame.isActive && !(requestDoc["force"] | false)) {
+      sendJson(commandResult(result, 409, "Gra w toku – OTA tylko z force"), doc);
+      return;
+    }
+    if (!ota.imageReady) {
+      sendJson(commandResult(result, 400, "Brak obrazu – najpierw /ota_upload"), doc);
+      return;
+    }
+    if (!resolveOtaTarget(node, ota.mac)) {
+      sendJson(commandResult(result, 400, "Węzeł nieznany albo niepołączony"), doc);
+      return;
+    }
+
+    ota.node = node;
+    ota.running = true;
+    ota.state = "begin";
+    ota.error[0] = '\0';
+    xTaskCreatePinnedToCore(otaSendTask, "otaSend", 4096, NULL, 3, NULL, 1);
+    sendJson(commandResult(result, 200, "Transfer OTA do " + node + " rozpoczęty"), doc);
+  });
+
+  server.on("/ota_abort", HTTP_POST, []() {
+    ota.running = false;
+    server.send(200, "application/json", "{\"success\":true}");
+  });
+
+  server.on("/ota_status", HTTP_GET, []() {
+    JsonDocument& doc = beginResponseDoc();
+    uint32_t done = otaAckOffset;
+    unsigned long elapsed = (ota.running ? millis() : ota.endMs) - ota.startMs;
+    doc["state"] = ota.state ? ota.state : "idle";
+    doc["node"] = ota.node;
+    doc["image_ready"] = ota.imageReady;
+    doc["size"] = ota.imageSize;
+    doc["crc"] = String(ota.imageCrc, HEX);
+    doc["offset"] = done;
+    doc["percent"] = ota.imageSize > 0 ? done * 100 / ota.imageSize : 0;
+    doc["resumed_from"] = ota.resumedFrom;
+    doc["retransmits"] = ota.retransmits;
+    doc["elapsed_ms"] = ota.startMs > 0 ? elapsed : 0;
+    doc["kbps"] = (ota.startMs > 0 && elapsed > 0) ? (float)(done - ota.resumedFrom) / 1.024f / elapsed : 0;
+    if (ota.error[0]) doc["error"] = (const char*)ota.error;
+    sendJson(200, doc);
+  });
+
+  server.onNotFound([]() {
+    String message = "File Not Found\n\n";
+    message += "URI: " + server.uri() + "\n";
+    message += "Method: " + String((server.method() == HTTP_GET) ? "GET" : "POST") + "\n";
+    server.send(404, "text/plain", message);
+  });
+
+  const char* headerKeys[] = { "If-None-Match", "Accept-Encoding" };
+  server.collectHeaders(headerKeys, 2);
+  server.begin();
+  Serial.println("Serwer WWW uruchomiony na porcie 80");
+}
+
+// Migracja SPIFFS → LittleFS: partycja "spiffs" z firmware sprzed LittleFS ma inny format i nie da się
+// jej zamontować jako LittleFS. Formatujemy tylko wtedy, zawsze z wpisem w logu. Starych plików nie
+// przenosimy (ten sam obszar flash, brak miejsca na kopię) – index.html i dźwięki trzeba wgrać
+// ponownie: web_build.py albo POST /upload. Konfiguracja Mastera leży w NVS i migracji nie wymaga.
+bool mountFs() {
+  if (LittleFS.begin(false)) return true;
+
+  if (SPIFFS.begin(false)) {
+    Serial.println("LittleFS: na partycji jest SPIFFS (" + String(SPIFFS.usedBytes()) +
+                   " B zajęte) – formatuję jako LittleFS, pliki panelu trzeba wgrać ponownie");
+    SPIFFS.end();
+  } else {
+    Serial.println("LittleFS: partycja pusta albo uszkodzona – formatuję");
+  }
+  if (!LittleFS.format()) return false;
+  return LittleFS.begin(false);
+}
+
+void listFsFiles() {
+  Serial.println("=== Pliki w LittleFS ===");
+  File root = LittleFS.open("/");
+  File file = root.openNextFile();
+  while (file) {
+    Serial.print("Plik: ");
+    Serial.print(file.name());
+    Serial.print(" (");
+    Serial.print(file.size());
+    Serial.println(" bajtów)");
+    file = root.openNextFile();
+  }
+  Serial.println("=====================");
+}
+
+String formatTimestamp(unsigned long timestamp) {
+  unsigned long seconds = timestamp / 1000;
+  unsigned long minutes = seconds / 60;
+  unsigned long hours = minutes / 60;
+  
+  seconds = seconds % 60;
+  minutes = minutes % 60;
+  hours = hours % 24;
+  
+  char timeStr[10];
+  sprintf(timeStr, "%02lu:%02lu:%02lu", hours, minutes, seconds);
+  return String(timeStr);
+}
+
+bool sendAudioToGolab(String fileName, bool queued) {
+  // queue_audio dopisuje plik do playlisty Gołąb zamiast przerywać bieżący
+  GolabMessage msg;
+  msg.command = queued ? "queue_audio" : "play_audio";
+  msg.data = fileName;
+  msg.timestamp = millis();
+  return sendToGolab(msg);
+}
+
+bool sendCommandToGolab(String command, String data) {
+  GolabMessage msg;
   msg.command = command;
   msg.data = data;
   msg.timestamp = millis();
@@ -490,8 +1859,9 @@ bool sendToWalizka(GolabMessage& message) {
   if (len > 249) len = 249;
   serialized.getBytes(data, len + 1);
   
-  esp_err_t result = esp_now_send(walizka_mac, data, len);
+  esp_err_t result = espNowSend(masterConfig.walizkaMac, data, len);
   if (result == ESP_OK) {
+    watchDelivery(masterConfig.walizkaMac);
     Serial.println("Wiadomość wysłana do Walizka: " + message.command);
     return true;
   } else {
@@ -499,6 +1869,45 @@ bool sendToWalizka(GolabMessage& message) {
     return false;
   }
 }
+bool sendCommandToNode(NodeLink& node, String command, String data) {
+  if (!node.connected) {
+    Serial.println(String(node.label) + " nie jest połączony");
+    return false;
+  }
+
+  String serialized = command + "|" + data + "|" + String(millis());
+  uint8_t buf[250];
+  size_t len = serialized.length();
+  if (len > 249) len = 249;
+  serialized.getBytes(buf, len + 1);
+
+  esp_err_t result = espNowSend(node.mac, buf, len);
+  if (result == ESP_OK) {
+    watchDelivery(node.mac);
+    Serial.println("Wiadomość wysłana do " + String(node.label) + ": " + command);
+    return true;
+  } else {
+    Serial.println("Błąd wysyłania do " + String(node.label));
+    return false;
+  }
+}
+
+int sendRelayFrame(NodeLink& node, uint8_t channel, uint8_t mode, uint32_t argMs) {
+  if (!node.connected) return -1;
+
+  RelayFrame frame;
+  frame.magic = RELAY_FRAME_MAGIC;
+  frame.seq = ++relaySeq;
+  frame.channel = channel;
+  frame.mode = mode;
+  frame.argMs = argMs;
+  frame.check = relayFrameCheck((const uint8_t*)&frame, sizeof(frame) - 1);
+
+  if (espNowSend(node.mac, (const uint8_t*)&frame, sizeof(frame)) != ESP_OK) return -1;
+  watchDelivery(node.mac);
+  return frame.seq;
+}
+
 bool sendToGolab(GolabMessage& message) {
   if (!golabConnected) {
     Serial.println("Gołąb nie jest połączony");
@@ -511,8 +1920,9 @@ bool sendToGolab(GolabMessage& message) {
   if (len > 249) len = 249;
   messageData.getBytes(data, len + 1);
   
-  esp_err_t result = esp_now_send(golab_mac, data, len);
+  esp_err_t result = espNowSend(masterConfig.golabMac, data, len);
   if (result == ESP_OK) {
+    watchDelivery(masterConfig.golabMac);
     Serial.println("Wiadomość wysłana do Gołąb: " + message.command);
     return true;
   } else {
@@ -522,6 +1932,28 @@ bool sendToGolab(GolabMessage& message) {
 }
 
 void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status) {
+  resolveDelivery(mac_addr, status == ESP_NOW_SEND_SUCCESS);
+  portENTER_CRITICAL(&phyMux);
+  phyInFlight--;
+  portEXIT_CRITICAL(&phyMux);
+  int member = phyMemberByMac(mac_addr);
+  if (member >= 0) {
+    phyPeers[member].sent++;
+    if (status != ESP_NOW_SEND_SUCCESS) phyPeers[member].failed++;
+  }
+  if (phyBench.active && memcmp(mac_addr, phyBench.mac, 6) == 0) {
+    phyBench.sentOk = status == ESP_NOW_SEND_SUCCESS;
+    phyBench.sentDone = true;
+  }
+  bool toStandby = ha.role == HA_PRIMARY && memcmp(mac_addr, ha.standbyMac, 6) == 0;
+  if (!toStandby && memcmp(mac_addr, BROADCAST_MAC, 6) != 0) {
+    // Straty na bieżącym kanale – tylko unicasty do slave'ów, rozgłoszenie nie ma ACK w warstwie MAC
+    ChannelLink& link = channelLinks[radioChannel];
+    link.sent++;
+    if (status != ESP_NOW_SEND_SUCCESS) link.failed++;
+  }
+  if (ota.running) return;   // tysiące paczek OTA – log z każdej spowalniałby transfer
+  if (toStandby) return;     // heartbeat co 200 ms
   if (status == ESP_NOW_SEND_SUCCESS) {
     Serial.println("ESP-NOW: Wysłano pomyślnie do Gołąb");
   } else {
@@ -530,6 +1962,62 @@ void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status) {
 }
 
 void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
+  if (radioTask == NULL) radioTask = xTaskGetCurrentTaskHandle();
+  if (len >= 2 && incomingData[0] == HA_FRAME_MAGIC) {
+    haHandleFrame(mac, incomingData, len);
+    return;
+  }
+  if (ha.role == HA_STANDBY) return;
+  if (ha.tookOver && ha.rehomeMs == 0) ha.rehomeMs = millis();
+
+  if (len == sizeof(PhyBenchFrame) && incomingData[0] == PHY_FRAME_MAGIC) {
+    const PhyBenchFrame* pong = (const PhyBenchFrame*)incomingData;
+    if (pong->type == PHY_BENCH_PONG) {
+      phyBench.pongUs = micros();
+      phyBench.pongSeq = pong->seq;
+      phyBench.pongRate = pong->rate;
+      phyBench.pongReady = true;
+    }
+    return;
+  }
+
+  if (len == sizeof(HealthRecord) && incomingData[0] == HEALTH_FRAME_MAGIC) {
+    handleHealthRecord(mac, (const HealthRecord*)incomingData);
+    return;
+  }
+
+  if (len == sizeof(ChannelFrame) && incomingData[0] == CHANNEL_FRAME_MAGIC) {
+    if (incomingData[1] == CHANNEL_PROBE) answerChannelProbe();
+    return;
+  }
+
+  // ACK ramki przekaźnika – bez konwersji do String, żeby nie zawyżać pomiaru RTT
+  if (len == sizeof(RelayAck) && incomingData[0] == RELAY_ACK_MAGIC) {
+    const RelayAck* ack = (const RelayAck*)incomingData;
+    relayAckUs = micros();
+    relayAckSeq = ack->seq;
+    relayAckStatus = ack->status;
+    relayAckOutputs = ack->outputs;
+    relayAckNs = ack->rxToGpioNs;
+    relayAckReady = true;
+    return;
+  }
+
+  if (len == sizeof(GroupAck) && incomingData[0] == GROUP_ACK_MAGIC) {
+    handleGroupAck(mac, (const GroupAck*)incomingData);
+    return;
+  }
+
+  if (len >= 2 && incomingData[0] == ROOM_FRAME_MAGIC) {
+    handleRoomFrame(mac, incomingData, len);
+    return;
+  }
+
+  if (len == sizeof(OtaReplyFrame) && incomingData[0] == OTA_MAGIC) {
+    handleOtaReply(mac, (const OtaReplyFrame*)incomingData);
+    return;
+  }
+
   String receivedData = "";
   for (int i = 0; i < len; i++) {
     receivedData += (char)incomingData[i];
@@ -538,7 +2026,7 @@ void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
   // Sprawdź od którego urządzenia przyszła wiadomość
   bool fromGolab = true;
   for (int i = 0; i < 6; i++) {
-    if (mac[i] != golab_mac[i]) {
+    if (mac[i] != masterConfig.golabMac[i]) {
       fromGolab = false;
       break;
     }
@@ -548,7 +2036,7 @@ void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
   if (!fromGolab) {
     fromWalizka = true;
     for (int i = 0; i < 6; i++) {
-      if (mac[i] != walizka_mac[i]) {
+      if (mac[i] != masterConfig.walizkaMac[i]) {
         fromWalizka = false;
         break;
       }
@@ -564,7 +2052,7 @@ void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
     walizkaConnected = true;
     lastWalizkaHeartbeat = millis();
   } else {
-    Serial.println("Otrzymano od nieznanego urządzenia: " + receivedData);
+    handleNodeFrame(mac, receivedData);
     return;
   }
   
@@ -592,7 +2080,9 @@ void handleWalizkaMessage(String command, String data) {
     DeserializationError error = deserializeJson(doc, data);
     
     if (!error) {
-      walizkaState.stage = doc["stage"] | "WAITING_TAG1";
+      String stage = doc["stage"] | "WAITING_TAG1";
+      if (stage != walizkaState.stage) queueRoomEvent("stage:walizka:" + stage);
+      walizkaState.stage = stage;
       walizkaState.tag1Used = doc["tag1_used"] | false;
       walizkaState.tag2Allowed = doc["tag2_allowed"] | false;
       walizkaState.tag2Used = doc["tag2_used"] | false;
@@ -667,6 +2157,9 @@ void handleWalizkaMessage(String command, String data) {
   } else if (command == "lock_opened") {
     Serial.println("Walizka: Zamek otwarty");
     
+  } else if (command == "config_ack") {
+    handleConfigAck("walizka", data);
+
   } else if (command == "heartbeat") {
     Serial.println("Heartbeat od Walizka");
     
@@ -682,15 +2175,30 @@ void handleGolabMessage(String command, String data) {
     Serial.println("🔔 HINT REQUEST od Gołąb!");
     hintRequested = true;
     hintRequestTime = millis();
-    blinkLED(5, 100);
+    hintRequestCount++;
+    ledPlay(LED_HINT);
+    queueRoomEvent("hint_request");
   } else if (command == "status") {
     Serial.println("Status Gołąb: " + data);
   } else if (command == "audio_finished") {
     Serial.println("Gołąb zakończył odtwarzanie audio");
+  } else if (command == "audio_catalog") {
+    handleAudioCatalog(data);
+  } else if (command == "audio_stats") {
+    golabAudioStats = data;
+  } else if (command == "hint_latency") {
+    int sep = data.indexOf(':');
+    if (sep > 0) {
+      hintThresholdToSendUs = data.substring(0, sep).toInt();
+      hintSendToAckUs = data.substring(sep + 1).toInt();
+      Serial.println("⏱️ Opóźnienie podpowiedzi: " + String(hintThresholdToSendUs + hintSendToAckUs) + " us od progu do Mastera");
+    }
   } else if (command == "volume_set") {
     Serial.println("Gołąb: głośność ustawiona na " + data);
   } else if (command == "error") {
     Serial.println("Błąd Gołąb: " + data);
+  } else if (command == "config_ack") {
+    handleConfigAck("golab", data);
   } else if (command == "heartbeat") {
     Serial.println("Heartbeat od Gołąb");
   } else {
@@ -699,97 +2207,3876 @@ void handleGolabMessage(String command, String data) {
 }
 
 bool startGame(JsonObject gameData) {
+  // Druga tabletka klikająca "start" w trakcie gry nie może jej zrestartować
+  if (currentGame.isActive) return false;
+
+  resetGameSession();
   currentGame.sessionId = gameData["sessionId"] | String(millis());
   currentGame.groupName = gameData["groupName"] | "Unknown";
   currentGame.playerCount = gameData["playerCount"] | 4;
   currentGame.isTestGame = gameData["isTestGame"] | false;
+  currentGame.gameTimeMs = gameData["gameTimeMs"] | 0;
   currentGame.isActive = true;
-  currentGame.isPaused = false;
   currentGame.startTime = millis();
+  currentGame.state = "active";
+  snapshotDirty = true;
+  journalLogStart();
   
   Serial.println("Rozpoczynanie gry: " + currentGame.groupName);
-  sendCommandToGolab("start_game", currentGame.groupName);
+  announceGameState(sendGroupCommand("role:game", "start_game", currentGame.groupName));
+  queueRoomEvent("game:start:" + currentGame.groupName);
   return true;
 }
 
+// Docelowy stan zamiast przełącznika – dwie tabletki wysyłające to samo nie odwracają pauzy
 bool pauseGame(bool paused) {
   if (!currentGame.isActive) return false;
+  if (currentGame.isPaused == paused) return true;
   
+  unsigned long now = millis();
+  if (paused) {
+    currentGame.pausedAt = now;
+  } else {
+    currentGame.pausedTotalMs += now - currentGame.pausedAt;
+    currentGame.pausedAt = 0;
+  }
   currentGame.isPaused = paused;
+  currentGame.state = paused ? "paused" : "active";
+  snapshotDirty = true;
+  journalLog(paused ? JRN_PAUSE : JRN_RESUME);
   Serial.println(paused ? "Gra wstrzymana" : "Gra wznowiona");
-  sendCommandToGolab(paused ? "pause_game" : "resume_game", "");
+  announceGameState(sendGroupCommand("role:game", paused ? "pause_game" : "resume_game", ""));
+  queueRoomEvent(paused ? "game:pause" : "game:resume");
   return true;
 }
 
 bool endGame(String status) {
   if (!currentGame.isActive) return false;
   
-  Serial.println("Kończenie gry ze statusem: " + status);
-  sendCommandToGolab("end_game", status);
-  resetGameSession();
+  unsigned long now = millis();
+  if (currentGame.isPaused) currentGame.pausedTotalMs += now - currentGame.pausedAt;
+  currentGame.endedAt = now;
+  currentGame.pausedAt = 0;
+  currentGame.isActive = false;
+  currentGame.isPaused = false;
+  currentGame.state = "finished";
+  currentGame.endStatus = status;
+  snapshotDirty = true;
+  journalLogEnd();
+  journal.compactPending = true;   // sesja zamknięta – stare rekordy do usunięcia
+
+  // Wynik zostaje widoczny na wszystkich tabletach do następnego startu
+  Serial.println("Kończenie gry ze statusem: " + status + " po " + formatTimestamp(gameElapsedMs(now)));
+  announceGameState(sendGroupCommand("role:game", "end_game", status));
+  queueRoomEvent("game:end:" + status);
   return true;
 }
 
-void checkGolabConnection() {
-  // Sprawdź połączenie z Gołąb
-  if (golabConnected && (millis() - lastGolabHeartbeat > HEARTBEAT_TIMEOUT)) {
-    golabConnected = false;
-    Serial.println("Utracono połączenie z Gołąb");
+unsigned long gameElapsedMs(unsigned long now) {
+  if (currentGame.state == "idle") return 0;
+  unsigned long end = now;
+  if (currentGame.state == "finished") end = currentGame.endedAt;
+  else if (currentGame.isPaused) end = currentGame.pausedAt;
+  return end - currentGame.startTime - currentGame.pausedTotalMs;
+}
+
+// Sekcja "game" w /snapshot. Zawiera tylko wartości zmieniające się przy zmianie stanu,
+// więc wersja rośnie wyłącznie przy zdarzeniach. Czas trwającej gry klient liczy z zegara
+// Mastera: elapsed = uptime (ze snapshotu) - anchor_ms.
+void fillGameSession(JsonObject doc) {
+  doc["state"] = currentGame.state;
+  if (currentGame.state == "idle") return;
+
+  bool running = currentGame.state == "active";
+  doc["session_id"] = currentGame.sessionId;
+  doc["group"] = currentGame.groupName;
+  doc["players"] = currentGame.playerCount;
+  doc["test"] = currentGame.isTestGame;
+  doc["started_at"] = (long)currentGame.startTime;   // po odtworzeniu z dziennika może być ujemne
+  doc["game_time_ms"] = currentGame.gameTimeMs;
+  doc["hints_used"] = currentGame.hintsUsed;
+  doc["paused_total_ms"] = currentGame.pausedTotalMs;
+  doc["running"] = running;
+  if (running) {
+    doc["anchor_ms"] = (long)(currentGame.startTime + currentGame.pausedTotalMs);
+  } else {
+    doc["elapsed_ms"] = gameElapsedMs(millis());
   }
-  
-  // Sprawdź połączenie z Walizka
-  if (walizkaConnected && (millis() - lastWalizkaHeartbeat > HEARTBEAT_TIMEOUT)) {
-    walizkaConnected = false;
-    Serial.println("Utracono połączenie z Walizka");
+  if (currentGame.state == "finished") doc["end_status"] = currentGame.endStatus;
+
+  JsonObject stages = doc.createNestedObject("stages");
+  stages["walizka"] = walizkaState.stage;
+  for (int i = 0; i < NODE_LINK_COUNT; i++) {
+    if (nodeLinks[i].registered) stages[nodeLinks[i].id] = nodeLinks[i].stage;
   }
-  
-  // Wysyłaj heartbeaty co 10 sekund
-  static unsigned long lastHeartbeat = 0;
-  if (millis() - lastHeartbeat > 10000) {
-    if (golabConnected) {
-      sendCommandToGolab("heartbeat", "master_ping");
-    }
-    if (walizkaConnected) {
-      sendCommandToWalizka("heartbeat", "master_ping");
-    }
-    lastHeartbeat = millis();
+}
+
+// === DZIENNIK SESJI ===
+
+uint32_t journalSectorBit(int sector) {
+  return 1UL << sector;
+}
+
+uint32_t journalRecordCrc(const JournalRecord& rec) {
+  return crc32_le(0, (const uint8_t*)&rec, offsetof(JournalRecord, crc));
+}
+
+JournalSlot journalRead(int slot, JournalRecord& rec) {
+  if (esp_partition_read(journal.part, slot * JOURNAL_SLOT_SIZE, &rec, JOURNAL_SLOT_SIZE) != ESP_OK) {
+    return JSLOT_BROKEN;
+  }
+  if (rec.magic == JOURNAL_MAGIC && rec.version == JOURNAL_VERSION && rec.crc == journalRecordCrc(rec)) {
+    return JSLOT_VALID;
   }
+  const uint8_t* bytes = (const uint8_t*)&rec;
+  for (size_t i = 0; i < JOURNAL_SLOT_SIZE; i++) {
+    if (bytes[i] != 0xFF) return JSLOT_BROKEN;
+  }
+  return JSLOT_ERASED;
 }
 
-void resetGameSession() {
-  currentGame.sessionId = "";
-  currentGame.groupName = "";
-  currentGame.playerCount = 0;
-  currentGame.isTestGame = false;
-  currentGame.isActive = false;
-  currentGame.isPaused = false;
-  currentGame.startTime = 0;
+// Obcięcie tekstu do pola o stałym rozmiarze bez urywania znaku UTF-8 (nazwy grup mają polskie litery)
+void copyUtf8Text(char* dst, size_t size, const String& src) {
+  strlcpy(dst, src.c_str(), size);
+  if (src.length() < size) return;
+  size_t n = strlen(dst);
+  while (n > 0 && ((uint8_t)dst[n - 1] & 0xC0) == 0x80) n--;
+  if (n > 0 && ((uint8_t)dst[n - 1] & 0x80)) n--;
+  dst[n] = '\0';
 }
 
-void resetWalizkaState() {
-  walizkaState.stage = "WAITING_TAG1";
-  walizkaState.tag1Used = false;
-  walizkaState.tag2Allowed = false;
-  walizkaState.tag2Used = false;
-  walizkaState.relayState = false;
-  walizkaState.enteredCodeLength = 0;
-  walizkaState.stageTime = 0;
-  walizkaState.codesCount = 0;
-  walizkaState.lastUpdate = 0;
-  
-  for (int i = 0; i < 10; i++) {
-    walizkaState.digitStats[i] = 0;
-    if (i < 10) {
-      walizkaState.codesHistory[i] = "";
-    }
+bool journalEraseSector(int sector) {
+  unsigned long t = micros();
+  esp_err_t err = esp_partition_erase_range(journal.part, sector * JOURNAL_SECTOR_SIZE, JOURNAL_SECTOR_SIZE);
+  journal.lastEraseUs = micros() - t;
+  if (journal.lastEraseUs > journal.maxEraseUs) journal.maxEraseUs = journal.lastEraseUs;
+  journal.erases++;
+  journal.eraseMask &= ~journalSectorBit(sector);
+  if (err != ESP_OK) {
+    journal.errors++;
+    return false;
   }
+  journal.cleanSectors |= journalSectorBit(sector);
+  return true;
 }
 
-void blinkLED(int times, int delayMs) {
-  for (int i = 0; i < times; i++) {
-    digitalWrite(2, HIGH);
-    delay(delayMs);
-    digitalWrite(2, LOW);
-    delay(delayMs);
+void journalCheckpoint();
+
+// Zapis gotowego rekordu (typ, czas gry i treść wypełnione) – numer i CRC nadawane tutaj
+bool journalWrite(JournalRecord& rec) {
+  if (journal.part == NULL) return false;
+
+  int sector = journal.head / JOURNAL_SLOTS_PER_SECTOR;
+  if (journal.head % JOURNAL_SLOTS_PER_SECTOR == 0) {
+    // Wejście w nowy sektor: zwykle skasowany już przy kompakcji, inaczej kasowanie tutaj
+    if (!(journal.cleanSectors & journalSectorBit(sector)) && !journalEraseSector(sector)) return false;
+    // Następny sektor trzyma START bieżącej sesji – zanim pierścień go nadpisze, sesja
+    // zostanie przepisana tutaj
+    int next = (sector + 1) % journal.sectors;
+    if (journal.baseSlot >= 0 && journal.baseSlot / JOURNAL_SLOTS_PER_SECTOR == next) {
+      journal.checkpointPending = true;
+    }
   }
-}
\ No newline at end of file
+
+  rec.magic = JOURNAL_MAGIC;
+  rec.version = JOURNAL_VERSION;
+  rec.seq = journal.nextSeq;
+  rec.crc = journalRecordCrc(rec);
+
+  unsigned long t = micros();
+  esp_err_t err = esp_partition_write(journal.part, journal.head * JOURNAL_SLOT_SIZE, &rec, JOURNAL_SLOT_SIZE);
+  uint32_t us = micros() - t;
+  journal.cleanSectors &= ~journalSectorBit(sector);
+
+  int slot = journal.head;
+  journal.head = (journal.head + 1) % journal.slots;
+  if (err != ESP_OK) {
+    journal.errors++;          // slot zostaje zepsuty – odtwarzanie go pominie
+    return false;
+  }
+
+  journal.nextSeq++;
+  journal.records++;
+  journal.lastWriteUs = us;
+  journal.totalWriteUs += us;
+  if (us > journal.maxWriteUs) journal.maxWriteUs = us;
+  journal.lastWriteMs = millis();
+  if (rec.type == JRN_START) journal.baseSlot = slot;
+  haReplicateRecord(rec);
+
+  if (journal.checkpointPending && !journal.checkpointing) journalCheckpoint();
+  return true;
+}
+
+bool journalAppend(JournalRecord& rec, uint8_t type) {
+  rec.type = type;
+  rec.elapsedMs = gameElapsedMs(millis());
+  return journalWrite(rec);
+}
+
+void journalLog(uint8_t type) {
+  JournalRecord rec;
+  memset(&rec, 0, sizeof(rec));
+  journalAppend(rec, type);
+}
+
+void journalLogStart() {
+  JournalRecord rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.start.gameTimeMs = currentGame.gameTimeMs;
+  rec.start.players = constrain(currentGame.playerCount, 0, 255);
+  rec.start.test = currentGame.isTestGame;
+  copyUtf8Text(rec.start.sessionId, sizeof(rec.start.sessionId), currentGame.sessionId);
+  copyUtf8Text(rec.start.group, sizeof(rec.start.group), currentGame.groupName);
+  // Etapy sprzed START nie są odtwarzane – journalService() zapisze bieżące od nowa
+  for (int i = 0; i <= NODE_LINK_COUNT; i++) journal.stages[i] = "";
+  journalAppend(rec, JRN_START);
+}
+
+void journalLogHint() {
+  JournalRecord rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.hints = currentGame.hintsUsed;
+  journalAppend(rec, JRN_HINT);
+}
+
+// index 0 = Walizka, index 1.. = nodeLinks
+void journalLogStage(int index, const String& stage) {
+  JournalRecord rec;
+  memset(&rec, 0, sizeof(rec));
+  strlcpy(rec.stage.node, index == 0 ? "walizka" : nodeLinks[index - 1].id, sizeof(rec.stage.node));
+  copyUtf8Text(rec.stage.stage, sizeof(rec.stage.stage), stage);
+  journal.stages[index] = stage;
+  journalAppend(rec, JRN_STAGE);
+}
+
+void journalLogEnd() {
+  JournalRecord rec;
+  memset(&rec, 0, sizeof(rec));
+  copyUtf8Text(rec.endStatus, sizeof(rec.endStatus), currentGame.endStatus);
+  journalAppend(rec, JRN_END);
+}
+
+// Przepisanie całej sesji jako nowego START – starsze rekordy przestają być potrzebne
+void journalCheckpoint() {
+  journal.checkpointPending = false;
+  if (currentGame.state == "idle") {
+    journal.baseSlot = -1;
+    return;
+  }
+
+  journal.checkpointing = true;
+  String walizkaStage = walizkaState.stage;
+  journalLogStart();
+  if (currentGame.hintsUsed > 0) journalLogHint();
+  if (walizkaStage.length() > 0) journalLogStage(0, walizkaStage);
+  for (int i = 0; i < NODE_LINK_COUNT; i++) {
+    if (nodeLinks[i].stage.length() > 0) journalLogStage(i + 1, nodeLinks[i].stage);
+  }
+  if (currentGame.isPaused) journalLog(JRN_PAUSE);
+  if (currentGame.state == "finished") journalLogEnd();
+  journal.checkpointing = false;
+  journal.checkpointPending = false;
+  journal.checkpoints++;
+}
+
+// Po zakończeniu gry: sesja przepisana na początek świeżego sektora, reszta partycji kasowana
+// po jednym sektorze na przebieg loop() – następna gra pisze bez czekania na kasowanie flash.
+void journalCompact() {
+  journal.compactPending = false;
+  if (journal.head % JOURNAL_SLOTS_PER_SECTOR != 0) {
+    journal.head = (journal.head / JOURNAL_SLOTS_PER_SECTOR + 1) % journal.sectors * JOURNAL_SLOTS_PER_SECTOR;
+  }
+  int sector = journal.head / JOURNAL_SLOTS_PER_SECTOR;
+  journalCheckpoint();
+
+  uint32_t all = journal.sectors == 32 ? 0xFFFFFFFFUL : journalSectorBit(journal.sectors) - 1;
+  journal.eraseMask = all & ~journal.cleanSectors & ~journalSectorBit(sector);
+  journal.compactions++;
+  Serial.printf("Dziennik: kompakcja, do skasowania %d sektorów\n", __builtin_popcount(journal.eraseMask));
+}
+
+// Wywoływane z loop(): kompakcja, kasowanie, etapy zagadek i znacznik czasu gry.
+// Etapy zmieniają się w callbacku ESP-NOW – tam tylko RAM, zapis do flash dopiero tutaj.
+void journalService() {
+  if (journal.part == NULL) return;
+
+  if (journal.compactPending) {
+    journalCompact();
+    return;
+  }
+  if (journal.eraseMask) {
+    int sector = __builtin_ctz(journal.eraseMask);
+    if (sector == journal.head / JOURNAL_SLOTS_PER_SECTOR) {
+      journal.eraseMask &= ~journalSectorBit(sector);
+    } else {
+      journalEraseSector(sector);
+    }
+    return;
+  }
+
+  // Rezerwowy pisze tylko to, co przyszło od aktywnego
+  if (!currentGame.isActive || ha.role == HA_STANDBY) return;
+
+  if (walizkaState.stage != journal.stages[0]) journalLogStage(0, walizkaState.stage);
+  for (int i = 0; i < NODE_LINK_COUNT; i++) {
+    if (nodeLinks[i].registered && nodeLinks[i].stage != journal.stages[i + 1]) {
+      journalLogStage(i + 1, nodeLinks[i].stage);
+    }
+  }
+  if (!currentGame.isPaused && millis() - journal.lastWriteMs >= JOURNAL_TICK_MS) journalLog(JRN_TICK);
+}
+
+void journalApply(const JournalRecord& rec, unsigned long& elapsed) {
+  elapsed = rec.elapsedMs;
+  switch (rec.type) {
+    case JRN_START: {
+      resetGameSession();
+      char text[sizeof(rec.start.group) + 1];
+      memcpy(text, rec.start.sessionId, sizeof(rec.start.sessionId));
+      text[sizeof(rec.start.sessionId)] = '\0';
+      currentGame.sessionId = text;
+      memcpy(text, rec.start.group, sizeof(rec.start.group));
+      text[sizeof(rec.start.group)] = '\0';
+      currentGame.groupName = text;
+      currentGame.playerCount = rec.start.players;
+      currentGame.isTestGame = rec.start.test;
+      currentGame.gameTimeMs = rec.start.gameTimeMs;
+      currentGame.isActive = true;
+      currentGame.state = "active";
+      for (int i = 0; i <= NODE_LINK_COUNT; i++) journal.stages[i] = "";
+      break;
+    }
+    case JRN_PAUSE:
+    case JRN_RESUME:
+      currentGame.isPaused = rec.type == JRN_PAUSE;
+      currentGame.state = currentGame.isPaused ? "paused" : "active";
+      break;
+    case JRN_HINT:
+      currentGame.hintsUsed = rec.hints;
+      break;
+    case JRN_STAGE: {
+      char node[sizeof(rec.stage.node) + 1];
+      char stage[sizeof(rec.stage.stage) + 1];
+      memcpy(node, rec.stage.node, sizeof(rec.stage.node));
+      node[sizeof(rec.stage.node)] = '\0';
+      memcpy(stage, rec.stage.stage, sizeof(rec.stage.stage));
+      stage[sizeof(rec.stage.stage)] = '\0';
+      if (strcmp(node, "walizka") == 0) {
+        walizkaState.stage = stage;
+        journal.stages[0] = stage;
+      } else {
+        for (int i = 0; i < NODE_LINK_COUNT; i++) {
+          if (strcmp(node, nodeLinks[i].id) != 0) continue;
+          nodeLinks[i].stage = stage;
+          journal.stages[i + 1] = stage;
+        }
+      }
+      break;
+    }
+    case JRN_END: {
+      char status[sizeof(rec.endStatus) + 1];
+      memcpy(status, rec.endStatus, sizeof(rec.endStatus));
+      status[sizeof(rec.endStatus)] = '\0';
+      currentGame.isActive = false;
+      currentGame.isPaused = false;
+      currentGame.state = "finished";
+      currentGame.endStatus = status;
+      break;
+    }
+  }
+}
+
+// Czas gry sprzed restartu (albo z rekordu aktywnego) wraca jako przesunięcie startu; millis()
+// liczy od zera, więc startTime może się "zawinąć" – gameElapsedMs() liczy modulo 2^32
+void journalRestoreClock(unsigned long elapsed) {
+  unsigned long now = millis();
+  currentGame.startTime = now - elapsed;
+  currentGame.pausedTotalMs = 0;
+  if (currentGame.isPaused) currentGame.pausedAt = now;
+  if (currentGame.state == "finished") currentGame.endedAt = now;
+  snapshotDirty = true;
+}
+
+// Przegląd partycji, odtworzenie sesji od ostatniego START i ogłoszenie jej slave'om
+void journalMount() {
+  unsigned long startUs = micros();
+  journal.baseSlot = -1;
+  journal.nextSeq = 1;
+  journal.part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                          (esp_partition_subtype_t)JOURNAL_PARTITION_SUBTYPE, "journal");
+  if (journal.part == NULL || journal.part->size < 2 * JOURNAL_SECTOR_SIZE) {
+    journal.part = NULL;
+    Serial.println("Dziennik: brak partycji \"journal\" – gra nie przetrwa restartu");
+    return;
+  }
+  journal.sectors = min((int)(journal.part->size / JOURNAL_SECTOR_SIZE), JOURNAL_MAX_SECTORS);
+  journal.slots = journal.sectors * JOURNAL_SLOTS_PER_SECTOR;
+
+  JournalRecord rec;
+  int lastSlot = -1;
+  uint32_t lastSeq = 0;
+  uint32_t baseSeq = 0;
+  uint32_t dirty = 0;
+  for (int slot = 0; slot < journal.slots; slot++) {
+    JournalSlot state = journalRead(slot, rec);
+    if (state == JSLOT_ERASED) continue;
+    dirty |= journalSectorBit(slot / JOURNAL_SLOTS_PER_SECTOR);
+    if (state != JSLOT_VALID) continue;
+    if (lastSlot < 0 || rec.seq > lastSeq) {
+      lastSlot = slot;
+      lastSeq = rec.seq;
+    }
+    if (rec.type == JRN_START && (journal.baseSlot < 0 || rec.seq > baseSeq)) {
+      journal.baseSlot = slot;
+      baseSeq = rec.seq;
+    }
+  }
+  uint32_t all = journal.sectors == 32 ? 0xFFFFFFFFUL : journalSectorBit(journal.sectors) - 1;
+  journal.cleanSectors = all & ~dirty;
+
+  // Zapis od slotu za ostatnim rekordem; urwane sloty w tym samym sektorze są omijane
+  if (lastSlot >= 0) {
+    journal.nextSeq = lastSeq + 1;
+    journal.head = (lastSlot + 1) % journal.slots;
+    while (journal.head % JOURNAL_SLOTS_PER_SECTOR != 0 && journalRead(journal.head, rec) != JSLOT_ERASED) {
+      journal.head = (journal.head + 1) % journal.slots;
+    }
+  }
+
+  // Rekordy sesji leżą za START w kolejności pierścienia; starsze i zepsute są pomijane
+  unsigned long elapsed = 0;
+  if (journal.baseSlot >= 0) {
+    uint32_t applied = 0;
+    for (int i = 0; i < journal.slots; i++) {
+      int slot = (journal.baseSlot + i) % journal.slots;
+      if (journalRead(slot, rec) != JSLOT_VALID || rec.seq < baseSeq || (applied && rec.seq <= applied)) continue;
+      journalApply(rec, elapsed);
+      applied = rec.seq;
+      journal.replayed++;
+    }
+  }
+
+  if (currentGame.state != "idle") {
+    journalRestoreClock(elapsed);
+    journal.restored = true;
+    journal.lastWriteMs = millis();
+
+    // Restart między wejściem w sektor a przepisaniem sesji – dokończ przepisanie teraz
+    int next = (journal.head / JOURNAL_SLOTS_PER_SECTOR + 1) % journal.sectors;
+    if (journal.baseSlot / JOURNAL_SLOTS_PER_SECTOR == next) journalCheckpoint();
+  }
+  journal.mountUs = micros() - startUs;
+
+  Serial.printf("Dziennik: %d slotów, %lu rekordów odtworzonych w %lu us\n",
+                journal.slots, (unsigned long)journal.replayed, (unsigned long)journal.mountUs);
+  if (currentGame.isActive && ha.role != HA_STANDBY) {
+    Serial.println("Odtworzono grę: " + currentGame.groupName + " (" + currentGame.state + ", " +
+                   formatTimestamp(elapsed) + ")");
+    // Walizka rozpoznaje tę samą grupę i nie kasuje postępu. Po starcie (i po przejęciu HA)
+    // nikt nie jest jeszcze połączony – ogłoszenie idzie do każdego, gdy tylko się zgłosi.
+    gameAnnouncePending = resolveGroupTarget("role:game");
+  }
+}
+
+// === KONFIGURACJA MASTERA ===
+
+bool parseMac(const String& text, uint8_t* mac) {
+  unsigned int b[6];
+  if (sscanf(text.c_str(), "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6) {
+    return false;
+  }
+  for (int i = 0; i < 6; i++) {
+    if (b[i] > 0xFF) return false;
+    mac[i] = (uint8_t)b[i];
+  }
+  return true;
+}
+
+String formatMac(const uint8_t* mac) {
+  char macStr[18];
+  snprintf(macStr, sizeof(macStr), "%02X:%02X:%02X:%02X:%02X:%02X",
+           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return String(macStr);
+}
+
+void loadMasterConfig() {
+  configPrefs.begin("master", true);
+  String ssid = configPrefs.getString("ap_ssid", DEFAULT_AP_SSID);
+  String password = configPrefs.getString("ap_pass", DEFAULT_AP_PASSWORD);
+  strlcpy(masterConfig.apSsid, ssid.c_str(), sizeof(masterConfig.apSsid));
+  strlcpy(masterConfig.apPassword, password.c_str(), sizeof(masterConfig.apPassword));
+
+  if (configPrefs.getBytes("golab_mac", masterConfig.golabMac, 6) != 6) {
+    memcpy(masterConfig.golabMac, DEFAULT_GOLAB_MAC, 6);
+  }
+  if (configPrefs.getBytes("walizka_mac", masterConfig.walizkaMac, 6) != 6) {
+    memcpy(masterConfig.walizkaMac, DEFAULT_WALIZKA_MAC, 6);
+  }
+
+  masterConfig.heartbeatTimeout = configPrefs.getULong("hb_timeout", DEFAULT_HEARTBEAT_TIMEOUT);
+  masterConfig.heartbeatInterval = configPrefs.getULong("hb_interval", DEFAULT_HEARTBEAT_INTERVAL);
+  if (masterConfig.heartbeatInterval > HEARTBEAT_INTERVAL_MAX) masterConfig.heartbeatInterval = HEARTBEAT_INTERVAL_MAX;
+  if (configPrefs.getBytes("zones", masterConfig.zones, GROUP_MEMBER_COUNT) != GROUP_MEMBER_COUNT) {
+    memset(masterConfig.zones, DEFAULT_ZONE, GROUP_MEMBER_COUNT);
+  }
+  String roomId = configPrefs.getString("room_id", DEFAULT_ROOM_ID);
+  strlcpy(masterConfig.roomId, roomId.c_str(), sizeof(masterConfig.roomId));
+  masterConfig.roomRole = configPrefs.getUChar("room_role", ROOM_STANDALONE);
+  if (masterConfig.roomRole > ROOM_AGGREGATOR) masterConfig.roomRole = ROOM_STANDALONE;
+  if (configPrefs.getBytes("aggr_mac", masterConfig.aggregatorMac, 6) != 6) {
+    memset(masterConfig.aggregatorMac, 0, 6);
+  }
+  masterConfig.roomMemberCount = configPrefs.getBytes("room_members", masterConfig.roomMembers, sizeof(masterConfig.roomMembers)) / 6;
+  masterConfig.channel = configPrefs.getUChar("channel", CHANNEL_DEFAULT);
+  if (!channelValid(masterConfig.channel)) masterConfig.channel = CHANNEL_DEFAULT;
+  masterConfig.channelAuto = configPrefs.getBool("chan_auto", true);
+  if (configPrefs.getBytes("phy_modes", masterConfig.phyModes, GROUP_MEMBER_COUNT) != GROUP_MEMBER_COUNT) {
+    memset(masterConfig.phyModes, PHY_MODE_AUTO, GROUP_MEMBER_COUNT);
+  }
+  for (int i = 0; i < GROUP_MEMBER_COUNT; i++) {
+    if (masterConfig.phyModes[i] >= PHY_RATE_COUNT) masterConfig.phyModes[i] = PHY_MODE_AUTO;
+  }
+  masterConfig.haRole = configPrefs.getUChar("ha_role", HA_OFF);
+  if (masterConfig.haRole > HA_STANDBY) masterConfig.haRole = HA_OFF;
+  masterConfig.haKeySet = configPrefs.getBytes("ha_key", masterConfig.haKey, sizeof(masterConfig.haKey)) == sizeof(masterConfig.haKey);
+  if (configPrefs.getBytes("ha_peer", masterConfig.haPeerMac, 6) != 6) {
+    memset(masterConfig.haPeerMac, 0, 6);
+    masterConfig.haRole = HA_OFF;
+  }
+  configPrefs.end();
+}
+
+void saveMasterConfig() {
+  configPrefs.begin("master", false);
+  configPrefs.putString("ap_ssid", masterConfig.apSsid);
+  configPrefs.putString("ap_pass", masterConfig.apPassword);
+  configPrefs.putBytes("golab_mac", masterConfig.golabMac, 6);
+  configPrefs.putBytes("walizka_mac", masterConfig.walizkaMac, 6);
+  configPrefs.putULong("hb_timeout", masterConfig.heartbeatTimeout);
+  configPrefs.putULong("hb_interval", masterConfig.heartbeatInterval);
+  configPrefs.putBytes("zones", masterConfig.zones, GROUP_MEMBER_COUNT);
+  configPrefs.putString("room_id", masterConfig.roomId);
+  configPrefs.putUChar("room_role", masterConfig.roomRole);
+  configPrefs.putBytes("aggr_mac", masterConfig.aggregatorMac, 6);
+  configPrefs.putBytes("room_members", masterConfig.roomMembers, masterConfig.roomMemberCount * 6);
+  configPrefs.putUChar("channel", masterConfig.channel);
+  configPrefs.putBool("chan_auto", masterConfig.channelAuto);
+  configPrefs.putBytes("phy_modes", masterConfig.phyModes, GROUP_MEMBER_COUNT);
+  configPrefs.putUChar("ha_role", masterConfig.haRole);
+  configPrefs.putBytes("ha_peer", masterConfig.haPeerMac, 6);
+  if (masterConfig.haKeySet) configPrefs.putBytes("ha_key", masterConfig.haKey, sizeof(masterConfig.haKey));
+  else configPrefs.remove("ha_key");
+  configPrefs.end();
+}
+
+bool applyMasterConfig(JsonObject changes, String& error) {
+  // Walidacja całości przed zmianą czegokolwiek
+  MasterConfig next = masterConfig;
+
+  if (changes.containsKey("ap_ssid")) {
+    String ssid = changes["ap_ssid"].as<String>();
+    if (ssid.length() == 0 || ssid.length() > 32) { error = "Niepoprawny SSID"; return false; }
+    strlcpy(next.apSsid, ssid.c_str(), sizeof(next.apSsid));
+  }
+  if (changes.containsKey("ap_password")) {
+    String password = changes["ap_password"].as<String>();
+    if (password.length() < 8 || password.length() > 63) { error = "Hasło musi mieć 8-63 znaki"; return false; }
+    strlcpy(next.apPassword, password.c_str(), sizeof(next.apPassword));
+  }
+  if (changes.containsKey("golab_mac") && !parseMac(changes["golab_mac"].as<String>(), next.golabMac)) {
+    error = "Niepoprawny MAC Gołąb"; return false;
+  }
+  if (changes.containsKey("walizka_mac") && !parseMac(changes["walizka_mac"].as<String>(), next.walizkaMac)) {
+    error = "Niepoprawny MAC Walizka"; return false;
+  }
+  if (changes.containsKey("heartbeat_timeout")) {
+    next.heartbeatTimeout = changes["heartbeat_timeout"];
+  }
+  if (changes.containsKey("heartbeat_interval")) {
+    next.heartbeatInterval = changes["heartbeat_interval"];
+  }
+  if (changes.containsKey("zones")) {
+    // {"zones":{"lom":2,"podloga":2}} – tylko wymienione węzły
+    for (JsonPair kv : changes["zones"].as<JsonObject>()) {
+      int member = groupMemberById(kv.key().c_str());
+      int zone = kv.value() | 0;
+      if (member < 0 || zone < 1 || zone > 255) {
+        error = "Niepoprawna strefa: " + String(kv.key().c_str());
+        return false;
+      }
+      next.zones[member] = zone;
+    }
+  }
+  if (changes.containsKey("phy")) {
+    // {"phy":{"golab":"54m","lom":"lr250k","podloga":"auto"}} – tylko wymienione węzły
+    for (JsonPair kv : changes["phy"].as<JsonObject>()) {
+      int member = groupMemberById(kv.key().c_str());
+      String mode = kv.value().as<String>();
+      int rate = phyRateByName(mode);
+      if (member < 0 || (rate < 0 && mode != "auto")) {
+        error = "Niepoprawna szybkość PHY: " + String(kv.key().c_str());
+        return false;
+      }
+      if ((PHY_PINNED_MEMBERS & (1UL << member)) && rate >= 0 && rate != PHY_RATE_DEFAULT) {
+        error = String(kv.key().c_str()) + " nadaje też do innych węzłów – szybkość PHY stała (1m)";
+        return false;
+      }
+      next.phyModes[member] = rate < 0 ? PHY_MODE_AUTO : rate;
+    }
+  }
+  if (changes.containsKey("room_id")) {
+    String roomId = changes["room_id"].as<String>();
+    bool valid = roomId.length() > 0 && roomId.length() < sizeof(next.roomId);
+    for (unsigned int i = 0; i < roomId.length() && valid; i++) {
+      char c = roomId[i];
+      valid = isalnum(c) || c == '_' || c == '-';
+    }
+    if (!valid) { error = "room_id: 1-15 znaków [a-z0-9_-]"; return false; }
+    strlcpy(next.roomId, roomId.c_str(), sizeof(next.roomId));
+  }
+  if (changes.containsKey("room_role")) {
+    String role = changes["room_role"].as<String>();
+    int found = -1;
+    for (int i = 0; i <= ROOM_AGGREGATOR; i++) {
+      if (role == ROOM_ROLE_NAMES[i]) found = i;
+    }
+    if (found < 0) { error = "room_role: standalone, member albo aggregator"; return false; }
+    next.roomRole = found;
+  }
+  if (changes.containsKey("aggregator_mac") && !parseMac(changes["aggregator_mac"].as<String>(), next.aggregatorMac)) {
+    error = "Niepoprawny MAC agregatora"; return false;
+  }
+  if (next.roomRole == ROOM_MEMBER && memcmp(next.aggregatorMac, "\0\0\0\0\0\0", 6) == 0) {
+    error = "Rola member wymaga aggregator_mac"; return false;
+  }
+  if (changes.containsKey("room_members")) {
+    JsonArray members = changes["room_members"];
+    if (members.isNull() || members.size() > ROOM_MEMBERS_MAX) {
+      error = "room_members: lista najwyżej " + String(ROOM_MEMBERS_MAX) + " MAC-ów"; return false;
+    }
+    next.roomMemberCount = 0;
+    for (JsonVariant member : members) {
+      if (!parseMac(member.as<String>(), next.roomMembers[next.roomMemberCount])) {
+        error = "Niepoprawny MAC w room_members"; return false;
+      }
+      next.roomMemberCount++;
+    }
+  }
+  // Para Masterów – zmiana działa od następnego restartu (rola i MAC ustalane przy starcie radia)
+  if (changes.containsKey("ha_role")) {
+    String role = changes["ha_role"].as<String>();
+    int found = -1;
+    for (int i = 0; i <= HA_STANDBY; i++) {
+      if (role == HA_ROLE_NAMES[i]) found = i;
+    }
+    if (found < 0) { error = "ha_role: off, primary albo standby"; return false; }
+    next.haRole = found;
+  }
+  if (changes.containsKey("ha_peer_mac") && !parseMac(changes["ha_peer_mac"].as<String>(), next.haPeerMac)) {
+    error = "Niepoprawny MAC drugiego Mastera"; return false;
+  }
+  if (next.haRole != HA_OFF && memcmp(next.haPeerMac, "\0\0\0\0\0\0", 6) == 0) {
+    error = "Para Masterów wymaga ha_peer_mac"; return false;
+  }
+  // Wspólne hasło pary, to samo na obu płytkach; "" wyłącza szyfrowanie (hasło AP nie jest wtedy synchronizowane)
+  if (changes.containsKey("ha_key")) {
+    String key = changes["ha_key"].as<String>();
+    if (key.length() > 0 && (key.length() < 8 || key.length() > 63)) { error = "ha_key musi mieć 8-63 znaki"; return false; }
+    next.haKeySet = key.length() > 0;
+    uint8_t digest[32];
+    mbedtls_sha256_ret((const unsigned char*)key.c_str(), key.length(), digest, 0);
+    memcpy(next.haKey, digest, sizeof(next.haKey));
+    if (!next.haKeySet) memset(next.haKey, 0, sizeof(next.haKey));
+  }
+  // Sam kanał zmienia tylko /channel_switch – slave'y muszą przejść razem z Masterem
+  if (changes.containsKey("channel") && (changes["channel"] | 0) != masterConfig.channel) {
+    error = "Kanał zmienia /channel_switch"; return false;
+  }
+  if (changes.containsKey("channel_auto")) {
+    next.channelAuto = changes["channel_auto"] | true;
+  }
+  if (next.heartbeatInterval < 1000 || next.heartbeatTimeout <= next.heartbeatInterval) {
+    error = "heartbeat_timeout musi być większy niż heartbeat_interval (min. 1000 ms)";
+    return false;
+  }
+  if (next.heartbeatInterval > HEARTBEAT_INTERVAL_MAX) {
+    // Węzły słyszą Mastera tylko z heartbeatu – po CHANNEL_HUNT_AFTER_MS ciszy szukają go na innych kanałach
+    error = "heartbeat_interval najwyżej " + String(HEARTBEAT_INTERVAL_MAX) + " ms";
+    return false;
+  }
+
+  bool apChanged = strcmp(next.apSsid, masterConfig.apSsid) != 0 ||
+                   strcmp(next.apPassword, masterConfig.apPassword) != 0;
+  bool golabChanged = memcmp(next.golabMac, masterConfig.golabMac, 6) != 0;
+  bool walizkaChanged = memcmp(next.walizkaMac, masterConfig.walizkaMac, 6) != 0;
+
+  // Przerejestruj peery ESP-NOW bez restartu
+  if (golabChanged) {
+    esp_now_del_peer(masterConfig.golabMac);
+    addEspNowPeer(next.golabMac, "Gołąb");
+    golabConnected = false;
+    golabConfigHash = 0;
+  }
+  if (walizkaChanged) {
+    esp_now_del_peer(masterConfig.walizkaMac);
+    addEspNowPeer(next.walizkaMac, "Walizka");
+    walizkaConnected = false;
+    walizkaConfigHash = 0;
+  }
+
+  bool roomsChanged = next.roomRole != masterConfig.roomRole ||
+                      memcmp(next.aggregatorMac, masterConfig.aggregatorMac, 6) != 0 ||
+                      next.roomMemberCount != masterConfig.roomMemberCount ||
+                      memcmp(next.roomMembers, masterConfig.roomMembers, next.roomMemberCount * 6) != 0 ||
+                      strcmp(next.roomId, masterConfig.roomId) != 0;
+
+  bool phyChanged = memcmp(next.phyModes, masterConfig.phyModes, GROUP_MEMBER_COUNT) != 0;
+
+  masterConfig = next;
+  saveMasterConfig();
+  if (roomsChanged) setupRooms();
+  if (phyChanged) lastPhyEvalMs = millis() - PHY_RENEW_MS;   // nowa szybkość od następnego loop()
+
+  if (apChanged) {
+    // Odpowiedź HTTP zostanie wysłana przed rozłączeniem klientów w loop()
+    apRestartPending = true;
+  }
+
+  Serial.println("Konfiguracja Master zaktualizowana");
+  return true;
+}
+
+void checkPendingApRestart() {
+  if (!apRestartPending) return;
+  apRestartPending = false;
+
+  delay(200);
+  WiFi.softAPdisconnect(false);
+  WiFi.softAP(masterConfig.apSsid, masterConfig.apPassword, radioChannel);
+  Serial.println("Access Point uruchomiony ponownie: " + String(masterConfig.apSsid));
+}
+
+// === KONFIGURACJA ZAGADEK ===
+
+void loadPuzzleConfig() {
+  // Wartości domyślne = dotychczasowe stałe z firmware slave'ów
+  puzzleConfig.version = 0;
+  puzzleConfig.lottoCode = "010716363847";
+  puzzleConfig.compartment = "53";
+  puzzleConfig.triggerTrack = 7;
+  puzzleConfig.startTag1 = "F1AAF703";
+  puzzleConfig.startTag2 = "E3BF25E2";
+  puzzleConfig.walizkaVolume = 20;
+  puzzleConfig.golabVolume = 20;
+
+  puzzlePrefs.begin("puzzle", true);
+  String stored = puzzlePrefs.getString("blob", "");
+  puzzlePrefs.end();
+
+  if (stored.length() > 0) {
+    DynamicJsonDocument doc(512);
+    if (!deserializeJson(doc, stored)) {
+      puzzleConfig.version = doc["v"] | 0;
+      puzzleConfig.lottoCode = doc["code"] | puzzleConfig.lottoCode;
+      puzzleConfig.compartment = doc["comp"] | puzzleConfig.compartment;
+      puzzleConfig.triggerTrack = doc["trk"] | puzzleConfig.triggerTrack;
+      puzzleConfig.startTag1 = doc["tag1"] | puzzleConfig.startTag1;
+      puzzleConfig.startTag2 = doc["tag2"] | puzzleConfig.startTag2;
+      puzzleConfig.walizkaVolume = doc["vol_w"] | puzzleConfig.walizkaVolume;
+      puzzleConfig.golabVolume = doc["vol_g"] | puzzleConfig.golabVolume;
+    } else {
+      Serial.println("Uszkodzona konfiguracja zagadek w NVS - używam domyślnej");
+    }
+  }
+
+  buildPuzzleConfigBlob();
+  Serial.println("Konfiguracja zagadek v" + String(puzzleConfig.version) + " (hash " + String(puzzleConfigHash, HEX) + ")");
+}
+
+void buildPuzzleConfigBlob() {
+  // Kolejność pól jest stała, więc ten sam config daje zawsze ten sam hash
+  DynamicJsonDocument doc(512);
+  doc["v"] = puzzleConfig.version;
+  doc["code"] = puzzleConfig.lottoCode;
+  doc["comp"] = puzzleConfig.compartment;
+  doc["trk"] = puzzleConfig.triggerTrack;
+  doc["tag1"] = puzzleConfig.startTag1;
+  doc["tag2"] = puzzleConfig.startTag2;
+  doc["vol_w"] = puzzleConfig.walizkaVolume;
+  doc["vol_g"] = puzzleConfig.golabVolume;
+
+  puzzleConfigBlob = "";
+  serializeJson(doc, puzzleConfigBlob);
+  puzzleConfigHash = fnv1aHash(puzzleConfigBlob);
+}
+
+void savePuzzleConfig() {
+  puzzlePrefs.begin("puzzle", false);
+  puzzlePrefs.putString("blob", puzzleConfigBlob);
+  puzzlePrefs.end();
+}
+
+// UID tagu MIFARE w zapisie walizki: 4, 7 albo 10 bajtów jako wielkie litery hex
+bool isValidTagUid(const String& uid) {
+  if (uid.length() != 8 && uid.length() != 14 && uid.length() != 20) return false;
+  for (unsigned int i = 0; i < uid.length(); i++) {
+    if (!isxdigit(uid[i])) return false;
+  }
+  return true;
+}
+
+// Kod LOTTO i numer skrytki wpisywane na klawiaturze walizki – handleKey() przyjmuje tylko cyfry
+bool isKeypadDigits(const String& text, unsigned int maxLength) {
+  if (text.length() == 0 || text.length() > maxLength) return false;
+  for (unsigned int i = 0; i < text.length(); i++) {
+    if (!isdigit(text[i])) return false;
+  }
+  return true;
+}
+
+bool updatePuzzleConfig(JsonObject changes, String& error) {
+  String code = changes["code"] | puzzleConfig.lottoCode;
+  String comp = changes["comp"] | puzzleConfig.compartment;
+  int track = changes["trk"] | puzzleConfig.triggerTrack;
+  String tag1 = changes["tag1"] | puzzleConfig.startTag1;
+  String tag2 = changes["tag2"] | puzzleConfig.startTag2;
+  int volW = changes["vol_w"] | puzzleConfig.walizkaVolume;
+  int volG = changes["vol_g"] | puzzleConfig.golabVolume;
+
+  // Walizka ma 16 znaków LCD i numer skrytki wpisywany z klawiatury
+  if (!isKeypadDigits(code, 16)) { error = "code: 1-16 cyfr"; return false; }
+  if (!isKeypadDigits(comp, 4)) { error = "comp: 1-4 cyfry"; return false; }
+  if (track < 1 || track > 255) { error = "trk: 1-255"; return false; }
+  tag1.toUpperCase();
+  tag2.toUpperCase();
+  if (!isValidTagUid(tag1) || !isValidTagUid(tag2)) { error = "tag1/tag2: UID hex o długości 8, 14 albo 20 znaków"; return false; }
+
+  PuzzleConfig previous = puzzleConfig;
+  puzzleConfig.lottoCode = code;
+  puzzleConfig.compartment = comp;
+  puzzleConfig.triggerTrack = track;
+  puzzleConfig.startTag1 = tag1;
+  puzzleConfig.startTag2 = tag2;
+  puzzleConfig.walizkaVolume = constrain(volW, 0, 30);
+  puzzleConfig.golabVolume = constrain(volG, 0, 30);
+  puzzleConfig.version++;
+
+  buildPuzzleConfigBlob();
+  if (puzzleConfigBlob.length() > PUZZLE_CONFIG_BLOB_MAX) {
+    // Ramka tekstowa ucięta na 249 B dałaby slave'om niepełny JSON, a sync nigdy by się nie zbiegł
+    error = "Konfiguracja ma " + String(puzzleConfigBlob.length()) + " B, w ramce ESP-NOW mieści się " +
+            String(PUZZLE_CONFIG_BLOB_MAX) + " B";
+    puzzleConfig = previous;
+    buildPuzzleConfigBlob();
+    return false;
+  }
+  savePuzzleConfig();
+
+  // Wymuś natychmiastowe rozesłanie nowej wersji
+  lastGolabConfigPush = 0;
+  lastWalizkaConfigPush = 0;
+  checkPuzzleConfigSync();
+
+  Serial.println("Nowa konfiguracja zagadek v" + String(puzzleConfig.version));
+  return true;
+}
+
+void checkPuzzleConfigSync() {
+  // Wysyłaj konfigurację do każdego połączonego slave'a, dopóki nie potwierdzi hasha.
+  // Obejmuje to zarówno dołączenie węzła, jak i zmianę konfiguracji.
+  if (golabConnected && golabConfigHash != puzzleConfigHash &&
+      (lastGolabConfigPush == 0 || millis() - lastGolabConfigPush > CONFIG_PUSH_RETRY)) {
+    sendCommandToGolab("puzzle_config", puzzleConfigBlob);
+    lastGolabConfigPush = millis();
+  }
+
+  if (walizkaConnected && walizkaConfigHash != puzzleConfigHash &&
+      (lastWalizkaConfigPush == 0 || millis() - lastWalizkaConfigPush > CONFIG_PUSH_RETRY)) {
+    sendCommandToWalizka("puzzle_config", puzzleConfigBlob);
+    lastWalizkaConfigPush = millis();
+  }
+}
+
+void handleConfigAck(String node, String data) {
+  // Format: "<wersja>:<hash hex>"
+  int colon = data.indexOf(':');
+  if (colon <= 0) return;
+
+  uint32_t version = data.substring(0, colon).toInt();
+  uint32_t hash = strtoul(data.substring(colon + 1).c_str(), NULL, 16);
+
+  if (node == "golab") golabConfigHash = hash;
+  else if (node == "walizka") walizkaConfigHash = hash;
+
+  if (hash == puzzleConfigHash) {
+    Serial.println("Konfiguracja v" + String(version) + " potwierdzona przez " + node);
+  } else {
+    Serial.println("Niezgodny hash konfiguracji od " + node + " (v" + String(version) + ")");
+  }
+}
+
+// === KATALOG AUDIO ===
+
+// Nazwa z manifestu trafia do ramek tekstowych "cmd|data|ms" – bez '|' i znaków spoza [A-Za-z0-9_-]
+bool isAudioName(const char* name) {
+  size_t length = strlen(name);
+  if (length == 0 || length > 15) return false;
+  for (size_t i = 0; i < length; i++) {
+    if (!isalnum((unsigned char)name[i]) && name[i] != '_' && name[i] != '-') return false;
+  }
+  return true;
+}
+
+void loadAudioManifest() {
+  puzzlePrefs.begin("audio", true);
+  audioManifest = puzzlePrefs.getString("manifest", DEFAULT_AUDIO_MANIFEST);
+  puzzlePrefs.end();
+
+  // Manifest zapisany przed walidacją nazw mógł zawierać '|' – Gołąb nigdy by go nie potwierdził
+  DynamicJsonDocument stored(1024);
+  bool valid = !deserializeJson(stored, audioManifest) && stored.is<JsonObject>();
+  if (valid) {
+    for (JsonPair kv : stored.as<JsonObject>()) {
+      if (!isAudioName(kv.key().c_str())) valid = false;
+    }
+  }
+  if (!valid) {
+    Serial.println("⚠️ Niepoprawny manifest audio w NVS – przywracam domyślny");
+    audioManifest = DEFAULT_AUDIO_MANIFEST;
+  }
+
+  audioManifestHash = fnv1aHash(audioManifest);
+  golabCatalog.valid = false;
+  Serial.println("Manifest audio: " + audioManifest);
+}
+
+bool updateAudioManifest(JsonObject manifest, String& error) {
+  // Płaski obiekt {"nazwa": numer_pliku}; nazwy do 15 znaków (tablica na Gołąb)
+  DynamicJsonDocument clean(1024);
+  int count = 0;
+  for (JsonPair kv : manifest) {
+    int track = kv.value().as<int>();
+    if (!isAudioName(kv.key().c_str())) {
+      error = "Nazwa pliku musi mieć 1-15 znaków [A-Za-z0-9_-]";
+      return false;
+    }
+    if (track <= 0 || track > 3000) {
+      error = String("Niepoprawny numer pliku dla ") + kv.key().c_str();
+      return false;
+    }
+    clean[kv.key().c_str()] = track;
+    count++;
+  }
+  if (count == 0 || count > 16) {
+    error = "Manifest musi mieć 1-16 wpisów";
+    return false;
+  }
+
+  String serializedManifest;
+  serializeJson(clean, serializedManifest);
+  // Manifest idzie w jednej ramce ESP-NOW razem z komendą i timestampem
+  if (serializedManifest.length() > 200) {
+    error = "Manifest za długi dla ramki ESP-NOW";
+    return false;
+  }
+
+  audioManifest = serializedManifest;
+  audioManifestHash = fnv1aHash(audioManifest);
+
+  puzzlePrefs.begin("audio", false);
+  puzzlePrefs.putString("manifest", audioManifest);
+  puzzlePrefs.end();
+
+  lastGolabManifestPush = 0;
+  checkAudioManifestSync();
+  Serial.println("Nowy manifest audio: " + audioManifest);
+  return true;
+}
+
+void checkAudioManifestSync() {
+  bool golabSynced = golabCatalog.valid && golabCatalog.manifestHash == audioManifestHash;
+  if (golabConnected && !golabSynced &&
+      (lastGolabManifestPush == 0 || millis() - lastGolabManifestPush > CONFIG_PUSH_RETRY)) {
+    sendCommandToGolab("audio_manifest", audioManifest);
+    lastGolabManifestPush = millis();
+  }
+}
+
+void handleAudioCatalog(String data) {
+  DynamicJsonDocument doc(512);
+  if (deserializeJson(doc, data)) return;
+
+  golabCatalog.sdFiles = doc["sd"] | 0;
+  golabCatalog.entries = doc["entries"] | 0;
+  golabCatalog.manifestHash = strtoul(doc["manifest"] | "0", NULL, 16);
+
+  JsonArray folders = doc["folders"];
+  golabCatalog.folderCount = 0;
+  for (JsonVariant count : folders) {
+    if (golabCatalog.folderCount >= AUDIO_MAX_FOLDERS) break;
+    golabCatalog.folderFiles[golabCatalog.folderCount++] = count.as<int>();
+  }
+
+  golabCatalog.updated = millis();
+  golabCatalog.valid = true;
+  Serial.println("Katalog audio Gołąb: " + String(golabCatalog.sdFiles) + " plików na SD");
+}
+
+NodeLink* findNodeById(const String& id) {
+  for (int i = 0; i < NODE_LINK_COUNT; i++) {
+    if (id == nodeLinks[i].id) return &nodeLinks[i];
+  }
+  return NULL;
+}
+
+NodeLink* findNodeByMac(const uint8_t* mac) {
+  for (int i = 0; i < NODE_LINK_COUNT; i++) {
+    if (nodeLinks[i].registered && memcmp(nodeLinks[i].mac, mac, 6) == 0) return &nodeLinks[i];
+  }
+  return NULL;
+}
+
+void handleNodeFrame(const uint8_t* mac, const String& frame) {
+  int firstPipe = frame.indexOf('|');
+  int secondPipe = frame.indexOf('|', firstPipe + 1);
+  if (firstPipe <= 0 || secondPipe <= 0) {
+    Serial.println("Otrzymano od nieznanego urządzenia: " + frame);
+    return;
+  }
+
+  String command = frame.substring(0, firstPipe);
+  String data = frame.substring(firstPipe + 1, secondPipe);
+  unsigned long nodeMs = strtoul(frame.c_str() + secondPipe + 1, NULL, 10);
+
+  NodeLink* node = findNodeByMac(mac);
+
+  // Rejestracja: węzeł przedstawia się swoim id, Master zapamiętuje MAC i dodaje peera
+  if (command == "register") {
+    NodeLink* claimed = findNodeById(data);
+    if (claimed == NULL) {
+      Serial.println("Rejestracja nieznanego węzła: " + data + " (" + formatMac(mac) + ")");
+      return;
+    }
+    if (!claimed->registered || memcmp(claimed->mac, mac, 6) != 0) {
+      if (claimed->registered) esp_now_del_peer(claimed->mac);
+      memcpy(claimed->mac, mac, 6);
+      addEspNowPeer(mac, claimed->label);
+      claimed->registered = true;
+    }
+    claimed->connected = true;
+    claimed->lastSeen = millis();
+    claimed->clockValid = false;
+    Serial.println("Zarejestrowano " + String(claimed->label) + " (" + formatMac(mac) + ")");
+    sendCommandToNode(*claimed, "registered", String(millis()));
+    return;
+  }
+
+  if (node == NULL) {
+    Serial.println("Otrzymano od nieznanego urządzenia: " + frame);
+    return;
+  }
+
+  node->connected = true;
+  node->lastSeen = millis();
+  handleNodeMessage(*node, command, data, nodeMs);
+}
+
+void handleNodeMessage(NodeLink& node, String command, String data, unsigned long nodeMs) {
+  unsigned long now = millis();
+
+  if (command == "heartbeat") {
+    // Odpowiedź na ping: data = millis Mastera z pingu -> RTT i przesunięcie zegara węzła
+    unsigned long echoed = strtoul(data.c_str(), NULL, 10);
+    if (echoed > 0 && echoed <= now) {
+      node.rttMs = now - echoed;
+      node.clockOffset = (long)(echoed + node.rttMs / 2) - (long)nodeMs;
+      node.clockValid = true;
+    }
+  } else if (command == "event") {
+    // data: {"ev":"sensor","id":1,"stage":"ACTIVE","relay":0}
+    if (node.clockValid) {
+      long sent = (long)nodeMs + node.clockOffset;
+      node.eventLatencyMs = (long)now > sent ? now - sent : 0;
+      node.eventLatencySumMs += node.eventLatencyMs;
+      if (node.eventLatencyMs > node.eventLatencyMaxMs) node.eventLatencyMaxMs = node.eventLatencyMs;
+    }
+    node.eventCount++;
+
+    DynamicJsonDocument doc(256);
+    if (!deserializeJson(doc, data)) {
+      String stage = doc["stage"] | node.stage;
+      if (stage != node.stage) queueRoomEvent("stage:" + String(node.id) + ":" + stage);
+      node.stage = stage;
+      node.relayState = doc["relay"] | node.relayState;
+    }
+
+    // Historia: najnowsze na końcu, tak jak historia kodów Walizka
+    String entry = data + "|" + String(now);
+    if (node.eventsCount < NODE_EVENT_HISTORY) {
+      node.events[node.eventsCount++] = entry;
+    } else {
+      for (int i = 1; i < NODE_EVENT_HISTORY; i++) node.events[i - 1] = node.events[i];
+      node.events[NODE_EVENT_HISTORY - 1] = entry;
+    }
+    Serial.println(String(node.label) + " zdarzenie: " + data + " (" + String(node.eventLatencyMs) + " ms)");
+  } else if (command == "bench_stats") {
+    node.bench = data;
+  } else if (command == "state") {
+    node.state = data;
+  } else {
+    Serial.println("Nieznana komenda od " + String(node.label) + ": " + command);
+  }
+}
+
+// Korzeń od razu jako obiekt – handlery mogą wziąć doc.as<JsonObject>() bez wcześniejszego zapisu
+JsonDocument& beginResponseDoc() {
+  responseDoc.to<JsonObject>();
+  return responseDoc;
+}
+
+// Ciało żądania do requestDoc; brak ciała = pusty dokument, false = ciało nie jest JSON-em
+bool parseRequestBody() {
+  requestDoc.clear();
+  if (!server.hasArg("plain")) return true;
+  if (!deserializeJson(requestDoc, server.arg("plain"))) return true;
+  requestDoc.clear();
+  return false;
+}
+
+void sendJson(int code, JsonDocument& doc) {
+  uint32_t freeNow = ESP.getFreeHeap();
+  uint32_t heapUsed = heapBeforeRequest > freeNow ? heapBeforeRequest - freeNow : 0;
+  // Punkt odniesienia z tej samej odpowiedzi: dawna ścieżka trzymała naraz dokument na stercie
+  // i String z całą treścią (+ narzut alokatora na oba bloki)
+  uint32_t stringPathHeap = doc.memoryUsage() + measureJson(doc) + 1 + 2 * HEAP_BLOCK_OVERHEAD;
+
+  chunkedResponse.begin(code, "application/json");
+  serializeJson(doc, chunkedResponse);
+  uint32_t bytes = chunkedResponse.end();
+
+  responseStats.count++;
+  responseStats.lastBytes = bytes;
+  responseStats.lastHeapUsed = heapUsed;
+  if (bytes > responseStats.maxBytes) responseStats.maxBytes = bytes;
+  if (heapUsed > responseStats.maxHeapUsed) responseStats.maxHeapUsed = heapUsed;
+  responseStats.lastStringPathHeap = stringPathHeap;
+  if (stringPathHeap > responseStats.maxStringPathHeap) responseStats.maxStringPathHeap = stringPathHeap;
+}
+
+// Pola /status; volatileFields = false pomija wartości zmieniające się przy każdym odczycie
+void fillStatus(JsonObject doc, bool volatileFields) {
+  doc["ip"] = WiFi.softAPIP().toString();
+  doc["ssid"] = masterConfig.apSsid;
+  doc["golab_connected"] = golabConnected;
+  doc["walizka_connected"] = walizkaConnected;
+  doc["lom_connected"] = findNodeById("lom")->connected;
+  doc["podloga_connected"] = findNodeById("podloga")->connected;
+  doc["game_active"] = currentGame.isActive;
+  doc["fs_total"] = LittleFS.totalBytes();
+  doc["boot_ms"] = bootTimeMs;
+  doc["config_load_us"] = configLoadUs;
+  doc["golab_audio"] = serialized(golabAudioStats);
+  doc["hint_threshold_to_send_us"] = hintThresholdToSendUs;
+  doc["hint_send_to_ack_us"] = hintSendToAckUs;
+  if (volatileFields) {
+    doc["rssi"] = WiFi.RSSI();
+    doc["uptime"] = millis();
+    doc["free_heap"] = ESP.getFreeHeap();
+    doc["fs_used"] = LittleFS.usedBytes();
+    doc["min_free_heap"] = ESP.getMinFreeHeap();
+    JsonObject http = doc.createNestedObject("http");
+    http["responses"] = responseStats.count;
+    http["last_bytes"] = responseStats.lastBytes;
+    http["max_bytes"] = responseStats.maxBytes;
+    http["last_heap_used"] = responseStats.lastHeapUsed;
+    http["max_heap_used"] = responseStats.maxHeapUsed;
+    http["last_string_path_heap"] = responseStats.lastStringPathHeap;
+    http["max_string_path_heap"] = responseStats.maxStringPathHeap;
+    JsonObject jrn = doc.createNestedObject("journal");
+    jrn["ok"] = journal.part != NULL;
+    jrn["slots"] = journal.slots;
+    jrn["head"] = journal.head;
+    jrn["records"] = journal.records;
+    jrn["last_write_us"] = journal.lastWriteUs;
+    jrn["max_write_us"] = journal.maxWriteUs;
+    jrn["avg_write_us"] = journal.records ? (uint32_t)(journal.totalWriteUs / journal.records) : 0;
+    jrn["erases"] = journal.erases;
+    jrn["last_erase_us"] = journal.lastEraseUs;
+    jrn["max_erase_us"] = journal.maxEraseUs;
+    jrn["checkpoints"] = journal.checkpoints;
+    jrn["compactions"] = journal.compactions;
+    jrn["errors"] = journal.errors;
+    jrn["mount_us"] = journal.mountUs;
+    jrn["replayed"] = journal.replayed;
+    jrn["restored"] = journal.restored;
+    fillHaReport(doc.createNestedObject("ha"));
+  }
+}
+
+void fillPuzzleStatus(JsonObject doc, bool timing) {
+  // Status Walizka LOTTO
+  JsonObject walizka = doc.createNestedObject("walizka");
+  walizka["stage"] = walizkaState.stage;
+  walizka["connected"] = walizkaConnected;
+  walizka["last_update"] = walizkaState.lastUpdate;
+  
+  // Historia kodów
+  JsonArray codes = walizka.createNestedArray("codesHistory");
+  for (int i = 0; i < walizkaState.codesCount && i < 10; i++) {
+    String entry = walizkaState.codesHistory[i];
+    int pipe1 = entry.indexOf('|');
+    int pipe2 = entry.indexOf('|', pipe1 + 1);
+    
+    if (pipe1 > 0 && pipe2 > 0) {
+      JsonObject codeEntry = codes.createNestedObject();
+      codeEntry["code"] = entry.substring(0, pipe1);
+      codeEntry["correct"] = (entry.substring(pipe1 + 1, pipe2) == "1");
+      codeEntry["timestamp"] = formatTimestamp(entry.substring(pipe2 + 1).toInt());
+    }
+  }
+  
+  // Statystyki cyfr
+  JsonObject stats = walizka.createNestedObject("digitStats");
+  for (int i = 0; i < 10; i++) {
+    stats[String(i)] = walizkaState.digitStats[i];
+  }
+
+  for (int i = 0; i < NODE_LINK_COUNT; i++) {
+    addNodeStatus(doc.createNestedObject(nodeLinks[i].id), nodeLinks[i], timing);
+  }
+}
+
+// Stan połączeń wszystkich slave'ów – sekcja "peers" w /snapshot. Tylko pola zmieniające się
+// przy zerwaniu/odzyskaniu łącza, inaczej każdy heartbeat podbijałby wersję sekcji.
+void fillPeerHealth(JsonObject doc) {
+  doc.createNestedObject("golab")["connected"] = golabConnected;
+  doc.createNestedObject("walizka")["connected"] = walizkaConnected;
+  for (int i = 0; i < NODE_LINK_COUNT; i++) {
+    JsonObject node = doc.createNestedObject(nodeLinks[i].id);
+    node["connected"] = nodeLinks[i].connected;
+    node["registered"] = nodeLinks[i].registered;
+  }
+}
+
+// Wiek ostatniej ramki i RTT – "peer_timing" w każdej odpowiedzi /snapshot, poza wersjonowaniem
+void fillPeerTiming(JsonObject doc) {
+  unsigned long now = millis();
+  if (lastGolabHeartbeat > 0) doc.createNestedObject("golab")["age_ms"] = now - lastGolabHeartbeat;
+  if (lastWalizkaHeartbeat > 0) doc.createNestedObject("walizka")["age_ms"] = now - lastWalizkaHeartbeat;
+  for (int i = 0; i < NODE_LINK_COUNT; i++) {
+    if (nodeLinks[i].lastSeen == 0) continue;
+    JsonObject node = doc.createNestedObject(nodeLinks[i].id);
+    node["age_ms"] = now - nodeLinks[i].lastSeen;
+    node["rtt_ms"] = nodeLinks[i].rttMs;
+  }
+}
+
+void refreshSnapshot() {
+  if (!snapshotDirty && snapshotVersion > 0 && millis() - snapshotBuiltAt < SNAPSHOT_REFRESH_MS) return;
+  snapshotDirty = false;
+  snapshotBuiltAt = millis();
+
+  JsonDocument& doc = beginResponseDoc();
+  for (int i = 0; i < SNAP_SECTION_COUNT; i++) {
+    doc.clear();
+    JsonObject obj = doc.to<JsonObject>();
+    switch (i) {
+      case SNAP_STATUS:
+        fillStatus(obj, false);
+        break;
+      case SNAP_HINT:
+        obj["count"] = hintRequestCount;
+        obj["last_request"] = hintRequestTime;
+        break;
+      case SNAP_PUZZLES:
+        fillPuzzleStatus(obj, false);
+        break;
+      case SNAP_PEERS:
+        fillPeerHealth(obj);
+        break;
+      case SNAP_GAME:
+        fillGameSession(obj);
+        break;
+    }
+
+    String json;
+    serializeJson(doc, json);
+    uint32_t hash = fnv1aHash(json);
+    if (snapshotParts[i].version == 0 || hash != snapshotParts[i].hash) {
+      snapshotParts[i].json = json;
+      snapshotParts[i].hash = hash;
+      snapshotParts[i].version = ++snapshotVersion;
+    }
+  }
+}
+
+// Pojedynczy endpoint komendy: body -> runPanelCommand -> ta sama odpowiedź co w /batch
+void handlePanelCommand(const char* op, bool needsBody) {
+  if (!server.hasArg("plain") && needsBody) {
+    server.send(400, "application/json", "{\"success\":false,\"error\":\"Brak danych\"}");
+    return;
+  }
+  parseRequestBody();
+
+  JsonDocument& result = beginResponseDoc();
+  int code = runPanelCommand(op, requestDoc.as<JsonObject>(), result.to<JsonObject>());
+  sendJson(code, result);
+}
+
+int commandResult(JsonObject result, int code, const String& text) {
+  result["success"] = code == 200;
+  result[code == 200 ? "message" : "error"] = text;
+  return code;
+}
+
+// Komendy panelu wspólne dla /play_audio, /stop_audio, /command, /set_volume, /puzzle_command i /batch
+int runPanelCommand(const String& op, JsonObject args, JsonObject result) {
+  if (op == "play_audio") {
+    String fileName = args["fileName"] | "";
+    bool queued = args["queue"] | false;
+    if (sendAudioToGolab(fileName, queued)) {
+      Serial.println("Wysłano audio do Gołąb: " + fileName);
+      if (currentGame.isActive && fileName.indexOf("hint") >= 0) {
+        currentGame.hintsUsed++;
+        snapshotDirty = true;
+        journalLogHint();
+        queueRoomEvent("hint:" + fileName);
+      }
+      return commandResult(result, 200, "Audio wysłane do Gołąb");
+    }
+    return commandResult(result, 500, "Błąd wysyłania do Gołąb");
+  }
+
+  if (op == "stop_audio") {
+    if (sendCommandToGolab("stop_audio", "")) return commandResult(result, 200, "Stop wysłane do Gołąb");
+    return commandResult(result, 500, "Błąd komunikacji z Gołąb");
+  }
+
+  if (op == "set_volume") {
+    int volume = args["volume"] | 20;
+    volume = constrain(volume, 0, 30);
+    if (sendCommandToGolab("set_volume", String(volume))) {
+      Serial.println("Ustawiono głośność Gołąb: " + String(volume));
+      return commandResult(result, 200, "Głośność ustawiona: " + String(volume));
+    }
+    return commandResult(result, 500, "Błąd komunikacji z Gołąb");
+  }
+
+  if (op == "room_command") {
+    // {"room":"pokoj2","command":{"op":"command",...}} – własny pokój wykonywany od razu
+    String roomId = args["room"] | "";
+    JsonObject command = args["command"];
+    String innerOp = command["op"] | "";
+    if (command.isNull() || innerOp.length() == 0 || innerOp == "room_command") {
+      return commandResult(result, 400, "Brak komendy dla pokoju");
+    }
+    if (roomId == masterConfig.roomId) return runPanelCommand(innerOp, command, result);
+    return relayRoomCommand(roomId, command, result);
+  }
+
+  if (op == "group_command") {
+    String target = args["target"] | "";
+    String command = args["command"] | "";
+    if (command.length() == 0 || resolveGroupTarget(target) == 0) {
+      return commandResult(result, 400, "Nieznana grupa albo brak komendy");
+    }
+    uint16_t seq = sendGroupCommand(target, command, args["data"] | "");
+    if (seq == 0) return commandResult(result, 503, "Brak osiągalnych adresatów albo wolnego slotu");
+    result["seq"] = seq;
+    return commandResult(result, 200, "Komenda grupowa wysłana");
+  }
+
+  if (op == "command") {
+    String command = args["command"] | "";
+    bool success = false;
+    String message = "";
+    
+    if (command == "start_game") {
+      success = startGame(args["data"]);
+      message = success ? "Gra rozpoczęta" : "Błąd rozpoczynania gry";
+    } else if (command == "pause_game") {
+      success = pauseGame(args["data"]["paused"]);
+      message = success ? (args["data"]["paused"] ? "Gra wstrzymana" : "Gra wznowiona") : "Błąd pauzy";
+    } else if (command == "end_game") {
+      success = endGame(args["data"]["status"]);
+      message = success ? "Gra zakończona" : "Błąd zakończenia gry";
+    } else {
+      message = "Nieznana komenda: " + command;
+    }
+
+    // Jak dotąd: 200 także przy niepowodzeniu, wynik w "success"
+    result["success"] = success;
+    result["message"] = message;
+    return 200;
+  }
+
+  if (op == "puzzle_command") {
+    String puzzle = args["puzzle"] | "";
+    String command = args["command"] | "";
+    
+    if (puzzle == "walizka") {
+      if (command == "open_lock") {
+        if (sendCommandToWalizka("open_lock", "")) return commandResult(result, 200, "Komenda wysłana do Walizka");
+        return commandResult(result, 500, "Błąd komunikacji z Walizka");
+      }
+      if (command == "reset") {
+        if (sendCommandToWalizka("reset_puzzle", "")) return commandResult(result, 200, "Reset wysłany do Walizka");
+        return commandResult(result, 500, "Błąd komunikacji z Walizka");
+      }
+      return commandResult(result, 400, "Nieznana komenda");
+    }
+
+    if (puzzle == "podloga" && command.startsWith("relay_")) {
+      // Podłoga: binarna ramka na wybrany kanał (relay_on = LATCH, relay_off, relay_pulse)
+      NodeLink* node = findNodeById(puzzle);
+      uint8_t channel = args["channel"] | 0;
+      uint32_t ms = args["ms"] | 500;
+      uint8_t mode;
+      if (command == "relay_on") mode = RELAY_MODE_LATCH;
+      else if (command == "relay_off") mode = RELAY_MODE_OFF;
+      else if (command == "relay_pulse") mode = RELAY_MODE_PULSE;
+      else return commandResult(result, 400, "Nieznana komenda");
+
+      if (sendRelayFrame(*node, channel, mode, ms) >= 0) return commandResult(result, 200, "Komenda wysłana do Podłoga");
+      return commandResult(result, 500, "Błąd komunikacji z Podłoga");
+    }
+
+    if (NodeLink* node = findNodeById(puzzle)) {
+      // Łom / Podłoga / węzły I/O: start, reset, relay_on, relay_off
+      // Węzły I/O przyjmują dodatkowo komendy surowe z polem "data" ("indeks:wartość")
+      bool ioNode = strncmp(node->id, "io", 2) == 0;
+      String channel = String((int)(args["channel"] | 0));
+      String nodeCommand;
+      String nodeData = "";
+      if (command == "start") nodeCommand = "start_puzzle";
+      else if (command == "reset") nodeCommand = "reset_puzzle";
+      else if (command == "relay_on") { nodeCommand = "relay"; nodeData = ioNode ? channel + ":1" : "1"; }
+      else if (command == "relay_off") { nodeCommand = "relay"; nodeData = ioNode ? channel + ":0" : "0"; }
+      else if (ioNode && (command == "relay" || command == "pulse" || command == "pwm" ||
+                          command == "play" || command == "volume" || command == "stop_audio" ||
+                          command == "subscribe" || command == "get")) {
+        nodeCommand = command;
+        nodeData = args["data"] | "";
+      }
+      else return commandResult(result, 400, "Nieznana komenda");
+
+      if (sendCommandToNode(*node, nodeCommand, nodeData)) return commandResult(result, 200, "Komenda wysłana do " + String(node->label));
+      return commandResult(result, 500, "Błąd komunikacji z " + String(node->label));
+    }
+
+    return commandResult(result, 400, "Nieznana zagadka");
+  }
+
+  return commandResult(result, 400, "Nieznana operacja: " + op);
+}
+
+// === WEBSOCKET PANELU ===
+
+void setupWebSocket() {
+  deliveryQueue = xQueueCreate(DELIVERY_SLOTS * 2, sizeof(DeliveryReport));
+  webSocket.begin();
+  webSocket.onEvent(webSocketEvent);
+  webSocket.enableHeartbeat(15000, 3000, 2);   // martwe tablety znikają bez czekania na TCP
+  Serial.println("WebSocket uruchomiony na porcie 81");
+}
+
+void webSocketEvent(uint8_t num, WStype_t type, uint8_t* payload, size_t length) {
+  if (type == WStype_CONNECTED) {
+    Serial.println("WebSocket: panel #" + String(num) + " połączony");
+    return;
+  }
+  if (type == WStype_DISCONNECTED) {
+    Serial.println("WebSocket: panel #" + String(num) + " rozłączony");
+    return;
+  }
+  if (type != WStype_TEXT) return;
+
+  unsigned long receivedUs = micros();
+  DynamicJsonDocument doc(512);
+  if (deserializeJson(doc, payload, length)) {
+    webSocket.sendTXT(num, "{\"success\":false,\"error\":\"Niepoprawny JSON\"}");
+    return;
+  }
+  uint32_t id = doc["id"] | 0;
+  String op = doc["op"] | "";
+
+  // Uzbrój śledzenie – pierwsza ramka ESP-NOW wysłana przez komendę dostaje to "id"
+  deliveryArmed = true;
+  deliveryArmClient = num;
+  deliveryArmId = id;
+  deliveryArmUs = receivedUs;
+
+  DynamicJsonDocument result(256);
+  int code = runPanelCommand(op, doc.as<JsonObject>(), result.to<JsonObject>());
+  bool tracked = !deliveryArmed;
+  deliveryArmed = false;
+
+  result["id"] = id;
+  result["code"] = code;
+  result["track"] = tracked;
+  String response;
+  serializeJson(result, response);
+  webSocket.sendTXT(num, response);
+}
+
+void watchDelivery(const uint8_t* mac) {
+  if (!deliveryArmed) return;
+  deliveryArmed = false;
+
+  portENTER_CRITICAL(&deliveryMux);
+  for (int i = 0; i < DELIVERY_SLOTS; i++) {
+    DeliveryWatch& w = deliveryWatches[i];
+    if (w.used) continue;
+    w.used = true;
+    w.client = deliveryArmClient;
+    w.id = deliveryArmId;
+    memcpy(w.mac, mac, 6);
+    w.startUs = deliveryArmUs;
+    w.sentMs = millis();
+    break;
+  }
+  portEXIT_CRITICAL(&deliveryMux);
+}
+
+// Wołane z OnDataSent (zadanie WiFi): potwierdzenia przychodzą w kolejności wysyłania,
+// więc najstarszy wpis dla danego MAC to ta ramka
+void resolveDelivery(const uint8_t* mac, bool delivered) {
+  unsigned long now = micros();
+  int oldest = -1;
+
+  portENTER_CRITICAL(&deliveryMux);
+  for (int i = 0; i < DELIVERY_SLOTS; i++) {
+    DeliveryWatch& w = deliveryWatches[i];
+    if (!w.used || memcmp(w.mac, mac, 6) != 0) continue;
+    if (oldest < 0 || (long)(w.startUs - deliveryWatches[oldest].startUs) < 0) oldest = i;
+  }
+  DeliveryReport report = { 0, 0, delivered, 0 };
+  if (oldest >= 0) {
+    DeliveryWatch& w = deliveryWatches[oldest];
+    report.client = w.client;
+    report.id = w.id;
+    report.us = now - w.startUs;
+    w.used = false;
+  }
+  portEXIT_CRITICAL(&deliveryMux);
+
+  if (oldest >= 0) xQueueSend(deliveryQueue, &report, 0);
+}
+
+void flushDeliveryReports() {
+  DeliveryReport report;
+  char msg[80];
+  while (xQueueReceive(deliveryQueue, &report, 0) == pdTRUE) {
+    snprintf(msg, sizeof(msg), "{\"id\":%lu,\"dlv\":%d,\"ms\":%.1f}",
+             (unsigned long)report.id, report.delivered ? 1 : 0, report.us / 1000.0f);
+    webSocket.sendTXT(report.client, msg);
+  }
+
+  // Brak callbacku ESP-NOW w rozsądnym czasie – zgłoś niedostarczenie i zwolnij miejsce
+  for (int i = 0; i < DELIVERY_SLOTS; i++) {
+    DeliveryWatch& w = deliveryWatches[i];
+    if (!w.used || millis() - w.sentMs < DELIVERY_TIMEOUT_MS) continue;
+    portENTER_CRITICAL(&deliveryMux);
+    bool expired = w.used;
+    w.used = false;
+    portEXIT_CRITICAL(&deliveryMux);
+    if (expired) {
+      snprintf(msg, sizeof(msg), "{\"id\":%lu,\"dlv\":0}", (unsigned long)w.id);
+      webSocket.sendTXT(w.client, msg);
+    }
+  }
+}
+
+// === GORĄCA REZERWA MASTERA ===
+
+uint8_t haGameState() {
+  if (currentGame.state == "active") return HA_GAME_ACTIVE;
+  if (currentGame.state == "paused") return HA_GAME_PAUSED;
+  if (currentGame.state == "finished") return HA_GAME_FINISHED;
+  return HA_GAME_IDLE;
+}
+
+// Przed setupWiFiAP(): rola z nasłuchu heartbeatu, potem adres MAC odpowiedni dla roli.
+// Heartbeaty idą na adres rezerwowego, więc płytka startująca pod tym adresem usłyszy
+// aktywnego, którakolwiek z pary nim teraz jest.
+void haBegin() {
+  ha.role = HA_OFF;
+  if (masterConfig.haRole == HA_OFF) {
+    haHandover.magic = 0;
+    return;
+  }
+
+  uint8_t own[6];
+  esp_read_mac(own, ESP_MAC_WIFI_STA);      // fabryczny – esp_wifi_set_mac nie przeżywa restartu
+  bool preferPrimary = masterConfig.haRole == HA_PRIMARY;
+  memcpy(ha.roomMac, preferPrimary ? own : masterConfig.haPeerMac, 6);
+  memcpy(ha.standbyMac, preferPrimary ? masterConfig.haPeerMac : own, 6);
+  ha.records = xQueueCreate(HA_RECORD_QUEUE, sizeof(JournalRecord));
+
+  bool takeover = haHandover.magic == HA_HANDOVER_MAGIC;
+  if (!takeover) {
+    // Preferowany aktywny czeka krócej – przy jednoczesnym starcie obu to on zostaje aktywnym
+    WiFi.mode(WIFI_STA);
+    esp_wifi_set_mac(WIFI_IF_STA, ha.standbyMac);
+    esp_wifi_set_channel(masterConfig.channel, WIFI_SECOND_CHAN_NONE);
+    radioChannel = masterConfig.channel;
+    ha.role = HA_STANDBY;
+    if (esp_now_init() == ESP_OK) {
+      esp_now_register_recv_cb(OnDataRecv);
+      unsigned long listen = preferPrimary ? HA_HEARTBEAT_MS * 4 : HA_FAILOVER_MS;
+      unsigned long start = millis();
+      while (!ha.heardPrimary && millis() - start < listen) delay(10);
+      esp_now_deinit();
+    }
+    if (ha.heardPrimary) {
+      Serial.println("HA: aktywny Master odpowiada – start jako rezerwowy (" + formatMac(ha.standbyMac) + ")");
+      return;
+    }
+  }
+
+  // Aktywny: adres pokoju na STA i odpowiadający mu adres AP (na ESP32 domyślnie STA + 1),
+  // więc slave'y i tablety panelu nie widzą zmiany
+  ha.role = HA_PRIMARY;
+  uint8_t apMac[6];
+  memcpy(apMac, ha.roomMac, 6);
+  apMac[5] += 1;
+  WiFi.mode(WIFI_AP_STA);
+  if (esp_wifi_set_mac(WIFI_IF_STA, ha.roomMac) != ESP_OK || esp_wifi_set_mac(WIFI_IF_AP, apMac) != ESP_OK) {
+    Serial.println("HA: nie udało się ustawić adresu MAC pokoju");
+  }
+  if (takeover) {
+    ha.tookOver = true;
+    ha.detectMs = haHandover.detectMs;
+  }
+  Serial.println(String("HA: start jako aktywny (") + formatMac(ha.roomMac) + ")" + (takeover ? " – przejęcie" : ""));
+}
+
+// Po setupESPNow(): peer drugiej płytki, a po przejęciu węzły zarejestrowane u poprzedniego
+// aktywnego – "registered" to szybka ścieżka dołączenia, węzeł odpowiada heartbeatem
+void haStart() {
+  if (ha.role == HA_OFF) return;
+  addEspNowPeer(ha.role == HA_PRIMARY ? ha.standbyMac : ha.roomMac,
+                ha.role == HA_PRIMARY ? "Master rezerwowy" : "Master aktywny",
+                masterConfig.haKeySet ? masterConfig.haKey : NULL);
+  if (!masterConfig.haKeySet) Serial.println("HA: brak ha_key – łącze pary nieszyfrowane, hasło AP nie jest synchronizowane");
+  if (ha.role == HA_PRIMARY) {
+    ha.loopAliveMs = millis();
+    xTaskCreatePinnedToCore(haHeartbeatTask, "haHeartbeat", 3072, NULL, 2, NULL, 1);
+  }
+
+  if (ha.tookOver) {
+    for (int i = 0; i < NODE_LINK_COUNT; i++) {
+      if (!(haHandover.nodeMask & (1 << i))) continue;
+      NodeLink& node = nodeLinks[i];
+      memcpy(node.mac, haHandover.nodeMacs[i], 6);
+      addEspNowPeer(node.mac, node.label);
+      node.registered = true;
+      sendCommandToNode(node, "registered", String(millis()));
+    }
+  }
+  haHandover.magic = 0;
+}
+
+// Wołane z OnDataRecv (zadanie WiFi): tylko kopie, stosowanie i zapis do flash w loop()
+void haHandleFrame(const uint8_t* mac, const uint8_t* data, int len) {
+  uint8_t type = data[1];
+  if (ha.role == HA_PRIMARY) {
+    if (type == HA_SYNC_REQUEST && memcmp(mac, ha.standbyMac, 6) == 0) ha.syncRequested = true;
+    return;
+  }
+  if (ha.role != HA_STANDBY || memcmp(mac, ha.roomMac, 6) != 0) return;
+
+  if (type == HA_HEARTBEAT && len == sizeof(HaHeartbeat)) {
+    portENTER_CRITICAL(&haMux);
+    memcpy(&ha.heartbeat, data, sizeof(HaHeartbeat));
+    ha.lastHeartbeatMs = millis();
+    ha.heardPrimary = true;
+    ha.heartbeatPending = true;
+    portEXIT_CRITICAL(&haMux);
+  } else if (type == HA_RECORD && len == sizeof(HaRecordFrame) && ha.records != NULL) {
+    xQueueSend(ha.records, data + offsetof(HaRecordFrame, rec), 0);   // pełna kolejka = luka, wykryje ją heartbeat
+  } else if (type == HA_CONFIG && len == sizeof(HaConfigFrame)) {
+    portENTER_CRITICAL(&haMux);
+    memcpy(&ha.config, data, sizeof(HaConfigFrame));
+    ha.configPending = true;
+    portEXIT_CRITICAL(&haMux);
+  } else if (type == HA_CHANNEL && len == sizeof(HaChannelFrame)) {
+    const HaChannelFrame* frame = (const HaChannelFrame*)data;
+    if (channelValid(frame->channel)) {
+      ha.channelAt = millis() + frame->delayMs;
+      ha.channelTo = frame->channel;
+    }
+  }
+}
+
+// Wołane z journalWrite() po udanym zapisie – rekord z numeracją aktywnego
+void haReplicateRecord(const JournalRecord& rec) {
+  if (ha.role != HA_PRIMARY) return;
+  HaRecordFrame frame;
+  frame.magic = HA_FRAME_MAGIC;
+  frame.type = HA_RECORD;
+  frame.rec = rec;
+  if (espNowSend(ha.standbyMac, (const uint8_t*)&frame, sizeof(frame)) == ESP_OK) ha.recordsSent++;
+}
+
+void haServicePrimary() {
+  if (ha.drill) {
+    Serial.println("HA: próba przejęcia – aktywny milknie");
+    esp_now_deinit();
+    WiFi.mode(WIFI_OFF);
+    delay(HA_DRILL_SILENCE_MS);
+    ESP.restart();
+  }
+
+  if (ha.syncRequested) {
+    // Checkpoint = cała sesja od nowego START; rekordy idą do rezerwowego jak każde inne
+    ha.syncRequested = false;
+    ha.syncs++;
+    if (currentGame.state != "idle") journalCheckpoint();
+  }
+
+  unsigned long now = millis();
+  if (now - ha.lastHeartbeatSentMs >= HA_HEARTBEAT_MS) {
+    ha.lastHeartbeatSentMs = now;
+    HaHeartbeat hb;
+    memset(&hb, 0, sizeof(hb));
+    hb.magic = HA_FRAME_MAGIC;
+    hb.type = HA_HEARTBEAT;
+    hb.seq = journal.nextSeq - 1;
+    hb.state = haGameState();
+    for (int i = 0; i < NODE_LINK_COUNT; i++) {
+      if (!nodeLinks[i].registered) continue;
+      hb.nodeMask |= 1 << i;
+      memcpy(hb.nodeMacs[i], nodeLinks[i].mac, 6);
+    }
+    portENTER_CRITICAL(&haMux);
+    memcpy(&ha.heartbeat, &hb, sizeof(hb));
+    ha.loopAliveMs = now;
+    portEXIT_CRITICAL(&haMux);
+  }
+
+  if (now - ha.lastConfigSentMs >= HA_CONFIG_MS) {
+    ha.lastConfigSentMs = now;
+    HaConfigFrame cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.magic = HA_FRAME_MAGIC;
+    cfg.type = HA_CONFIG;
+    strlcpy(cfg.apSsid, masterConfig.apSsid, sizeof(cfg.apSsid));
+    // Hasło AP tylko szyfrowanym łączem – bez ha_key rezerwowy zostaje przy własnym
+    if (masterConfig.haKeySet) strlcpy(cfg.apPassword, masterConfig.apPassword, sizeof(cfg.apPassword));
+    memcpy(cfg.golabMac, masterConfig.golabMac, 6);
+    memcpy(cfg.walizkaMac, masterConfig.walizkaMac, 6);
+    cfg.heartbeatTimeout = masterConfig.heartbeatTimeout;
+    cfg.heartbeatInterval = masterConfig.heartbeatInterval;
+    cfg.channel = masterConfig.channel;
+    espNowSend(ha.standbyMac, (const uint8_t*)&cfg, sizeof(cfg));
+  }
+}
+
+// Aktywny: heartbeat co HA_HEARTBEAT_MS niezależnie od loop(), z treścią odświeżaną przez loop()
+void haHeartbeatTask(void* arg) {
+  HaHeartbeat hb;
+  for (;;) {
+    vTaskDelay(pdMS_TO_TICKS(HA_HEARTBEAT_MS));
+    portENTER_CRITICAL(&haMux);
+    memcpy(&hb, &ha.heartbeat, sizeof(hb));
+    unsigned long alive = ha.loopAliveMs;
+    portEXIT_CRITICAL(&haMux);
+    if (hb.magic != HA_FRAME_MAGIC || millis() - alive > HA_LOOP_STALL_MS) continue;
+    if (espNowSend(ha.standbyMac, (const uint8_t*)&hb, sizeof(hb)) == ESP_OK) ha.heartbeats++;
+  }
+}
+
+void haServiceStandby() {
+  // Rekordy od aktywnego: stan w RAM jak przy odtwarzaniu dziennika + zapis do własnego.
+  // START jest samodzielny (checkpoint), każdy inny musi mieć kolejny numer.
+  JournalRecord rec;
+  while (xQueueReceive(ha.records, &rec, 0) == pdTRUE) {
+    if (rec.magic != JOURNAL_MAGIC || rec.version != JOURNAL_VERSION || rec.crc != journalRecordCrc(rec)) continue;
+    if (rec.type != JRN_START && (!ha.synced || rec.seq != ha.lastSeq + 1)) {
+      if (ha.synced) ha.gaps++;
+      ha.synced = false;
+      continue;
+    }
+    ha.lastSeq = rec.seq;
+    ha.synced = true;
+    ha.mismatches = 0;
+
+    unsigned long elapsed = 0;
+    journalApply(rec, elapsed);
+    journalRestoreClock(elapsed);
+    journalWrite(rec);           // własna numeracja i CRC
+    if (rec.type == JRN_END) journal.compactPending = true;
+    ha.recordsApplied++;
+  }
+
+  if (ha.heartbeatPending) {
+    HaHeartbeat hb;
+    portENTER_CRITICAL(&haMux);
+    memcpy(&hb, &ha.heartbeat, sizeof(hb));
+    ha.heartbeatPending = false;
+    portEXIT_CRITICAL(&haMux);
+
+    haHandover.nodeMask = hb.nodeMask;
+    memcpy(haHandover.nodeMacs, hb.nodeMacs, sizeof(haHandover.nodeMacs));
+
+    if (hb.state == HA_GAME_IDLE) {
+      // Aktywny bez gry – stara sesja z własnego dziennika nie może wrócić po przejęciu
+      if (currentGame.state != "idle") {
+        resetGameSession();
+        resetWalizkaState();
+        snapshotDirty = true;
+        journal.compactPending = true;
+      }
+      ha.lastSeq = hb.seq;
+      ha.synced = true;
+      ha.mismatches = 0;
+    } else if (!ha.synced || hb.seq != ha.lastSeq) {
+      // Dwa heartbeaty z rzędu – za pierwszym rekordy mogą jeszcze być w drodze
+      unsigned long now = millis();
+      if (++ha.mismatches >= 2 && now - ha.lastSyncRequestMs >= HA_SYNC_RETRY_MS) {
+        HaControlFrame req = { HA_FRAME_MAGIC, HA_SYNC_REQUEST };
+        espNowSend(ha.roomMac, (const uint8_t*)&req, sizeof(req));
+        ha.lastSyncRequestMs = now;
+        ha.mismatches = 0;
+        ha.syncs++;
+      }
+    } else {
+      ha.mismatches = 0;
+    }
+  }
+
+  if (ha.configPending) {
+    HaConfigFrame cfg;
+    portENTER_CRITICAL(&haMux);
+    memcpy(&cfg, &ha.config, sizeof(cfg));
+    ha.configPending = false;
+    portEXIT_CRITICAL(&haMux);
+
+    MasterConfig next = masterConfig;
+    cfg.apSsid[sizeof(cfg.apSsid) - 1] = '\0';
+    cfg.apPassword[sizeof(cfg.apPassword) - 1] = '\0';
+    strlcpy(next.apSsid, cfg.apSsid, sizeof(next.apSsid));
+    if (cfg.apPassword[0] != '\0') strlcpy(next.apPassword, cfg.apPassword, sizeof(next.apPassword));
+    memcpy(next.golabMac, cfg.golabMac, 6);
+    memcpy(next.walizkaMac, cfg.walizkaMac, 6);
+    next.heartbeatTimeout = cfg.heartbeatTimeout;
+    next.heartbeatInterval = cfg.heartbeatInterval;
+    if (channelValid(cfg.channel)) next.channel = cfg.channel;   // po restarcie nasłuch na kanale aktywnego
+    if (memcmp(&next, &masterConfig, sizeof(next)) != 0) {
+      masterConfig = next;
+      saveMasterConfig();
+      Serial.println("HA: konfiguracja aktywnego zapisana");
+    }
+  }
+
+  if (ha.channelTo != 0 && (long)(millis() - ha.channelAt) >= 0) {
+    radioChannel = ha.channelTo;
+    ha.channelTo = 0;
+    esp_wifi_set_channel(radioChannel, WIFI_SECOND_CHAN_NONE);
+    masterConfig.channel = radioChannel;
+    saveMasterConfig();
+    ha.lastHeartbeatMs = millis();     // aktywny przechodzi chwilę po slave'ach
+    Serial.println("HA: kanał radiowy zmieniony na " + String(radioChannel));
+  }
+
+  // Odczyt czasu heartbeatu przed millis() – callback może go podbić w międzyczasie
+  unsigned long last = ha.lastHeartbeatMs;
+  unsigned long silent = millis() - last;
+  if (ha.heardPrimary && silent > HA_FAILOVER_MS) {
+    // Restart pod adresem pokoju: setup() ustawi MAC i AP, journalMount() odtworzy grę
+    // i ogłosi ją slave'om, haStart() przywróci rejestracje węzłów
+    Serial.printf("HA: aktywny milczy od %lu ms – przejmuję pokój\n", silent);
+    haHandover.detectMs = silent;
+    haHandover.magic = HA_HANDOVER_MAGIC;
+    delay(10);
+    ESP.restart();
+  }
+}
+
+void haService() {
+  if (ha.role == HA_PRIMARY) haServicePrimary();
+  else if (ha.role == HA_STANDBY) haServiceStandby();
+}
+
+void fillHaReport(JsonObject doc) {
+  doc["role"] = HA_ROLE_NAMES[ha.role];
+  doc["preferred"] = HA_ROLE_NAMES[masterConfig.haRole];
+  if (ha.role == HA_OFF) return;
+  doc["room_mac"] = formatMac(ha.roomMac);
+  doc["standby_mac"] = formatMac(ha.standbyMac);
+  doc["failover_ms"] = HA_FAILOVER_MS;
+  doc["syncs"] = ha.syncs;
+
+  if (ha.role == HA_PRIMARY) {
+    doc["heartbeats"] = ha.heartbeats;
+    doc["records_sent"] = ha.recordsSent;
+    doc["journal_seq"] = journal.nextSeq - 1;
+  } else {
+    doc["heartbeat_age_ms"] = ha.heardPrimary ? millis() - ha.lastHeartbeatMs : 0;
+    doc["synced"] = ha.synced;
+    doc["primary_seq"] = ha.lastSeq;
+    doc["records_applied"] = ha.recordsApplied;
+    doc["gaps"] = ha.gaps;
+    doc["game_state"] = currentGame.state;
+  }
+
+  if (ha.tookOver) {
+    // Czas przejęcia: cisza aktywnego do decyzji + restart do gotowości (bez ~0,3 s bootloadera)
+    // i do pierwszej ramki slave'a pod nowym aktywnym
+    JsonObject failover = doc.createNestedObject("last_failover");
+    failover["detect_ms"] = ha.detectMs;
+    failover["ready_ms"] = ha.readyMs;
+    failover["rehome_ms"] = ha.rehomeMs;
+    failover["total_ms"] = ha.detectMs + (ha.rehomeMs ? ha.rehomeMs : ha.readyMs);
+  }
+}
+
+// === KANAŁ RADIOWY ===
+
+// Średni RTT heartbeatu węzłów na bieżącym kanale – do porównania kanałów w /channel
+void sampleChannelRtt() {
+  uint32_t total = 0;
+  int count = 0;
+  for (int i = 0; i < NODE_LINK_COUNT; i++) {
+    if (!nodeLinks[i].connected || !nodeLinks[i].clockValid) continue;
+    total += nodeLinks[i].rttMs;
+    count++;
+  }
+  if (count > 0) channelLinks[radioChannel].rttMs = total / count;
+}
+
+// -1 = za mało ramek na tym kanale
+float channelLossPercent(int channel) {
+  const ChannelLink& link = channelLinks[channel];
+  if (link.sent < CHANNEL_MIN_SAMPLES) return -1.0f;
+  return 100.0f * link.failed / link.sent;
+}
+
+// Niższy = lepszy: obce sieci na kanale i sąsiednich + kara za zmierzone straty ESP-NOW
+float channelScore(int channel) {
+  float score = channelSurvey.interferenceDbm[channel];
+  float loss = channelLossPercent(channel);
+  if (loss > 0) score += loss * CHANNEL_LOSS_PENALTY_DB;
+  return score;
+}
+
+// Przy równym wyniku zostaje bieżący – zmiana kanału rozłącza tablety panelu
+uint8_t bestSurveyChannel() {
+  uint8_t best = radioChannel;
+  for (int ch = CHANNEL_MIN; ch <= CHANNEL_MAX; ch++) {
+    if (channelScore(ch) < channelScore(best)) best = ch;
+  }
+  return best;
+}
+
+// Przegląd w tle, prowadzony przez serviceChannelSurvey(); false = przegląd albo zmiana kanału w toku
+bool startChannelSurvey(bool autoSwitch) {
+  if (channelSurvey.running || channelSwitch.phase != CHANNEL_IDLE) return false;
+  channelSurvey.running = true;
+  channelSurvey.autoSwitch = autoSwitch;
+  channelSurvey.scanChannel = CHANNEL_MIN;
+  channelSurvey.startedAt = millis();
+  channelSurvey.nextScanAt = channelSurvey.startedAt;
+  channelSurvey.scanNetworks = 0;
+  memset(channelSurvey.scanApCount, 0, sizeof(channelSurvey.scanApCount));
+  memset(channelSurvey.scanMaxRssi, 0, sizeof(channelSurvey.scanMaxRssi));
+  memset(channelSurvey.scanPowerMw, 0, sizeof(channelSurvey.scanPowerMw));
+  sampleChannelRtt();
+  return true;
+}
+
+// Wyniki skanu jednego kanału do sum przeglądu
+void collectSurveyScan(int found) {
+  String ownBssid = WiFi.softAPmacAddress();
+  for (int i = 0; i < found; i++) {
+    int channel = WiFi.channel(i);
+    if (!channelValid(channel) || WiFi.BSSIDstr(i).equalsIgnoreCase(ownBssid)) continue;
+    int rssi = WiFi.RSSI(i);
+    channelSurvey.scanNetworks++;
+    if (channelSurvey.scanApCount[channel] == 0 || rssi > channelSurvey.scanMaxRssi[channel]) channelSurvey.scanMaxRssi[channel] = rssi;
+    if (channelSurvey.scanApCount[channel] < 255) channelSurvey.scanApCount[channel]++;
+    // Kanały 2,4 GHz co 5 MHz przy szerokości 20 MHz – sieć zakłóca też 4 sąsiednie w każdą stronę
+    for (int ch = CHANNEL_MIN; ch <= CHANNEL_MAX; ch++) {
+      int distance = abs(ch - channel);
+      if (distance < 5) channelSurvey.scanPowerMw[ch] += powf(10.0f, rssi / 10.0f) * CHANNEL_OVERLAP[distance];
+    }
+  }
+  WiFi.scanDelete();
+}
+
+void finishChannelSurvey() {
+  channelSurvey.running = false;
+  memcpy(channelSurvey.apCount, channelSurvey.scanApCount, sizeof(channelSurvey.apCount));
+  memcpy(channelSurvey.maxRssi, channelSurvey.scanMaxRssi, sizeof(channelSurvey.maxRssi));
+  for (int ch = CHANNEL_MIN; ch <= CHANNEL_MAX; ch++) {
+    float powerMw = channelSurvey.scanPowerMw[ch];
+    float dbm = powerMw > 0 ? 10.0f * log10f(powerMw) : CHANNEL_NOISE_FLOOR_DBM;
+    channelSurvey.interferenceDbm[ch] = dbm < CHANNEL_NOISE_FLOOR_DBM ? CHANNEL_NOISE_FLOOR_DBM : dbm;
+  }
+  channelSurvey.valid = true;
+  channelSurvey.at = millis();
+  channelSurvey.durationMs = channelSurvey.at - channelSurvey.startedAt;
+  channelSurvey.networks = channelSurvey.scanNetworks;
+  uint8_t best = bestSurveyChannel();
+  Serial.printf("Przegląd kanałów: %d sieci w %lu ms, zalecany %u (teraz %u)\n", channelSurvey.networks,
+                (unsigned long)channelSurvey.durationMs, best, radioChannel);
+
+  String error;
+  if (channelSurvey.autoSwitch && best != radioChannel && !currentGame.isActive &&
+      channelScore(radioChannel) - channelScore(best) >= CHANNEL_SWITCH_MARGIN_DB &&
+      !startChannelSwitch(best, "auto", false, error)) {
+    Serial.println("Kanał: automatyczna zmiana odrzucona – " + error);
+  }
+}
+
+// Jeden kanał na raz: skan asynchroniczny, potem CHANNEL_SCAN_GAP_MS na kanale pokoju
+void serviceChannelSurvey() {
+  if (!channelSurvey.running) return;
+  int found = WiFi.scanComplete();
+  if (found == WIFI_SCAN_RUNNING) return;
+  if (found >= 0) {
+    collectSurveyScan(found);
+    channelSurvey.scanChannel++;
+    channelSurvey.nextScanAt = millis() + CHANNEL_SCAN_GAP_MS;
+    if (channelSurvey.scanChannel > CHANNEL_MAX) {
+      finishChannelSurvey();
+      return;
+    }
+  }
+  if ((long)(millis() - channelSurvey.nextScanAt) < 0) return;
+  // WIFI_SCAN_FAILED też tu: brak skanu w toku (albo nieudany) – skan bieżącego kanału od nowa
+  if (WiFi.scanNetworks(true, true, false, CHANNEL_SCAN_MS, channelSurvey.scanChannel) == WIFI_SCAN_FAILED) {
+    channelSurvey.running = false;
+    WiFi.scanDelete();
+    Serial.println("Przegląd kanałów: skan nieudany");
+  }
+}
+
+// Faza 2: commit do wszystkich – także tych bez ACK prepare (mogło zginąć tylko potwierdzenie).
+// Rezerwowy Master dostaje zapowiedź osobno. Master przechodzi ostatni, po powtórkach commitu.
+// forced: bez kompletu potwierdzeń prepare – slave przejdzie także bez własnego prepare.
+void commitChannelSwitch(bool forced) {
+  channelSwitch.seq = sendGroupCommand("all", "channel_commit",
+                                       String(channelSwitch.target) + ":" + String(CHANNEL_SWITCH_DELAY_MS) +
+                                       (forced ? ":force" : ""));
+  if (ha.role == HA_PRIMARY) {
+    HaChannelFrame frame = { HA_FRAME_MAGIC, HA_CHANNEL, channelSwitch.target, (uint16_t)CHANNEL_SWITCH_DELAY_MS };
+    for (int i = 0; i < 3; i++) espNowSend(ha.standbyMac, (const uint8_t*)&frame, sizeof(frame));
+  }
+  channelSwitch.switchAt = millis() + CHANNEL_SWITCH_DELAY_MS + GROUP_RETRY_MS * GROUP_MAX_RETRIES;
+  channelSwitch.phase = CHANNEL_COMMITTED;
+  Serial.printf("Kanał: commit %u -> %u\n", channelSwitch.from, channelSwitch.target);
+}
+
+void applyChannelSwitch() {
+  sampleChannelRtt();
+  uint8_t target = channelSwitch.target;
+  radioChannel = target;
+  WiFi.softAP(masterConfig.apSsid, masterConfig.apPassword, target);   // tablety panelu łączą się ponownie
+  masterConfig.channel = target;
+  saveMasterConfig();
+
+  channelSwitch.phase = CHANNEL_IDLE;
+  channelSwitch.switches++;
+  channelSwitch.lastDurationMs = millis() - channelSwitch.startedAt;
+  channelSwitch.result = "Kanał " + String(channelSwitch.from) + " -> " + String(target);
+  Serial.println(channelSwitch.result + " w " + String(channelSwitch.lastDurationMs) + " ms");
+}
+
+// Faza 1: prepare do wszystkich osiągalnych; dalej serviceChannel(). Bez osiągalnych
+// slave'ów od razu commit – ci, którzy wrócą, znajdą Mastera sondą.
+bool startChannelSwitch(uint8_t target, const String& reason, bool force, String& error) {
+  if (ha.role == HA_STANDBY) { error = "Kanał zmienia aktywny Master"; return false; }
+  if (!channelValid(target)) { error = "Kanał " + String(CHANNEL_MIN) + "-" + String(CHANNEL_MAX); return false; }
+  if (channelSwitch.phase != CHANNEL_IDLE) { error = "Zmiana kanału w toku"; return false; }
+  if (channelSurvey.running) { error = "Przegląd pasma w toku"; return false; }
+  if (target == radioChannel) { error = "Master już jest na kanale " + String(target); return false; }
+
+  channelSwitch.from = radioChannel;
+  channelSwitch.target = target;
+  channelSwitch.force = force;
+  channelSwitch.reason = reason;
+  channelSwitch.startedAt = millis();
+  channelSwitch.result = "";
+
+  uint8_t mac[6];
+  bool reachable = false;
+  for (int i = 0; i < GROUP_MEMBER_COUNT; i++) {
+    if (groupMemberMac(i, mac)) reachable = true;
+  }
+  if (!reachable) {
+    commitChannelSwitch(true);
+    return true;
+  }
+
+  channelSwitch.seq = sendGroupCommand("all", "channel_prepare", String(target));
+  if (channelSwitch.seq == 0) { error = "Wszystkie sloty komend grupowych w locie"; return false; }
+  channelSwitch.phase = CHANNEL_PREPARING;
+  Serial.printf("Kanał: przygotowanie %u -> %u (%s)\n", channelSwitch.from, target, reason.c_str());
+  return true;
+}
+
+// Wołane z OnDataRecv: slave szuka Mastera po zmianie kanału. Odpowiedź rozgłoszeniem – szukający
+// nie musi być peerem; limit, żeby kilka sond naraz nie zajęło radia.
+void answerChannelProbe() {
+  unsigned long now = millis();
+  if (now - lastChannelHereMs < 50) return;
+  lastChannelHereMs = now;
+  ChannelFrame here = { CHANNEL_FRAME_MAGIC, CHANNEL_HERE, radioChannel };
+  espNowSend(BROADCAST_MAC, (const uint8_t*)&here, sizeof(here));
+}
+
+void serviceChannel() {
+  unsigned long now = millis();
+  if (!channelBootSurveyDone && now >= CHANNEL_BOOT_SURVEY_MS) {
+    channelBootSurveyDone = true;
+    // Automatycznie tylko bez gry (np. odtworzonej z dziennika) i poza federacją –
+    // Mastery pokoi słyszą się tylko na wspólnym kanale
+    if (masterConfig.channelAuto && !currentGame.isActive && masterConfig.roomRole == ROOM_STANDALONE) {
+      startChannelSurvey(true);
+    }
+  }
+  serviceChannelSurvey();
+
+  if (channelSwitch.phase == CHANNEL_PREPARING) {
+    GroupFanout* f = findGroupFanout(channelSwitch.seq);
+    if (f != NULL && f->active) return;
+    if (f == NULL || (!f->complete && !channelSwitch.force)) {
+      // Slave, który nie potwierdził, zostałby na starym kanale – wszyscy zostają
+      uint32_t missing = f != NULL ? f->expected & ~f->acked : 0;
+      String names;
+      for (int i = 0; i < GROUP_MEMBER_COUNT; i++) {
+        if (!(missing & (1UL << i))) continue;
+        if (names.length() > 0) names += ", ";
+        names += GROUP_MEMBER_IDS[i];
+      }
+      sendGroupCommand("all", "channel_abort", "");
+      channelSwitch.phase = CHANNEL_IDLE;
+      channelSwitch.aborts++;
+      channelSwitch.result = "Przerwano: brak potwierdzenia" + (names.length() > 0 ? " od " + names : String(""));
+      Serial.println("Kanał: " + channelSwitch.result);
+      return;
+    }
+    commitChannelSwitch(channelSwitch.force);
+  } else if (channelSwitch.phase == CHANNEL_COMMITTED && (long)(now - channelSwitch.switchAt) >= 0) {
+    applyChannelSwitch();
+  }
+}
+
+// /channel: bieżący kanał, stan zmiany i tabela kanałów (przegląd + zmierzone łącze ESP-NOW)
+void fillChannelReport(JsonObject doc) {
+  doc["channel"] = radioChannel;
+  doc["auto"] = masterConfig.channelAuto;
+  JsonObject sw = doc.createNestedObject("switch");
+  sw["phase"] = CHANNEL_PHASE_NAMES[channelSwitch.phase];
+  if (channelSwitch.phase != CHANNEL_IDLE) {
+    sw["from"] = channelSwitch.from;
+    sw["target"] = channelSwitch.target;
+    sw["reason"] = channelSwitch.reason;
+  }
+  if (channelSwitch.result.length() > 0) sw["result"] = channelSwitch.result;
+  sw["switches"] = channelSwitch.switches;
+  sw["aborts"] = channelSwitch.aborts;
+  sw["last_duration_ms"] = channelSwitch.lastDurationMs;
+
+  sampleChannelRtt();
+  if (channelSurvey.running) {
+    JsonObject scan = doc.createNestedObject("survey_running");
+    scan["channel"] = channelSurvey.scanChannel;
+    scan["elapsed_ms"] = millis() - channelSurvey.startedAt;
+  }
+  if (channelSurvey.valid) {
+    JsonObject survey = doc.createNestedObject("survey");
+    survey["age_s"] = (millis() - channelSurvey.at) / 1000;
+    survey["duration_ms"] = channelSurvey.durationMs;
+    survey["networks"] = channelSurvey.networks;
+    survey["recommended"] = bestSurveyChannel();
+  }
+
+  JsonArray channels = doc.createNestedArray("channels");
+  for (int ch = CHANNEL_MIN; ch <= CHANNEL_MAX; ch++) {
+    JsonObject c = channels.createNestedObject();
+    c["channel"] = ch;
+    if (channelSurvey.valid) {
+      c["aps"] = channelSurvey.apCount[ch];
+      if (channelSurvey.apCount[ch] > 0) c["max_rssi"] = channelSurvey.maxRssi[ch];
+      c["interference_dbm"] = roundf(channelSurvey.interferenceDbm[ch] * 10) / 10;
+      c["score"] = roundf(channelScore(ch) * 10) / 10;
+    }
+    const ChannelLink& link = channelLinks[ch];
+    if (link.sent == 0) continue;
+    c["sent"] = link.sent;
+    c["failed"] = link.failed;
+    float loss = channelLossPercent(ch);
+    if (loss >= 0) c["loss_pct"] = roundf(loss * 10) / 10;
+    if (link.rttMs > 0) c["rtt_ms"] = link.rttMs;
+  }
+}
+
+// === SZYBKOŚĆ PHY ===
+
+// Węzły mają MAC z konfiguracji (Gołąb, Walizka) albo z rejestracji; wołane też z zadania WiFi
+int phyMemberByMac(const uint8_t* mac) {
+  if (memcmp(mac, masterConfig.golabMac, 6) == 0) return GROUP_MEMBER_GOLAB;
+  if (memcmp(mac, masterConfig.walizkaMac, 6) == 0) return GROUP_MEMBER_WALIZKA;
+  for (int i = 0; i < NODE_LINK_COUNT; i++) {
+    if (nodeLinks[i].registered && memcmp(mac, nodeLinks[i].mac, 6) == 0) return groupMemberById(nodeLinks[i].id);
+  }
+  return -1;
+}
+
+// Zadanie WiFi: ESP-NOW to ramki akcji (zarządzające), nadawca w adresie 2 nagłówka 802.11
+void phyPromiscuousRx(void* buf, wifi_promiscuous_pkt_type_t type) {
+  if (type != WIFI_PKT_MGMT) return;
+  const wifi_promiscuous_pkt_t* pkt = (const wifi_promiscuous_pkt_t*)buf;
+  if (pkt->payload[0] != 0xD0) return;
+  int member = phyMemberByMac(pkt->payload + 10);
+  if (member < 0) return;
+  PhyPeer& peer = phyPeers[member];
+  int rssi = pkt->rx_ctrl.rssi;
+  peer.rssi = peer.rssi == 0 ? rssi : (peer.rssi * 3 + rssi) / 4;
+}
+
+void setupPhy() {
+  phyLock = xSemaphoreCreateMutex();
+  phyEnableLongRange();
+  esp_wifi_config_espnow_rate(WIFI_IF_STA, PHY_RATES[PHY_RATE_DEFAULT].rate);
+  for (int m = 0; m < GROUP_MEMBER_COUNT; m++) {
+    uint8_t mode = masterConfig.phyModes[m];
+    bool pinned = PHY_PINNED_MEMBERS & (1UL << m);
+    phyPeers[m].rate = mode == PHY_MODE_AUTO || pinned ? PHY_RATE_DEFAULT : mode;
+    phyPeers[m].lossPct = -1.0f;
+  }
+
+  wifi_promiscuous_filter_t filter = { WIFI_PROMIS_FILTER_MASK_MGMT };
+  esp_wifi_set_promiscuous_filter(&filter);
+  esp_wifi_set_promiscuous_rx_cb(phyPromiscuousRx);
+  esp_wifi_set_promiscuous(true);
+}
+
+uint8_t phyRateFor(const uint8_t* mac) {
+  if (phyBench.active && memcmp(mac, phyBench.mac, 6) == 0) return phyBench.rate;
+  int member = phyMemberByMac(mac);
+  return member < 0 ? PHY_RATE_DEFAULT : phyPeers[member].rate;
+}
+
+// Każde esp_now_send Mastera idzie tędy – szybkość radia przełączana pod adresata. Przed
+// zmianą czeka, aż poprzednie ramki wyjdą (nie wiadomo, czy ramka już w kolejce nie dostałaby
+// nowej szybkości); w zadaniu WiFi bez czekania, bo tam działa też OnDataSent.
+esp_err_t espNowSend(const uint8_t* mac, const uint8_t* data, size_t len) {
+  bool inRadioTask = xTaskGetCurrentTaskHandle() == radioTask;
+  bool locked = phyLock != NULL &&
+                xSemaphoreTake(phyLock, inRadioTask ? 0 : pdMS_TO_TICKS(PHY_DRAIN_MS)) == pdTRUE;
+  uint8_t rate = phyRateFor(mac);
+  if (locked && rate != phyApplied) {
+    unsigned long waitStart = millis();
+    while (!inRadioTask && phyInFlight > 0 && millis() - waitStart < PHY_DRAIN_MS) delay(1);
+    if (esp_wifi_config_espnow_rate(WIFI_IF_STA, PHY_RATES[rate].rate) == ESP_OK) {
+      phyApplied = rate;
+      phySwitches++;
+    }
+  }
+  esp_err_t result = esp_now_send(mac, data, len);
+  if (result == ESP_OK) {
+    portENTER_CRITICAL(&phyMux);
+    phyInFlight++;
+    portEXIT_CRITICAL(&phyMux);
+  }
+  if (locked) xSemaphoreGive(phyLock);
+  return result;
+}
+
+// Najszybsza szybkość, przy której RSSI ma zapas PHY_FADE_MARGIN_DB (+ extraDb) nad czułością
+int phyRateForRssi(int rssi, int extraDb) {
+  int best = 0;
+  for (int i = 0; i < PHY_RATE_COUNT; i++) {
+    if (rssi >= PHY_RATES[i].sensitivityDbm + PHY_FADE_MARGIN_DB + extraDb) best = i;
+  }
+  return best;
+}
+
+void servicePhy() {
+  unsigned long now = millis();
+  if (phyBench.active || now - lastPhyEvalMs < PHY_RENEW_MS) return;
+  lastPhyEvalMs = now;
+
+  uint8_t mac[6];
+  for (int m = 0; m < GROUP_MEMBER_COUNT; m++) {
+    PhyPeer& peer = phyPeers[m];
+    portENTER_CRITICAL(&phyMux);
+    uint32_t sent = peer.sent;
+    uint32_t failed = peer.failed;
+    peer.sent = 0;
+    peer.failed = 0;
+    portEXIT_CRITICAL(&phyMux);
+    peer.totalSent += sent;
+    peer.totalFailed += failed;
+    peer.lossPct = sent >= PHY_MIN_SAMPLES ? 100.0f * failed / sent : -1.0f;
+
+    bool reachable = groupMemberMac(m, mac);
+    uint8_t mode = masterConfig.phyModes[m];
+    int rssi = peer.rssi;
+    int wanted = peer.rate;
+    const char* reason = "";
+    if (PHY_PINNED_MEMBERS & (1UL << m)) {
+      wanted = PHY_RATE_DEFAULT;
+      reason = "łącze do innego węzła";
+    } else if (mode != PHY_MODE_AUTO) {
+      wanted = mode;
+      reason = "konfiguracja";
+    } else if (!reachable) {
+      // Slave bez odnowienia dzierżawy sam wraca do 1 Mb/s – Master też, żeby się spotkali
+      wanted = PHY_RATE_DEFAULT;
+      reason = "brak łączności";
+      peer.upStreak = 0;
+    } else if (peer.lossPct > PHY_DOWN_LOSS_PCT && peer.rate > 0) {
+      wanted = peer.rate - 1;
+      reason = "straty";
+      peer.upStreak = 0;
+    } else if (rssi != 0 && phyRateForRssi(rssi, 0) < peer.rate) {
+      wanted = phyRateForRssi(rssi, 0);
+      reason = "słaby sygnał";
+      peer.upStreak = 0;
+    } else if (rssi != 0 && peer.lossPct >= 0 && peer.lossPct <= PHY_UP_LOSS_PCT &&
+               phyRateForRssi(rssi, PHY_HYSTERESIS_DB) > peer.rate) {
+      if (++peer.upStreak >= PHY_UP_WINDOWS) {
+        wanted = phyRateForRssi(rssi, PHY_HYSTERESIS_DB);
+        reason = "mocny sygnał";
+        peer.upStreak = 0;
+      }
+    } else {
+      peer.upStreak = 0;
+    }
+
+    bool changed = wanted != peer.rate;
+    if (changed) {
+      peer.rate = wanted;
+      peer.changes++;
+      peer.lastChange = String(PHY_RATES[wanted].name) + " – " + reason;
+      Serial.printf("PHY %s: %s\n", GROUP_MEMBER_IDS[m], peer.lastChange.c_str());
+    }
+    // Zmiana albo odnowienie dzierżawy; komenda idzie już nową szybkością
+    if (reachable && (changed || peer.rate != PHY_RATE_DEFAULT)) {
+      sendGroupCommand(String("node:") + GROUP_MEMBER_IDS[m], "phy_rate", PHY_RATES[peer.rate].name);
+    }
+  }
+}
+
+// Sonda o numerze seq; RTT w us albo 0, gdy odpowiedź nie przyszła albo przyszła inną szybkością
+uint32_t phyBenchPing(const uint8_t* mac, uint8_t* frame, int size, uint16_t seq, uint8_t rate) {
+  ((PhyBenchFrame*)frame)->seq = seq;
+  phyBench.pongReady = false;
+  unsigned long t0 = micros();
+  if (espNowSend(mac, frame, size) != ESP_OK) return 0;
+  while (!(phyBench.pongReady && phyBench.pongSeq == seq) && micros() - t0 < PHY_BENCH_PONG_MS * 1000) delay(1);
+  if (!(phyBench.pongReady && phyBench.pongSeq == seq) || phyBench.pongRate != rate) return 0;
+  return phyBench.pongUs - t0;
+}
+
+// Seria ramek TIMED do Podłogi w tle – wynik w relayBench, raport w GET /relay_bench
+void relayBenchTask(void* arg) {
+  NodeLink& node = *findNodeById("podloga");
+  RelayBench& b = relayBench;
+  b.rttMin = UINT32_MAX;
+  b.devMin = UINT32_MAX;
+
+  for (int i = 0; i < b.count; i++) {
+    relayAckReady = false;
+    unsigned long t0 = micros();
+    // TIMED: każda ramka przedłuża załączenie, więc wyjście nie "klika" przy każdym pomiarze
+    int seq = sendRelayFrame(node, b.channel, RELAY_MODE_TIMED, b.ms);
+    b.sent = i + 1;
+    if (seq < 0) continue;
+
+    while (!(relayAckReady && relayAckSeq == seq) && micros() - t0 < 100000) vTaskDelay(1);
+    if (!(relayAckReady && relayAckSeq == seq)) continue;
+
+    if (relayAckStatus != RELAY_ACK_OK) {
+      b.rejected++;
+      continue;
+    }
+    unsigned long rtt = relayAckUs - t0;
+    b.acked++;
+    b.rttSum += rtt;
+    b.rttMin = min(b.rttMin, rtt);
+    b.rttMax = max(b.rttMax, rtt);
+    b.devSum += relayAckNs;
+    b.devMin = min(b.devMin, (uint32_t)relayAckNs);
+    b.devMax = max(b.devMax, (uint32_t)relayAckNs);
+    vTaskDelay(pdMS_TO_TICKS(5));
+  }
+  sendRelayFrame(node, b.channel, RELAY_MODE_OFF, 0);
+  sendCommandToNode(node, "bench", "");
+
+  b.durationMs = max(millis() - b.startedAt, 1UL);
+  b.active = false;
+  vTaskDelete(NULL);
+}
+
+void fillRelayBenchReport(JsonObject doc) {
+  const RelayBench& b = relayBench;
+  doc["running"] = b.active;
+  if (!b.active && b.durationMs == 0) return;     // jeszcze nie mierzono
+  doc["success"] = b.acked > 0;
+  doc["channel"] = b.channel;
+  doc["sent"] = b.sent;
+  doc["count"] = b.count;
+  doc["acked"] = b.acked;
+  doc["rejected"] = b.rejected;
+  doc["duration_ms"] = b.active ? millis() - b.startedAt : b.durationMs;
+  JsonObject rtt = doc.createNestedObject("rtt_us");
+  rtt["min"] = b.acked ? b.rttMin : 0;
+  rtt["avg"] = b.acked ? b.rttSum / b.acked : 0;
+  rtt["max"] = b.rttMax;
+  JsonObject dev = doc.createNestedObject("rx_to_gpio_ns");
+  dev["min"] = b.acked ? b.devMin : 0;
+  dev["avg"] = b.acked ? (uint32_t)(b.devSum / b.acked) : 0;
+  dev["max"] = b.devMax;
+}
+
+// Zadanie w tle – pomiar trwa od sekund do minut, loop() obsługuje w tym czasie resztę systemu.
+// Sonda niesie szybkość, na którą slave ma przejść; czas odpowiedzi stemplowany w OnDataRecv,
+// więc delay(1) w pętli oczekiwania go nie zawyża. Wyniki w phyBench.results, raport w /phy.
+void phyBenchTask(void* arg) {
+  static uint32_t rtts[PHY_BENCH_MAX_FRAMES];
+  uint8_t buf[ESP_NOW_MAX_DATA_LEN];
+  memset(buf, 0, sizeof(buf));
+  PhyBenchFrame* frame = (PhyBenchFrame*)buf;
+  frame->magic = PHY_FRAME_MAGIC;
+  const uint8_t* mac = phyBench.mac;
+  int frames = phyBench.frames;
+  int size = phyBench.size;
+  uint16_t seq = 0;
+
+  for (int r = 0; r < phyBench.rateCount; r++) {
+    uint8_t rate = phyBench.rates[r];
+    phyBench.rate = rate;
+    frame->rate = rate;
+    PhyBenchResult& res = phyBench.results[r];
+    memset(&res, 0, sizeof(res));
+    res.rate = rate;
+
+    // Rozgrzewka: do pierwszej odpowiedzi wysłanej już testowaną szybkością
+    frame->type = PHY_BENCH_PING;
+    bool ready = false;
+    unsigned long warmStart = millis();
+    while (!ready && millis() - warmStart < PHY_BENCH_WARMUP_MS) {
+      ready = phyBenchPing(mac, buf, sizeof(PhyBenchFrame), ++seq, rate) > 0;
+    }
+    if (!ready) {
+      phyBench.done = r + 1;
+      continue;
+    }
+    res.answered = true;
+
+    // Seria: następna ramka zaraz po potwierdzeniu MAC poprzedniej
+    frame->type = PHY_BENCH_BURST;
+    uint32_t macFailed = 0;
+    unsigned long burstStart = micros();
+    for (int i = 0; i < frames; i++) {
+      frame->seq = ++seq;
+      phyBench.sentDone = false;
+      if (espNowSend(mac, buf, size) != ESP_OK) {
+        macFailed++;
+        continue;
+      }
+      unsigned long t0 = micros();
+      while (!phyBench.sentDone && micros() - t0 < PHY_BENCH_PONG_MS * 1000) delayMicroseconds(10);
+      if (!phyBench.sentDone || !phyBench.sentOk) macFailed++;
+    }
+    unsigned long burstUs = micros() - burstStart;
+    res.fps = burstUs > 0 ? (uint32_t)((uint64_t)frames * 1000000 / burstUs) : 0;
+    res.macLossPct = 100.0f * macFailed / frames;
+
+    // Ping-pong pełnym rozmiarem: RTT i straty na poziomie aplikacji
+    frame->type = PHY_BENCH_PING;
+    int pongs = 0;
+    for (int i = 0; i < frames; i++) {
+      uint32_t rtt = phyBenchPing(mac, buf, size, ++seq, rate);
+      if (rtt > 0) rtts[pongs++] = rtt;
+    }
+    res.lossPct = 100.0f * (frames - pongs) / frames;
+    res.pongs = pongs;
+    if (pongs > 0) {
+      std::sort(rtts, rtts + pongs);
+      res.rttMin = rtts[0];
+      res.rttP50 = rtts[pongs / 2];
+      res.rttP90 = rtts[pongs * 9 / 10];
+      res.rttP99 = rtts[pongs * 99 / 100];
+      res.rttMax = rtts[pongs - 1];
+    }
+    phyBench.done = r + 1;
+  }
+
+  // Slave wraca do szybkości z automatu albo konfiguracji; ramki pomiaru nie wchodzą do okna oceny
+  int member = phyMemberByMac(mac);
+  uint8_t restore = member >= 0 ? phyPeers[member].rate : PHY_RATE_DEFAULT;
+  phyBench.rate = restore;
+  frame->rate = restore;
+  frame->type = PHY_BENCH_PING;
+  for (int i = 0; i < 3 && phyBenchPing(mac, buf, sizeof(PhyBenchFrame), ++seq, restore) == 0; i++) {}
+  if (member >= 0) {
+    portENTER_CRITICAL(&phyMux);
+    phyPeers[member].sent = 0;
+    phyPeers[member].failed = 0;
+    portEXIT_CRITICAL(&phyMux);
+  }
+  phyBench.durationMs = millis() - phyBench.startedAt;
+  phyBench.active = false;
+  vTaskDelete(NULL);
+}
+
+// /phy: tryb i bieżąca szybkość każdego węzła z danymi, na których opiera się automat
+void fillPhyReport(JsonObject doc) {
+  doc["applied"] = PHY_RATES[phyApplied].name;
+  doc["switches"] = phySwitches;
+  JsonArray rates = doc.createNestedArray("rates");
+  for (int i = 0; i < PHY_RATE_COUNT; i++) rates.add(PHY_RATES[i].name);
+
+  JsonObject nodes = doc.createNestedObject("nodes");
+  for (int m = 0; m < GROUP_MEMBER_COUNT; m++) {
+    const PhyPeer& peer = phyPeers[m];
+    JsonObject node = nodes.createNestedObject(GROUP_MEMBER_IDS[m]);
+    uint8_t mode = masterConfig.phyModes[m];
+    node["mode"] = PHY_PINNED_MEMBERS & (1UL << m) ? "pinned" : (mode == PHY_MODE_AUTO ? "auto" : PHY_RATES[mode].name);
+    node["rate"] = PHY_RATES[peer.rate].name;
+    if (peer.rssi != 0) node["rssi"] = peer.rssi;
+    if (peer.lossPct >= 0) node["loss_pct"] = roundf(peer.lossPct * 10) / 10;
+    node["sent"] = peer.totalSent + peer.sent;
+    node["failed"] = peer.totalFailed + peer.failed;
+    node["changes"] = peer.changes;
+    if (peer.lastChange.length() > 0) node["last_change"] = peer.lastChange;
+  }
+
+  // Ostatni pomiar łącza (POST /phy_bench) – w toku częściowy
+  if (phyBench.startedAt == 0) return;
+  JsonObject bench = doc.createNestedObject("bench");
+  bench["node"] = GROUP_MEMBER_IDS[phyBench.member];
+  bench["state"] = phyBench.active ? "running" : "done";
+  bench["frames"] = phyBench.frames;
+  bench["size"] = phyBench.size;
+  bench["elapsed_ms"] = phyBench.active ? millis() - phyBench.startedAt : phyBench.durationMs;
+  JsonArray results = bench.createNestedArray("results");
+  int done = phyBench.done;
+  for (int r = 0; r < done; r++) {
+    const PhyBenchResult& res = phyBench.results[r];
+    JsonObject entry = results.createNestedObject();
+    entry["rate"] = PHY_RATES[res.rate].name;
+    if (!res.answered) {
+      entry["error"] = "Brak odpowiedzi";
+      continue;
+    }
+    entry["fps"] = res.fps;
+    entry["mac_loss_pct"] = roundf(res.macLossPct * 10) / 10;
+    entry["loss_pct"] = roundf(res.lossPct * 10) / 10;
+    if (res.pongs == 0) continue;
+    JsonObject rtt = entry.createNestedObject("rtt_us");
+    rtt["min"] = res.rttMin;
+    rtt["p50"] = res.rttP50;
+    rtt["p90"] = res.rttP90;
+    rtt["p99"] = res.rttP99;
+    rtt["max"] = res.rttMax;
+  }
+}
+
+// === ZDROWIE WĘZŁÓW ===
+
+// Zadanie WiFi – tylko kopia do pierścienia węzła
+void handleHealthRecord(const uint8_t* mac, const HealthRecord* rec) {
+  if (rec->version != HEALTH_VERSION) return;
+  int member = phyMemberByMac(mac);
+  if (member < 0) return;
+  NodeHealth& h = nodeHealth[member];
+  portENTER_CRITICAL(&healthMux);
+  if (h.count > 0) {
+    const HealthSample& last = h.samples[(h.head + HEALTH_HISTORY - 1) % HEALTH_HISTORY];
+    if (rec->uptimeS < last.rec.uptimeS) {
+      h.reboots++;
+      h.lastRebootAt = millis();
+    }
+  }
+  HealthSample& s = h.samples[h.head];
+  s.at = millis();
+  s.rec = *rec;
+  s.rssi = phyPeers[member].rssi;
+  h.head = (h.head + 1) % HEALTH_HISTORY;
+  if (h.count < HEALTH_HISTORY) h.count++;
+  h.records++;
+  portEXIT_CRITICAL(&healthMux);
+}
+
+const char* resetReasonName(uint8_t reason) {
+  return reason < sizeof(RESET_REASON_NAMES) / sizeof(RESET_REASON_NAMES[0]) ? RESET_REASON_NAMES[reason] : "unknown";
+}
+
+// Stan i trendy jednego węzła; samples od najstarszej, count > 0
+void fillNodeHealth(JsonObject node, const NodeHealth& h, const HealthSample* samples, int count, bool history) {
+  unsigned long now = millis();
+  const HealthSample& last = samples[count - 1];
+  const HealthRecord& r = last.rec;
+  unsigned long age = now - last.at;
+
+  node["records"] = h.records;
+  node["age_ms"] = age;
+  node["uptime_s"] = r.uptimeS;
+  node["reset_reason"] = resetReasonName(r.resetReason);
+  node["reboots"] = h.reboots;
+  if (h.reboots > 0) node["last_reboot_ago_s"] = (now - h.lastRebootAt) / 1000;
+  node["heap_free"] = r.heapFree;
+  node["heap_min"] = r.heapMin;
+  node["heap_max_block"] = r.heapMaxBlock;
+  node["frag_pct"] = r.heapFree > 0 ? 100 - (uint32_t)((uint64_t)r.heapMaxBlock * 100 / r.heapFree) : 0;
+  node["loop_max_ms"] = r.loopMaxMs;
+  node["loop_avg_ms"] = r.loopAvgMs;
+  if (last.rssi != 0) node["rssi"] = last.rssi;
+  bool hasPeripheral = !(r.flags & HEALTH_NO_PERIPHERAL);
+  if (hasPeripheral) {
+    node["peripheral_ok"] = (r.flags & HEALTH_PERIPHERAL_OK) != 0;
+    node["peripheral_errors"] = r.peripheralErrors;
+  }
+
+  // Trend liczony od ostatniego restartu węzła – wcześniejsze próbki to inny przebieg sterty
+  int first = count - 1;
+  while (first > 0 && samples[first - 1].rec.uptimeS <= samples[first].rec.uptimeS) first--;
+  int n = count - first;
+  uint16_t loopMax = 0;
+  uint32_t radioSent = 0, radioFailed = 0;
+  float sx = 0, sy = 0, sxy = 0, sxx = 0;
+  for (int i = first; i < count; i++) {
+    const HealthSample& s = samples[i];
+    if (s.rec.loopMaxMs > loopMax) loopMax = s.rec.loopMaxMs;
+    radioSent += s.rec.radioSent;
+    radioFailed += s.rec.radioFailed;
+    float x = (s.at - samples[first].at) / 60000.0f;
+    float y = (float)s.rec.heapFree - (float)samples[first].rec.heapFree;
+    sx += x;
+    sy += y;
+    sxy += x * y;
+    sxx += x * x;
+  }
+  float radioFailPct = radioSent > 0 ? radioFailed * 100.0f / radioSent : 0;
+  int errorsDelta = (int)r.peripheralErrors - (int)samples[first].rec.peripheralErrors;
+  float denom = n * sxx - sx * sx;
+  bool slopeValid = n >= HEALTH_TREND_MIN_SAMPLES && denom > 0;
+  float slope = slopeValid ? (n * sxy - sx * sy) / denom : 0;
+
+  JsonObject trend = node.createNestedObject("trend");
+  trend["samples"] = n;
+  trend["window_s"] = (last.at - samples[first].at) / 1000;
+  if (slopeValid) trend["heap_slope_bpm"] = roundf(slope);
+  trend["loop_max_ms"] = loopMax;
+  trend["radio_sent"] = radioSent;
+  trend["radio_failed"] = radioFailed;
+  trend["radio_fail_pct"] = roundf(radioFailPct * 10) / 10;
+  if (hasPeripheral) trend["peripheral_errors_delta"] = errorsDelta;
+
+  JsonArray warnings = node.createNestedArray("warnings");
+  if (age > HEALTH_STALE_MS) warnings.add("Brak rekordu od " + String(age / 1000) + " s");
+  if (slopeValid && slope < HEALTH_LEAK_BPM) warnings.add("Sterta maleje ~" + String((int)-slope) + " B/min – możliwy wyciek");
+  if (r.heapMin < HEALTH_HEAP_LOW) warnings.add("Minimum sterty " + String(r.heapMin) + " B");
+  if (loopMax > HEALTH_LOOP_SLOW_MS) warnings.add("Obieg loop() do " + String(loopMax) + " ms");
+  if (radioSent >= 10 && radioFailPct > HEALTH_RADIO_FAIL_PCT) warnings.add(String((int)radioFailPct) + "% wysyłek bez ACK");
+  if (hasPeripheral && errorsDelta > 0) warnings.add("Błędy peryferiów: +" + String(errorsDelta));
+  if (hasPeripheral && !(r.flags & HEALTH_PERIPHERAL_OK)) warnings.add("Peryferium nie odpowiada");
+  switch (r.resetReason) {
+    case ESP_RST_PANIC: case ESP_RST_INT_WDT: case ESP_RST_TASK_WDT: case ESP_RST_WDT: case ESP_RST_BROWNOUT:
+      warnings.add(String("Ostatni restart: ") + resetReasonName(r.resetReason));
+      break;
+    default:
+      break;
+  }
+
+  if (!history) return;
+  JsonObject hist = node.createNestedObject("history");
+  JsonArray ages = hist.createNestedArray("age_s");
+  JsonArray uptime = hist.createNestedArray("uptime_s");
+  JsonArray heapFree = hist.createNestedArray("heap_free");
+  JsonArray heapMin = hist.createNestedArray("heap_min");
+  JsonArray loopMaxMs = hist.createNestedArray("loop_max_ms");
+  JsonArray failed = hist.createNestedArray("radio_failed");
+  JsonArray rssi = hist.createNestedArray("rssi");
+  for (int i = 0; i < count; i++) {
+    const HealthSample& s = samples[i];
+    ages.add((now - s.at) / 1000);
+    uptime.add(s.rec.uptimeS);
+    heapFree.add(s.rec.heapFree);
+    heapMin.add(s.rec.heapMin);
+    loopMaxMs.add(s.rec.loopMaxMs);
+    failed.add(s.rec.radioFailed);
+    rssi.add(s.rssi);
+  }
+}
+
+// /nodes: only < 0 = wszystkie węzły bez historii
+void fillNodesReport(JsonObject doc, int only) {
+  static HealthSample samples[HEALTH_HISTORY];      // tylko pętla główna (serwer WWW)
+  doc["history_len"] = HEALTH_HISTORY;
+  JsonObject nodes = doc.createNestedObject("nodes");
+  for (int m = 0; m < GROUP_MEMBER_COUNT; m++) {
+    if (only >= 0 && m != only) continue;
+    JsonObject node = nodes.createNestedObject(GROUP_MEMBER_IDS[m]);
+    NodeHealth& h = nodeHealth[m];
+    portENTER_CRITICAL(&healthMux);
+    int count = h.count;
+    for (int i = 0; i < count; i++) samples[i] = h.samples[(h.head - count + i + HEALTH_HISTORY) % HEALTH_HISTORY];
+    portEXIT_CRITICAL(&healthMux);
+    if (count == 0) {
+      node["records"] = 0;
+      continue;
+    }
+    fillNodeHealth(node, h, samples, count, only >= 0);
+  }
+}
+
+// === FEDERACJA POKOI ===
+
+void roomEventPush(RoomEventRing& ring, const char* text) {
+  RoomEvent& e = ring.items[ring.head];
+  e.at = millis();
+  strlcpy(e.text, text, sizeof(e.text));
+  ring.head = (ring.head + 1) % ROOM_EVENT_BUFFER;
+  if (ring.count < ROOM_EVENT_BUFFER) ring.count++;
+  else ring.dropped++;
+}
+
+// Najstarsze zdarzenie (do wysłania); false = pusto
+bool roomEventPop(RoomEventRing& ring, RoomEvent& out) {
+  if (ring.count == 0) return false;
+  int tail = (ring.head - ring.count + ROOM_EVENT_BUFFER) % ROOM_EVENT_BUFFER;
+  out = ring.items[tail];
+  ring.count--;
+  return true;
+}
+
+void setupRooms() {
+  if (roomCommandQueue == NULL) roomCommandQueue = xQueueCreate(4, sizeof(RoomCommandItem));
+
+  portENTER_CRITICAL(&roomMux);
+  memset(rooms, 0, sizeof(rooms));
+  memset(&roomOutbox, 0, sizeof(roomOutbox));
+  rooms[0].used = true;                    // własny pokój
+  strlcpy(rooms[0].id, masterConfig.roomId, sizeof(rooms[0].id));
+  portEXIT_CRITICAL(&roomMux);
+
+  if (masterConfig.roomRole == ROOM_MEMBER && !esp_now_is_peer_exist(masterConfig.aggregatorMac)) {
+    addEspNowPeer(masterConfig.aggregatorMac, "Agregator pokoi");
+  }
+  lastRoomStatusMs = 0;
+  Serial.printf("Pokój %s: %s\n", masterConfig.roomId, ROOM_ROLE_NAMES[masterConfig.roomRole]);
+}
+
+// Zdarzenie pokoju – może być wołane z callbacku ESP-NOW, więc tylko kopia do bufora
+void queueRoomEvent(const String& text) {
+  if (masterConfig.roomRole == ROOM_STANDALONE) return;
+  portENTER_CRITICAL(&roomMux);
+  roomEventPush(masterConfig.roomRole == ROOM_AGGREGATOR ? rooms[0].events : roomOutbox, text.c_str());
+  portEXIT_CRITICAL(&roomMux);
+}
+
+// Zwięzły status pokoju – mieści się w jednej ramce ESP-NOW
+size_t buildRoomStatus(char* out, size_t size) {
+  StaticJsonDocument<384> doc;
+  char group[25];
+  copyUtf8Text(group, sizeof(group), currentGame.groupName);
+  doc["room"] = masterConfig.roomId;
+  doc["state"] = currentGame.state;
+  if (currentGame.state != "idle") {
+    doc["group"] = group;
+    doc["elapsed_ms"] = gameElapsedMs(millis());
+    doc["running"] = currentGame.state == "active";
+    doc["game_time_ms"] = currentGame.gameTimeMs;
+    doc["hints"] = currentGame.hintsUsed;
+  }
+  doc["hint_request"] = hintRequested;
+  doc["golab"] = golabConnected;
+  doc["walizka"] = walizkaConnected;
+  doc["stage"] = walizkaState.stage;
+  int nodes = 0;
+  for (int i = 0; i < NODE_LINK_COUNT; i++) {
+    if (nodeLinks[i].connected) nodes++;
+  }
+  doc["nodes"] = nodes;
+  return serializeJson(doc, out, size);
+}
+
+bool sendRoomFrame(const uint8_t* mac, uint8_t type, const char* text, size_t len) {
+  uint8_t frame[2 + ROOM_PAYLOAD_MAX];
+  if (len > ROOM_PAYLOAD_MAX) return false;
+  frame[0] = ROOM_FRAME_MAGIC;
+  frame[1] = type;
+  memcpy(frame + 2, text, len);
+  return espNowSend(mac, frame, 2 + len) == ESP_OK;
+}
+
+// Agregator przyjmuje ramki pokoi tylko od Masterów wpisanych w room_members (/config)
+bool isRoomMember(const uint8_t* mac) {
+  for (int i = 0; i < masterConfig.roomMemberCount; i++) {
+    if (memcmp(masterConfig.roomMembers[i], mac, 6) == 0) return true;
+  }
+  return false;
+}
+
+int findRoomByMac(const uint8_t* mac) {
+  for (int i = 1; i < ROOM_MAX; i++) {
+    if (rooms[i].used && memcmp(rooms[i].mac, mac, 6) == 0) return i;
+  }
+  return -1;
+}
+
+// Wołane z OnDataRecv (zadanie WiFi): tylko kopie do buforów, reszta w loop()
+void handleRoomFrame(const uint8_t* mac, const uint8_t* data, int len) {
+  uint8_t type = data[1];
+  const char* text = (const char*)data + 2;
+  int textLen = min(len - 2, (int)ROOM_PAYLOAD_MAX);
+
+  if (masterConfig.roomRole == ROOM_MEMBER) {
+    // Komendy przyjmujemy wyłącznie od skonfigurowanego agregatora
+    if (type != ROOM_COMMAND || memcmp(mac, masterConfig.aggregatorMac, 6) != 0) return;
+    RoomCommandItem item;
+    item.len = textLen;
+    memcpy(item.text, text, textLen);
+    item.text[textLen] = '\0';
+    xQueueSend(roomCommandQueue, &item, 0);
+    return;
+  }
+  if (masterConfig.roomRole != ROOM_AGGREGATOR) return;
+  if (!isRoomMember(mac)) {
+    roomFramesRejected++;
+    return;
+  }
+
+  portENTER_CRITICAL(&roomMux);
+  int index = findRoomByMac(mac);
+  if (index < 0 && type == ROOM_STATUS) {
+    // Nowy pokój – id z pierwszego statusu ({"room":"...",...})
+    for (int i = 1; i < ROOM_MAX && index < 0; i++) {
+      if (!rooms[i].used) index = i;
+    }
+    if (index >= 0) {
+      memset(&rooms[index], 0, sizeof(RoomLink));
+      rooms[index].used = true;
+      memcpy(rooms[index].mac, mac, 6);
+    }
+  }
+  if (index >= 0) {
+    RoomLink& room = rooms[index];
+    room.lastSeen = millis();
+    if (type == ROOM_STATUS && textLen > 0 && text[0] == '{' && text[textLen - 1] == '}') {
+      memcpy(room.status, text, textLen);
+      room.status[textLen] = '\0';
+      room.statusNew = true;
+    } else if (type == ROOM_EVENT) {
+      char event[ROOM_EVENT_TEXT];
+      int n = min(textLen, (int)sizeof(event) - 1);
+      memcpy(event, text, n);
+      event[n] = '\0';
+      roomEventPush(room.events, event);
+    } else if (type == ROOM_RESULT && !roomReplyReady) {
+      memcpy(roomReply, text, textLen);
+      roomReply[textLen] = '\0';
+      roomReplyReady = true;
+    }
+  }
+  portEXIT_CRITICAL(&roomMux);
+}
+
+void serviceRooms() {
+  if (masterConfig.roomRole == ROOM_AGGREGATOR) {
+    // Id z każdego nowego statusu (członek mógł zmienić room_id), peery pokoi dodawane poza callbackiem
+    unsigned long now = millis();
+    for (int i = 1; i < ROOM_MAX; i++) {
+      RoomLink& room = rooms[i];
+      if (!room.used) continue;
+
+      char status[ROOM_PAYLOAD_MAX + 1];
+      portENTER_CRITICAL(&roomMux);
+      bool expired = now - room.lastSeen > ROOM_EXPIRE_MS;
+      if (expired) room.used = false;      // peer ESP-NOW zostaje – lista room_members i tak go ogranicza
+      bool statusNew = room.statusNew;
+      room.statusNew = false;
+      if (statusNew) strlcpy(status, room.status, sizeof(status));
+      portEXIT_CRITICAL(&roomMux);
+      if (expired) {
+        Serial.printf("Pokój %s: brak ramek od %lu s – usunięty\n", room.id, ROOM_EXPIRE_MS / 1000);
+        continue;
+      }
+
+      if (statusNew) {
+        StaticJsonDocument<384> doc;
+        if (!deserializeJson(doc, status)) strlcpy(room.id, doc["room"] | "?", sizeof(room.id));
+      }
+      if (!room.peerAdded && room.id[0] != '\0') {
+        room.peerAdded = esp_now_is_peer_exist(room.mac) || addEspNowPeer(room.mac, room.id);
+      }
+    }
+    return;
+  }
+  if (masterConfig.roomRole != ROOM_MEMBER) return;
+
+  // Komendy od agregatora – wynik wraca tą samą drogą z tym samym "id"
+  RoomCommandItem item;
+  while (xQueueReceive(roomCommandQueue, &item, 0) == pdTRUE) {
+    DynamicJsonDocument doc(512);
+    DynamicJsonDocument result(256);
+    int code = 400;
+    if (deserializeJson(doc, item.text)) {
+      commandResult(result.to<JsonObject>(), code, "Niepoprawny JSON");
+    } else {
+      String op = doc["op"] | "";
+      code = op == "room_command" ? commandResult(result.to<JsonObject>(), 400, "Zagnieżdżona komenda pokoju")
+                                  : runPanelCommand(op, doc.as<JsonObject>(), result.to<JsonObject>());
+    }
+    result["id"] = doc["id"] | 0;
+    result["code"] = code;
+    char reply[ROOM_PAYLOAD_MAX + 1];
+    size_t len = serializeJson(result, reply, sizeof(reply));
+    if (len >= ROOM_PAYLOAD_MAX) {
+      len = snprintf(reply, sizeof(reply), "{\"id\":%lu,\"code\":%d,\"success\":%s}",
+                     (unsigned long)(doc["id"] | 0), code, code == 200 ? "true" : "false");
+    }
+    sendRoomFrame(masterConfig.aggregatorMac, ROOM_RESULT, reply, len);
+  }
+
+  // Status co sekundę, a przy zmianie gry lub prośbie o podpowiedź od razu
+  unsigned long now = millis();
+  uint32_t gameVersion = snapshotParts[SNAP_GAME].version;
+  if (now - lastRoomStatusMs >= ROOM_STATUS_INTERVAL_MS || gameVersion != lastRoomGameVersion ||
+      hintRequested != lastRoomHintRequested) {
+    char status[ROOM_PAYLOAD_MAX + 1];
+    size_t len = buildRoomStatus(status, sizeof(status));
+    if (len < ROOM_PAYLOAD_MAX) sendRoomFrame(masterConfig.aggregatorMac, ROOM_STATUS, status, len);
+    lastRoomStatusMs = now;
+    lastRoomGameVersion = gameVersion;
+    lastRoomHintRequested = hintRequested;
+  }
+
+  RoomEvent event;
+  while (true) {
+    portENTER_CRITICAL(&roomMux);
+    bool have = roomEventPop(roomOutbox, event);
+    portEXIT_CRITICAL(&roomMux);
+    if (!have) break;
+    sendRoomFrame(masterConfig.aggregatorMac, ROOM_EVENT, event.text, strlen(event.text));
+  }
+}
+
+// Agregator: komenda panelu do innego pokoju. Czeka na wynik najwyżej ROOM_COMMAND_BUDGET_MS –
+// panel dostaje wtedy 504 zamiast wiszącego żądania.
+int relayRoomCommand(const String& roomId, JsonObject command, JsonObject result) {
+  if (masterConfig.roomRole != ROOM_AGGREGATOR) return commandResult(result, 400, "Ten Master nie jest agregatorem");
+  int index = -1;
+  for (int i = 1; i < ROOM_MAX; i++) {
+    if (rooms[i].used && roomId == rooms[i].id) index = i;
+  }
+  if (index < 0) return commandResult(result, 404, "Nieznany pokój: " + roomId);
+  RoomLink& room = rooms[index];
+  if (!room.peerAdded || millis() - room.lastSeen > ROOM_TIMEOUT_MS) {
+    return commandResult(result, 503, "Pokój " + roomId + " nie odpowiada");
+  }
+
+  uint32_t id = ++roomCommandSeq;
+  command["id"] = id;
+  char text[ROOM_PAYLOAD_MAX + 1];
+  size_t len = serializeJson(command, text, sizeof(text));
+  if (len >= ROOM_PAYLOAD_MAX) return commandResult(result, 413, "Komenda za duża na ramkę ESP-NOW");
+
+  roomReplyReady = false;
+  unsigned long startUs = micros();
+  if (!sendRoomFrame(room.mac, ROOM_COMMAND, text, len)) return commandResult(result, 500, "Błąd wysyłania ESP-NOW");
+
+  DynamicJsonDocument reply(384);
+  bool answered = false;
+  while (micros() - startUs < ROOM_COMMAND_BUDGET_MS * 1000UL) {
+    if (roomReplyReady) {
+      portENTER_CRITICAL(&roomMux);
+      String copy = roomReply;
+      roomReplyReady = false;
+      portEXIT_CRITICAL(&roomMux);
+      if (!deserializeJson(reply, copy) && (reply["id"] | 0) == id) {
+        answered = true;
+        break;
+      }
+    }
+    delay(1);
+  }
+
+  uint32_t us = micros() - startUs;
+  room.commands++;
+  if (!answered) {
+    room.commandTimeouts++;
+    return commandResult(result, 504, "Pokój " + roomId + " nie odpowiedział w " + String(ROOM_COMMAND_BUDGET_MS) + " ms");
+  }
+  room.commandLastUs = us;
+  room.commandTotalUs += us;
+  if (us > room.commandMaxUs) room.commandMaxUs = us;
+
+  for (JsonPair kv : reply.as<JsonObject>()) {
+    if (strcmp(kv.key().c_str(), "id") != 0 && strcmp(kv.key().c_str(), "code") != 0) result[kv.key()] = kv.value();
+  }
+  result["room"] = roomId;
+  result["relay_us"] = us;
+  return reply["code"] | 500;
+}
+
+// /rooms: widok wszystkich pokoi (agregator) albo tylko własnego
+void fillRoomsReport(JsonObject doc) {
+  doc["self"] = masterConfig.roomId;
+  doc["role"] = ROOM_ROLE_NAMES[masterConfig.roomRole];
+  doc["budget_ms"] = ROOM_COMMAND_BUDGET_MS;
+  if (masterConfig.roomRole == ROOM_AGGREGATOR) doc["rejected_frames"] = roomFramesRejected;
+  unsigned long now = millis();
+
+  JsonArray roomList = doc.createNestedArray("rooms");
+  for (int i = 0; i < ROOM_MAX; i++) {
+    RoomLink& room = rooms[i];
+    if (!room.used) continue;
+    JsonObject entry = roomList.createNestedObject();
+    char status[ROOM_PAYLOAD_MAX + 1];
+    RoomEventRing events;
+
+    portENTER_CRITICAL(&roomMux);
+    strlcpy(status, room.status, sizeof(status));
+    events = room.events;
+    unsigned long lastSeen = room.lastSeen;
+    portEXIT_CRITICAL(&roomMux);
+    if (i == 0) {
+      buildRoomStatus(status, sizeof(status));
+      lastSeen = now;
+    }
+
+    entry["id"] = room.id;
+    entry["self"] = i == 0;
+    entry["connected"] = i == 0 || now - lastSeen < ROOM_TIMEOUT_MS;
+    entry["age_ms"] = now - lastSeen;     // wiek statusu – panel dolicza go do elapsed_ms
+    if (status[0] != '\0') entry["status"] = serialized(String(status));
+
+    JsonArray eventList = entry.createNestedArray("events");
+    for (int n = 0; n < events.count; n++) {
+      const RoomEvent& e = events.items[(events.head - events.count + n + ROOM_EVENT_BUFFER) % ROOM_EVENT_BUFFER];
+      JsonObject item = eventList.createNestedObject();
+      item["age_ms"] = now - e.at;
+      item["text"] = e.text;
+    }
+    entry["dropped"] = events.dropped;
+
+    if (i > 0) {
+      JsonObject cmd = entry.createNestedObject("commands");
+      cmd["count"] = room.commands;
+      cmd["timeouts"] = room.commandTimeouts;
+      cmd["last_us"] = room.commandLastUs;
+      cmd["max_us"] = room.commandMaxUs;
+      uint32_t ok = room.commands - room.commandTimeouts;
+      cmd["avg_us"] = ok ? (uint32_t)(room.commandTotalUs / ok) : 0;
+    }
+  }
+}
+
+// === KOMENDY GRUPOWE ===
+
+// 0 = nieznana albo pusta grupa
+uint32_t resolveGroupTarget(const String& target) {
+  if (target == "all") return (1UL << GROUP_MEMBER_COUNT) - 1;
+  if (target.startsWith("role:")) {
+    String role = target.substring(5);
+    for (int i = 0; i < GROUP_ROLE_COUNT; i++) {
+      if (role == GROUP_ROLES[i].name) return GROUP_ROLES[i].mask;
+    }
+    return 0;
+  }
+  if (target.startsWith("zone:")) {
+    int zone = target.substring(5).toInt();
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_MEMBER_COUNT; i++) {
+      if (zone > 0 && masterConfig.zones[i] == zone) mask |= 1UL << i;
+    }
+    return mask;
+  }
+  if (target.startsWith("node:")) {
+    int member = groupMemberById(target.substring(5).c_str());
+    return member < 0 ? 0 : 1UL << member;
+  }
+  return 0;
+}
+
+// MAC członka, o ile jest znany: Gołąb/Walizka z konfiguracji, węzły po rejestracji
+bool groupMemberAddress(int member, uint8_t* mac) {
+  if (member == GROUP_MEMBER_GOLAB) {
+    memcpy(mac, masterConfig.golabMac, 6);
+    return true;
+  }
+  if (member == GROUP_MEMBER_WALIZKA) {
+    memcpy(mac, masterConfig.walizkaMac, 6);
+    return true;
+  }
+  NodeLink* node = findNodeById(GROUP_MEMBER_IDS[member]);
+  if (node == NULL || !node->registered) return false;
+  memcpy(mac, node->mac, 6);
+  return true;
+}
+
+// MAC członka, o ile jest osiągalny
+bool groupMemberMac(int member, uint8_t* mac) {
+  if (!groupMemberAddress(member, mac)) return false;
+  if (member == GROUP_MEMBER_GOLAB) return golabConnected;
+  if (member == GROUP_MEMBER_WALIZKA) return walizkaConnected;
+  return findNodeById(GROUP_MEMBER_IDS[member])->connected;
+}
+
+// Zwraca numer komendy; 0 = nieznana grupa, nikt osiągalny albo wszystkie sloty w locie.
+// wholeGroup: zawsze rozgłoszenie do całej grupy, także bez osiągalnych członków (restart) –
+// ACK osiągalnych służą wtedy tylko do raportu.
+uint16_t sendGroupCommand(const String& target, const String& command, const String& data, bool wholeGroup) {
+  uint32_t members = resolveGroupTarget(target);
+  uint32_t expected = 0;
+  uint8_t mac[6];
+  int single = -1;
+  for (int i = 0; i < GROUP_MEMBER_COUNT; i++) {
+    if ((members & (1UL << i)) && groupMemberMac(i, mac)) {
+      expected |= 1UL << i;
+      single = i;
+    }
+  }
+  if (members == 0 || (expected == 0 && !wholeGroup)) {
+    Serial.println("Grupa " + target + ": brak osiągalnych adresatów dla " + command);
+    return 0;
+  }
+
+  GroupFanout& f = groupFanouts[groupFanoutNext];
+  if (f.active) {
+    Serial.println("Komendy grupowe: wszystkie sloty w locie, " + command + " odrzucone");
+    return 0;
+  }
+  groupFanoutNext = (groupFanoutNext + 1) % GROUP_FANOUT_SLOTS;
+  if (++groupSeq == 0) groupSeq = 1;
+
+  // Maska w ramce to cała grupa – węzeł uznany za rozłączony też wykona komendę, jeśli ją usłyszy
+  GroupFrameHeader header = { GROUP_FRAME_MAGIC, groupSeq, members };
+  String text = command + "|" + data + "|" + String(millis());
+  size_t textLen = min((size_t)text.length(), GROUP_TEXT_MAX);
+  memcpy(f.frame, &header, sizeof(header));
+  memcpy(f.frame + sizeof(header), text.c_str(), textLen);
+  f.frameLen = sizeof(header) + textLen;
+  f.target = target;
+  f.command = command;
+  f.members = members;
+  f.retries = 0;
+  f.unicasts = 0;
+  f.complete = false;
+  f.wsTracked = deliveryArmed;
+  f.wsClient = deliveryArmClient;
+  f.wsId = deliveryArmId;
+  deliveryArmed = false;       // wynik komendy grupowej idzie po ostatnim ACK, nie po callbacku MAC
+
+  portENTER_CRITICAL(&groupMux);
+  f.seq = groupSeq;
+  f.expected = expected;
+  f.acked = 0;
+  f.doneUs = 0;
+  f.startUs = micros();
+  f.active = true;
+  portEXIT_CRITICAL(&groupMux);
+
+  // Jeden adresat: zwykły unicast (potwierdzany w warstwie MAC); kilku: jedna ramka dla wszystkich
+  f.broadcast = wholeGroup || __builtin_popcount(expected) > 1;
+  if (f.broadcast) {
+    espNowSend(BROADCAST_MAC, f.frame, f.frameLen);
+  } else {
+    groupMemberMac(single, mac);
+    espNowSend(mac, f.frame, f.frameLen);
+    f.unicasts++;
+  }
+  f.lastSendMs = millis();
+  Serial.printf("Grupa %s #%u: %s do %d adresatów (%s)\n", target.c_str(), f.seq, command.c_str(),
+                __builtin_popcount(expected), f.broadcast ? "rozgłoszenie" : "unicast");
+  return f.seq;
+}
+
+// Wołane z OnDataRecv (zadanie WiFi); ACK liczy się tylko z adresu tego członka
+void handleGroupAck(const uint8_t* mac, const GroupAck* ack) {
+  uint8_t memberMac[6];
+  if (ack->member >= GROUP_MEMBER_COUNT || !groupMemberAddress(ack->member, memberMac)) return;
+  if (memcmp(mac, memberMac, 6) != 0) return;
+  unsigned long now = micros();
+
+  portENTER_CRITICAL(&groupMux);
+  for (int i = 0; i < GROUP_FANOUT_SLOTS; i++) {
+    GroupFanout& f = groupFanouts[i];
+    if (f.seq != ack->seq || f.startUs == 0) continue;
+    f.acked |= 1UL << ack->member;
+    if (f.active && f.doneUs == 0 && (f.acked & f.expected) == f.expected) f.doneUs = now - f.startUs;
+  }
+  portEXIT_CRITICAL(&groupMux);
+}
+
+// Komenda gry nie wyszła (sloty fan-out zajęte, brak adresatów) – stan dośle serviceGameAnnounce
+void announceGameState(uint16_t seq) {
+  if (seq != 0) return;
+  gameAnnouncePending = resolveGroupTarget("role:game");
+  Serial.println("⚠️ Komenda gry nie wysłana – ponowienie z loop()");
+}
+
+// Bieżący stan gry do członka role:game zaraz po jego zgłoszeniu się: po odtworzeniu gry
+// z dziennika albo gdy start/pauza/koniec nie zmieściły się w slotach fan-out. Wysyłamy stan,
+// nie zaległe komendy – węzły przyjmują powtórzony start tej samej grupy bez kasowania postępu.
+void serviceGameAnnounce() {
+  static unsigned long lastAttempt = 0;
+  if (gameAnnouncePending == 0) return;
+  if (currentGame.state == "idle") {
+    gameAnnouncePending = 0;
+    return;
+  }
+  // Sloty zwalniają się po ACK albo po rezygnacji – nie próbujemy w każdym obiegu loop()
+  if (millis() - lastAttempt < 100) return;
+  lastAttempt = millis();
+  uint8_t mac[6];
+  for (int m = 0; m < GROUP_MEMBER_COUNT; m++) {
+    if (!(gameAnnouncePending & (1UL << m)) || !groupMemberMac(m, mac)) continue;
+    String target = String("node:") + GROUP_MEMBER_IDS[m];
+    if (!currentGame.isActive) {
+      if (sendGroupCommand(target, "end_game", currentGame.endStatus) == 0) return;   // sloty zajęte
+    } else {
+      if (sendGroupCommand(target, "start_game", currentGame.groupName) == 0) return;
+      if (sendGroupCommand(target, currentGame.isPaused ? "pause_game" : "resume_game", "") == 0) return;
+    }
+    gameAnnouncePending &= ~(1UL << m);
+  }
+}
+
+// Ostatnia komenda o tym numerze; NULL = slot już nadpisany
+GroupFanout* findGroupFanout(uint16_t seq) {
+  for (int i = 0; i < GROUP_FANOUT_SLOTS; i++) {
+    if (groupFanouts[i].startUs != 0 && groupFanouts[i].seq == seq) return &groupFanouts[i];
+  }
+  return NULL;
+}
+
+void finishGroupFanout(GroupFanout& f, bool complete) {
+  portENTER_CRITICAL(&groupMux);
+  f.active = false;
+  if (f.doneUs == 0) f.doneUs = micros() - f.startUs;   // niepełne: czas do rezygnacji
+  portEXIT_CRITICAL(&groupMux);
+  f.complete = complete;
+
+  Serial.printf("Grupa %s #%u: %d/%d ACK w %lu us, powtórki %u (unicastów %u)\n",
+                f.target.c_str(), f.seq, __builtin_popcount(f.acked & f.expected),
+                __builtin_popcount(f.expected), (unsigned long)f.doneUs, f.retries, f.unicasts);
+  if (f.wsTracked) {
+    char msg[80];
+    snprintf(msg, sizeof(msg), "{\"id\":%lu,\"dlv\":%d,\"ms\":%.1f}",
+             (unsigned long)f.wsId, complete ? 1 : 0, f.doneUs / 1000.0f);
+    webSocket.sendTXT(f.wsClient, msg);
+  }
+}
+
+void serviceGroupFanouts() {
+  unsigned long now = millis();
+  for (int i = 0; i < GROUP_FANOUT_SLOTS; i++) {
+    GroupFanout& f = groupFanouts[i];
+    if (!f.active) continue;
+
+    uint32_t missing = f.expected & ~f.acked;
+    if (missing == 0) {
+      finishGroupFanout(f, true);
+      continue;
+    }
+    if (now - f.lastSendMs < GROUP_RETRY_MS) continue;
+    if (f.retries >= GROUP_MAX_RETRIES) {
+      finishGroupFanout(f, false);
+      continue;
+    }
+
+    // Powtórka tylko do brakujących – unicast, ten sam numer (węzeł, który już wykonał, tylko potwierdzi)
+    uint8_t mac[6];
+    for (int m = 0; m < GROUP_MEMBER_COUNT; m++) {
+      if (!(missing & (1UL << m)) || !groupMemberMac(m, mac)) continue;
+      espNowSend(mac, f.frame, f.frameLen);
+      f.unicasts++;
+    }
+    f.retries++;
+    f.lastSendMs = now;
+  }
+}
+
+void addGroupMembers(JsonArray arr, uint32_t mask) {
+  for (int i = 0; i < GROUP_MEMBER_COUNT; i++) {
+    if (mask & (1UL << i)) arr.add(GROUP_MEMBER_IDS[i]);
+  }
+}
+
+// /groups: role, strefy i ostatnie komendy z czasem rozesłania
+void fillGroupReport(JsonObject doc) {
+  JsonObject roles = doc.createNestedObject("roles");
+  for (int i = 0; i < GROUP_ROLE_COUNT; i++) {
+    addGroupMembers(roles.createNestedArray(GROUP_ROLES[i].name), GROUP_ROLES[i].mask);
+  }
+  JsonObject zones = doc.createNestedObject("zones");
+  for (int i = 0; i < GROUP_MEMBER_COUNT; i++) zones[GROUP_MEMBER_IDS[i]] = masterConfig.zones[i];
+  uint8_t mac[6];
+  uint32_t reachable = 0;
+  for (int i = 0; i < GROUP_MEMBER_COUNT; i++) {
+    if (groupMemberMac(i, mac)) reachable |= 1UL << i;
+  }
+  addGroupMembers(doc.createNestedArray("reachable"), reachable);
+
+  // Od najnowszej
+  JsonArray recent = doc.createNestedArray("recent");
+  for (int n = 1; n <= GROUP_FANOUT_SLOTS; n++) {
+    GroupFanout& f = groupFanouts[(groupFanoutNext - n + GROUP_FANOUT_SLOTS) % GROUP_FANOUT_SLOTS];
+    if (f.startUs == 0) continue;
+    JsonObject entry = recent.createNestedObject();
+    entry["seq"] = f.seq;
+    entry["target"] = f.target;
+    entry["command"] = f.command;
+    entry["state"] = f.active ? "pending" : (f.complete ? "complete" : "partial");
+    entry["broadcast"] = f.broadcast;
+    addGroupMembers(entry.createNestedArray("expected"), f.expected);
+    addGroupMembers(entry.createNestedArray("acked"), f.acked);
+    addGroupMembers(entry.createNestedArray("missing"), f.expected & ~f.acked);
+    addGroupMembers(entry.createNestedArray("skipped"), f.members & ~f.expected);
+    entry["retries"] = f.retries;
+    entry["unicasts"] = f.unicasts;
+    if (!f.active) entry["completion_us"] = f.doneUs;
+  }
+}
+
+void addNodeStatus(JsonObject obj, NodeLink& node, bool timing) {
+  obj["connected"] = node.connected;
+  obj["registered"] = node.registered;
+  obj["mac"] = node.registered ? formatMac(node.mac) : String("");
+  obj["stage"] = node.stage;
+  obj["relay_state"] = node.relayState;
+  if (timing) obj["last_seen"] = node.lastSeen;
+  if (node.bench.length() > 0) obj["bench"] = serialized(node.bench);
+  if (node.state.length() > 0) obj["state"] = serialized(node.state);
+
+  JsonObject metrics = obj.createNestedObject("metrics");
+  if (timing) metrics["rtt_ms"] = node.rttMs;
+  metrics["event_latency_ms"] = node.eventLatencyMs;
+  metrics["event_latency_avg_ms"] = node.eventCount > 0 ? node.eventLatencySumMs / node.eventCount : 0;
+  metrics["event_latency_max_ms"] = node.eventLatencyMaxMs;
+  metrics["events"] = node.eventCount;
+
+  JsonArray events = obj.createNestedArray("events");
+  for (int i = 0; i < node.eventsCount; i++) {
+    int sep = node.events[i].lastIndexOf('|');
+    JsonObject e = events.createNestedObject();
+    e["event"] = serialized(node.events[i].substring(0, sep));
+    e["timestamp"] = formatTimestamp(node.events[i].substring(sep + 1).toInt());
+  }
+}
+
+void checkGolabConnection() {
+  // Sprawdź połączenie z Gołąb
+  if (golabConnected && (millis() - lastGolabHeartbeat > masterConfig.heartbeatTimeout)) {
+    golabConnected = false;
+    golabConfigHash = 0;
+    Serial.println("Utracono połączenie z Gołąb");
+  }
+  
+  // Sprawdź połączenie z Walizka
+  if (walizkaConnected && (millis() - lastWalizkaHeartbeat > masterConfig.heartbeatTimeout)) {
+    walizkaConnected = false;
+    walizkaConfigHash = 0;
+    Serial.println("Utracono połączenie z Walizka");
+  }
+
+  // Łom / Podłoga – po utracie węzeł sam ponawia rejestrację
+  for (int i = 0; i < NODE_LINK_COUNT; i++) {
+    NodeLink& node = nodeLinks[i];
+    if (node.connected && (millis() - node.lastSeen > masterConfig.heartbeatTimeout)) {
+      node.connected = false;
+      node.clockValid = false;
+      Serial.println("Utracono połączenie z " + String(node.label));
+    }
+  }
+  
+  // Wysyłaj heartbeaty co masterConfig.heartbeatInterval (domyślnie 10 s)
+  static unsigned long lastHeartbeat = 0;
+  if (millis() - lastHeartbeat > masterConfig.heartbeatInterval) {
+    if (golabConnected) {
+      sendCommandToGolab("heartbeat", "master_ping");
+    }
+    if (walizkaConnected) {
+      sendCommandToWalizka("heartbeat", "master_ping");
+    }
+    // Węzły odsyłają data z pingu – z tego liczony jest RTT
+    for (int i = 0; i < NODE_LINK_COUNT; i++) {
+      if (nodeLinks[i].connected) sendCommandToNode(nodeLinks[i], "heartbeat", String(millis()));
+    }
+    lastHeartbeat = millis();
+  }
+}
+
+void resetGameSession() {
+  currentGame.sessionId = "";
+  currentGame.groupName = "";
+  currentGame.playerCount = 0;
+  currentGame.isTestGame = false;
+  currentGame.isActive = false;
+  currentGame.isPaused = false;
+  currentGame.startTime = 0;
+  currentGame.pausedAt = 0;
+  currentGame.pausedTotalMs = 0;
+  currentGame.endedAt = 0;
+  currentGame.gameTimeMs = 0;
+  currentGame.hintsUsed = 0;
+  currentGame.state = "idle";
+  currentGame.endStatus = "";
+}
+
+void resetWalizkaState() {
+  walizkaState.stage = "WAITING_TAG1";
+  walizkaState.tag1Used = false;
+  walizkaState.tag2Allowed = false;
+  walizkaState.tag2Used = false;
+  walizkaState.relayState = false;
+  walizkaState.enteredCodeLength = 0;
+  walizkaState.stageTime = 0;
+  walizkaState.codesCount = 0;
+  walizkaState.lastUpdate = 0;
+  
+  for (int i = 0; i < 10; i++) {
+    walizkaState.digitStats[i] = 0;
+    if (i < 10) {
+      walizkaState.codesHistory[i] = "";
+    }
+  }
+}
+
+// === OTA SLAVE'ÓW ===
+
+void loadOtaImage() {
+  ota.image = esp_ota_get_next_update_partition(NULL);
+  Preferences prefs;
+  prefs.begin("ota_img", true);
+  ota.imageSize = prefs.getUInt("size", 0);
+  ota.imageCrc = prefs.getUInt("crc", 0);
+  prefs.end();
+  ota.imageReady = ota.image != NULL && ota.imageSize > 0 && ota.imageSize <= ota.image->size;
+  if (ota.imageReady) {
+    Serial.println("Obraz OTA w " + String(ota.image->label) + ": " + String(ota.imageSize) + " B");
+  }
+}
+
+void handleOtaUpload() {
+  HTTPUpload& upload = server.upload();
+
+  if (upload.status == UPLOAD_FILE_START) {
+    // Transfer czyta obraz z partycji (ota.imageSize, CRC) – nowy upload nie może go ruszyć
+    if (ota.running) {
+      ota.uploadFailed = true;
+      strlcpy(ota.error, "Trwa transfer OTA", sizeof(ota.error));
+      return;
+    }
+    ota.uploadFailed = false;
+    ota.imageReady = false;
+    ota.imageSize = 0;
+    ota.imageCrc = 0;
+    ota.uploadErased = 0;
+    ota.uploadStartMs = millis();
+    ota.image = esp_ota_get_next_update_partition(NULL);
+    if (ota.image == NULL) {
+      ota.uploadFailed = true;
+      strlcpy(ota.error, "Brak partycji OTA", sizeof(ota.error));
+    }
+    Preferences prefs;
+    prefs.begin("ota_img", false);
+    prefs.clear();
+    prefs.end();
+    Serial.println("OTA upload: " + upload.filename);
+  } else if (upload.status == UPLOAD_FILE_WRITE) {
+    if (ota.uploadFailed) return;
+    // Obraz aplikacji ESP32 zaczyna się bajtem 0xE9
+    if (ota.imageSize == 0 && upload.currentSize > 0 && upload.buf[0] != 0xE9) {
+      ota.uploadFailed = true;
+      strlcpy(ota.error, "To nie jest obraz firmware ESP32", sizeof(ota.error));
+      return;
+    }
+    if (ota.imageSize + upload.currentSize > ota.image->size) {
+      ota.uploadFailed = true;
+      strlcpy(ota.error, "Obraz większy niż partycja OTA", sizeof(ota.error));
+      return;
+    }
+    while (ota.uploadErased < ota.imageSize + upload.currentSize) {
+      esp_partition_erase_range(ota.image, ota.uploadErased, OTA_SECTOR_SIZE);
+      ota.uploadErased += OTA_SECTOR_SIZE;
+    }
+    if (esp_partition_write(ota.image, ota.imageSize, upload.buf, upload.currentSize) != ESP_OK) {
+      ota.uploadFailed = true;
+      strlcpy(ota.error, "Błąd zapisu flash", sizeof(ota.error));
+      return;
+    }
+    ota.imageCrc = otaCrc32(ota.imageCrc, upload.buf, upload.currentSize);
+    ota.imageSize += upload.currentSize;
+  } else if (upload.status == UPLOAD_FILE_END) {
+    if (ota.running) return;           // upload odrzucony na starcie
+    ota.uploadMs = millis() - ota.uploadStartMs;
+    if (ota.uploadFailed || ota.imageSize == 0) return;
+    ota.imageReady = true;
+    Preferences prefs;
+    prefs.begin("ota_img", false);
+    prefs.putUInt("size", ota.imageSize);
+    prefs.putUInt("crc", ota.imageCrc);
+    prefs.end();
+    Serial.println("OTA upload gotowy: " + String(ota.imageSize) + " B, CRC " + String(ota.imageCrc, HEX));
+  } else if (upload.status == UPLOAD_FILE_ABORTED) {
+    ota.uploadFailed = true;
+    strlcpy(ota.error, "Upload przerwany", sizeof(ota.error));
+  }
+}
+
+void loadStaticAsset(StaticAsset& asset) {
+  free(asset.data);
+  asset.data = NULL;
+  asset.loaded = true;
+  asset.exists = false;
+
+  String gzPath = String(asset.path) + ".gz";
+  asset.gzip = LittleFS.exists(gzPath);
+  File file = LittleFS.open(asset.gzip ? gzPath : String(asset.path), "r");
+  if (!file) {
+    Serial.println("BŁĄD: " + String(asset.path) + " nie znaleziony!");
+    return;
+  }
+  asset.size = file.size();
+  if (asset.size <= ASSET_CACHE_MAX) asset.data = (uint8_t*)malloc(asset.size);
+
+  // Jeden przebieg po pliku: skrót na ETag i kopia do cache
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts_ret(&sha, 0);
+  uint8_t buf[512];
+  size_t offset = 0;
+  while (offset < asset.size) {
+    size_t n = file.read(buf, sizeof(buf));
+    if (n == 0) break;
+    mbedtls_sha256_update_ret(&sha, buf, n);
+    if (asset.data) memcpy(asset.data + offset, buf, n);
+    offset += n;
+  }
+  file.close();
+  uint8_t digest[32];
+  mbedtls_sha256_finish_ret(&sha, digest);
+  mbedtls_sha256_free(&sha);
+
+  if (offset != asset.size) {
+    free(asset.data);
+    asset.data = NULL;
+    Serial.println("BŁĄD: odczyt " + String(asset.path) + " przerwany");
+    return;
+  }
+  char etag[19];
+  snprintf(etag, sizeof(etag), "\"%02x%02x%02x%02x%02x%02x%02x%02x\"",
+           digest[0], digest[1], digest[2], digest[3], digest[4], digest[5], digest[6], digest[7]);
+  asset.etag = etag;
+  asset.exists = true;
+  Serial.println("Zasób " + String(asset.path) + (asset.gzip ? " (gzip)" : "") + ": " + String(asset.size) +
+                 " B" + (asset.data ? ", w RAM" : ", z pliku") + ", ETag " + asset.etag);
+}
+
+// Po uploadzie "/index.html" albo "/index.html.gz" zasób jest wczytywany od nowa przy następnym żądaniu
+void invalidateStaticAsset(const String& path) {
+  String base = path.endsWith(".gz") ? path.substring(0, path.length() - 3) : path;
+  for (int i = 0; i < STATIC_ASSET_COUNT; i++) {
+    if (base == staticAssets[i].path) {
+      free(staticAssets[i].data);
+      staticAssets[i].data = NULL;
+      staticAssets[i].loaded = false;
+    }
+  }
+}
+
+void serveStaticAsset(StaticAsset& asset) {
+  if (!asset.loaded) loadStaticAsset(asset);
+  if (!asset.exists) {
+    server.send(404, "text/plain", String(asset.path) + " nie znaleziony na LittleFS!");
+    return;
+  }
+
+  if (asset.gzip) {
+    // Pośrednie cache nie mogą oddać wersji gzip klientowi, który jej nie przyjmuje
+    server.sendHeader("Vary", "Accept-Encoding");
+    if (server.header("Accept-Encoding").indexOf("gzip") < 0) {
+      // Rzadki przypadek – bez cache w RAM i bez ETag (ten dotyczy treści .gz)
+      File file = LittleFS.open(asset.path, "r");
+      if (!file) {
+        server.send(406, "text/plain", String(asset.path) + " dostępny tylko jako gzip");
+        return;
+      }
+      server.sendHeader("Cache-Control", "no-cache");
+      server.streamFile(file, asset.contentType);
+      file.close();
+      return;
+    }
+  }
+
+  server.sendHeader("ETag", asset.etag);
+  server.sendHeader("Cache-Control", asset.cacheControl);
+  if (server.header("If-None-Match") == asset.etag) {
+    server.send(304);
+    return;
+  }
+
+  if (asset.data) {
+    if (asset.gzip) server.sendHeader("Content-Encoding", "gzip");
+    server.send_P(200, asset.contentType, (const char*)asset.data, asset.size);
+  } else {
+    // streamFile sam dodaje Content-Encoding dla pliku .gz
+    File file = LittleFS.open(asset.gzip ? String(asset.path) + ".gz" : String(asset.path), "r");
+    server.streamFile(file, asset.contentType);
+    file.close();
+  }
+}
+
+bool isValidFsPath(const String& path) {
+  if (!path.startsWith("/") || path.length() < 2 || path.length() > FS_MAX_PATH) return false;
+  if (path.indexOf("..") >= 0 || path.endsWith(".tmp")) return false;
+  return path.indexOf('/', 1) < 0;       // pliki panelu leżą płasko w katalogu głównym
+}
+
+void failFsUpload(const char* error) {
+  fsUpload.failed = true;
+  strlcpy(fsUpload.error, error, sizeof(fsUpload.error));
+  if (fsUpload.file) fsUpload.file.close();
+  if (fsUpload.tmpPath.length() > 0) LittleFS.remove(fsUpload.tmpPath);
+  Serial.println("Upload " + fsUpload.path + ": " + String(error));
+}
+
+// Plik trafia do "<path>.tmp" kawałkami z bufora serwera (bez kopii całości w RAM).
+// Docelowy plik jest podmieniany dopiero po zgodności SHA-256, więc przerwany
+// albo uszkodzony upload zostawia poprzednią wersję nietkniętą.
+void handleFsUpload() {
+  HTTPUpload& upload = server.upload();
+
+  if (upload.status == UPLOAD_FILE_START) {
+    fsUpload.path = server.hasArg("path") ? server.arg("path") : upload.filename;
+    if (!fsUpload.path.startsWith("/")) fsUpload.path = "/" + fsUpload.path;
+    fsUpload.tmpPath = "";
+    fsUpload.expectedHash = server.arg("sha256");
+    fsUpload.expectedHash.toLowerCase();
+    fsUpload.hash = "";
+    fsUpload.size = 0;
+    fsUpload.failed = false;
+    fsUpload.error[0] = '\0';
+    fsUpload.startMs = millis();
+    fsUpload.ms = 0;
+
+    if (!isValidFsPath(fsUpload.path)) {
+      failFsUpload("Niepoprawna ścieżka pliku");
+      return;
+    }
+    fsUpload.tmpPath = fsUpload.path + ".tmp";
+    fsUpload.file = LittleFS.open(fsUpload.tmpPath, "w");
+    if (!fsUpload.file) {
+      failFsUpload("Nie można utworzyć pliku tymczasowego");
+      return;
+    }
+    mbedtls_sha256_init(&fsUpload.sha);
+    mbedtls_sha256_starts_ret(&fsUpload.sha, 0);
+    Serial.println("Upload: " + fsUpload.path);
+  } else if (upload.status == UPLOAD_FILE_WRITE) {
+    if (fsUpload.failed) return;
+    // Zostaw zapas, żeby upload nie zapełnił systemu plików kosztem innych danych
+    size_t freeBytes = LittleFS.totalBytes() - LittleFS.usedBytes();
+    if (freeBytes < upload.currentSize + FS_UPLOAD_RESERVE) {
+      mbedtls_sha256_free(&fsUpload.sha);
+      failFsUpload("Za mało miejsca na LittleFS");
+      return;
+    }
+    if (fsUpload.file.write(upload.buf, upload.currentSize) != upload.currentSize) {
+      mbedtls_sha256_free(&fsUpload.sha);
+      failFsUpload("Błąd zapisu LittleFS");
+      return;
+    }
+    mbedtls_sha256_update_ret(&fsUpload.sha, upload.buf, upload.currentSize);
+    fsUpload.size += upload.currentSize;
+  } else if (upload.status == UPLOAD_FILE_END) {
+    fsUpload.ms = millis() - fsUpload.startMs;
+    if (fsUpload.failed) return;
+    fsUpload.file.close();
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish_ret(&fsUpload.sha, digest);
+    mbedtls_sha256_free(&fsUpload.sha);
+    char hex[65];
+    for (int i = 0; i < 32; i++) snprintf(hex + i * 2, 3, "%02x", digest[i]);
+    fsUpload.hash = hex;
+
+    if (fsUpload.expectedHash.length() > 0 && fsUpload.expectedHash != fsUpload.hash) {
+      failFsUpload("Niezgodny SHA-256");
+      return;
+    }
+    // Rename w LittleFS podmienia plik docelowy atomowo – nie ma chwili bez pliku
+    if (!LittleFS.rename(fsUpload.tmpPath, fsUpload.path)) {
+      failFsUpload("Błąd zmiany nazwy pliku");
+      return;
+    }
+    // Zwykły plik wgrany ponownie: stara wersja .gz miałaby pierwszeństwo i zasłaniała nową treść
+    String gzPath = fsUpload.path + ".gz";
+    if (!fsUpload.path.endsWith(".gz") && LittleFS.exists(gzPath)) {
+      LittleFS.remove(gzPath);
+      Serial.println("Upload " + fsUpload.path + ": usunięto nieaktualny " + gzPath);
+    }
+    invalidateStaticAsset(fsUpload.path);
+    Serial.println("Upload gotowy: " + fsUpload.path + " (" + String(fsUpload.size) + " B, " + String(fsUpload.ms) + " ms)");
+  } else if (upload.status == UPLOAD_FILE_ABORTED) {
+    if (fsUpload.failed) return;
+    mbedtls_sha256_free(&fsUpload.sha);
+    failFsUpload("Upload przerwany");
+  }
+}
+
+bool resolveOtaTarget(const String& node, uint8_t* mac) {
+  if (node == "golab" && golabConnected) {
+    memcpy(mac, masterConfig.golabMac, 6);
+    return true;
+  }
+  if (node == "walizka" && walizkaConnected) {
+    memcpy(mac, masterConfig.walizkaMac, 6);
+    return true;
+  }
+  NodeLink* link = findNodeById(node);
+  if (link != NULL && link->connected) {
+    memcpy(mac, link->mac, 6);
+    return true;
+  }
+  return false;
+}
+
+// Callback ESP-NOW (zadanie WiFi) – tylko zapis do zmiennych czytanych przez otaSendTask
+void handleOtaReply(const uint8_t* mac, const OtaReplyFrame* reply) {
+  if (!ota.running || memcmp(mac, ota.mac, 6) != 0) return;
+
+  if (reply->type == OTA_ACK) {
+    if (reply->offset > otaAckOffset) otaAckOffset = reply->offset;
+    if (reply->status != OTA_STATUS_OK) otaNack = true;
+  } else if (reply->type == OTA_BEGIN_ACK || reply->type == OTA_END_ACK) {
+    otaCtrlType = reply->type;
+    otaCtrlStatus = reply->status;
+    otaCtrlOffset = reply->offset;
+    otaCtrlReady = true;
+  }
+}
+
+bool otaSendControl(const void* frame, size_t len, uint8_t replyType, unsigned long timeoutMs, int attempts) {
+  for (int i = 0; i < attempts && ota.running; i++) {
+    otaCtrlReady = false;
+    espNowSend(ota.mac, (const uint8_t*)frame, len);
+    unsigned long start = millis();
+    while (millis() - start < timeoutMs && ota.running) {
+      if (otaCtrlReady && otaCtrlType == replyType) return true;
+      vTaskDelay(pdMS_TO_TICKS(5));
+    }
+  }
+  return false;
+}
+
+bool otaSendChunk(uint32_t offset) {
+  OtaChunkFrame frame;
+  uint16_t len = min((uint32_t)OTA_CHUNK_SIZE, ota.imageSize - offset);
+  if (esp_partition_read(ota.image, offset, frame.data, len) != ESP_OK) return false;
+
+  frame.magic = OTA_MAGIC;
+  frame.type = OTA_CHUNK;
+  frame.offset = offset;
+  frame.len = len;
+  frame.crc = otaCrc32(0, frame.data, len);
+  return espNowSend(ota.mac, (const uint8_t*)&frame, OTA_CHUNK_HEADER + len) == ESP_OK;
+}
+
+void otaFinish(const char* state, const String& error) {
+  strlcpy(ota.error, error.c_str(), sizeof(ota.error));
+  ota.state = state;
+  ota.endMs = millis();
+  ota.running = false;
+  Serial.println("OTA " + ota.node + ": " + String(state) + (error.length() > 0 ? " – " + error : ""));
+}
+
+void otaSendTask(void* arg) {
+  ota.startMs = millis();
+  ota.endMs = 0;
+  ota.retransmits = 0;
+  ota.resumedFrom = 0;
+  otaAckOffset = 0;
+  otaNack = false;
+
+  OtaBeginFrame begin = { OTA_MAGIC, OTA_BEGIN, ota.imageSize, ota.imageCrc, OTA_CHUNK_SIZE };
+  if (!otaSendControl(&begin, sizeof(begin), OTA_BEGIN_ACK, 2000, 3)) {
+    otaFinish(ota.running ? "error" : "aborted", "Brak odpowiedzi na OTA_BEGIN");
+    vTaskDelete(NULL);
+    return;
+  }
+  if (otaCtrlStatus != OTA_STATUS_OK) {
+    otaFinish("error", "Węzeł odrzucił obraz (status " + String(otaCtrlStatus) + ")");
+    vTaskDelete(NULL);
+    return;
+  }
+
+  // Wznowienie: slave podaje offset, od którego ma już zapisane dane
+  ota.resumedFrom = otaCtrlOffset;
+  otaAckOffset = otaCtrlOffset;
+  ota.startMs = millis();
+  ota.state = "sending";
+
+  uint32_t next = otaAckOffset;
+  uint32_t lastAcked = otaAckOffset;
+  unsigned long lastProgress = millis();
+  int timeouts = 0;
+
+  while (otaAckOffset < ota.imageSize) {
+    if (!ota.running) {
+      OtaControlFrame abortFrame = { OTA_MAGIC, OTA_ABORT };
+      espNowSend(ota.mac, (const uint8_t*)&abortFrame, sizeof(abortFrame));
+      otaFinish("aborted", "");
+      vTaskDelete(NULL);
+      return;
+    }
+
+    uint32_t acked = otaAckOffset;
+    if (otaNack) {
+      // Błędny CRC albo zapis – go-back-N od potwierdzonego offsetu
+      otaNack = false;
+      next = acked;
+      ota.retransmits++;
+    }
+    if (next < acked) next = acked;
+
+    while (next < ota.imageSize && next < acked + (uint32_t)OTA_WINDOW * OTA_CHUNK_SIZE) {
+      if (!otaSendChunk(next)) break;    // bufor ESP-NOW pełny – spróbuj w następnym obiegu
+      next += min((uint32_t)OTA_CHUNK_SIZE, ota.imageSize - next);
+    }
+
+    if (acked != lastAcked) {
+      lastAcked = acked;
+      lastProgress = millis();
+      timeouts = 0;
+    } else if (millis() - lastProgress > OTA_ACK_TIMEOUT_MS) {
+      if (++timeouts > OTA_MAX_TIMEOUTS) {
+        otaFinish("error", "Węzeł przestał odpowiadać przy " + String(acked) + " B – ponów /ota_start, transfer zostanie wznowiony");
+        vTaskDelete(NULL);
+        return;
+      }
+      next = acked;
+      ota.retransmits++;
+      lastProgress = millis();
+    }
+    vTaskDelay(1);
+  }
+
+  ota.state = "verifying";
+  unsigned long sendEnd = millis();
+  OtaControlFrame end = { OTA_MAGIC, OTA_END };
+  if (!otaSendControl(&end, sizeof(end), OTA_END_ACK, OTA_VERIFY_TIMEOUT_MS, 2)) {
+    otaFinish("error", "Brak potwierdzenia weryfikacji");
+  } else if (otaCtrlStatus != OTA_STATUS_OK) {
+    otaFinish("error", "Weryfikacja w węźle nieudana (status " + String(otaCtrlStatus) + ")");
+  } else {
+    unsigned long ms = max(1UL, sendEnd - ota.startMs);
+    Serial.println("OTA " + ota.node + ": " + String((float)(ota.imageSize - ota.resumedFrom) / 1.024f / ms, 1) + " KB/s");
+    otaFinish("done", "");
+    ota.endMs = sendEnd;   // KB/s w /ota_status liczone bez czasu weryfikacji
+  }
+  vTaskDelete(NULL);
+}
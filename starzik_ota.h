@@ -0,0 +1,267 @@
+// starzik_ota.h
+// Aktualizacja firmware slave'ów przez ESP-NOW (Master -> węzeł) – wspólna dla Master i slave'ów.
+// Obraz idzie paczkami z CRC32 w oknie potwierdzanym skumulowanym ACK (go-back-N).
+// Slave pisze wprost do nieaktywnej partycji OTA, a postęp trzyma w NVS, więc przerwany
+// transfer wznawia się od ostatniego zapisanego sektora, a nie od zera.
+#pragma once
+
+#include <Arduino.h>
+#include <esp_now.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <Preferences.h>
+#include <rom/crc.h>
+#include "starzik_frame_magic.h"
+
+const uint16_t OTA_CHUNK_SIZE = 200;
+const uint8_t OTA_WINDOW = 8;             // paczek w locie bez potwierdzenia
+const uint32_t OTA_SECTOR_SIZE = 4096;
+const uint32_t OTA_SAVE_EVERY = 16384;    // zapis postępu do NVS co 16 KB
+
+enum OtaFrameType : uint8_t {
+  OTA_BEGIN = 1,        // Master -> slave: rozmiar i CRC obrazu
+  OTA_BEGIN_ACK = 2,    // slave -> Master: status, offset wznowienia
+  OTA_CHUNK = 3,
+  OTA_ACK = 4,          // slave -> Master: status, następny oczekiwany offset
+  OTA_END = 5,
+  OTA_END_ACK = 6,      // slave -> Master: wynik weryfikacji i przełączenia partycji
+  OTA_ABORT = 7
+};
+
+enum OtaStatus : uint8_t {
+  OTA_STATUS_OK = 0,
+  OTA_STATUS_SIZE = 1,
+  OTA_STATUS_CRC = 2,       // paczka z błędnym CRC – Master cofa się do offsetu z ACK
+  OTA_STATUS_FLASH = 3,
+  OTA_STATUS_VERIFY = 4,
+  OTA_STATUS_STATE = 5,
+  OTA_STATUS_BOOT = 6
+};
+
+struct __attribute__((packed)) OtaBeginFrame {
+  uint8_t magic;
+  uint8_t type;
+  uint32_t size;
+  uint32_t crc;
+  uint16_t chunkSize;
+};
+
+struct __attribute__((packed)) OtaChunkFrame {
+  uint8_t magic;
+  uint8_t type;
+  uint32_t offset;
+  uint16_t len;
+  uint32_t crc;
+  uint8_t data[OTA_CHUNK_SIZE];
+};
+
+struct __attribute__((packed)) OtaReplyFrame {
+  uint8_t magic;
+  uint8_t type;
+  uint8_t status;
+  uint32_t offset;
+};
+
+struct __attribute__((packed)) OtaControlFrame {
+  uint8_t magic;
+  uint8_t type;
+};
+
+const size_t OTA_CHUNK_HEADER = sizeof(OtaChunkFrame) - OTA_CHUNK_SIZE;
+
+inline uint32_t otaCrc32(uint32_t crc, const uint8_t* data, size_t len) {
+  return crc32_le(crc, data, len);
+}
+
+// ===== Strona slave'a =====
+// Callback ESP-NOW tylko kopiuje ramkę do kolejki; kasowanie i zapis flash robi osobne zadanie.
+
+struct OtaRxItem {
+  uint8_t len;
+  uint8_t data[sizeof(OtaChunkFrame)];
+};
+
+static const uint8_t* otaMasterMac = NULL;
+static QueueHandle_t otaQueue = NULL;
+static const esp_partition_t* otaPartition = NULL;
+static bool otaActive = false;
+static uint32_t otaSize = 0;
+static uint32_t otaImageCrc = 0;
+static uint32_t otaNext = 0;          // następny oczekiwany offset
+static uint32_t otaErasedTo = 0;      // skasowane sektory [0, otaErasedTo)
+static uint32_t otaSavedAt = 0;       // offset zapisany w NVS (początek sektora)
+
+inline void otaReply(uint8_t type, uint8_t status, uint32_t offset) {
+  OtaReplyFrame r = { OTA_MAGIC, type, status, offset };
+  esp_now_send(otaMasterMac, (const uint8_t*)&r, sizeof(r));
+}
+
+inline void otaSaveProgress(uint32_t offset) {
+  Preferences prefs;
+  prefs.begin("ota", false);
+  prefs.putUInt("size", otaSize);
+  prefs.putUInt("crc", otaImageCrc);
+  prefs.putString("part", otaPartition->label);
+  prefs.putUInt("offset", offset);
+  prefs.end();
+  otaSavedAt = offset;
+}
+
+inline void otaClearProgress() {
+  Preferences prefs;
+  prefs.begin("ota", false);
+  prefs.clear();
+  prefs.end();
+}
+
+inline void otaOnBegin(const OtaBeginFrame* f) {
+  otaPartition = esp_ota_get_next_update_partition(NULL);
+  if (otaPartition == NULL || f->size == 0 || f->size > otaPartition->size || f->chunkSize != OTA_CHUNK_SIZE) {
+    otaReply(OTA_BEGIN_ACK, OTA_STATUS_SIZE, 0);
+    return;
+  }
+
+  // Ten sam obraz na tę samą partycję – wznów od ostatniego zapisanego sektora
+  Preferences prefs;
+  prefs.begin("ota", true);
+  uint32_t savedSize = prefs.getUInt("size", 0);
+  uint32_t savedCrc = prefs.getUInt("crc", 0);
+  uint32_t savedOffset = prefs.getUInt("offset", 0);
+  String savedPart = prefs.getString("part", "");
+  prefs.end();
+
+  uint32_t resume = 0;
+  if (savedSize == f->size && savedCrc == f->crc && savedPart == otaPartition->label && savedOffset <= f->size) {
+    resume = savedOffset - savedOffset % OTA_SECTOR_SIZE;
+  }
+
+  otaSize = f->size;
+  otaImageCrc = f->crc;
+  otaNext = resume;
+  otaErasedTo = resume;
+  otaActive = true;
+  otaSaveProgress(resume);
+
+  Serial.printf("OTA: start %lu B na %s, wznowienie od %lu\n",
+                (unsigned long)otaSize, otaPartition->label, (unsigned long)resume);
+  otaReply(OTA_BEGIN_ACK, OTA_STATUS_OK, resume);
+}
+
+inline void otaOnChunk(const OtaChunkFrame* f, size_t frameLen) {
+  if (!otaActive) {
+    otaReply(OTA_ACK, OTA_STATUS_STATE, 0);
+    return;
+  }
+
+  // Duplikat albo paczka za dziurą – potwierdź to, co już jest zapisane
+  if (f->offset != otaNext) {
+    otaReply(OTA_ACK, OTA_STATUS_OK, otaNext);
+    return;
+  }
+
+  if (f->len == 0 || f->len > OTA_CHUNK_SIZE || frameLen < OTA_CHUNK_HEADER + f->len ||
+      f->offset + f->len > otaSize) {
+    otaReply(OTA_ACK, OTA_STATUS_SIZE, otaNext);
+    return;
+  }
+  if (otaCrc32(0, f->data, f->len) != f->crc) {
+    otaReply(OTA_ACK, OTA_STATUS_CRC, otaNext);
+    return;
+  }
+
+  while (otaErasedTo < f->offset + f->len) {
+    if (esp_partition_erase_range(otaPartition, otaErasedTo, OTA_SECTOR_SIZE) != ESP_OK) {
+      otaReply(OTA_ACK, OTA_STATUS_FLASH, otaNext);
+      return;
+    }
+    otaErasedTo += OTA_SECTOR_SIZE;
+  }
+  if (esp_partition_write(otaPartition, f->offset, f->data, f->len) != ESP_OK) {
+    otaReply(OTA_ACK, OTA_STATUS_FLASH, otaNext);
+    return;
+  }
+
+  otaNext += f->len;
+  if (otaNext - otaSavedAt >= OTA_SAVE_EVERY) {
+    otaSaveProgress(otaNext - otaNext % OTA_SECTOR_SIZE);
+  }
+  otaReply(OTA_ACK, OTA_STATUS_OK, otaNext);
+}
+
+inline void otaOnEnd() {
+  if (!otaActive || otaNext != otaSize) {
+    otaReply(OTA_END_ACK, OTA_STATUS_STATE, otaNext);
+    return;
+  }
+
+  // Weryfikacja: CRC32 całego obrazu odczytanego z flash
+  uint8_t buf[256];
+  uint32_t crc = 0;
+  for (uint32_t off = 0; off < otaSize; off += sizeof(buf)) {
+    uint32_t n = min((uint32_t)sizeof(buf), otaSize - off);
+    if (esp_partition_read(otaPartition, off, buf, n) != ESP_OK) break;
+    crc = otaCrc32(crc, buf, n);
+  }
+
+  otaActive = false;
+  otaClearProgress();
+
+  if (crc != otaImageCrc) {
+    Serial.println("OTA: błąd weryfikacji CRC");
+    otaReply(OTA_END_ACK, OTA_STATUS_VERIFY, 0);
+    return;
+  }
+  // esp_ota_set_boot_partition sprawdza też nagłówek i skrót obrazu
+  if (esp_ota_set_boot_partition(otaPartition) != ESP_OK) {
+    Serial.println("OTA: obraz odrzucony przez bootloader");
+    otaReply(OTA_END_ACK, OTA_STATUS_BOOT, 0);
+    return;
+  }
+
+  Serial.println("OTA: obraz zweryfikowany, restart...");
+  otaReply(OTA_END_ACK, OTA_STATUS_OK, otaSize);
+  vTaskDelay(pdMS_TO_TICKS(1000));
+  ESP.restart();
+}
+
+inline void otaSlaveTask(void* arg) {
+  OtaRxItem item;
+  while (true) {
+    if (xQueueReceive(otaQueue, &item, portMAX_DELAY) != pdTRUE) continue;
+
+    switch (item.data[1]) {
+      case OTA_BEGIN:
+        if (item.len >= sizeof(OtaBeginFrame)) otaOnBegin((const OtaBeginFrame*)item.data);
+        break;
+      case OTA_CHUNK:
+        if (item.len >= OTA_CHUNK_HEADER) otaOnChunk((const OtaChunkFrame*)item.data, item.len);
+        break;
+      case OTA_END:
+        otaOnEnd();
+        break;
+      case OTA_ABORT:
+        otaActive = false;
+        Serial.println("OTA: przerwane przez Master");
+        break;
+    }
+  }
+}
+
+// Wywołać w setup() po esp_now_init() i dodaniu Mastera jako peera
+inline void otaSlaveBegin(const uint8_t* masterMac) {
+  otaMasterMac = masterMac;
+  otaQueue = xQueueCreate(OTA_WINDOW * 2, sizeof(OtaRxItem));
+  xTaskCreatePinnedToCore(otaSlaveTask, "ota", 4096, NULL, 2, NULL, 1);
+}
+
+// Wywołać na początku callbacku odbioru; true = ramka OTA (obsłużona albo odrzucona)
+inline bool otaSlaveHandleFrame(const uint8_t* mac, const uint8_t* data, int len) {
+  if (len < 2 || data[0] != OTA_MAGIC) return false;
+  if (otaQueue == NULL || memcmp(mac, otaMasterMac, 6) != 0) return true;
+
+  OtaRxItem item;
+  item.len = min((size_t)len, sizeof(item.data));
+  memcpy(item.data, data, item.len);
+  xQueueSend(otaQueue, &item, 0);
+  return true;
+}
@@ -0,0 +1,121 @@
+// starzik_phy.h
+// Szybkość PHY ESP-NOW na węzeł – wspólna dla Master i slave'ów.
+// Arduino-ESP32 2.x (IDF 4.4) nie ma szybkości per peer, esp_wifi_config_espnow_rate() ustawia
+// jedną dla interfejsu. Master przełącza szybkość przed każdym wysłaniem pod adresata
+// (espNowSend()). Slave ma jedną szybkość na wszystko – dlatego węzeł nadający też do innych
+// węzłów (Walizka -> Podłoga) Master trzyma na domyślnej (PHY_PINNED_MEMBERS).
+// Szybkość inna niż domyślna jest u slave'a dzierżawą: Master odnawia ją komendą
+// "phy_rate|<nazwa>" co PHY_RENEW_MS, a bez odnowienia slave wraca do 1 Mb/s – węzeł, którego
+// odpowiedzi przestały dochodzić, sam odzyskuje łączność.
+#pragma once
+
+#include <Arduino.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include "starzik_frame_magic.h"
+
+const unsigned long PHY_RENEW_MS = 10000;
+const unsigned long PHY_LEASE_MS = 35000;      // ponad trzy odnowienia
+
+struct PhyRate {
+  const char* name;
+  wifi_phy_rate_t rate;
+  int8_t sensitivityDbm;     // czułość odbiornika ESP32 z noty katalogowej (LR – szacunkowo)
+};
+
+// Od największego zasięgu do największej przepływności – drabina automatu Mastera.
+// LR działa tylko między ESP32, obie strony muszą mieć WIFI_PROTOCOL_LR.
+static const PhyRate PHY_RATES[] = {
+  { "lr250k", WIFI_PHY_RATE_LORA_250K, -102 },
+  { "lr500k", WIFI_PHY_RATE_LORA_500K, -99 },
+  { "1m", WIFI_PHY_RATE_1M_L, -97 },
+  { "2m", WIFI_PHY_RATE_2M_L, -95 },
+  { "6m", WIFI_PHY_RATE_6M, -92 },
+  { "12m", WIFI_PHY_RATE_12M, -90 },
+  { "24m", WIFI_PHY_RATE_24M, -86 },
+  { "54m", WIFI_PHY_RATE_54M, -75 },
+};
+const int PHY_RATE_COUNT = sizeof(PHY_RATES) / sizeof(PHY_RATES[0]);
+const uint8_t PHY_RATE_DEFAULT = 2;            // 1 Mb/s – domyślna szybkość ESP-NOW
+
+enum PhyFrameType : uint8_t {
+  PHY_BENCH_PING = 1,    // Master -> slave: odpowiedz i przejdź na "rate"
+  PHY_BENCH_PONG = 2,    // slave -> Master: "rate" = szybkość, z jaką poszła odpowiedź
+  PHY_BENCH_BURST = 3    // Master -> slave: seria do pomiaru ramek/s, bez odpowiedzi
+};
+
+// Nagłówek; sondy mogą być dłuższe (wypełnienie do rozmiaru testowanej ramki)
+struct __attribute__((packed)) PhyBenchFrame {
+  uint8_t magic;
+  uint8_t type;
+  uint8_t rate;
+  uint16_t seq;
+};
+
+inline int phyRateByName(const String& name) {
+  for (int i = 0; i < PHY_RATE_COUNT; i++) {
+    if (name == PHY_RATES[i].name) return i;
+  }
+  return -1;
+}
+
+// Radio musi już działać (po WiFi.mode()); LR obok 802.11b/g/n – słychać obie modulacje
+inline void phyEnableLongRange() {
+  esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N | WIFI_PROTOCOL_LR);
+}
+
+// ===== Strona slave'a =====
+
+static const uint8_t* phyMasterMac = NULL;
+static uint8_t phyCurrent = PHY_RATE_DEFAULT;
+static volatile uint8_t phyRequested = PHY_RATE_DEFAULT;
+static volatile unsigned long phyLeaseAt = 0;      // ostatnie odnowienie
+
+// Wywołać w setup() po esp_now_init()
+inline void phySlaveBegin(const uint8_t* masterMac) {
+  phyMasterMac = masterMac;
+  phyEnableLongRange();
+  esp_wifi_config_espnow_rate(WIFI_IF_STA, PHY_RATES[PHY_RATE_DEFAULT].rate);
+}
+
+// Wywołać na początku callbacku odbioru; true = ramka pomiaru szybkości.
+// Odpowiedź od razu, z bieżącą szybkością – przełączenie radia w loop(), nie w zadaniu WiFi.
+inline bool phySlaveHandleFrame(const uint8_t* mac, const uint8_t* data, int len) {
+  if (len < (int)sizeof(PhyBenchFrame) || data[0] != PHY_FRAME_MAGIC) return false;
+  if (phyMasterMac == NULL || memcmp(mac, phyMasterMac, 6) != 0) return true;
+
+  const PhyBenchFrame* ping = (const PhyBenchFrame*)data;
+  if (ping->type != PHY_BENCH_PING) return true;
+  if (ping->rate < PHY_RATE_COUNT) {
+    phyRequested = ping->rate;
+    phyLeaseAt = millis();
+  }
+  PhyBenchFrame pong = { PHY_FRAME_MAGIC, PHY_BENCH_PONG, phyCurrent, ping->seq };
+  esp_now_send(phyMasterMac, (const uint8_t*)&pong, sizeof(pong));
+  return true;
+}
+
+// Z handleMasterMessage(); true = komenda szybkości
+inline bool phySlaveCommand(const String& command, const String& data) {
+  if (command != "phy_rate") return false;
+  int rate = phyRateByName(data);
+  if (rate >= 0) {
+    phyRequested = rate;
+    phyLeaseAt = millis();
+  }
+  return true;
+}
+
+// Wywoływać w loop(): przełączenie zamówionej szybkości i powrót do domyślnej po dzierżawie
+inline void phySlaveService() {
+  unsigned long leaseAt = phyLeaseAt;
+  if (phyRequested != PHY_RATE_DEFAULT && millis() - leaseAt > PHY_LEASE_MS) {
+    phyRequested = PHY_RATE_DEFAULT;
+    Serial.println("PHY: brak odnowienia od Mastera – powrót do 1 Mb/s");
+  }
+  uint8_t rate = phyRequested;
+  if (rate == phyCurrent) return;
+  phyCurrent = rate;
+  esp_wifi_config_espnow_rate(WIFI_IF_STA, PHY_RATES[rate].rate);
+  Serial.printf("PHY: szybkość ESP-NOW %s\n", PHY_RATES[rate].name);
+}
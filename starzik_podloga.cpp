@@ -0,0 +1,400 @@
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_timer.h>
+#include <soc/gpio_reg.h>
+#include "starzik_relay_frame.h"
+#include "starzik_ota.h"
+#include "starzik_group.h"
+#include "starzik_channel.h"
+#include "starzik_phy.h"
+#include "starzik_health.h"
+
+// --- Kanały przekaźników ---
+// Stan wyjścia zapisywany bezpośrednio do rejestrów W1TS/W1TC (adres i maska liczone przy starcie)
+struct RelayChannel {
+  uint8_t pin;
+  bool activeHigh;
+  uint32_t onReg;
+  uint32_t offReg;
+  uint32_t mask;
+  esp_timer_handle_t offTimer;
+  int64_t offAtUs;        // 0 = brak zaplanowanego wyłączenia
+  bool on;
+  bool pulsing;
+};
+
+// Okablowany jest tylko kanał 0. Dodatkowe kanały włącza flaga -DPODLOGA_EXTRA_RELAYS
+// w platformio.ini, a ich piny to PRZYKŁAD – niesprawdzone na płytce, przed włączeniem
+// wpisz te, do których podłączono IN modułu (GPIO16/17 zajmuje PSRAM na modułach WROVER).
+RelayChannel relays[] = {
+  { 4, false },           // <- Twój pin IN, HL-51 zwykle active-LOW
+#ifdef PODLOGA_EXTRA_RELAYS
+  { 16, false },          // placeholder
+  { 17, false },          // placeholder
+  { 18, false },          // placeholder
+#endif
+};
+const int RELAY_COUNT = sizeof(relays) / sizeof(relays[0]);
+static_assert(RELAY_COUNT == RELAY_CHANNEL_COUNT, "relays[] niezgodne z RELAY_CHANNEL_COUNT (starzik_relay_frame.h)");
+portMUX_TYPE relay_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// --- Master (ESP-NOW) ---
+#define NODE_ID "podloga"
+#define REGISTER_RETRY_MS 2000
+#define MASTER_TIMEOUT_MS 30000
+
+uint8_t master_mac[] = {0x78, 0x1C, 0x3C, 0xF5, 0x82, 0xD8};
+
+struct MasterFrame {
+  char text[250];
+};
+
+QueueHandle_t master_queue = NULL;    // ramki tekstowe od Mastera, obsługiwane w loop()
+bool master_connected = false;
+unsigned long last_master_frame = 0;
+unsigned long last_register_attempt = 0;
+volatile bool relay_event_pending = false;
+
+// --- Logowanie odroczone: callback tylko wrzuca wpis do kolejki, drukuje osobne zadanie ---
+struct RelayLog {
+  uint8_t mac[6];
+  uint8_t seq;
+  uint8_t channel;
+  uint8_t mode;
+  uint8_t status;
+  uint8_t outputs;
+  uint32_t argMs;
+  uint32_t ns;
+};
+
+QueueHandle_t log_queue = NULL;
+volatile uint32_t log_dropped = 0;
+
+// --- Pomiar: wejście do callbacku -> zapis rejestru GPIO ---
+uint32_t cpu_mhz = 240;
+volatile uint32_t bench_count = 0;
+volatile uint64_t bench_sum_ns = 0;
+volatile uint32_t bench_min_ns = UINT32_MAX;
+volatile uint32_t bench_max_ns = 0;
+
+void setupRelays() {
+  for (int i = 0; i < RELAY_COUNT; i++) {
+    RelayChannel& r = relays[i];
+    bool high = r.pin >= 32;
+    uint32_t setReg = high ? GPIO_OUT1_W1TS_REG : GPIO_OUT_W1TS_REG;
+    uint32_t clrReg = high ? GPIO_OUT1_W1TC_REG : GPIO_OUT_W1TC_REG;
+    r.mask = 1UL << (high ? r.pin - 32 : r.pin);
+    r.onReg = r.activeHigh ? setReg : clrReg;
+    r.offReg = r.activeHigh ? clrReg : setReg;
+
+    REG_WRITE(r.offReg, r.mask);      // startowo wyłączony, zanim pin stanie się wyjściem
+    pinMode(r.pin, OUTPUT);
+  }
+}
+
+uint8_t relayOutputs() {
+  uint8_t mask = 0;
+  for (int i = 0; i < RELAY_COUNT; i++) {
+    if (relays[i].on) mask |= 1 << i;
+  }
+  return mask;
+}
+
+void relayOffTimer(void* arg) {
+  RelayChannel& r = relays[(int)(intptr_t)arg];
+  bool changed = false;
+
+  // Spóźniony timer (po LATCH/OFF albo przedłużeniu TIMED) nic nie robi
+  portENTER_CRITICAL(&relay_mux);
+  if (r.offAtUs != 0 && esp_timer_get_time() >= r.offAtUs - 1000) {
+    REG_WRITE(r.offReg, r.mask);
+    r.on = false;
+    r.pulsing = false;
+    r.offAtUs = 0;
+    changed = true;
+  }
+  portEXIT_CRITICAL(&relay_mux);
+
+  if (changed) relay_event_pending = true;
+}
+
+// Wywoływane z callbacku WiFi i z loop(); *gpioCycles = chwila zapisu rejestru
+uint8_t applyRelay(uint8_t ch, uint8_t mode, uint32_t argMs, uint32_t* gpioCycles) {
+  if (ch >= RELAY_COUNT) return RELAY_ACK_BAD_CHANNEL;
+  if (mode >= RELAY_MODE_COUNT) return RELAY_ACK_BAD_MODE;
+  bool timed = (mode == RELAY_MODE_PULSE || mode == RELAY_MODE_TIMED);
+  if (timed && (argMs == 0 || argMs > RELAY_MAX_MS)) return RELAY_ACK_BAD_MODE;
+
+  RelayChannel& r = relays[ch];
+  uint8_t status = RELAY_ACK_OK;
+
+  portENTER_CRITICAL(&relay_mux);
+  if (mode == RELAY_MODE_PULSE && r.pulsing) {
+    status = RELAY_ACK_IGNORED;
+  } else {
+    bool on = (mode != RELAY_MODE_OFF);
+    REG_WRITE(on ? r.onReg : r.offReg, r.mask);
+    *gpioCycles = ESP.getCycleCount();
+    r.on = on;
+    r.pulsing = (mode == RELAY_MODE_PULSE);
+    r.offAtUs = timed ? esp_timer_get_time() + (int64_t)argMs * 1000 : 0;
+  }
+  portEXIT_CRITICAL(&relay_mux);
+
+  if (status != RELAY_ACK_OK) return status;
+
+  esp_timer_stop(r.offTimer);
+  if (timed) esp_timer_start_once(r.offTimer, (uint64_t)argMs * 1000);
+  relay_event_pending = true;         // zdarzenie do Mastera wysyła loop()
+  return status;
+}
+
+void logRelay(const uint8_t* mac, uint8_t seq, uint8_t ch, uint8_t mode, uint32_t argMs, uint8_t status, uint32_t ns) {
+  RelayLog e;
+  memcpy(e.mac, mac, 6);
+  e.seq = seq;
+  e.channel = ch;
+  e.mode = mode;
+  e.status = status;
+  e.outputs = relayOutputs();
+  e.argMs = argMs;
+  e.ns = ns;
+  if (xQueueSend(log_queue, &e, 0) != pdTRUE) log_dropped++;
+}
+
+uint32_t recordLatency(uint32_t rxCycles, uint32_t gpioCycles) {
+  uint32_t ns = (uint32_t)((uint64_t)(gpioCycles - rxCycles) * 1000 / cpu_mhz);
+  bench_count++;
+  bench_sum_ns += ns;
+  if (ns < bench_min_ns) bench_min_ns = ns;
+  if (ns > bench_max_ns) bench_max_ns = ns;
+  return ns;
+}
+
+void handleRelayFrame(const uint8_t* mac, const RelayFrame* f, uint32_t rxCycles) {
+  uint32_t gpioCycles = 0;
+  uint32_t ns = 0;
+  uint8_t status;
+
+  if (relayFrameCheck((const uint8_t*)f, sizeof(RelayFrame) - 1) != f->check) {
+    status = RELAY_ACK_BAD_CHECK;
+  } else {
+    status = applyRelay(f->channel, f->mode, f->argMs, &gpioCycles);
+    if (status == RELAY_ACK_OK) ns = recordLatency(rxCycles, gpioCycles);
+  }
+
+  // ACK dopiero po zapisie GPIO – nie wydłuża ścieżki do wyjścia
+  RelayAck ack = { RELAY_ACK_MAGIC, f->seq, status, relayOutputs(), ns };
+  if (!esp_now_is_peer_exist(mac)) {
+    esp_now_peer_info_t peer = {};
+    memcpy(peer.peer_addr, mac, 6);
+    peer.channel = 0; peer.encrypt = false; peer.ifidx = WIFI_IF_STA;
+    esp_now_add_peer(&peer);
+  }
+  esp_now_send(mac, (const uint8_t*)&ack, sizeof(ack));
+
+  logRelay(mac, f->seq, f->channel, f->mode, f->argMs, status, ns);
+}
+
+void loggerTask(void* arg) {
+  static const char* MODE_NAMES[] = { "OFF", "LATCH", "PULSE", "TIMED" };
+  RelayLog e;
+  while (true) {
+    if (xQueueReceive(log_queue, &e, portMAX_DELAY) != pdTRUE) continue;
+    Serial.printf("[SLAVE] %02X:%02X:%02X:%02X:%02X:%02X #%u CH%u %s %lu ms -> status %u, wyjścia 0x%02X, %lu ns\n",
+                  e.mac[0], e.mac[1], e.mac[2], e.mac[3], e.mac[4], e.mac[5],
+                  e.seq, e.channel, e.mode < RELAY_MODE_COUNT ? MODE_NAMES[e.mode] : "?",
+                  (unsigned long)e.argMs, e.status, e.outputs, (unsigned long)e.ns);
+    if (log_dropped > 0) {
+      Serial.printf("[SLAVE] Pominięto %lu wpisów logu\n", (unsigned long)log_dropped);
+      log_dropped = 0;
+    }
+  }
+}
+
+void sendToMaster(const String& command, const String& data) {
+  String serialized = command + "|" + data + "|" + String(millis());
+  uint8_t message[250];
+  size_t len = serialized.length();
+  if (len > 249) len = 249;
+  serialized.getBytes(message, len + 1);
+
+  if (esp_now_send(master_mac, message, len) != ESP_OK) {
+    Serial.println("[SLAVE] Błąd wysyłania do Master: " + command);
+  }
+}
+
+void sendEvent(const char* ev) {
+  if (!master_connected) return;
+  uint8_t outputs = relayOutputs();
+  char json[128];
+  snprintf(json, sizeof(json), "{\"ev\":\"%s\",\"id\":0,\"stage\":\"%s\",\"relay\":%s,\"outputs\":%u}",
+           ev, outputs ? "ON" : "OFF", outputs ? "true" : "false", outputs);
+  sendToMaster("event", json);
+}
+
+void sendBenchStats() {
+  char json[128];
+  uint32_t n = bench_count;
+  snprintf(json, sizeof(json), "{\"n\":%lu,\"min_ns\":%lu,\"avg_ns\":%lu,\"max_ns\":%lu}",
+           (unsigned long)n, (unsigned long)(n ? bench_min_ns : 0),
+           (unsigned long)(n ? bench_sum_ns / n : 0), (unsigned long)bench_max_ns);
+  sendToMaster("bench_stats", json);
+}
+
+void onDataSent(const uint8_t * mac, esp_now_send_status_t status) {
+  healthNoteSend(status);
+}
+
+void onDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
+  uint32_t rxCycles = ESP.getCycleCount();
+
+  // Szybka ścieżka: binarna ramka przekaźnika, walidowana w buforze odbiorczym
+  if (len == sizeof(RelayFrame) && incomingData[0] == RELAY_FRAME_MAGIC) {
+    handleRelayFrame(mac, (const RelayFrame*)incomingData, rxCycles);
+    return;
+  }
+
+  if (channelSlaveHandleFrame(mac, incomingData, len)) return;
+  if (phySlaveHandleFrame(mac, incomingData, len)) return;
+  if (otaSlaveHandleFrame(mac, incomingData, len)) return;
+  const uint8_t* groupText;
+  int groupLen = groupSlaveHandleFrame(mac, incomingData, len, &groupText);
+  if (groupLen == 0) return;
+  if (groupLen > 0) {          // komenda grupowa – dalej jak zwykła ramka tekstowa
+    incomingData = groupText;
+    len = groupLen;
+  }
+
+  // Zgodność z Walizka: "relay_on|...|ts" – ZAŁĄCZ NA STAŁE do resetu
+  if (len >= 9 && memcmp(incomingData, "relay_on|", 9) == 0) {
+    uint32_t gpioCycles = 0;
+    uint8_t status = applyRelay(0, RELAY_MODE_LATCH, 0, &gpioCycles);
+    uint32_t ns = (status == RELAY_ACK_OK) ? recordLatency(rxCycles, gpioCycles) : 0;
+    logRelay(mac, 0, 0, RELAY_MODE_LATCH, 0, status, ns);
+    return;
+  }
+
+  // Pozostałe ramki tekstowe od Mastera: kolejka do loop() (odpowiedzi wymagają wysyłania)
+  if (memcmp(mac, master_mac, 6) == 0) {
+    MasterFrame frame;
+    if (len > (int)sizeof(frame.text) - 1) len = sizeof(frame.text) - 1;
+    memcpy(frame.text, incomingData, len);
+    frame.text[len] = '\0';
+    xQueueSend(master_queue, &frame, 0);
+  }
+}
+
+void setAllRelays(uint8_t mode) {
+  uint32_t gpioCycles;
+  for (int i = 0; i < RELAY_COUNT; i++) applyRelay(i, mode, 0, &gpioCycles);
+}
+
+void handleMasterMessage(const String& command, const String& data) {
+  uint32_t gpioCycles;
+  if (command == "heartbeat" || command == "registered") {
+    if (!master_connected) {
+      Serial.println("[SLAVE] Połączono z Master");
+      relay_event_pending = true;     // od razu zgłoś aktualny stan przekaźników
+    }
+    master_connected = true;
+    sendToMaster("heartbeat", data);  // echo – Master liczy z tego RTT
+    healthSlaveSend(master_mac, 0, true, false);  // przekaźniki bez sprzężenia zwrotnego – nic do monitorowania
+  } else if (command == "relay") {
+    applyRelay(0, data == "1" ? RELAY_MODE_LATCH : RELAY_MODE_OFF, 0, &gpioCycles);
+  } else if (command == "reset_puzzle") {
+    setAllRelays(RELAY_MODE_OFF);
+  } else if (command == "start_puzzle") {
+    sendEvent("started");             // podłoga nie ma własnego etapu startu
+  } else if (command == "bench") {
+    if (data == "reset") {
+      bench_count = 0;
+      bench_sum_ns = 0;
+      bench_min_ns = UINT32_MAX;
+      bench_max_ns = 0;
+    }
+    sendBenchStats();
+  } else if (command == "restart") {
+    ESP.restart();
+  } else if (channelSlaveCommand(command, data)) {
+    Serial.println("[SLAVE] Kanał radiowy: " + command + " " + data);
+  } else if (phySlaveCommand(command, data)) {
+    Serial.println("[SLAVE] Szybkość radia: " + data);
+  } else {
+    Serial.println("[SLAVE] Nieznana komenda od Master: " + command);
+  }
+}
+
+void serviceMaster() {
+  MasterFrame frame;
+  while (xQueueReceive(master_queue, &frame, 0) == pdTRUE) {
+    String payload = frame.text;
+    int p1 = payload.indexOf('|');
+    int p2 = payload.indexOf('|', p1 + 1);
+    if (p1 <= 0 || p2 <= 0) continue;
+    last_master_frame = millis();
+    handleMasterMessage(payload.substring(0, p1), payload.substring(p1 + 1, p2));
+  }
+
+  if (master_connected && millis() - last_master_frame > MASTER_TIMEOUT_MS) {
+    master_connected = false;
+    Serial.println("[SLAVE] Utracono połączenie z Master");
+  }
+
+  if (!master_connected && millis() - last_register_attempt > REGISTER_RETRY_MS) {
+    last_register_attempt = millis();
+    sendToMaster("register", NODE_ID);
+  }
+
+  if (relay_event_pending && master_connected) {
+    relay_event_pending = false;
+    sendEvent("relay");
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  setupRelays();                      // startowo wyłączone
+  cpu_mhz = ESP.getCpuFreqMHz();
+
+  for (int i = 0; i < RELAY_COUNT; i++) {
+    esp_timer_create_args_t args = {};
+    args.callback = &relayOffTimer;
+    args.arg = (void*)(intptr_t)i;
+    args.name = "relay";
+    esp_timer_create(&args, &relays[i].offTimer);
+  }
+
+  log_queue = xQueueCreate(16, sizeof(RelayLog));
+  xTaskCreatePinnedToCore(loggerTask, "relayLog", 3072, NULL, 1, NULL, 1);
+
+  WiFi.mode(WIFI_STA);
+  WiFi.disconnect();
+  channelSlaveBegin(master_mac);   // kanał z NVS, zanim ruszy ESP-NOW
+
+  master_queue = xQueueCreate(4, sizeof(MasterFrame));
+  if (esp_now_init() != ESP_OK) {
+    Serial.println("esp_now_init FAIL"); while(true) delay(1000);
+  }
+  esp_now_register_send_cb(onDataSent);
+  esp_now_register_recv_cb(onDataRecv);
+
+  esp_now_peer_info_t peer = {};
+  memcpy(peer.peer_addr, master_mac, 6);
+  peer.channel = 0; peer.encrypt = false; peer.ifidx = WIFI_IF_STA;
+  if (esp_now_add_peer(&peer) != ESP_OK) Serial.println("[SLAVE] Błąd dodawania Master peer");
+  otaSlaveBegin(master_mac);
+  groupSlaveBegin(master_mac, NODE_ID);
+  phySlaveBegin(master_mac);
+
+  Serial.print("[SLAVE] MAC: "); Serial.println(WiFi.macAddress());
+  Serial.printf("[SLAVE] Ready – %d kanałów przekaźników\n", RELAY_COUNT);
+}
+
+void loop(){
+  healthLoopTick();
+  serviceMaster();
+  channelSlaveService();
+  phySlaveService();
+  delay(20);
+}
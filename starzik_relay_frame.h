@@ -0,0 +1,56 @@
+// starzik_relay_frame.h
+// Binarna ramka sterowania przekaźnikami Podłogi – wspólna dla Master i Podłoga.
+// Ramka ma stały rozmiar i jest walidowana w miejscu (bez kopiowania do String).
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "starzik_frame_magic.h"
+
+// Kanały Podłogi: okablowany tylko kanał 0; -DPODLOGA_EXTRA_RELAYS (w env:podloga i env:master)
+// dokłada trzy kolejne. Master sprawdza kanał, zanim wyśle ramkę.
+#ifdef PODLOGA_EXTRA_RELAYS
+const uint8_t RELAY_CHANNEL_COUNT = 4;
+#else
+const uint8_t RELAY_CHANNEL_COUNT = 1;
+#endif
+const uint32_t RELAY_MAX_MS = 3600000;    // najdłuższe argMs impulsu / załączenia czasowego
+
+enum RelayMode : uint8_t {
+  RELAY_MODE_OFF = 0,
+  RELAY_MODE_LATCH = 1,   // włącz do odwołania
+  RELAY_MODE_PULSE = 2,   // włącz na argMs; ponowienie w trakcie impulsu jest ignorowane
+  RELAY_MODE_TIMED = 3,   // włącz na argMs; ponowienie przedłuża czas od nowa
+  RELAY_MODE_COUNT
+};
+
+enum RelayAckStatus : uint8_t {
+  RELAY_ACK_OK = 0,
+  RELAY_ACK_BAD_CHECK = 1,
+  RELAY_ACK_BAD_CHANNEL = 2,
+  RELAY_ACK_BAD_MODE = 3,
+  RELAY_ACK_IGNORED = 4    // impuls już trwa
+};
+
+struct __attribute__((packed)) RelayFrame {
+  uint8_t magic;
+  uint8_t seq;
+  uint8_t channel;
+  uint8_t mode;
+  uint32_t argMs;
+  uint8_t check;           // XOR wszystkich poprzednich bajtów
+};
+
+struct __attribute__((packed)) RelayAck {
+  uint8_t magic;
+  uint8_t seq;
+  uint8_t status;
+  uint8_t outputs;         // maska włączonych kanałów po wykonaniu ramki
+  uint32_t rxToGpioNs;     // czas od wejścia do callbacku ESP-NOW do zapisu rejestru GPIO
+};
+
+inline uint8_t relayFrameCheck(const uint8_t* bytes, size_t len) {
+  uint8_t x = 0;
+  for (size_t i = 0; i < len; i++) x ^= bytes[i];
+  return x;
+}
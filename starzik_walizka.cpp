@@ -10,7 +10,14 @@
 #include <DFRobotDFPlayerMini.h>
 #include <HardwareSerial.h>
 #include <ArduinoJson.h>
+#include <Preferences.h>
 #include <Arduino.h>
+#include "starzik_ota.h"
+#include "starzik_group.h"
+#include "starzik_channel.h"
+#include "starzik_phy.h"
+#include "starzik_health.h"
+#include "starzik_hash.h"
 
 // --- LCD ---
 LiquidCrystal_I2C lcd(0x27, 16, 2);
@@ -55,37 +62,218 @@ const int busyPin = 34;
 uint8_t master_mac[] = {0x78, 0x1C, 0x3C, 0xF5, 0x82, 0xD8};  // MASTER – panel www
 uint8_t device_mac[] = {0x78, 0x1C, 0x3C, 0xF5, 0x88, 0x88};   // SLAVE: podłoga z przekaźnikiem
 
-// --- Tagi startowe ---
-const char* START_TAG_1 = "F1AAF703";
-const char* START_TAG_2 = "E3BF25E2";
+// --- Konfiguracja zagadki ---
+// Wartości domyślne; Master nadpisuje je komendą "puzzle_config", a wersja trafia do NVS
+String startTag1 = "F1AAF703";
+String startTag2 = "E3BF25E2";
+uint16_t triggerSoundTrack = 7;     // => 0007.mp3, plik po wybraniu „skrytki”
+String correctCode = "010716363847";
+String compartmentCode = "53";
+int dfVolume = 20;
+
+Preferences puzzlePrefs;
+uint32_t puzzleConfigVersion = 0;
+uint32_t puzzleConfigHash = 0;
+char pendingConfig[250];            // konfiguracja odebrana w callbacku ESP-NOW
+volatile bool pendingConfigReady = false;
+
+// --- Maszyna stanów zagadki (tabela) ---
+// Etapy, przejścia i akcje są opisane deklaratywnie w tabelach poniżej,
+// a loop() tylko zamienia wejścia (tag, klawiatura, kontaktron) na zdarzenia.
+enum PuzzleState : uint8_t {
+  ST_WAITING_TAG1,
+  ST_KEYPAD_ACTIVE,
+  ST_WAITING_MAGNET,
+  ST_LANGUAGE_SELECT,
+  ST_WAITING_COMPARTMENT,
+  ST_COUNT
+};
 
-// --- Numer pliku po wybraniu „skrytki” (np. pusty dźwięk) ---
-const uint16_t TRIGGER_SOUND_TRACK = 7; // => 0007.mp3
+enum PuzzleEvent : uint8_t {
+  EV_TAG_START,     // odczytano jeden z tagów startowych
+  EV_INPUT_OK,      // wpisany kod zgodny z oczekiwanym
+  EV_INPUT_BAD,     // wpisany kod niezgodny
+  EV_MAGNET,        // kontaktron: zbliżenie magnesu
+  EV_KEY_1,         // wybór z menu
+  EV_KEY_2,
+  EV_COUNT
+};
 
-// --- Zmienne logiki ---
-String correctCode = "010716363847";
-String enteredCode = "";
-bool tag1Used = false;
+enum ActionOp : uint8_t {
+  OP_PLAY,              // arg = numer pliku, 0 = triggerSoundTrack z konfiguracji
+  OP_WAIT,              // arg = ms
+  OP_WAIT_DF,           // czekaj na koniec odtwarzania (busyPin)
+  OP_RELAY_PULSE,       // arg = ms
+  OP_LCD,               // wyczyść LCD i wypisz text w 1. linii
+  OP_LCD_LINE2,         // wypisz text w 2. linii
+  OP_LCD_OFF,
+  OP_SEND_MASTER,       // text = komenda, text2 = dane (NULL -> dane zdarzenia)
+  OP_SEND_PEER,         // do podłogi z przekaźnikiem
+  OP_LCD_SEND_RESULT,   // wynik ostatniego OP_SEND_PEER w 2. linii
+  OP_CODE_STATS,        // arg = 1 poprawny / 0 błędny
+  OP_CLEAR_INPUT,
+  OP_ARM_MAGNET,
+  OP_STATUS
+};
+
+enum InputMode : uint8_t {
+  IN_NONE,
+  IN_LOTTO,         // cyfry, '*' kasuje, '#' zatwierdza -> porównanie z correctCode
+  IN_COMPARTMENT,   // cyfry, automatyczne zatwierdzenie po długości compartmentCode
+  IN_MENU           // '1' / '2' -> EV_KEY_1 / EV_KEY_2
+};
+
+enum SensorMode : uint8_t { SENSE_NONE, SENSE_RFID, SENSE_MAGNET };
+
+struct FsmAction {
+  uint8_t op;
+  uint16_t arg;
+  const char* text;
+  const char* text2;
+};
+
+struct FsmState {
+  const char* name;          // nazwa etapu w statusie dla Mastera
+  const FsmAction* entry;
+  uint8_t entryCount;
+  uint8_t input;             // InputMode
+  uint8_t sensor;            // SensorMode
+  uint8_t clickTrack;        // dźwięk klawisza, 0 = brak
+  bool keyDebounce;          // dodatkowy debounce KEY_DEBOUNCE_DELAY
+};
+
+struct FsmTransition {
+  uint8_t next;              // ST_COUNT = brak przejścia
+  const FsmAction* actions;
+  uint8_t actionCount;
+};
+
+// Każdy blok akcji to osobna tablica; ACTIONS() podaje jej początek i długość,
+// więc dopisanie albo usunięcie akcji nie wymaga poprawiania indeksów w tabelach niżej
+#define ACTIONS(block) block, (uint8_t)(sizeof(block) / sizeof(block[0]))
+
+// Wejście w etap
+const FsmAction ENTER_TAG1[] = {
+  { OP_LCD_OFF, 0, NULL, NULL },
+  { OP_STATUS, 0, NULL, NULL },
+};
+const FsmAction ENTER_KEYPAD[] = {
+  { OP_CLEAR_INPUT, 0, NULL, NULL },
+  { OP_LCD, 0, "Liczby LOTTO + #:", NULL },
+  { OP_STATUS, 0, NULL, NULL },
+};
+const FsmAction ENTER_MAGNET[] = {
+  { OP_ARM_MAGNET, 0, NULL, NULL },
+  { OP_LCD, 0, "ZEFLIK", NULL },
+  { OP_STATUS, 0, NULL, NULL },
+};
+const FsmAction ENTER_LANGUAGE[] = {
+  { OP_LCD, 0, "1 - POLSKI", NULL },
+  { OP_LCD_LINE2, 0, "2 - SLASKI", NULL },
+  { OP_STATUS, 0, NULL, NULL },
+};
+const FsmAction ENTER_COMPARTMENT[] = {
+  { OP_CLEAR_INPUT, 0, NULL, NULL },
+  { OP_LCD, 0, "Podaj nr skrytki", NULL },
+  { OP_STATUS, 0, NULL, NULL },
+};
 
-// MAGNES
-bool magnetAllowed = false;
-bool magnetUsed = false;
+// WAITING_TAG1 --TAG_START--> KEYPAD_ACTIVE: dźwięk + otwarcie lokalnej zwory
+const FsmAction ON_TAG_START[] = {
+  { OP_PLAY, 1, NULL, NULL },
+  { OP_WAIT, 200, NULL, NULL },
+  { OP_RELAY_PULSE, 5000, NULL, NULL },
+  { OP_SEND_MASTER, 0, "tag1_detected", NULL },
+};
+// KEYPAD_ACTIVE --INPUT_OK--> WAITING_MAGNET
+const FsmAction ON_CODE_OK[] = {
+  { OP_CODE_STATS, 1, NULL, NULL },
+  { OP_PLAY, 3, NULL, NULL },
+  { OP_WAIT, 200, NULL, NULL },
+  { OP_SEND_MASTER, 0, "code_correct", NULL },
+};
+// KEYPAD_ACTIVE --INPUT_BAD--> KEYPAD_ACTIVE
+const FsmAction ON_CODE_BAD[] = {
+  { OP_CODE_STATS, 0, NULL, NULL },
+  { OP_PLAY, 4, NULL, NULL },
+  { OP_WAIT, 200, NULL, NULL },
+  { OP_LCD, 0, "Zle numery", NULL },
+  { OP_WAIT, 2000, NULL, NULL },
+  { OP_SEND_MASTER, 0, "code_incorrect", NULL },
+};
+// WAITING_MAGNET --MAGNET--> LANGUAGE_SELECT
+const FsmAction ON_MAGNET[] = {
+  { OP_SEND_MASTER, 0, "magnet_detected", "kontaktron_activated" },
+};
+// LANGUAGE_SELECT --KEY_1--> WAITING_COMPARTMENT
+const FsmAction ON_POLISH[] = {
+  { OP_PLAY, 5, NULL, NULL },
+  { OP_WAIT, 200, NULL, NULL },
+  { OP_SEND_MASTER, 0, "language_selected", "POLSKI" },
+  { OP_WAIT_DF, 0, NULL, NULL },
+};
+// LANGUAGE_SELECT --KEY_2--> WAITING_COMPARTMENT
+const FsmAction ON_SILESIAN[] = {
+  { OP_PLAY, 6, NULL, NULL },
+  { OP_WAIT, 200, NULL, NULL },
+  { OP_SEND_MASTER, 0, "language_selected", "SLASKI" },
+  { OP_WAIT_DF, 0, NULL, NULL },
+};
+// WAITING_COMPARTMENT --INPUT_OK--> WAITING_COMPARTMENT (wielokrotnie, aż do resetu)
+const FsmAction ON_COMPARTMENT_OK[] = {
+  { OP_SEND_PEER, 0, "relay_on", "latch" },
+  { OP_PLAY, 0, NULL, NULL },
+  { OP_LCD_SEND_RESULT, 0, NULL, NULL },
+  { OP_WAIT, 600, NULL, NULL },
+};
+// WAITING_COMPARTMENT --INPUT_BAD--> WAITING_COMPARTMENT
+const FsmAction ON_COMPARTMENT_BAD[] = {
+  { OP_LCD_LINE2, 0, "Zly numer", NULL },
+  { OP_PLAY, 0, NULL, NULL },   // jeśli nie chcesz dźwięku przy błędzie, usuń tę akcję
+  { OP_WAIT, 600, NULL, NULL },
+};
+
+const FsmState FSM_STATES[ST_COUNT] = {
+  { "WAITING_TAG1",        ACTIONS(ENTER_TAG1),        IN_NONE,        SENSE_RFID,   0, false },
+  { "KEYPAD_ACTIVE",       ACTIONS(ENTER_KEYPAD),      IN_LOTTO,       SENSE_NONE,   2, false },
+  { "WAITING_MAGNET",      ACTIONS(ENTER_MAGNET),      IN_NONE,        SENSE_MAGNET, 0, false },
+  { "LANGUAGE_SELECT",     ACTIONS(ENTER_LANGUAGE),    IN_MENU,        SENSE_NONE,   0, true  },
+  { "WAITING_COMPARTMENT", ACTIONS(ENTER_COMPARTMENT), IN_COMPARTMENT, SENSE_NONE,   0, true  },
+};
+
+#define NO_TR { ST_COUNT, NULL, 0 }
+const FsmTransition FSM_TRANSITIONS[ST_COUNT][EV_COUNT] = {
+  //                TAG_START                                     INPUT_OK                                                  INPUT_BAD                                                  MAGNET                                         KEY_1                                             KEY_2
+  /* TAG1 */      { { ST_KEYPAD_ACTIVE, ACTIONS(ON_TAG_START) },  NO_TR,                                                    NO_TR,                                                     NO_TR,                                         NO_TR,                                            NO_TR },
+  /* KEYPAD */    { NO_TR,                                        { ST_WAITING_MAGNET, ACTIONS(ON_CODE_OK) },               { ST_KEYPAD_ACTIVE, ACTIONS(ON_CODE_BAD) },                NO_TR,                                         NO_TR,                                            NO_TR },
+  /* MAGNET */    { NO_TR,                                        NO_TR,                                                    NO_TR,                                                     { ST_LANGUAGE_SELECT, ACTIONS(ON_MAGNET) },    NO_TR,                                            NO_TR },
+  /* LANGUAGE */  { NO_TR,                                        NO_TR,                                                    NO_TR,                                                     NO_TR,                                         { ST_WAITING_COMPARTMENT, ACTIONS(ON_POLISH) },   { ST_WAITING_COMPARTMENT, ACTIONS(ON_SILESIAN) } },
+  /* SKRYTKA */   { NO_TR,                                        { ST_WAITING_COMPARTMENT, ACTIONS(ON_COMPARTMENT_OK) },   { ST_WAITING_COMPARTMENT, ACTIONS(ON_COMPARTMENT_BAD) },   NO_TR,                                         NO_TR,                                            NO_TR },
+};
+#undef NO_TR
+#undef ACTIONS
 
-// JĘZYK -> po pliku "Podaj nr skrytki" i wpis 53 (wielokrotnie)
-bool languageChosen = false;
-bool waitingForCompartment = false;  // tryb wprowadzania numeru skrytki
-String compartmentInput = "";        // bufor cyfr skrytki
+PuzzleState puzzleState = ST_WAITING_TAG1;
+String inputBuffer = "";        // wpisywany kod LOTTO / numer skrytki
+String eventData = "";          // dane bieżącego zdarzenia (UID, kod)
+bool lastPeerSendOk = false;
 
 // Master status
 bool masterConnected = false;
+bool dfOnline = false;              // wynik DFPlayer.begin() – do telemetrii zdrowia
+bool rfidOnline = false;            // MFRC522 odpowiada na odczyt VersionReg
+uint16_t peripheralErrors = 0;      // od startu: błędy DFPlayera + brak odpowiedzi RFID
 unsigned long lastMasterHeartbeat = 0;
 const unsigned long HEARTBEAT_TIMEOUT = 30000;
 
+// Przebieg gry – komendy grupowe Mastera (start/koniec gry)
+bool gameActive = false;
+String gameGroup = "";
+
 // Statystyki
 String codesHistory[20];
 int codesHistoryCount = 0;
 int digitStats[10] = {0};
-String currentStage = "WAITING_TAG1";
 unsigned long stageStartTime = 0;
 
 // Debounce klawiatury
@@ -104,12 +292,22 @@ void sendStatusUpdate();
 void sendCodeStatistics(String code, bool correct);
 void resetPuzzle();
 void openLockFromPanel();
-void updateStage(String newStage);
+void fsmDispatch(PuzzleEvent event);
+void fsmEnter(PuzzleState next);
+void fsmRunActions(const FsmAction* actions, uint8_t count);
+void handleKey(char key);
+void submitInput(const String& expected);
+void printLine2(const char* text);
 void addCodeToHistory(String code, bool correct);
 void updateDigitStatistics(String code);
 void handleMasterMessage(String command, String data);
 void sendHeartbeatToMaster();
 void checkMasterConnection();
+bool checkRfidReader();
+void checkDfErrors();
+void loadPuzzleConfig();
+bool applyPuzzleConfig(const String& blob, bool persist);
+void checkPendingConfig();
 void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status);
 void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len);
 
@@ -129,256 +327,214 @@ void setup() {
 
   SPI.begin();
   rfid.PCD_Init();
+  rfidOnline = checkRfidReader();
+  if (!rfidOnline) Serial.println("Czytnik RFID nie odpowiada");
 
-  if (!myDFPlayer.begin(mySoftwareSerial)) {
+  dfOnline = myDFPlayer.begin(mySoftwareSerial);
+  if (!dfOnline) {
     Serial.println("Nie można połączyć z DFPlayerem");
   } else {
     Serial.println("DFPlayer połączony");
-    myDFPlayer.volume(20);
+    myDFPlayer.volume(dfVolume);
   }
 
+  loadPuzzleConfig();
+
   WiFi.mode(WIFI_STA);
   Serial.print("MAC Address Walizka: ");
   Serial.println(WiFi.macAddress());
 
   setupESPNow();
 
-  stageStartTime = millis();
   Serial.println("🧳 Walizka gotowa!");
   Serial.println("🧲 Kontaktron pin: " + String(kontaktronPin));
 
-  sendStatusUpdate();
+  fsmEnter(ST_WAITING_TAG1);
 }
 
 void loop() {
+  healthLoopTick();
   checkMasterConnection();
+  channelSlaveService();
+  phySlaveService();
+  checkPendingConfig();
+  checkDfErrors();
+
+  const FsmState& state = FSM_STATES[puzzleState];
 
-  // === ETAP 1: Start po TAGU (dowolny z 2 UID) ===
-  if (!tag1Used) {
+  // === Czujniki aktywne w bieżącym etapie ===
+  if (state.sensor == SENSE_RFID) {
     String uid;
     if (readUIDIfPresent(uid)) {
       Serial.print("📡 Odczytano tag: "); Serial.println(uid);
-      if (uid == START_TAG_1 || uid == START_TAG_2) {
+      if (uid == startTag1 || uid == startTag2) {
         Serial.println("📍 Tag startowy OK");
-
-        myDFPlayer.play(1);
-        delay(200);
-
-        // Otwórz lokalną zworę
-        digitalWrite(relayPin, HIGH);
-        delay(5000);
-        digitalWrite(relayPin, LOW);
-
-        tag1Used = true;
-        updateStage("KEYPAD_ACTIVE");
-
-        lcd.backlight();
-        lcd.clear();
-        lcd.setCursor(0, 0);
-        lcd.print("Liczby LOTTO + #:");
-
-        sendToMaster("tag1_detected", uid);
-        sendStatusUpdate();
+        eventData = uid;
+        fsmDispatch(EV_TAG_START);
       }
     }
+  } else if (state.sensor == SENSE_MAGNET && checkMagnet()) {
+    Serial.println("🧲 Magnes wykryty!");
+    fsmDispatch(EV_MAGNET);
   }
 
-  // === ETAP 2: Kod ===
-  if (tag1Used && !magnetAllowed) {
+  // === Klawiatura ===
+  if (state.input != IN_NONE) {
     char key = keypad.getKey();
-    if (key) {
-      myDFPlayer.play(2);
-      waitForDFPlayer();
-
-      if (key >= '0' && key <= '9' && enteredCode.length() < 12) {
-        enteredCode += key;
-        lcd.setCursor(enteredCode.length() - 1, 1);
-        lcd.print(key);
-        Serial.println("Wprowadzono: " + String(key));
-        myDFPlayer.play(2);
-        delay(100);
-
-      } else if (key == '*') {
-        if (enteredCode.length() > 0) {
-          enteredCode.remove(enteredCode.length() - 1);
-          lcd.setCursor(enteredCode.length(), 1);
-          lcd.print(" ");
-          lcd.setCursor(enteredCode.length(), 1);
-        }
-
-      } else if (key == '#') {
-        if (enteredCode.length() > 0) {
-          Serial.println("Sprawdzanie: " + enteredCode);
-
-          bool isCorrect = (enteredCode == correctCode);
-          String codeToSend = enteredCode;
-
-          addCodeToHistory(enteredCode, isCorrect);
-          updateDigitStatistics(enteredCode);
-          sendCodeStatistics(enteredCode, isCorrect);
-
-          if (isCorrect) {
-            magnetAllowed = true;
-            updateStage("WAITING_MAGNET");
-
-            // >>> DODANE: uzbrój detekcję — zapamiętaj stan w chwili wejścia w etap
-            lastMagnetState = !digitalRead(kontaktronPin);
-            magnetArmedAt = millis();
-            Serial.println(String("ARM MAGNET, initial=") + (lastMagnetState ? "MAGNES" : "BRAK"));
-
-            Serial.println("✅ Kod OK – czekam na magnes");
-            myDFPlayer.play(3);
-            delay(200);
-
-            lcd.clear();
-            lcd.print("ZEFLIK");
-
-            sendToMaster("code_correct", codeToSend);
-            sendStatusUpdate();
-
-          } else {
-            Serial.println("❌ Zly kod");
-            myDFPlayer.play(4);
-            delay(200);
-
-            lcd.clear();
-            lcd.print("Zle numery");
-            delay(2000);
-
-            sendToMaster("code_incorrect", codeToSend);
-
-            enteredCode = "";
-            lcd.clear();
-            lcd.setCursor(0, 0);
-            lcd.print("Liczby LOTTO + #:");
-          }
-        }
-      }
+    if (key && (!state.keyDebounce || millis() - lastKeyTime > KEY_DEBOUNCE_DELAY || key != lastKey)) {
+      lastKeyTime = millis();
+      lastKey = key;
+      handleKey(key);
     }
   }
 
-  // === ETAP 3: Magnes ===
-  if (magnetAllowed && !magnetUsed && checkMagnet()) {
-    Serial.println("🧲 Magnes wykryty!");
-    magnetUsed = true;
-    updateStage("LANGUAGE_SELECT");
+  // Heartbeat do MASTER co 15 s
+  static unsigned long lastHeartbeat = 0;
+  if (millis() - lastHeartbeat > 15000) {
+    sendHeartbeatToMaster();
+    if (!checkRfidReader()) {
+      if (peripheralErrors < 0xFFFF) peripheralErrors++;
+      rfid.PCD_Init();              // zakłócenie SPI / zanik zasilania modułu – spróbuj ponownie
+      rfidOnline = checkRfidReader();
+    } else {
+      rfidOnline = true;
+    }
+    healthSlaveSend(master_mac, peripheralErrors, dfOnline && rfidOnline);
+    lastHeartbeat = millis();
+  }
 
-    lcd.clear();
-    lcd.print("1 - POLSKI");
-    lcd.setCursor(0, 1);
-    lcd.print("2 - SLASKI");
+  delay(50);
+}
 
-    sendToMaster("magnet_detected", "kontaktron_activated");
-    sendStatusUpdate();
-  }
+// --- Maszyna stanów ---
+void fsmDispatch(PuzzleEvent event) {
+  const FsmTransition& tr = FSM_TRANSITIONS[puzzleState][event];
+  if (tr.next == ST_COUNT) return;
 
-  // === ETAP 4: Wybór języka -> po pliku: "Podaj nr skrytki" ===
-  if (magnetUsed && !languageChosen) {
-    char key = keypad.getKey();
+  fsmRunActions(tr.actions, tr.actionCount);
+  fsmEnter((PuzzleState)tr.next);
+}
 
-    if (key && (millis() - lastKeyTime > KEY_DEBOUNCE_DELAY || key != lastKey)) {
-      lastKeyTime = millis();
-      lastKey = key;
+void fsmEnter(PuzzleState next) {
+  puzzleState = next;
+  stageStartTime = millis();
+  Serial.print("🔄 Nowy etap: "); Serial.println(FSM_STATES[next].name);
 
-      if (key == '1') {
-        Serial.println("🇵🇱 Polski");
-        myDFPlayer.play(5);
-        delay(200);
-        sendToMaster("language_selected", "POLSKI");
-        languageChosen = true;
-
-      } else if (key == '2') {
-        Serial.println("🏴 Śląski");
-        myDFPlayer.play(6);
-        delay(200);
-        sendToMaster("language_selected", "SLASKI");
-        languageChosen = true;
-      }
+  const FsmState& state = FSM_STATES[next];
+  fsmRunActions(state.entry, state.entryCount);
+}
 
-      if (languageChosen) {
-        // czekaj aż skończy się plik językowy
+void fsmRunActions(const FsmAction* actions, uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    const FsmAction& a = actions[i];
+    switch (a.op) {
+      case OP_PLAY:
+        myDFPlayer.play(a.arg ? a.arg : triggerSoundTrack);
+        break;
+      case OP_WAIT:
+        delay(a.arg);
+        break;
+      case OP_WAIT_DF:
         waitForDFPlayer();
-
-        // komunikat do gracza
+        break;
+      case OP_RELAY_PULSE:
+        digitalWrite(relayPin, HIGH);
+        delay(a.arg);
+        digitalWrite(relayPin, LOW);
+        break;
+      case OP_LCD:
+        lcd.backlight();
         lcd.clear();
-        lcd.setCursor(0,0); lcd.print("Podaj nr skrytki");
-        lcd.setCursor(0,1); lcd.print("                ");
-
-        compartmentInput = "";
-        waitingForCompartment = true;     // od teraz przyjmujemy cyfry skrytki (wielokrotnie)
-        updateStage("WAITING_COMPARTMENT");
+        lcd.setCursor(0, 0);
+        lcd.print(a.text);
+        break;
+      case OP_LCD_LINE2:
+        printLine2(a.text);
+        break;
+      case OP_LCD_OFF:
+        lcd.noBacklight();
+        lcd.clear();
+        break;
+      case OP_SEND_MASTER:
+        sendToMaster(a.text, a.text2 ? String(a.text2) : eventData);
+        break;
+      case OP_SEND_PEER:
+        lastPeerSendOk = sendToPeer(device_mac, a.text, a.text2 ? String(a.text2) : eventData);
+        break;
+      case OP_LCD_SEND_RESULT:
+        printLine2(lastPeerSendOk ? "OK" : "Blad wysylki");
+        break;
+      case OP_CODE_STATS:
+        addCodeToHistory(eventData, a.arg);
+        updateDigitStatistics(eventData);
+        sendCodeStatistics(eventData, a.arg);
+        break;
+      case OP_CLEAR_INPUT:
+        inputBuffer = "";
+        break;
+      case OP_ARM_MAGNET:
+        // uzbrój detekcję — zapamiętaj stan w chwili wejścia w etap
+        lastMagnetState = !digitalRead(kontaktronPin);
+        magnetArmedAt = millis();
+        Serial.println(String("ARM MAGNET, initial=") + (lastMagnetState ? "MAGNES" : "BRAK"));
+        break;
+      case OP_STATUS:
         sendStatusUpdate();
-      }
+        break;
     }
   }
+}
 
-  // === ETAP 5: Wprowadzanie numeru skrytki (wymagane 2 cyfry: "53") ===
-  if (waitingForCompartment) {
-    char k = keypad.getKey();
-    if (k && (millis() - lastKeyTime > KEY_DEBOUNCE_DELAY || k != lastKey)) {
-      lastKeyTime = millis();
-      lastKey = k;
-
-      if (k >= '0' && k <= '9') {
-        if (compartmentInput.length() < 2) {
-          compartmentInput += k;
-
-          // pokaż wpisywane cyfry (na drugiej linii)
-          lcd.setCursor(0,1);
-          if (compartmentInput.length() == 1) {
-            lcd.print(String(k) + "               ");
-          } else {
-            lcd.print(compartmentInput + "              ");
-          }
-        }
-
-        if (compartmentInput.length() == 2) {
-          if (compartmentInput == "53") {
-            // poprawny numer skrytki -> wyślij do SLAVE + zagraj stały plik
-            Serial.println("🔓 Skrytka 53 -> relay_on (SLAVE) + audio");
-            bool ok = sendToPeer(device_mac, "relay_on", "latch");
-            myDFPlayer.play(TRIGGER_SOUND_TRACK);
-
-            // krótki feedback
-            lcd.setCursor(0,1);
-            lcd.print(ok ? "OK              " : "Blad wysylki    ");
-          } else {
-            // zły numer — krótki komunikat
-            Serial.println("❌ Zly nr skrytki");
-            lcd.setCursor(0,1);
-            lcd.print("Zly numer       ");
-            myDFPlayer.play(TRIGGER_SOUND_TRACK); // jeśli nie chcesz dźwięku przy błędzie, usuń tę linię
-          }
-
-          // po chwili wróć do wpisywania kolejnego numeru (wielokrotnie, aż do resetu)
-          delay(600);
-          compartmentInput = "";
-          lcd.setCursor(0,0); lcd.print("Podaj nr skrytki");
-          lcd.setCursor(0,1); lcd.print("                ");
-          updateStage("WAITING_COMPARTMENT");
-          sendStatusUpdate();
-        }
-      } else if (k == '*') {
-        // kasuj ostatnią cyfrę
-        if (compartmentInput.length() > 0) {
-          compartmentInput.remove(compartmentInput.length() - 1);
-          lcd.setCursor(0,1);
-          lcd.print((compartmentInput.length() ? compartmentInput : String(" ")) + "               ");
-        }
-      } else if (k == '#') {
-        // ignorujemy '#' – niepotrzebny tu ENTER
-      }
-    }
+void handleKey(char key) {
+  const FsmState& state = FSM_STATES[puzzleState];
+
+  if (state.clickTrack) {
+    myDFPlayer.play(state.clickTrack);
+    waitForDFPlayer();
   }
 
-  // Heartbeat do MASTER co 15 s
-  static unsigned long lastHeartbeat = 0;
-  if (millis() - lastHeartbeat > 15000) {
-    sendHeartbeatToMaster();
-    lastHeartbeat = millis();
+  if (state.input == IN_MENU) {
+    if (key == '1') fsmDispatch(EV_KEY_1);
+    else if (key == '2') fsmDispatch(EV_KEY_2);
+    return;
   }
 
-  delay(50);
+  const String& expected = (state.input == IN_LOTTO) ? correctCode : compartmentCode;
+  // LOTTO: do 16 znaków (szerokość LCD), skrytka: dokładnie długość numeru
+  unsigned int maxLen = (state.input == IN_LOTTO) ? 16 : expected.length();
+
+  if (key >= '0' && key <= '9') {
+    if (inputBuffer.length() < maxLen) {
+      inputBuffer += key;
+      printLine2(inputBuffer.c_str());
+      Serial.println("Wprowadzono: " + String(key));
+    }
+    if (state.input == IN_COMPARTMENT && inputBuffer.length() == maxLen) {
+      submitInput(expected);
+    }
+  } else if (key == '*') {
+    if (inputBuffer.length() > 0) {
+      inputBuffer.remove(inputBuffer.length() - 1);
+      printLine2(inputBuffer.c_str());
+    }
+  } else if (key == '#' && state.input == IN_LOTTO) {
+    if (inputBuffer.length() > 0) submitInput(expected);
+  }
+}
+
+void submitInput(const String& expected) {
+  Serial.println("Sprawdzanie: " + inputBuffer);
+  eventData = inputBuffer;
+  bool isCorrect = (inputBuffer == expected);
+  Serial.println(isCorrect ? "✅ Kod OK" : "❌ Zly kod");
+  fsmDispatch(isCorrect ? EV_INPUT_OK : EV_INPUT_BAD);
+}
+
+void printLine2(const char* text) {
+  char line[17];
+  snprintf(line, sizeof(line), "%-16s", text);
+  lcd.setCursor(0, 1);
+  lcd.print(line);
 }
 
 // --- Pomocnicze ---
@@ -398,6 +554,21 @@ bool readUIDIfPresent(String &uidHex) {
   return true;
 }
 
+// MFRC522 bez zasilania lub z przerwaną magistralą SPI zwraca 0x00 albo 0xFF
+bool checkRfidReader() {
+  byte version = rfid.PCD_ReadRegister(MFRC522::VersionReg);
+  return version != 0x00 && version != 0xFF;
+}
+
+// Odpowiedzi DFPlayera z UART – liczymy tylko błędy (brak karty, błąd ramki, timeout)
+void checkDfErrors() {
+  if (!dfOnline) return;
+  while (myDFPlayer.available()) {
+    uint8_t type = myDFPlayer.readType();
+    if ((type == DFPlayerError || type == TimeOut || type == WrongStack) && peripheralErrors < 0xFFFF) peripheralErrors++;
+  }
+}
+
 bool checkMagnet() {
   // >>> DODANE: krótki czas uzbrojenia etapu magnesu
   if (millis() - magnetArmedAt < MAGNET_ARM_DELAY) return false;
@@ -421,6 +592,7 @@ void setupESPNow() {
   WiFi.mode(WIFI_STA);
   WiFi.disconnect();
   delay(100);
+  channelSlaveBegin(master_mac);   // kanał z NVS, zanim ruszy ESP-NOW
 
   if (esp_now_init() != ESP_OK) {
     Serial.println("Błąd inicjalizacji ESP-NOW");
@@ -438,6 +610,9 @@ void setupESPNow() {
     if (esp_now_add_peer(&p) != ESP_OK) Serial.println("Błąd dodawania Master peer");
     else Serial.println("ESP-NOW: dodano MASTER");
   }
+  otaSlaveBegin(master_mac);
+  groupSlaveBegin(master_mac, "walizka");
+  phySlaveBegin(master_mac);
 
   // SLAVE: podłoga z przekaźnikiem
   {
@@ -486,16 +661,16 @@ void sendToMaster(String command, String data) {
 
 void sendStatusUpdate() {
   DynamicJsonDocument doc(1024);
-  doc["stage"] = currentStage;
-  doc["tag1_used"] = tag1Used;
-  doc["magnet_allowed"] = magnetAllowed;
-  doc["magnet_used"] = magnetUsed;
+  doc["stage"] = FSM_STATES[puzzleState].name;
+  doc["tag1_used"] = puzzleState > ST_WAITING_TAG1;
+  doc["magnet_allowed"] = puzzleState >= ST_WAITING_MAGNET;
+  doc["magnet_used"] = puzzleState >= ST_LANGUAGE_SELECT;
   doc["magnet_state"] = !digitalRead(kontaktronPin);
   doc["relay_state"] = (bool)digitalRead(relayPin);
-  doc["entered_code_length"] = enteredCode.length();
+  doc["entered_code_length"] = (puzzleState == ST_KEYPAD_ACTIVE) ? inputBuffer.length() : 0;
   doc["stage_time"] = millis() - stageStartTime;
-  doc["language_chosen"] = languageChosen;
-  doc["waiting_for_compartment"] = waitingForCompartment;
+  doc["language_chosen"] = puzzleState >= ST_WAITING_COMPARTMENT;
+  doc["waiting_for_compartment"] = puzzleState == ST_WAITING_COMPARTMENT;
 
   // historia ostatnich 5 kodów
   JsonArray codes = doc.createNestedArray("codes_history");
@@ -535,21 +710,11 @@ void updateDigitStatistics(String code) {
   }
 }
 
-void updateStage(String newStage) {
-  currentStage = newStage;
-  stageStartTime = millis();
-  Serial.println("🔄 Nowy etap: " + newStage);
-}
-
 void resetPuzzle() {
   Serial.println("🔄 Reset zagadki");
-  enteredCode = ""; tag1Used = false;
-  magnetAllowed = false; magnetUsed = false;
-  languageChosen = false; waitingForCompartment = false; compartmentInput = "";
-  currentStage = "WAITING_TAG1"; stageStartTime = millis();
+  inputBuffer = ""; eventData = "";
   digitalWrite(relayPin, LOW);
-  lcd.noBacklight(); lcd.clear();
-  sendStatusUpdate();
+  fsmEnter(ST_WAITING_TAG1);
   Serial.println("✅ Zresetowano");
 }
 
@@ -564,9 +729,83 @@ void handleMasterMessage(String command, String data) {
   if (command == "reset_puzzle") resetPuzzle();
   else if (command == "open_lock") openLockFromPanel();
   else if (command == "get_status") sendStatusUpdate();
+  else if (command == "puzzle_config") {
+    // Zastosowanie w loop() – tu jesteśmy w callbacku WiFi
+    if (!pendingConfigReady) {
+      strncpy(pendingConfig, data.c_str(), sizeof(pendingConfig) - 1);
+      pendingConfig[sizeof(pendingConfig) - 1] = '\0';
+      pendingConfigReady = true;
+    }
+  }
+  else if (command == "start_game") {
+    // To samo ogłoszenie po restarcie Mastera nie kasuje postępu bieżącej gry
+    if (!gameActive || data != gameGroup) resetPuzzle();
+    gameActive = true;
+    gameGroup = data;
+  }
+  else if (command == "end_game") { gameActive = false; gameGroup = ""; }
+  else if (channelSlaveCommand(command, data)) { /* zmiana kanału w loop() */ }
+  else if (phySlaveCommand(command, data)) { /* zmiana szybkości w loop() */ }
   else if (command == "restart") { Serial.println("🔄 Restart"); delay(1000); ESP.restart(); }
 }
 
+// --- Konfiguracja zagadki ---
+void loadPuzzleConfig() {
+  puzzlePrefs.begin("puzzle", true);
+  String stored = puzzlePrefs.getString("blob", "");
+  puzzlePrefs.end();
+
+  if (stored.length() == 0 || !applyPuzzleConfig(stored, false)) {
+    Serial.println("⚙️ Konfiguracja zagadki: domyślna (firmware)");
+  }
+}
+
+bool applyPuzzleConfig(const String& blob, bool persist) {
+  DynamicJsonDocument doc(512);
+  if (deserializeJson(doc, blob)) {
+    Serial.println("❌ Niepoprawna konfiguracja zagadki");
+    return false;
+  }
+
+  correctCode = doc["code"] | correctCode;
+  compartmentCode = doc["comp"] | compartmentCode;
+  triggerSoundTrack = doc["trk"] | triggerSoundTrack;
+  startTag1 = doc["tag1"] | startTag1;
+  startTag2 = doc["tag2"] | startTag2;
+
+  int volume = doc["vol_w"] | dfVolume;
+  if (volume != dfVolume) {
+    dfVolume = constrain(volume, 0, 30);
+    myDFPlayer.volume(dfVolume);
+  }
+
+  puzzleConfigVersion = doc["v"] | 0;
+  puzzleConfigHash = fnv1aHash(blob);
+
+  if (persist) {
+    puzzlePrefs.begin("puzzle", false);
+    puzzlePrefs.putString("blob", blob);
+    puzzlePrefs.end();
+  }
+
+  Serial.println("⚙️ Konfiguracja zagadki v" + String(puzzleConfigVersion) + " (hash " + String(puzzleConfigHash, HEX) + ")");
+  return true;
+}
+
+void checkPendingConfig() {
+  if (!pendingConfigReady) return;
+
+  String blob = String(pendingConfig);
+  pendingConfigReady = false;
+
+  // Ta sama wersja (np. ponowne wysłanie po dołączeniu) – tylko potwierdź
+  if (fnv1aHash(blob) != puzzleConfigHash) {
+    if (!applyPuzzleConfig(blob, true)) return;
+  }
+
+  sendToMaster("config_ack", String(puzzleConfigVersion) + ":" + String(puzzleConfigHash, HEX));
+}
+
 void sendHeartbeatToMaster() { sendToMaster("heartbeat", "walizka_alive"); }
 
 void checkMasterConnection() {
@@ -577,10 +816,22 @@ void checkMasterConnection() {
 }
 
 void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status) {
+  healthNoteSend(status);
   if (status != ESP_NOW_SEND_SUCCESS) Serial.println("❌ ESP-NOW: błąd wysyłania (walizka)");
 }
 
 void OnDataRecv(const uint8_t * mac, const uint8_t *incomingData, int len) {
+  if (channelSlaveHandleFrame(mac, incomingData, len)) return;
+  if (phySlaveHandleFrame(mac, incomingData, len)) return;
+  if (otaSlaveHandleFrame(mac, incomingData, len)) return;
+  const uint8_t* groupText;
+  int groupLen = groupSlaveHandleFrame(mac, incomingData, len, &groupText);
+  if (groupLen == 0) return;
+  if (groupLen > 0) {          // komenda grupowa – dalej jak zwykła ramka tekstowa
+    incomingData = groupText;
+    len = groupLen;
+  }
+
   // filtrujemy nadawcę: tylko MASTER jest sterujący
   String payload; payload.reserve(len+1);
   for (int i = 0; i < len; i++) payload += (char)incomingData[i];
@@ -0,0 +1,65 @@
+# web_build.py
+# Przygotowanie plików panelu do LittleFS Mastera: minifikacja + gzip do katalogu data/.
+# Uruchamiane przez "make web" / "make web-wifi" przed wgraniem plików.
+# gzip bez znacznika czasu – ta sama treść daje ten sam plik, więc ETag na Masterze się nie zmienia.
+
+import gzip
+import os
+import re
+import shutil
+
+ROOT = os.path.dirname(os.path.abspath(__file__))
+DATA = os.path.join(ROOT, "data")
+
+# Pliki tekstowe: minifikacja i gzip. MP3 jest już skompresowane – kopiowane bez zmian.
+TEXT_ASSETS = ["index.html"]
+BINARY_ASSETS = ["beep.mp3"]
+
+
+def minify_html(text):
+    # Ostrożnie: tylko komentarze HTML, całe linie komentarzy JS i wcięcia.
+    # Podziały linii zostają, więc JS bez średników dalej działa.
+    text = re.sub(r"<!--(?!\[if).*?-->", "", text, flags=re.S)
+    lines = []
+    for line in text.splitlines():
+        line = line.strip()
+        if not line or line.startswith("//"):
+            continue
+        lines.append(line)
+    return "\n".join(lines) + "\n"
+
+
+def write_gzip(path, data):
+    with open(path, "wb") as raw:
+        with gzip.GzipFile(filename="", mode="wb", fileobj=raw, compresslevel=9, mtime=0) as gz:
+            gz.write(data)
+
+
+def main():
+    os.makedirs(DATA, exist_ok=True)
+
+    for name in TEXT_ASSETS:
+        src = os.path.join(ROOT, name)
+        with open(src, encoding="utf-8") as f:
+            original = f.read()
+        minified = minify_html(original).encode("utf-8")
+        dst = os.path.join(DATA, name + ".gz")
+        write_gzip(dst, minified)
+        # Stara nieskompresowana kopia zajmowałaby miejsce, a Master i tak woli .gz
+        plain = os.path.join(DATA, name)
+        if os.path.exists(plain):
+            os.remove(plain)
+        print("%s: %d B -> %d B min -> %d B gzip" % (
+            name, len(original.encode("utf-8")), len(minified), os.path.getsize(dst)))
+
+    for name in BINARY_ASSETS:
+        src = os.path.join(ROOT, name)
+        if not os.path.exists(src):
+            print("%s: brak, pominięty" % name)
+            continue
+        shutil.copyfile(src, os.path.join(DATA, name))
+        print("%s: %d B (bez kompresji)" % (name, os.path.getsize(src)))
+
+
+if __name__ == "__main__":
+    main()